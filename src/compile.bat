@@ -8,7 +8,14 @@ if NOT %ERRORLEVEL% EQU 0 (
 )
 
 REM compile project
-gcc -O3 -Wdisabled-optimization -Wall  -Wextra -Wno-unused -Wno-int-to-pointer-cast -Wunreachable-code -Winline -Wuninitialized -pedantic-errors -Wfloat-equal -Wcast-qual -Wcast-align -std=c99 "dexe_main.c" "dexe_utils.c" "dexe_stack.c" "dexe_parser.c" "dexe_executer.c" "icon.res" -o "dexe" 
+gcc -O3 -Wdisabled-optimization -Wall  -Wextra -Wno-unused -Wno-int-to-pointer-cast -Wunreachable-code -Winline -Wuninitialized -pedantic-errors -Wfloat-equal -Wcast-qual -Wcast-align -std=c99 "dexe_main.c" "dexe_utils.c" "dexe_stack.c" "dexe_parser.c" "dexe_executer.c" "dexe_memo.c" "dexe_verifier.c" "dexe_profile.c" "dexe_debugger.c" "dexe_trace.c" "dexe_metrics.c" "dexe_encoding.c" "dexe_writer.c" "dexe_threads.c" "dexe_linker.c" "dexe_batch.c" "dexe_heap.c" "dexe_vector.c" "dexe_registers.c" "dexe_layout.c" "dexe_tasks.c" "dexe_coroutines.c" "dexe_snapshot.c" "dexe_cache.c" "dexe_native.c" "dexe_disassembler.c" "dexe_counters.c" "icon.res" -lpsapi -o "dexe" 
+
+if NOT %ERRORLEVEL% EQU 0 (
+	pause
+)
+
+REM compile the optimizer
+gcc -O3 -Wdisabled-optimization -Wall  -Wextra -Wno-unused -Wno-int-to-pointer-cast -Wunreachable-code -Winline -Wuninitialized -pedantic-errors -Wfloat-equal -Wcast-qual -Wcast-align -std=c99 "dexe_opt.c" "dexe_optimizer.c" "dexe_utils.c" "dexe_stack.c" "dexe_parser.c" "dexe_executer.c" "dexe_memo.c" "dexe_verifier.c" "dexe_profile.c" "dexe_debugger.c" "dexe_trace.c" "dexe_metrics.c" "dexe_encoding.c" "dexe_writer.c" "dexe_threads.c" "dexe_linker.c" "dexe_batch.c" "dexe_heap.c" "dexe_vector.c" "dexe_registers.c" "dexe_layout.c" "dexe_tasks.c" "dexe_coroutines.c" "dexe_snapshot.c" "dexe_cache.c" "dexe_native.c" "dexe_disassembler.c" "dexe_counters.c" -lpsapi -o "dexe-opt"
 
 if NOT %ERRORLEVEL% EQU 0 (
 	pause
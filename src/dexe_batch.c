@@ -0,0 +1,444 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include <limits.h>
+#include <ctype.h>
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_executer.h"
+#include "dexe_batch.h"
+
+/*
+	Runs one function over many argument tuples. Functions that can be vectorized run
+	BATCH_LANES tuples at a time through the interpreter in dexe_batch_interpreter.h,
+	built once per instruction set below. Anything else runs each tuple through the
+	normal interpreter.
+*/
+
+//arg counts are a byte, so this covers the arguments of any call
+#define BATCH_MAX_ARGS 256
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define BATCH_X86 1
+	#include <immintrin.h>
+#else
+	#define BATCH_X86 0
+#endif
+
+
+//plain C, for everything else. The compiler may still vectorize it
+#define BATCH_NAME run_batch_generic
+#define BATCH_TARGET
+#define VEC int
+#define VEC_WIDTH 1
+#define VEC_LOAD(p) (*(p))
+#define VEC_STORE(p, v) (*(p) = (v))
+#define VEC_SET1(x) (x)
+#define VEC_ADD(a, b) ((int)((unsigned int)(a) + (unsigned int)(b)))
+#define VEC_SUB(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)))
+#define VEC_MUL(a, b) ((int)((unsigned int)(a) * (unsigned int)(b)))
+#define VEC_AND(a, b) ((a) & (b))
+#define VEC_OR(a, b) ((a) | (b))
+#define VEC_XOR(a, b) ((a) ^ (b))
+#define VEC_CMPEQ(a, b) ((a) == (b) ? -1 : 0)
+#define VEC_CMPGT(a, b) ((a) > (b) ? -1 : 0)
+#define VEC_BLEND(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+#define VEC_SHL(a, counts) ((int)((unsigned int)(a) << (counts)))
+#define VEC_SHR(a, counts) ((a) >> (counts))
+#include "dexe_batch_interpreter.h"
+#undef BATCH_NAME
+#undef BATCH_TARGET
+#undef VEC
+#undef VEC_WIDTH
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_SET1
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_MUL
+#undef VEC_AND
+#undef VEC_OR
+#undef VEC_XOR
+#undef VEC_CMPEQ
+#undef VEC_CMPGT
+#undef VEC_BLEND
+#undef VEC_SHL
+#undef VEC_SHR
+
+#if BATCH_X86
+
+//SSE2 has neither a 32 bit multiply nor shifts by a count per lane
+__attribute__((target("sse2"))) static inline __m128i sse2_mullo(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+__attribute__((target("sse2"))) static inline __m128i sse2_shift(__m128i a, __m128i counts, int left)
+{
+	int values[4];
+	int amounts[4];
+	
+	_mm_storeu_si128((__m128i*)values, a);
+	_mm_storeu_si128((__m128i*)amounts, counts);
+	for(int i = 0; i < 4; i++)
+		values[i] = left ? (int)((unsigned int)values[i] << amounts[i]) : values[i] >> amounts[i];
+	
+	return _mm_loadu_si128((__m128i*)values);
+}
+
+#define BATCH_NAME run_batch_sse2
+#define BATCH_TARGET __attribute__((target("sse2")))
+#define VEC __m128i
+#define VEC_WIDTH 4
+#define VEC_LOAD(p) _mm_loadu_si128((__m128i*)(p))
+#define VEC_STORE(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define VEC_SET1(x) _mm_set1_epi32(x)
+#define VEC_ADD(a, b) _mm_add_epi32((a), (b))
+#define VEC_SUB(a, b) _mm_sub_epi32((a), (b))
+#define VEC_MUL(a, b) sse2_mullo((a), (b))
+#define VEC_AND(a, b) _mm_and_si128((a), (b))
+#define VEC_OR(a, b) _mm_or_si128((a), (b))
+#define VEC_XOR(a, b) _mm_xor_si128((a), (b))
+#define VEC_CMPEQ(a, b) _mm_cmpeq_epi32((a), (b))
+#define VEC_CMPGT(a, b) _mm_cmpgt_epi32((a), (b))
+#define VEC_BLEND(mask, a, b) _mm_or_si128(_mm_and_si128((mask), (a)), _mm_andnot_si128((mask), (b)))
+#define VEC_SHL(a, counts) sse2_shift((a), (counts), 1)
+#define VEC_SHR(a, counts) sse2_shift((a), (counts), 0)
+#include "dexe_batch_interpreter.h"
+#undef BATCH_NAME
+#undef BATCH_TARGET
+#undef VEC
+#undef VEC_WIDTH
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_SET1
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_MUL
+#undef VEC_AND
+#undef VEC_OR
+#undef VEC_XOR
+#undef VEC_CMPEQ
+#undef VEC_CMPGT
+#undef VEC_BLEND
+#undef VEC_SHL
+#undef VEC_SHR
+
+#define BATCH_NAME run_batch_avx2
+#define BATCH_TARGET __attribute__((target("avx2")))
+#define VEC __m256i
+#define VEC_WIDTH 8
+#define VEC_LOAD(p) _mm256_loadu_si256((__m256i*)(p))
+#define VEC_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define VEC_SET1(x) _mm256_set1_epi32(x)
+#define VEC_ADD(a, b) _mm256_add_epi32((a), (b))
+#define VEC_SUB(a, b) _mm256_sub_epi32((a), (b))
+#define VEC_MUL(a, b) _mm256_mullo_epi32((a), (b))
+#define VEC_AND(a, b) _mm256_and_si256((a), (b))
+#define VEC_OR(a, b) _mm256_or_si256((a), (b))
+#define VEC_XOR(a, b) _mm256_xor_si256((a), (b))
+#define VEC_CMPEQ(a, b) _mm256_cmpeq_epi32((a), (b))
+#define VEC_CMPGT(a, b) _mm256_cmpgt_epi32((a), (b))
+#define VEC_BLEND(mask, a, b) _mm256_blendv_epi8((b), (a), (mask))
+#define VEC_SHL(a, counts) _mm256_sllv_epi32((a), (counts))
+#define VEC_SHR(a, counts) _mm256_srav_epi32((a), (counts))
+#include "dexe_batch_interpreter.h"
+#undef BATCH_NAME
+#undef BATCH_TARGET
+#undef VEC
+#undef VEC_WIDTH
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_SET1
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_MUL
+#undef VEC_AND
+#undef VEC_OR
+#undef VEC_XOR
+#undef VEC_CMPEQ
+#undef VEC_CMPGT
+#undef VEC_BLEND
+#undef VEC_SHL
+#undef VEC_SHR
+
+#endif
+
+
+/*
+	The best instruction set this processor has. DEXE_BATCH_ISA=generic, sse2 or avx2
+	asks for a lesser one, which is mostly useful for comparing them.
+*/
+int batch_isa()
+{
+	static int isa = -1;
+	
+	if(isa < 0)
+	{
+		char* request = getenv("DEXE_BATCH_ISA");
+		int limit = BATCH_ISA_AVX2;
+		
+		if(request != NULL)
+			limit = !strcmp(request, "generic") ? BATCH_ISA_GENERIC : !strcmp(request, "sse2") ? BATCH_ISA_SSE2 : BATCH_ISA_AVX2;
+		
+		isa = BATCH_ISA_GENERIC;
+#if BATCH_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("sse2"))
+			isa = BATCH_ISA_SSE2;
+		if(__builtin_cpu_supports("avx2"))
+			isa = BATCH_ISA_AVX2;
+#endif
+		if(isa > limit)
+			isa = limit;
+	}
+	
+	return isa;
+}
+
+//ints a frame of the vector interpreter needs for function_id itself
+static size_t frame_size(Executable* exe, int function_id)
+{
+	Executable_Function* function = &exe->functions[function_id];
+	
+	return ((size_t)function->size_of_instructions + function->arg_count + 1 + function->local_count + 3 + BATCH_MAX_ARGS) * BATCH_LANES;
+}
+
+/*
+	state is 0 not looked at, 1 being looked at (so reaching it again is recursion),
+	2 vectorizable, 3 not. Without recursion the deepest chain of calls is known, and
+	scratch gets the ints its frames need.
+*/
+static int vectorizable(Executable* exe, int function_id, char* state, size_t* scratch)
+{
+	Executable_Function* function = &exe->functions[function_id];
+	size_t deepest = 0;
+	int result;
+	
+	if(state[function_id])
+		return state[function_id] == 2;
+	
+	state[function_id] = 1;
+	
+	//the verifier proves the stack depth at each pc, the lanes depend on that. Natives have no code for them
+	result = (function->attributes & FUNCTION_ATTRIBUTE_VERIFIED) != 0 && function->native == NULL;
+	
+	for(int pc = 0; pc < function->size_of_instructions && result;)
+	{
+		unsigned char opcode = (unsigned char)function->instructions[pc];
+		
+		//lanes would race on the shared heap
+		if(IS_IO_OPCODE(opcode) || opcode > LAST_OPCODE || IS_HEAP_OPCODE(opcode) || IS_TASK_OPCODE(opcode) || IS_COROUTINE_OPCODE(opcode))
+			result = 0;
+		else if(opcode == Call)
+		{
+			int callee = bytes_to_int(function->instructions + pc + 1);
+			
+			result = vectorizable(exe, callee, state, scratch);
+			if(scratch[callee] > deepest)
+				deepest = scratch[callee];
+		}
+		
+		pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction((char)opcode).parameter_size : 0);
+	}
+	
+	scratch[function_id] = frame_size(exe, function_id) + deepest;
+	state[function_id] = result ? 2 : 3;
+	return result;
+}
+
+/*
+	No input or output and no recursion, in it or anything it calls. Returns the ints
+	of scratch the vector interpreter needs for it, or 0 if it can't be vectorized.
+*/
+size_t batch_vectorizable(Executable* exe, int function_id)
+{
+	char* state = (char*)calloc(exe->number_of_functions, 1);
+	size_t* scratch = (size_t*)calloc(exe->number_of_functions, sizeof(size_t));
+	size_t result = 0;
+	
+	if(state != NULL && scratch != NULL && vectorizable(exe, function_id, state, scratch))
+		result = scratch[function_id];
+	
+	free(state);
+	free(scratch);
+	return result;
+}
+
+/*
+	Runs function_id once per tuple. columns holds each argument for every tuple in
+	turn, columns[k * count + i] being argument k (in the order a caller pushes them)
+	of tuple i. Results go to results[i]. The executable must have been through dexe_prepare.
+*/
+void batch_execute(Executable* exe, int function_id, int count, int* columns, int* results)
+{
+	void (*run)(Executable*, int, int*, int, int*, int*) = run_batch_generic;
+	int arg_count = exe->functions[function_id].arg_count;
+	size_t scratch_size = batch_vectorizable(exe, function_id);
+	int* args = (int*)malloc(((size_t)arg_count + 1) * BATCH_LANES * sizeof(int));
+	int* scratch;
+	
+	if(args == NULL)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the arguments of a batch");
+	
+	if(scratch_size == 0)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			for(int k = 0; k < arg_count; k++)
+				args[k] = columns[k * count + i];
+			results[i] = dexe_call(exe, function_id, args);
+		}
+		
+		free(args);
+		return;
+	}
+	
+	scratch = (int*)malloc(scratch_size * sizeof(int));
+	if(scratch == NULL)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %lu bytes for the batch frames", (unsigned long)(scratch_size * sizeof(int)));
+	
+#if BATCH_X86
+	if(batch_isa() == BATCH_ISA_AVX2)
+		run = run_batch_avx2;
+	else if(batch_isa() == BATCH_ISA_SSE2)
+		run = run_batch_sse2;
+#endif
+	
+	for(int first = 0; first < count; first += BATCH_LANES)
+	{
+		int lanes = count - first < BATCH_LANES ? count - first : BATCH_LANES;
+		int returned[BATCH_LANES];
+		
+		//the callee's stack holds the last argument pushed at the bottom
+		for(int k = 0; k < arg_count; k++)
+			for(int l = 0; l < BATCH_LANES; l++)
+				args[k * BATCH_LANES + l] = l < lanes ? columns[(arg_count - 1 - k) * count + first + l] : 0;
+		
+		run(exe, function_id, args, (1 << lanes) - 1, returned, scratch);
+		memcpy(results + first, returned, lanes * sizeof(int));
+	}
+	
+	free(scratch);
+	free(args);
+}
+
+static int find_function(Executable* exe, char* name)
+{
+	char* end;
+	long id = strtol(name, &end, 10);
+	
+	if(end != name && *end == '\0')
+		return id >= 0 && id < exe->number_of_functions ? (int)id : -1;
+	
+	for(int i = 0; i < exe->number_of_functions && exe->flags & DEXE_FLAGS_DEBUG; i++)
+		if(!strcmp(exe->debug[i].function_name, name))
+			return i;
+	
+	return -1;
+}
+
+/*
+	The -batch command line. Every non-blank line of in is one tuple of integers, and
+	each result is written to out on its own line, in the same order.
+*/
+int batch_run_stream(Executable* exe, char* name, FILE* in, FILE* out)
+{
+	int function_id = find_function(exe, name);
+	int arg_count;
+	int count = 0;
+	int capacity = 1024;
+	int* rows;
+	int* columns;
+	int* results;
+	char line[4096];
+	
+	if(function_id < 0)
+		error(exe, FUNCTION_DOES_NOT_EXIST, "'%s' is not a function of this file", name);
+	arg_count = exe->functions[function_id].arg_count;
+	
+	rows = (int*)malloc(((size_t)arg_count + 1) * capacity * sizeof(int));
+	if(rows == NULL)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the batch input");
+	
+	for(int number = 1; fgets(line, sizeof(line), in) != NULL; number++)
+	{
+		char* text = line;
+		int values = 0;
+		
+		if(strchr(line, '\n') == NULL && !feof(in))
+			error(exe, NOT_ENOUGH_ARGUMENTS, "Line %d of the batch input is longer than %d characters", number, (int)sizeof(line) - 1);
+		
+		while(isspace((unsigned char)*text))
+			text++;
+		if(*text == '\0')
+			continue;
+		
+		if(count == capacity)
+		{
+			int* grown = (int*)realloc(rows, ((size_t)arg_count + 1) * capacity * 2 * sizeof(int));
+			if(grown == NULL)
+				error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the batch input");
+			rows = grown;
+			capacity *= 2;
+		}
+		
+		while(*text != '\0')
+		{
+			char* end;
+			long value = strtol(text, &end, 0);
+			
+			if(end == text || values == arg_count)
+				error(exe, NOT_ENOUGH_ARGUMENTS, "Line %d of the batch input should be %d integers", number, arg_count);
+			
+			rows[count * arg_count + values++] = (int)value;
+			for(text = end; isspace((unsigned char)*text); text++);
+		}
+		
+		if(values != arg_count)
+			error(exe, NOT_ENOUGH_ARGUMENTS, "Line %d of the batch input should be %d integers", number, arg_count);
+		count++;
+	}
+	
+	columns = (int*)malloc(((size_t)arg_count * count + 1) * sizeof(int));
+	results = (int*)malloc(((size_t)count + 1) * sizeof(int));
+	if(columns == NULL || results == NULL)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the batch input");
+	
+	for(int i = 0; i < count; i++)
+		for(int k = 0; k < arg_count; k++)
+			columns[k * count + i] = rows[i * arg_count + k];
+	free(rows);
+	
+	batch_execute(exe, function_id, count, columns, results);
+	
+	for(int i = 0; i < count; i++)
+		fprintf(out, "%d\n", results[i]);
+	
+	free(columns);
+	free(results);
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+//tuples run together. Each vector interpreter covers them with as many registers as it needs
+#define BATCH_LANES 8
+
+//the instruction sets the vector interpreter can use, picked once at runtime
+#define BATCH_ISA_GENERIC 0
+#define BATCH_ISA_SSE2    1
+#define BATCH_ISA_AVX2    2
+
+
+extern int batch_isa();
+extern size_t batch_vectorizable(Executable*, int);
+extern void batch_execute(Executable*, int, int, int*, int*);
+extern int batch_run_stream(Executable*, char*, FILE*, FILE*);
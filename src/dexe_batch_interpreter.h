@@ -0,0 +1,330 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+/*
+	The vector interpreter. Like dexe_interpreter.h this is a template: dexe_batch.c
+	includes it once per instruction set, with no include guard. Before each inclusion
+	it defines
+	
+		BATCH_NAME       the name of the function to generate
+		BATCH_TARGET     an attribute that lets the compiler use the instruction set, or nothing
+		VEC, VEC_WIDTH   a vector of VEC_WIDTH ints, and
+		VEC_LOAD(p) VEC_STORE(p, v) VEC_SET1(x) VEC_ADD(a, b) VEC_SUB(a, b) VEC_MUL(a, b)
+		VEC_AND(a, b) VEC_OR(a, b) VEC_XOR(a, b) VEC_CMPEQ(a, b) VEC_CMPGT(a, b)
+		VEC_BLEND(mask, a, b) VEC_SHL(a, counts) VEC_SHR(a, counts)
+	
+	Every stack slot, local and flag is a row of BATCH_LANES ints, one per tuple. Each
+	step runs the instruction at the lowest pc any unfinished lane is at, for all the
+	lanes at that pc. Lanes that branched elsewhere wait, so they join back up as soon
+	as the others reach them. Only verified functions get here, which means every lane
+	at a pc has the same stack depth and only the rows of the running lanes are written.
+*/
+
+#define FOR_VECTORS(h) for(int h = 0; h < BATCH_LANES; h += VEC_WIDTH)
+
+//writes the running lanes of a row, the rest may belong to lanes at another pc
+#define WRITE(row, h, value) \
+	VEC_STORE((row) + (h), VEC_BLEND(VEC_LOAD(lanes + (h)), (value), VEC_LOAD((row) + (h))))
+
+#define BINARY(operation) \
+	FOR_VECTORS(h) \
+		WRITE(below, h, operation(VEC_LOAD(below + h), VEC_LOAD(top + h)))
+
+#define FOR_LANES(l) \
+	for(int l = 0; l < BATCH_LANES; l++) \
+		if(step >> l & 1)
+
+
+/*
+	scratch has room for the frames of this function and of everything it can call,
+	as sized by vectorizable() in dexe_batch.c. Callees get what this frame doesn't use.
+*/
+BATCH_TARGET static void BATCH_NAME(Executable* exe, int function_id, int* args, int mask, int* results, int* scratch)
+{
+	Executable_Function* function = &exe->functions[function_id];
+	char* code = function->instructions;
+	
+	//at most one push per instruction, so this is as deep as the stack can get
+	int rows = function->size_of_instructions + function->arg_count + 1;
+	
+	int* slots = scratch;
+	int* locals = slots + rows * BATCH_LANES;
+	int* equal = locals + function->local_count * BATCH_LANES;
+	int* greater = equal + BATCH_LANES;
+	int* less = greater + BATCH_LANES;
+	int* callee_args = less + BATCH_LANES;
+	int* callee_scratch = callee_args + BATCH_MAX_ARGS * BATCH_LANES;
+	
+	//finished lanes sit at INT_MAX, so the lowest pc is the next one to run
+	int pcs[BATCH_LANES];
+	int depths[BATCH_LANES];
+	int lanes[BATCH_LANES];
+	unsigned long executed = 0;
+	
+	//the arguments arrive in the order the callee's stack holds them
+	memcpy(slots, args, (size_t)function->arg_count * BATCH_LANES * sizeof(int));
+	memset(locals, 0, (size_t)function->local_count * BATCH_LANES * sizeof(int));
+	for(int l = 0; l < BATCH_LANES; l++)
+	{
+		pcs[l] = mask >> l & 1 ? 0 : INT_MAX;
+		depths[l] = function->arg_count;
+		exe->metrics.calls += mask >> l & 1;
+	}
+	
+	for(;;)
+	{
+		int pc = INT_MAX;
+		int step = 0;
+		int first = 0;
+		
+		for(int l = 0; l < BATCH_LANES; l++)
+			pc = pcs[l] < pc ? pcs[l] : pc;
+		if(pc == INT_MAX)
+			break;
+		
+		for(int l = BATCH_LANES - 1; l >= 0; l--)
+		{
+			int running = pcs[l] == pc;
+			
+			step |= running << l;
+			lanes[l] = -running;
+			first = running ? l : first;
+			executed += running;
+		}
+		
+		unsigned char opcode = (unsigned char)code[pc];
+		Opcode op = get_opcode_from_instruction((char)opcode);
+		int depth = depths[first];
+		int* top = slots + (depth - 1) * BATCH_LANES;
+		int* below = top - BATCH_LANES;
+		int next = pc + 1 + op.parameter_size;
+		int target = 0;
+		int taken = 0;
+		int pushed = op.pushed_stack_size - op.required_stack_size;
+		
+		switch(opcode)
+		{
+			case Nop:
+			case Break:
+				break;
+			
+			case Load:
+			{
+				int* local = locals + (unsigned char)code[pc + 1] * BATCH_LANES;
+				FOR_VECTORS(h)
+					WRITE(top + BATCH_LANES, h, VEC_LOAD(local + h));
+				break;
+			}
+			case Push:
+			case Pushk:
+			{
+				int value = bytes_to_int(code + pc + 1);
+				if(opcode == Pushk)
+					value = bytes_to_int(exe->constants[value].data);
+				FOR_VECTORS(h)
+					WRITE(top + BATCH_LANES, h, VEC_SET1(value));
+				break;
+			}
+			case Store:
+			{
+				int* local = locals + (unsigned char)code[pc + 1] * BATCH_LANES;
+				FOR_VECTORS(h)
+					WRITE(local, h, VEC_LOAD(top + h));
+				break;
+			}
+			case Dup:
+			{
+				FOR_VECTORS(h)
+					WRITE(top + BATCH_LANES, h, VEC_LOAD(top + h));
+				break;
+			}
+			case Pop:
+				break;
+			
+			case Inc:
+			{
+				FOR_VECTORS(h)
+					WRITE(top, h, VEC_ADD(VEC_LOAD(top + h), VEC_SET1(1)));
+				break;
+			}
+			case Dec:
+			{
+				FOR_VECTORS(h)
+					WRITE(top, h, VEC_SUB(VEC_LOAD(top + h), VEC_SET1(1)));
+				break;
+			}
+			case Add:
+				BINARY(VEC_ADD);
+				break;
+			case Sub:
+				BINARY(VEC_SUB);
+				break;
+			case Mul:
+				BINARY(VEC_MUL);
+				break;
+			case And:
+				BINARY(VEC_AND);
+				break;
+			case Or:
+				BINARY(VEC_OR);
+				break;
+			case Xor:
+				BINARY(VEC_XOR);
+				break;
+			
+			//no vector divide, and a zero divisor has to stop the run the way it would for one tuple
+			case Div:
+			case Rem:
+			{
+				FOR_LANES(l)
+				{
+					int value1 = top[l];
+					int value2 = below[l];
+					
+					if(value1 == 0)
+						error(exe, DIVISION_BY_ZERO, "A division by zero was encountered while trying to divide %d by %d", value2, value1);
+					
+					if(opcode == Div)
+						below[l] = value1 == -1 ? (int)(0u - (unsigned int)value2) : value2 / value1;
+					else
+						below[l] = value1 == -1 ? 0 : value2 % value1;
+				}
+				break;
+			}
+			case Not:
+			{
+				FOR_VECTORS(h)
+					WRITE(top, h, VEC_XOR(VEC_LOAD(top + h), VEC_SET1(-1)));
+				break;
+			}
+			case Neg:
+			{
+				FOR_VECTORS(h)
+					WRITE(top, h, VEC_SUB(VEC_SET1(0), VEC_LOAD(top + h)));
+				break;
+			}
+			case Shl:
+			{
+				FOR_VECTORS(h)
+					WRITE(below, h, VEC_SHL(VEC_LOAD(below + h), VEC_AND(VEC_LOAD(top + h), VEC_SET1(31))));
+				break;
+			}
+			case Shr:
+			{
+				FOR_VECTORS(h)
+					WRITE(below, h, VEC_SHR(VEC_LOAD(below + h), VEC_AND(VEC_LOAD(top + h), VEC_SET1(31))));
+				break;
+			}
+			case Cmp:
+			{
+				FOR_VECTORS(h)
+				{
+					VEC value1 = VEC_LOAD(top + h);
+					VEC value2 = VEC_LOAD(below + h);
+					
+					WRITE(equal, h, VEC_CMPEQ(value2, value1));
+					WRITE(greater, h, VEC_CMPGT(value2, value1));
+					WRITE(less, h, VEC_CMPGT(value1, value2));
+				}
+				break;
+			}
+			
+			//each lane takes its own side. The flags of a lane are -1 or 0
+			case Jmp:
+			case Je:
+			case Jne:
+			case Jg:
+			case Jge:
+			case Jl:
+			case Jle:
+			{
+				target = pc + bytes_to_int(code + pc + 1);
+				
+				FOR_LANES(l)
+				{
+					int condition;
+					
+					switch(opcode)
+					{
+						case Je:  condition = equal[l]; break;
+						case Jne: condition = !equal[l]; break;
+						case Jg:  condition = greater[l]; break;
+						case Jge: condition = greater[l] | equal[l]; break;
+						case Jl:  condition = less[l]; break;
+						case Jle: condition = less[l] | equal[l]; break;
+						default:  condition = 1; break;
+					}
+					
+					taken |= (condition != 0) << l;
+				}
+				break;
+			}
+			
+			//the callee runs as a batch of just the lanes that got here
+			case Call:
+			{
+				int callee = bytes_to_int(code + pc + 1);
+				int arg_count = exe->functions[callee].arg_count;
+				int returned[BATCH_LANES];
+				
+				for(int k = 0; k < arg_count; k++)
+					memcpy(callee_args + k * BATCH_LANES, top - k * BATCH_LANES, BATCH_LANES * sizeof(int));
+				
+				BATCH_NAME(exe, callee, callee_args, step, returned, callee_scratch);
+				
+				FOR_VECTORS(h)
+					WRITE(slots + (depth - arg_count) * BATCH_LANES, h, VEC_LOAD(returned + h));
+				
+				pushed = 1 - arg_count;
+				break;
+			}
+			case Ret:
+			{
+				FOR_LANES(l)
+				{
+					results[l] = depth > 0 ? top[l] : 0;
+					pcs[l] = INT_MAX;
+				}
+				continue;
+			}
+			
+			//batch_vectorizable keeps everything else on the scalar path
+			default:
+				error(exe, INVALID_OPCODE, "Invalid opcode recieved: 0x%X", opcode);
+		}
+		
+		FOR_LANES(l)
+		{
+			pcs[l] = taken >> l & 1 ? target : next;
+			depths[l] = depth + pushed;
+		}
+	}
+	
+	for(int l = 0; l < BATCH_LANES; l++)
+		exe->metrics.returns += mask >> l & 1;
+	exe->metrics.instructions += executed;
+}
+
+#undef FOR_VECTORS
+#undef WRITE
+#undef BINARY
+#undef FOR_LANES
@@ -0,0 +1,427 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_native.h"
+#include "dexe_cache.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <io.h>
+	#include <direct.h>
+	#include <process.h>
+	
+	#define dup _dup
+	#define dup2 _dup2
+	#define close _close
+	#define fileno _fileno
+	#define getpid _getpid
+	#define make_directory(path) _mkdir(path)
+#else
+	#include <unistd.h>
+	#include <dirent.h>
+	#include <sys/stat.h>
+	
+	#define make_directory(path) mkdir(path, 0755)
+#endif
+
+struct Cache_Entry_struct
+{
+	char* name;
+	unsigned long long size;
+	unsigned long long modified;
+};
+typedef struct Cache_Entry_struct Cache_Entry;
+
+
+//whether the image and the input alone decide what the run prints
+static int cacheable(Executable* exe)
+{
+	if(exe->info->commandline & (COMMANDLINE_DEBUG | COMMANDLINE_PROFILE | COMMANDLINE_TRACE | COMMANDLINE_SNAPSHOT | COMMANDLINE_RESTORE | COMMANDLINE_METRICS | COMMANDLINE_COUNTERS))
+		return 0;
+	
+	//natives are part of dexe, libraries are files of their own
+	for(int i = 0; i < exe->number_of_imports; i++)
+		if(strcmp(exe->imports[i].library, NATIVE_LIBRARY))
+			return 0;
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		Executable_Function* function = &exe->functions[i];
+		
+		for(int pc = 0; pc < function->size_of_instructions;)
+		{
+			unsigned char opcode = (unsigned char)function->instructions[pc];
+			
+			if(opcode == Break)
+				return 0;
+			
+			pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction((char)opcode).parameter_size : 0);
+		}
+	}
+	
+	return 1;
+}
+
+//whether anything the entry can reach reads stdin. A batch always does
+static int reads_input(Executable* exe)
+{
+	int reads = exe->info->commandline & COMMANDLINE_BATCH ? 1 : 0;
+	int changed = 1;
+	char* reached;
+	
+	if(reads || exe->entry < 0 || exe->entry >= exe->number_of_functions)
+		return reads;
+	if((reached = (char*)calloc(exe->number_of_functions, 1)) == NULL)
+		return 1;
+	reached[exe->entry] = 1;
+	
+	//spread from the entry until nothing new is reached
+	while(changed && !reads)
+	{
+		changed = 0;
+		
+		for(int i = 0; i < exe->number_of_functions && !reads; i++)
+		{
+			Executable_Function* function = &exe->functions[i];
+			
+			for(int pc = 0; reached[i] && pc < function->size_of_instructions && !reads;)
+			{
+				unsigned char opcode = (unsigned char)function->instructions[pc];
+				
+				if(opcode == In || opcode == Ini)
+					reads = 1;
+				else if(opcode == Call || opcode == Spawn || opcode == Coroutine)
+				{
+					int callee = bytes_to_int(function->instructions + pc + 1);
+					
+					if(callee >= 0 && callee < exe->number_of_functions && !reached[callee])
+						reached[callee] = changed = 1;
+				}
+				
+				pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction((char)opcode).parameter_size : 0);
+			}
+		}
+	}
+	
+	free(reached);
+	return reads;
+}
+
+static char* entry_path(char* directory, char* name, char* extension)
+{
+	size_t size = strlen(directory) + strlen(name) + strlen(extension) + 2;
+	char* path = (char*)malloc(size);
+	
+	if(path != NULL)
+		snprintf(path, size, "%s/%s%s", directory, name, extension);
+	return path;
+}
+
+static int copy_output(FILE* from, FILE* to, unsigned long long* size)
+{
+	char buffer[1 << 16];
+	size_t count;
+	
+	*size = 0;
+	while((count = fread(buffer, 1, sizeof(buffer), from)) > 0)
+	{
+		if(fwrite(buffer, 1, count, to) != count)
+			return 1;
+		*size += count;
+	}
+	
+	return ferror(from);
+}
+
+static int by_modified(const void* a, const void* b)
+{
+	unsigned long long first = ((const Cache_Entry*)a)->modified;
+	unsigned long long second = ((const Cache_Entry*)b)->modified;
+	
+	return (first > second) - (first < second);
+}
+
+static void add_entry(Cache_Entry** entries, int* count, int* capacity, char* path, unsigned long long size, unsigned long long modified)
+{
+	if(*count == *capacity)
+	{
+		int grown_capacity = *capacity ? 2 * *capacity : 64;
+		Cache_Entry* grown = (Cache_Entry*)realloc(*entries, grown_capacity * sizeof(Cache_Entry));
+		
+		if(grown == NULL)
+		{
+			free(path);
+			return;
+		}
+		*entries = grown;
+		*capacity = grown_capacity;
+	}
+	
+	(*entries)[*count].name = path;
+	(*entries)[*count].size = size;
+	(*entries)[*count].modified = modified;
+	(*count)++;
+}
+
+//removes the least recently used entries until the directory holds at most limit bytes
+static void evict(char* directory, unsigned long long limit)
+{
+	Cache_Entry* entries = NULL;
+	int count = 0;
+	int capacity = 0;
+	unsigned long long total = 0;
+	char* path;
+	
+	#ifdef _WIN32
+		WIN32_FIND_DATAA found;
+		char* pattern = entry_path(directory, "*", CACHE_EXTENSION);
+		HANDLE search = pattern != NULL ? FindFirstFileA(pattern, &found) : INVALID_HANDLE_VALUE;
+		
+		free(pattern);
+		if(search == INVALID_HANDLE_VALUE)
+			return;
+		
+		do
+		{
+			if((path = entry_path(directory, found.cFileName, "")) != NULL)
+				add_entry(&entries, &count, &capacity, path, (unsigned long long)found.nFileSizeHigh << 32 | found.nFileSizeLow,
+					(unsigned long long)found.ftLastWriteTime.dwHighDateTime << 32 | found.ftLastWriteTime.dwLowDateTime);
+		}
+		while(FindNextFileA(search, &found));
+		FindClose(search);
+	#else
+		size_t extension = strlen(CACHE_EXTENSION);
+		DIR* search = opendir(directory);
+		struct dirent* found;
+		struct stat info;
+		
+		if(search == NULL)
+			return;
+		
+		while((found = readdir(search)) != NULL)
+		{
+			size_t length = strlen(found->d_name);
+			
+			if(length <= extension || strcmp(found->d_name + length - extension, CACHE_EXTENSION) || (path = entry_path(directory, found->d_name, "")) == NULL)
+				continue;
+			
+			if(stat(path, &info))
+				free(path);
+			else
+			{
+				//to the nanosecond, so entries from the same second still go in order
+				#ifdef __APPLE__
+					unsigned long long modified = (unsigned long long)info.st_mtimespec.tv_sec * 1000000000ULL + (unsigned long long)info.st_mtimespec.tv_nsec;
+				#else
+					unsigned long long modified = (unsigned long long)info.st_mtim.tv_sec * 1000000000ULL + (unsigned long long)info.st_mtim.tv_nsec;
+				#endif
+				
+				add_entry(&entries, &count, &capacity, path, (unsigned long long)info.st_size, modified);
+			}
+		}
+		closedir(search);
+	#endif
+	
+	for(int i = 0; i < count; i++)
+		total += entries[i].size;
+	
+	qsort(entries, count, sizeof(Cache_Entry), by_modified);
+	for(int i = 0; i < count; i++)
+	{
+		if(total > limit && !remove(entries[i].name))
+			total -= entries[i].size;
+		free(entries[i].name);
+	}
+	free(entries);
+}
+
+/*
+	Reads all of stdin, if the program reads it at all, and looks the run up. Returns 1
+	for a hit, whose output has been printed and whose exit code is in exit_code, or 0
+	to go on with the run, which then goes into a new entry when it can. Runs that
+	aren't cacheable go on untouched.
+*/
+int cache_begin(Executable* exe, int* exit_code)
+{
+	char* directory = exe->info->cache_directory;
+	unsigned long long image;
+	unsigned long long input = HASH_START;
+	unsigned char buffer[1 << 16];
+	char name[33];
+	size_t count;
+	Cache* cache;
+	FILE* entry;
+	
+	if(!cacheable(exe) || hash_file(exe->info->filename, &image))
+		return 0;
+	
+	if((cache = (Cache*)calloc(1, sizeof(Cache))) == NULL)
+		error(exe, ALLOCATION_ERROR_IN_MAIN, "Could not allocate the result cache");
+	cache->saved_stdout = -1;
+	exe->cache = cache;
+	
+	//what else changes the output goes in with the input
+	int options[5] = { DEXE_MAJOR_VERSION, DEXE_MINOR_VERSION, DEXE_REVISION_VERSION, exe->info->commandline & (COMMANDLINE_SILENT | COMMANDLINE_VERBOSE), exe->info->commandline & COMMANDLINE_BATCH };
+	input = hash_bytes(input, options, sizeof(options));
+	if(exe->info->commandline & COMMANDLINE_BATCH)
+		input = hash_bytes(input, exe->info->batch_function, strlen(exe->info->batch_function) + 1);
+	
+	//a program that never reads stdin is keyed on the image alone, and stdin is left alone
+	if(reads_input(exe))
+	{
+		if((cache->input = tmpfile()) == NULL)
+			error(exe, FILE_ERROR, "Could not create a file to keep the input in for the cache");
+		while((count = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+		{
+			input = hash_bytes(input, buffer, count);
+			if(fwrite(buffer, 1, count, cache->input) != count)
+				error(exe, FILE_ERROR, "Could not keep the input for the cache");
+		}
+		rewind(cache->input);
+		exe->input = cache->input;
+	}
+	
+	snprintf(name, sizeof(name), "%016llx%016llx", image, input);
+	if((cache->path = entry_path(directory, name, CACHE_EXTENSION)) == NULL)
+		return 0;
+	
+	//a hit is only used if it's whole
+	if((entry = fopen(cache->path, "r+b")) != NULL)
+	{
+		Cache_Header header;
+		unsigned long long size;
+		
+		if(fread(&header, sizeof(Cache_Header), 1, entry) == 1 && !memcmp(header.magic, CACHE_MAGIC, 4) && header.version == CACHE_VERSION &&
+			!fseek(entry, 0, SEEK_END) && ftell(entry) >= 0 && (unsigned long long)ftell(entry) == sizeof(Cache_Header) + header.output_size &&
+			!fseek(entry, sizeof(Cache_Header), SEEK_SET) && !copy_output(entry, stdout, &size))
+		{
+			//rewriting the header marks it as just used
+			rewind(entry);
+			fwrite(&header, sizeof(Cache_Header), 1, entry);
+			fclose(entry);
+			
+			fflush(stdout);
+			*exit_code = header.exit_code;
+			return 1;
+		}
+		fclose(entry);
+	}
+	
+	//a miss runs with stdout going into the new entry
+	Cache_Header header;
+	char suffix[32];
+	
+	make_directory(directory);
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+	if((cache->temporary = entry_path(directory, name, suffix)) == NULL || (cache->output = fopen(cache->temporary, "w+b")) == NULL)
+		return 0;
+	
+	memset(&header, 0, sizeof(Cache_Header));
+	fflush(stdout);
+	if(fwrite(&header, sizeof(Cache_Header), 1, cache->output) != 1 || fflush(cache->output) ||
+		(cache->saved_stdout = dup(fileno(stdout))) < 0 || dup2(fileno(cache->output), fileno(stdout)) < 0)
+	{
+		if(cache->saved_stdout >= 0)
+			close(cache->saved_stdout);
+		cache->saved_stdout = -1;
+		fclose(cache->output);
+		cache->output = NULL;
+		remove(cache->temporary);
+	}
+	
+	return 0;
+}
+
+//puts stdout back and prints what the run wrote. The entry is kept when store is set
+static void end_capture(Executable* exe, int exit_code, int store)
+{
+	Cache* cache = exe->cache;
+	Cache_Header header;
+	int kept = 0;
+	
+	fflush(stdout);
+	dup2(cache->saved_stdout, fileno(stdout));
+	close(cache->saved_stdout);
+	cache->saved_stdout = -1;
+	
+	memset(&header, 0, sizeof(Cache_Header));
+	memcpy(header.magic, CACHE_MAGIC, 4);
+	header.version = CACHE_VERSION;
+	header.exit_code = exit_code;
+	
+	if(!fseek(cache->output, sizeof(Cache_Header), SEEK_SET) && !copy_output(cache->output, stdout, &header.output_size) && store)
+	{
+		rewind(cache->output);
+		kept = fwrite(&header, sizeof(Cache_Header), 1, cache->output) == 1;
+	}
+	fflush(stdout);
+	
+	if(fclose(cache->output))
+		kept = 0;
+	cache->output = NULL;
+	
+	//another run may have put the same entry in first
+	if(kept && rename(cache->temporary, cache->path))
+	{
+		remove(cache->path);
+		kept = !rename(cache->temporary, cache->path);
+	}
+	if(!kept)
+		remove(cache->temporary);
+	else
+		evict(exe->info->cache_directory, exe->info->cache_size);
+}
+
+//the run is over, with exit_code. main and error() call this before they exit
+void cache_finish(Executable* exe, int exit_code)
+{
+	if(exe->cache != NULL && exe->cache->saved_stdout >= 0)
+		end_capture(exe, exit_code, 1);
+}
+
+void cache_free(Executable* exe)
+{
+	Cache* cache = exe->cache;
+	
+	if(cache == NULL)
+		return;
+	
+	//an exit that didn't go through cache_finish still gets its output out, but isn't kept
+	if(cache->saved_stdout >= 0)
+		end_capture(exe, 0, 0);
+	if(cache->input != NULL)
+	{
+		fclose(cache->input);
+		exe->input = stdin;
+	}
+	
+	free(cache->path);
+	free(cache->temporary);
+	free(cache);
+	exe->cache = NULL;
+}
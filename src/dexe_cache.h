@@ -0,0 +1,72 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+#define CACHE_MAGIC        "DCCH"
+#define CACHE_VERSION      1
+#define CACHE_EXTENSION    ".dcache"
+#define CACHE_DEFAULT_SIZE ((unsigned long long)256 << 20)
+
+
+/*
+	A run only depends on the image and what it reads, so with -cache its output and
+	exit code are kept in a directory under the hash of both, and the next run with
+	the same image and input prints them without running anything.
+	
+	That means all of stdin is read before the program starts, into a copy it reads
+	instead, and everything on stdout (errors included) goes into the entry and only
+	comes out once the run is over. Runs that the image and the input don't decide
+	aren't cached: debugging, code with a break in it, imports from libraries (they're
+	other files), and profiles, traces, snapshots and metrics, which a hit wouldn't
+	write. The silent and verbose options change the output, so they're part of the key.
+	
+	An entry is a Cache_Header and the output. Hits rewrite the header, so the entries
+	modified longest ago are the least recently used, and those are removed until the
+	directory is back under its size after every new entry.
+*/
+struct Cache_Header_struct
+{
+	char magic[4];
+	unsigned int version;
+	int exit_code;
+	unsigned int reserved;
+	unsigned long long output_size;
+};
+typedef struct Cache_Header_struct Cache_Header;
+
+struct Cache_struct
+{
+	char* path;      //of this run's entry
+	char* temporary; //the entry while it's written
+	
+	FILE* input;  //the copy of stdin
+	FILE* output; //stdout goes here until the run is over
+	int saved_stdout; //-1 unless stdout is redirected
+};
+typedef struct Cache_struct Cache;
+
+
+extern int cache_begin(Executable*, int*);
+extern void cache_finish(Executable*, int);
+extern void cache_free(Executable*);
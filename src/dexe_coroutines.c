@@ -0,0 +1,228 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_stack.h"
+#include "dexe_coroutines.h"
+
+#define COROUTINE_POOL_START 64
+
+
+static void save(Executable* exe, Coroutine_Frame* co, long* elements, int count)
+{
+	if(count > co->capacity)
+	{
+		int capacity = co->capacity ? co->capacity : 16;
+		long* grown;
+		
+		while(capacity < count)
+			capacity *= 2;
+		
+		if((grown = (long*)realloc(co->saved, capacity * sizeof(long))) == NULL)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %d bytes for a suspended coroutine", capacity * (int)sizeof(long));
+		co->saved = grown;
+		co->capacity = capacity;
+	}
+	
+	if(count > 0)
+		memcpy(co->saved, elements, count * sizeof(long));
+	co->size = count;
+}
+
+//a finished coroutine from the free list, or a new one
+static Coroutine_Frame* take(Executable* exe)
+{
+	Coroutine_Pool* pool = exe->coroutines;
+	Coroutine_Frame* co;
+	
+	if(pool == NULL)
+	{
+		if((pool = (Coroutine_Pool*)calloc(1, sizeof(Coroutine_Pool))) == NULL)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the coroutine pool");
+		pool->free = -1;
+		exe->coroutines = pool;
+	}
+	
+	if(pool->free >= 0)
+	{
+		co = pool->coroutines[pool->free];
+		pool->free = co->next_free;
+		return co;
+	}
+	
+	if(pool->count == COROUTINES_MAX)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "More than %d coroutines are alive at once", COROUTINES_MAX);
+	
+	if(pool->count == pool->capacity)
+	{
+		int capacity = pool->capacity ? 2 * pool->capacity : COROUTINE_POOL_START;
+		Coroutine_Frame** grown = (Coroutine_Frame**)realloc(pool->coroutines, capacity * sizeof(Coroutine_Frame*));
+		
+		if(grown == NULL)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not grow the coroutine pool to %d", capacity);
+		pool->coroutines = grown;
+		pool->capacity = capacity;
+	}
+	
+	if((co = (Coroutine_Frame*)calloc(1, sizeof(Coroutine_Frame))) == NULL)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate a coroutine");
+	co->index = pool->count;
+	pool->coroutines[pool->count++] = co;
+	
+	return co;
+}
+
+static void release(Executable* exe, Coroutine_Frame* co)
+{
+	co->state = COROUTINE_FREE;
+	co->generation = (co->generation + 1) & 0x7FF;
+	co->local_memory = NULL;
+	co->next_free = exe->coroutines->free;
+	exe->coroutines->free = co->index;
+}
+
+//args are in the order they were pushed
+long coroutine_create(Executable* exe, int function_id, long* args)
+{
+	Coroutine_Frame* co = take(exe);
+	int arg_count = exe->functions[function_id].arg_count;
+	
+	co->function_id = function_id;
+	co->state = COROUTINE_CREATED;
+	co->local_memory = NULL;
+	co->resumer = NULL;
+	
+	//the way stack_window would leave them in the callee
+	save(exe, co, args, arg_count);
+	for(int i = 0, k = arg_count - 1; i < k; i++, k--)
+	{
+		long temp = co->saved[i];
+		co->saved[i] = co->saved[k];
+		co->saved[k] = temp;
+	}
+	
+	return ((long)co->generation << 20) | co->index;
+}
+
+/*
+	Runs the coroutine in a frame at space until it yields or returns, and gives back
+	what it yielded or returned. A coroutine that returns goes back to the pool.
+*/
+int coroutine_resume(Executable* exe, long handle, long value, long* space, int length)
+{
+	Coroutine_Pool* pool = exe->coroutines;
+	Coroutine_Frame* co = NULL;
+	Stack_Frame frame;
+	int result;
+	
+	if(pool != NULL && handle >= 0 && COROUTINE_INDEX(handle) < pool->count)
+		co = pool->coroutines[COROUTINE_INDEX(handle)];
+	if(co == NULL || co->generation != COROUTINE_GENERATION(handle) || co->state == COROUTINE_FREE)
+		error(exe, COROUTINE_DOES_NOT_EXIST, "Resumed %ld, which is not a coroutine that has yet to return", handle);
+	if(co->state == COROUTINE_RUNNING)
+		error(exe, COROUTINE_DOES_NOT_EXIST, "Resumed %ld, which is already running and resumed this one", handle);
+	if(co->size > length)
+		error(exe, STACK_OVERFLOW, "The stack grew past its limit of %lu bytes.", (unsigned long)STACK_RESERVE_SIZE);
+	
+	frame.function_id = co->function_id;
+	frame.pc = 0;
+	frame.flags = 0;
+	frame.stack.stack_elements = space;
+	frame.stack.length = length;
+	frame.stack.stack_pointer = co->size;
+	if(co->size > 0)
+		memcpy(space, co->saved, co->size * sizeof(long));
+	
+	//a fresh one starts like any call, a suspended one picks up in coroutine_enter
+	if(co->state == COROUTINE_SUSPENDED)
+	{
+		co->value = value;
+		exe->resuming = co;
+	}
+	co->state = COROUTINE_RUNNING;
+	co->resumer = exe->coroutine;
+	exe->coroutine = co;
+	
+	stack_push(&exe->call_stack, (long)&frame);
+	co->depth = exe->call_stack.stack_pointer;
+	result = exe->functions[co->function_id].run_function(exe);
+	stack_pop(&exe->call_stack);
+	
+	exe->coroutine = co->resumer;
+	if(co->state == COROUTINE_RUNNING)
+		release(exe, co);
+	
+	return result;
+}
+
+/*
+	Suspends the running coroutine, whose frame is sf, so that it carries on from pc.
+	elements are its stack, or its registers, without the value being yielded.
+*/
+void coroutine_yield(Executable* exe, Stack_Frame* sf, int pc, long* elements, int count)
+{
+	Coroutine_Frame* co = exe->coroutine;
+	
+	if(co == NULL || co->depth != exe->call_stack.stack_pointer)
+		error(exe, COROUTINE_DOES_NOT_EXIST, "A yield outside of a coroutine's own function. Only the function a coroutine was created from can yield");
+	
+	save(exe, co, elements, count);
+	co->pc = pc;
+	co->flags = sf->flags;
+	co->local_memory = sf->local_memory;
+	co->state = COROUTINE_SUSPENDED;
+}
+
+//restores what coroutine_yield kept into the frame being resumed and returns its pc
+int coroutine_enter(Executable* exe, Stack_Frame* sf, long* value)
+{
+	Coroutine_Frame* co = exe->resuming;
+	
+	exe->resuming = NULL;
+	sf->local_memory = co->local_memory;
+	sf->flags = co->flags;
+	*value = co->value;
+	
+	return co->pc;
+}
+
+void coroutines_free(Executable* exe)
+{
+	Coroutine_Pool* pool = exe->coroutines;
+	
+	if(pool == NULL)
+		return;
+	
+	//a running coroutine's locals belong to its frame on the call stack
+	for(int i = 0; i < pool->count; i++)
+	{
+		if(pool->coroutines[i]->state == COROUTINE_SUSPENDED)
+			free(pool->coroutines[i]->local_memory);
+		free(pool->coroutines[i]->saved);
+		free(pool->coroutines[i]);
+	}
+	free(pool->coroutines);
+	free(pool);
+	exe->coroutines = NULL;
+}
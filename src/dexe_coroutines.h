@@ -0,0 +1,91 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	Stackless coroutines. coroutine f pops f's arguments and pushes a handle, resume
+	pops a handle and a value and runs the coroutine until it yields or returns, and
+	yield pops a value, hands it to the resumer and pushes the value the next resume
+	passes in. Resume pushes what was yielded, or what the function returned once it's
+	done, after which the handle is no good. The value of the first resume is dropped.
+	
+	Only the coroutine's own function can yield, anything it calls runs to the end
+	like always. That way a suspended coroutine is nothing but its stack, its locals
+	and a pc, which wait in a Coroutine_Frame from a pool instead of on the native stack,
+	and resuming is a call that starts where the yield left off. Tasks it spawned
+	have to be joined before it yields.
+*/
+
+//live at once. Handles carry a generation above the index, so old ones are caught
+#define COROUTINES_MAX        (1 << 20)
+#define COROUTINE_INDEX(handle)      ((int)((handle) & (COROUTINES_MAX - 1)))
+#define COROUTINE_GENERATION(handle) ((int)((handle) >> 20))
+
+#define COROUTINE_FREE      0
+#define COROUTINE_CREATED   1
+#define COROUTINE_SUSPENDED 2
+#define COROUTINE_RUNNING   3
+
+struct Coroutine_struct
+{
+	int function_id;
+	int state;
+	int generation;
+	int depth; //of its frame on the call stack while it runs
+	
+	//where it picks up again: a pc for the stack interpreter, an instruction for the register one
+	int pc;
+	int flags;
+	long value; //what the resume passed in
+	
+	//its stack, or all of its registers, while it's suspended. The arguments until it starts
+	long* saved;
+	int size;
+	int capacity;
+	int* local_memory;
+	
+	struct Coroutine_struct* resumer; //the coroutine running when this one was resumed
+	int index;
+	int next_free;
+};
+typedef struct Coroutine_struct Coroutine_Frame;
+
+struct Coroutine_Pool_struct
+{
+	Coroutine_Frame** coroutines; //never move once allocated, finished ones are reused
+	int count;
+	int capacity;
+	int free;
+};
+typedef struct Coroutine_Pool_struct Coroutine_Pool;
+
+
+extern long coroutine_create(Executable*, int, long*);
+extern int coroutine_resume(Executable*, long, long, long*, int);
+extern void coroutine_yield(Executable*, Stack_Frame*, int, long*, int);
+extern int coroutine_enter(Executable*, Stack_Frame*, long*);
+
+extern void coroutines_free(Executable*);
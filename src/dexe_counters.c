@@ -0,0 +1,372 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#ifdef __linux__
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_profile.h"
+#include "dexe_counters.h"
+
+#ifdef __linux__
+	#include <errno.h>
+	#include <unistd.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+
+static const char* const counter_names[COUNTERS_MAX] =
+{
+	[COUNTER_CYCLES]        = "cycles",
+	[COUNTER_INSTRUCTIONS]  = "instructions",
+	[COUNTER_BRANCH_MISSES] = "branch-misses",
+	[COUNTER_L1I_MISSES]    = "L1i-misses",
+	[COUNTER_L1D_MISSES]    = "L1d-misses",
+	[COUNTER_ITLB_MISSES]   = "iTLB-misses"
+};
+
+static const char* const class_names[OPCODE_CLASSES] =
+{
+	[OPCODE_CLASS_OTHER]      = "other",
+	[OPCODE_CLASS_STACK]      = "stack",
+	[OPCODE_CLASS_ARITHMETIC] = "arithmetic",
+	[OPCODE_CLASS_BRANCH]     = "branch",
+	[OPCODE_CLASS_CALL]       = "call",
+	[OPCODE_CLASS_HEAP]       = "heap",
+	[OPCODE_CLASS_VECTOR]     = "vector",
+	[OPCODE_CLASS_IO]         = "io"
+};
+
+#ifdef __linux__
+//misses are of reads, the only ones every processor counts
+#define CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct
+{
+	unsigned int type;
+	unsigned long long config;
+} counter_events[COUNTERS_MAX] =
+{
+	[COUNTER_CYCLES]        = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[COUNTER_INSTRUCTIONS]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[COUNTER_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[COUNTER_L1I_MISSES]    = { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1I) },
+	[COUNTER_L1D_MISSES]    = { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	[COUNTER_ITLB_MISSES]   = { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_ITLB) }
+};
+
+//user space only, which is all the interpreter is and all perf_event_paranoid 2 allows
+static int open_event(int event, int group)
+{
+	struct perf_event_attr attr;
+	
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counter_events[event].type;
+	attr.config = counter_events[event].config;
+	attr.disabled = group == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void close_events(Counters* counters)
+{
+	for(int i = 0; i < counters->number_of_events; i++)
+		close(counters->fds[i]);
+	counters->number_of_events = 0;
+	counters->group = -1;
+}
+
+/*
+	Opens the first count of the events that the processor has as one group. A group
+	is only ever scheduled whole, so one with more events than there are counters
+	never runs. Returns how long it ran in a first read, 0 if it never did.
+*/
+static unsigned long long open_group(Counters* counters, int count, int* missing)
+{
+	unsigned long long values[3 + COUNTERS_MAX];
+	
+	for(int event = 0; event < count; event++)
+	{
+		int fd = open_event(event, counters->group);
+		
+		if(fd == -1)
+		{
+			//there is no point trying the rest if perf_event_open isn't allowed at all
+			if(counters->group == -1 && (errno == EACCES || errno == EPERM || errno == ENOSYS))
+				return 0;
+			
+			*missing |= 1 << event;
+			continue;
+		}
+		
+		if(counters->group == -1)
+			counters->group = fd;
+		counters->fds[counters->number_of_events] = fd;
+		counters->events[counters->number_of_events++] = event;
+	}
+	
+	if(counters->group == -1)
+		return 0;
+	
+	ioctl(counters->group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(counters->group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	
+	if(read(counters->group, values, sizeof(values)) < (long)(3 * sizeof(unsigned long long)))
+		return 0;
+	return values[2];
+}
+#endif
+
+int counters_init(Executable* exe)
+{
+	Counters* counters = (Counters*)calloc(1, sizeof(Counters));
+	
+	if(counters == NULL)
+		return 1;
+	exe->counters = counters;
+	counters->group = -1;
+	
+	counters->number_of_functions = exe->number_of_functions;
+	counters->functions = (Function_Counters*)calloc(exe->number_of_functions, sizeof(Function_Counters));
+	counters->run_function = (int (**)(Executable*))calloc(exe->number_of_functions, sizeof(*counters->run_function));
+	counters->frames = (Counters_Frame*)malloc(COUNTERS_INITIAL_DEPTH * sizeof(Counters_Frame));
+	counters->capacity = COUNTERS_INITIAL_DEPTH;
+	if(counters->functions == NULL || counters->run_function == NULL || counters->frames == NULL)
+		return 1;
+	
+	#ifdef __linux__
+		//fewer events until the group fits in the counters there are
+		int missing = 0;
+		for(int count = COUNTERS_MAX; count > 0; count--)
+		{
+			int opened;
+			
+			missing = 0;
+			errno = 0;
+			if(open_group(counters, count, &missing))
+				break;
+			
+			//none that open is not a matter of fitting them in
+			opened = counters->number_of_events;
+			close_events(counters);
+			if(!opened)
+				break;
+		}
+		
+		if(counters->number_of_events == 0)
+			warning("hardware performance counters are not available (%s), -perf-counters only counts calls", errno ? strerror(errno) : "they never ran");
+		else
+		{
+			for(int event = 0; event < COUNTERS_MAX; event++)
+				if(missing & 1 << event)
+					warning("this processor does not count %s, -perf-counters leaves them out", counter_names[event]);
+		}
+	#else
+		warning("hardware performance counters are only read on Linux, -perf-counters only counts calls");
+	#endif
+	
+	return 0;
+}
+void counters_free(Executable* exe)
+{
+	if(exe->counters != NULL)
+	{
+		#ifdef __linux__
+			close_events(exe->counters);
+		#endif
+		free(exe->counters->functions);
+		free(exe->counters->run_function);
+		free(exe->counters->frames);
+		free(exe->counters);
+		exe->counters = NULL;
+	}
+}
+
+//what the group has counted so far, in the order of events
+static void read_counters(Counters* counters, unsigned long long* values)
+{
+	#ifdef __linux__
+		unsigned long long buffer[3 + COUNTERS_MAX];
+		
+		if(counters->group != -1 && read(counters->group, buffer, sizeof(buffer)) > 0)
+		{
+			memcpy(values, buffer + 3, counters->number_of_events * sizeof(unsigned long long));
+			return;
+		}
+	#endif
+	memset(values, 0, COUNTERS_MAX * sizeof(unsigned long long));
+}
+
+//run in place of whatever function_id was given last
+void counters_wrap(Executable* exe, int function_id)
+{
+	if(exe->functions[function_id].run_function != counters_run)
+	{
+		exe->counters->run_function[function_id] = exe->functions[function_id].run_function;
+		exe->functions[function_id].run_function = counters_run;
+	}
+}
+
+int counters_run(Executable* exe)
+{
+	Counters* counters = exe->counters;
+	int function_id = ((Stack_Frame*)stack_peek(&exe->call_stack))->function_id;
+	Function_Counters* function = &counters->functions[function_id];
+	unsigned long long now[COUNTERS_MAX];
+	
+	if(counters->depth == counters->capacity)
+	{
+		Counters_Frame* frames = (Counters_Frame*)realloc(counters->frames, 2 * counters->capacity * sizeof(Counters_Frame));
+		if(frames == NULL)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %d performance counter frames", 2 * counters->capacity);
+		counters->frames = frames;
+		counters->capacity *= 2;
+	}
+	
+	Counters_Frame* frame = &counters->frames[counters->depth++];
+	frame->function_id = function_id;
+	memset(frame->callees, 0, sizeof(frame->callees));
+	function->calls++;
+	function->active++;
+	
+	//the reads go as close to the call as they can, so the bookkeeping is left out
+	read_counters(counters, frame->start);
+	int result = counters->run_function[function_id](exe);
+	read_counters(counters, now);
+	
+	//a callee may have moved the frames
+	frame = &counters->frames[--counters->depth];
+	function->active--;
+	for(int i = 0; i < counters->number_of_events; i++)
+	{
+		unsigned long long taken = now[i] - frame->start[i];
+		
+		function->exclusive[i] += taken - frame->callees[i];
+		if(!function->active)
+			function->inclusive[i] += taken;
+		if(counters->depth)
+			counters->frames[counters->depth - 1].callees[i] += taken;
+	}
+	
+	return result;
+}
+
+static void write_values(FILE* file, Counters* counters, unsigned long long* values)
+{
+	for(int i = 0; i < counters->number_of_events; i++)
+		fprintf(file, " %llu", values[i]);
+}
+
+/*
+	The report is plain text, one record per line, like the profile:
+	
+		events <name>...
+		total <count>...
+		function <id> <name> calls <count> inclusive <count>... exclusive <count>...
+		class <name> <count>...
+	
+	Counts are in the order of the events line. Only functions that were called are
+	written. The counters can't tell instructions apart, so the class records need
+	-profile as well: each function's exclusive counts are split between the opcode
+	classes by how many of its instructions of each the profile saw run. They are
+	estimates, and the profile's own counting is in every count then.
+*/
+int counters_write(Executable* exe, char* filename)
+{
+	Counters* counters = exe->counters;
+	unsigned long long total[COUNTERS_MAX] = { 0 };
+	double classes[OPCODE_CLASSES][COUNTERS_MAX] = { { 0 } };
+	FILE* file = fopen(filename, "w");
+	
+	if(file == NULL)
+		return 1;
+	
+	fprintf(file, "# dexe perf counters of %s\n", exe->info->filename);
+	if(counters->number_of_events == 0)
+		fprintf(file, "# no hardware counters could be read, there are only calls\n");
+	
+	fprintf(file, "events");
+	for(int i = 0; i < counters->number_of_events; i++)
+		fprintf(file, " %s", counter_names[counters->events[i]]);
+	fprintf(file, "\n");
+	
+	for(int f = 0; f < counters->number_of_functions; f++)
+	{
+		Function_Counters* function = &counters->functions[f];
+		unsigned long run = 0;
+		
+		if(!function->calls)
+			continue;
+		
+		for(int i = 0; i < counters->number_of_events; i++)
+			total[i] += function->exclusive[i];
+		
+		if(exe->profile == NULL)
+			continue;
+		
+		for(int k = 0; k < OPCODE_CLASSES; k++)
+			run += exe->profile->functions[f].classes[k];
+		for(int k = 0; k < OPCODE_CLASSES && run; k++)
+			for(int i = 0; i < counters->number_of_events; i++)
+				classes[k][i] += (double)function->exclusive[i] * exe->profile->functions[f].classes[k] / run;
+	}
+	
+	fprintf(file, "total");
+	write_values(file, counters, total);
+	fprintf(file, "\n");
+	
+	for(int f = 0; f < counters->number_of_functions; f++)
+	{
+		Function_Counters* function = &counters->functions[f];
+		
+		if(!function->calls)
+			continue;
+		
+		fprintf(file, "function %d %s calls %lu inclusive", f, exe->flags & DEXE_FLAGS_DEBUG ? exe->debug[f].function_name : "-", function->calls);
+		write_values(file, counters, function->inclusive);
+		fprintf(file, " exclusive");
+		write_values(file, counters, function->exclusive);
+		fprintf(file, "\n");
+	}
+	
+	if(exe->profile == NULL)
+		fprintf(file, "# run with -profile as well to split the counts by opcode class\n");
+	else
+	{
+		for(int k = 0; k < OPCODE_CLASSES; k++)
+		{
+			fprintf(file, "class %s", class_names[k]);
+			for(int i = 0; i < counters->number_of_events; i++)
+				fprintf(file, " %.0f", classes[k][i]);
+			fprintf(file, "\n");
+		}
+	}
+	
+	return fclose(file);
+}
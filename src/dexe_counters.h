@@ -0,0 +1,97 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	Hardware performance counters per function, for -perf-counters. Every function's
+	run_function is wrapped by counters_run, which reads the counters as the call
+	begins and as it returns, so the interpreter being measured is the one that
+	would run anyway. A call's count goes to its function inclusively, and less its
+	callees' exclusively. Natives without a frame, and calls answered by the memo
+	cache, are part of their caller.
+	
+	Where the counters can't be opened (no perf_event_open, or a container that
+	doesn't allow it) only the calls are counted. Events the processor doesn't have
+	are left out of the report.
+*/
+
+//the hardware events, in the order they are opened and reported
+#define COUNTER_CYCLES        0
+#define COUNTER_INSTRUCTIONS  1
+#define COUNTER_BRANCH_MISSES 2
+#define COUNTER_L1I_MISSES    3
+#define COUNTER_L1D_MISSES    4
+#define COUNTER_ITLB_MISSES   5
+#define COUNTERS_MAX          6
+
+#define COUNTERS_INITIAL_DEPTH 64
+
+
+struct Function_Counters_struct
+{
+	unsigned long calls;
+	unsigned long long inclusive[COUNTERS_MAX]; //callees included, a recursive call only once
+	unsigned long long exclusive[COUNTERS_MAX];
+	int active; //calls into it that haven't returned
+};
+typedef struct Function_Counters_struct Function_Counters;
+
+//a call that hasn't returned: the counters as it began, and what its callees took since
+struct Counters_Frame_struct
+{
+	int function_id;
+	unsigned long long start[COUNTERS_MAX];
+	unsigned long long callees[COUNTERS_MAX];
+};
+typedef struct Counters_Frame_struct Counters_Frame;
+
+struct Counters_struct
+{
+	//the events are one group on this thread, read all at once. group is -1 when none opened
+	int group;
+	int fds[COUNTERS_MAX];
+	int number_of_events;
+	int events[COUNTERS_MAX]; //the COUNTER_* of each value in a read
+	
+	//what each function runs under counters_run
+	int (**run_function)(Executable*);
+	
+	int number_of_functions;
+	Function_Counters* functions;
+	
+	Counters_Frame* frames;
+	int depth;
+	int capacity;
+};
+typedef struct Counters_struct Counters;
+
+
+extern int counters_init(Executable*);
+extern void counters_free(Executable*);
+
+extern void counters_wrap(Executable*, int);
+extern int counters_run(Executable*);
+
+extern int counters_write(Executable*, char*);
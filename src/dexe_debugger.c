@@ -0,0 +1,495 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include <ctype.h>
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_executer.h"
+#include "dexe_debugger.h"
+
+/*
+	Runtime breakpoints. Setting one overwrites the opcode at (function, pc) in the
+	loaded code with Trap and remembers the original. Only the debug interpreter
+	variants know Trap: they ask debugger_trap for the original opcode, stop if the
+	condition holds, and then execute the original instruction in place. Code
+	without breakpoints runs exactly as fast as it would without the debugger.
+	
+	Breakpoints are written as
+	
+		<function>[:<pc>][,<condition>]
+	
+	where <function> is a function id or, with debug symbols, a function name, and
+	<condition> is 'top' or 'local<N>' (or a local's name), then one of
+	== != < <= > >=, then an integer. For example:  fib:10,local0<2
+	
+	Watchpoints stop whenever a Store changes a local. Only the watched function is
+	switched to an instrumented interpreter variant, everything else is untouched.
+	
+	Natives have no code to patch. A breakpoint on one is at pc 0 and native_run asks
+	debugger_native about it before the native runs, with the arguments on the stack.
+*/
+
+//indexed by COMPARE_*
+static char* comparisons[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+static char* skip_spaces(char* text)
+{
+	while(isspace((unsigned char)*text))
+		text++;
+	return text;
+}
+
+static char* function_label(Executable* exe, int function_id, char* buffer)
+{
+	if(exe->flags & DEXE_FLAGS_DEBUG)
+		return exe->debug[function_id].function_name;
+	
+	sprintf(buffer, "%d", function_id);
+	return buffer;
+}
+
+//reads a function id or name, returns -1 if there is no such function
+static int parse_function(Executable* exe, char** text)
+{
+	char* start = skip_spaces(*text);
+	char* end = start;
+	
+	if(isdigit((unsigned char)*start))
+	{
+		int id = (int)strtol(start, text, 10);
+		return id < exe->number_of_functions ? id : -1;
+	}
+	
+	while(*end && *end != ':' && *end != ',' && !isspace((unsigned char)*end))
+		end++;
+	*text = end;
+	
+	if(!(exe->flags & DEXE_FLAGS_DEBUG) || end == start)
+		return -1;
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		if(strlen(exe->debug[i].function_name) == (size_t)(end - start) && !strncmp(exe->debug[i].function_name, start, end - start))
+			return i;
+	}
+	
+	return -1;
+}
+
+//reads a local index or name, returns -1 if there is no such local
+static int parse_local(Executable* exe, int function_id, char** text)
+{
+	char* start = skip_spaces(*text);
+	char* end = start;
+	
+	if(!strncmp(start, "local", 5) && isdigit((unsigned char)start[5]))
+		start += 5;
+	
+	if(isdigit((unsigned char)*start))
+	{
+		int local = (int)strtol(start, text, 10);
+		return local < exe->functions[function_id].local_count ? local : -1;
+	}
+	
+	while(isalnum((unsigned char)*end) || *end == '_')
+		end++;
+	*text = end;
+	
+	if(!(exe->flags & DEXE_FLAGS_DEBUG) || end == start)
+		return -1;
+	
+	for(int i = 0; i < exe->functions[function_id].local_count; i++)
+	{
+		if(strlen(exe->debug[function_id].local_names[i]) == (size_t)(end - start) && !strncmp(exe->debug[function_id].local_names[i], start, end - start))
+			return i;
+	}
+	
+	return -1;
+}
+
+static int find_breakpoint(Executable* exe, int function_id, int pc)
+{
+	for(int i = 0; i < exe->debugger->number_of_breakpoints; i++)
+		if(exe->debugger->breakpoints[i].function_id == function_id && exe->debugger->breakpoints[i].pc == pc)
+			return i;
+	
+	return -1;
+}
+
+unsigned char debugger_original_opcode(Executable* exe, int function_id, int pc)
+{
+	unsigned char opcode = exe->functions[function_id].instructions[pc];
+	
+	if(opcode == Trap && exe->debugger != NULL)
+	{
+		int i = find_breakpoint(exe, function_id, pc);
+		if(i >= 0)
+			return exe->debugger->breakpoints[i].original;
+	}
+	
+	return opcode;
+}
+
+static int is_instruction_start(Executable* exe, int function_id, int pc)
+{
+	for(int k = 0; k < exe->functions[function_id].size_of_instructions; k++)
+	{
+		if(k == pc)
+			return 1;
+		
+		unsigned char opcode = debugger_original_opcode(exe, function_id, k);
+		if(opcode > LAST_OPCODE)
+			return 0;
+		
+		k += get_opcode_from_instruction(opcode).parameter_size;
+	}
+	
+	return 0;
+}
+
+
+int debugger_init(Executable* exe)
+{
+	exe->debugger = (Debugger*)calloc(1, sizeof(Debugger));
+	
+	return exe->debugger == NULL;
+}
+void debugger_free(Executable* exe)
+{
+	if(exe->debugger != NULL)
+	{
+		free(exe->debugger->breakpoints);
+		free(exe->debugger->watchpoints);
+		free(exe->debugger);
+		
+		exe->debugger = NULL;
+	}
+}
+
+int debugger_add_breakpoint(Executable* exe, char* spec)
+{
+	char* text = spec;
+	Breakpoint breakpoint;
+	char label[16];
+	
+	breakpoint.function_id = parse_function(exe, &text);
+	breakpoint.pc = 0;
+	breakpoint.condition = CONDITION_NONE;
+	breakpoint.local = 0;
+	breakpoint.comparison = COMPARE_EQUAL;
+	breakpoint.value = 0;
+	
+	if(breakpoint.function_id < 0)
+	{
+		printf("Breakpoint '%s': no such function\n", spec);
+		return 1;
+	}
+	
+	if(*text == ':')
+	{
+		text++;
+		breakpoint.pc = (int)strtol(text, &text, 10);
+	}
+	
+	if(exe->functions[breakpoint.function_id].native != NULL ? breakpoint.pc != 0 : !is_instruction_start(exe, breakpoint.function_id, breakpoint.pc))
+	{
+		printf("Breakpoint '%s': %d is not the start of an instruction\n", spec, breakpoint.pc);
+		return 1;
+	}
+	
+	text = skip_spaces(text);
+	if(*text == ',')
+	{
+		text = skip_spaces(text + 1);
+		
+		if(!strncmp(text, "top", 3))
+		{
+			breakpoint.condition = CONDITION_TOP;
+			text += 3;
+		}
+		else
+		{
+			breakpoint.condition = CONDITION_LOCAL;
+			breakpoint.local = parse_local(exe, breakpoint.function_id, &text);
+			if(breakpoint.local < 0)
+			{
+				printf("Breakpoint '%s': no such local\n", spec);
+				return 1;
+			}
+		}
+		
+		//two character operators first, so that '<=' isn't read as '<'
+		int length = 0;
+		text = skip_spaces(text);
+		for(int pass = 2; pass >= 1 && !length; pass--)
+		{
+			for(int c = 0; c < 6 && !length; c++)
+			{
+				if(strlen(comparisons[c]) == (size_t)pass && !strncmp(text, comparisons[c], pass))
+				{
+					breakpoint.comparison = c;
+					length = pass;
+				}
+			}
+		}
+		
+		if(!length)
+		{
+			printf("Breakpoint '%s': expected a comparison\n", spec);
+			return 1;
+		}
+		text += length;
+		
+		char* end;
+		breakpoint.value = (int)strtol(text, &end, 0);
+		if(end == text)
+		{
+			printf("Breakpoint '%s': expected a value to compare against\n", spec);
+			return 1;
+		}
+	}
+	
+	//setting the same breakpoint twice only replaces its condition
+	int existing = find_breakpoint(exe, breakpoint.function_id, breakpoint.pc);
+	if(existing >= 0)
+	{
+		breakpoint.original = exe->debugger->breakpoints[existing].original;
+		exe->debugger->breakpoints[existing] = breakpoint;
+		return 0;
+	}
+	
+	if(exe->debugger->number_of_breakpoints == exe->debugger->breakpoint_capacity)
+	{
+		int capacity = exe->debugger->breakpoint_capacity ? exe->debugger->breakpoint_capacity * 2 : 8;
+		Breakpoint* breakpoints = (Breakpoint*)realloc(exe->debugger->breakpoints, capacity * sizeof(Breakpoint));
+		if(breakpoints == NULL)
+			return 1;
+		
+		exe->debugger->breakpoints = breakpoints;
+		exe->debugger->breakpoint_capacity = capacity;
+	}
+	
+	//natives have nothing to patch, native_run checks for their breakpoints
+	Executable_Function* function = &exe->functions[breakpoint.function_id];
+	if(function->native != NULL)
+	{
+		breakpoint.original = Nop;
+		exe->debugger->breakpoints[exe->debugger->number_of_breakpoints++] = breakpoint;
+		
+		printf("Breakpoint set at %s\n", function_label(exe, breakpoint.function_id, label));
+		return 0;
+	}
+	
+	//library code is read-only and shared, so this function gets a copy of its own to patch
+	if(function->attributes & FUNCTION_ATTRIBUTE_SHARED)
+	{
+		char* copy = (char*)malloc(function->size_of_instructions);
+		if(copy == NULL)
+			return 1;
+		
+		memcpy(copy, function->instructions, function->size_of_instructions);
+		function->instructions = copy;
+		function->attributes &= ~FUNCTION_ATTRIBUTE_SHARED;
+	}
+	
+	//patch in the trap
+	char* code = function->instructions;
+	breakpoint.original = (unsigned char)code[breakpoint.pc];
+	code[breakpoint.pc] = (char)Trap;
+	
+	exe->debugger->breakpoints[exe->debugger->number_of_breakpoints++] = breakpoint;
+	
+	printf("Breakpoint set at %s @ %d\n", function_label(exe, breakpoint.function_id, label), breakpoint.pc);
+	return 0;
+}
+int debugger_remove_breakpoint(Executable* exe, char* spec)
+{
+	char* text = spec;
+	int function_id = parse_function(exe, &text);
+	int pc = 0;
+	
+	if(function_id >= 0 && *text == ':')
+		pc = (int)strtol(text + 1, &text, 10);
+	
+	int i = function_id < 0 ? -1 : find_breakpoint(exe, function_id, pc);
+	if(i < 0)
+	{
+		printf("No breakpoint at '%s'\n", spec);
+		return 1;
+	}
+	
+	//restore the original instruction
+	if(exe->functions[function_id].native == NULL)
+		exe->functions[function_id].instructions[pc] = (char)exe->debugger->breakpoints[i].original;
+	
+	exe->debugger->breakpoints[i] = exe->debugger->breakpoints[--exe->debugger->number_of_breakpoints];
+	return 0;
+}
+
+//spec is [<function>:]<local>. Without a function, default_function is used (if it isn't -1)
+int debugger_add_watchpoint(Executable* exe, char* spec, int default_function)
+{
+	char* text = spec;
+	int function_id = default_function;
+	char label[16];
+	
+	if(strchr(spec, ':') != NULL)
+	{
+		function_id = parse_function(exe, &text);
+		if(*text == ':')
+			text++;
+	}
+	
+	if(function_id < 0)
+	{
+		printf("Watchpoint '%s': no such function\n", spec);
+		return 1;
+	}
+	
+	int local = parse_local(exe, function_id, &text);
+	if(local < 0)
+	{
+		printf("Watchpoint '%s': no such local\n", spec);
+		return 1;
+	}
+	
+	if(exe->debugger->number_of_watchpoints == exe->debugger->watchpoint_capacity)
+	{
+		int capacity = exe->debugger->watchpoint_capacity ? exe->debugger->watchpoint_capacity * 2 : 8;
+		Watchpoint* watchpoints = (Watchpoint*)realloc(exe->debugger->watchpoints, capacity * sizeof(Watchpoint));
+		if(watchpoints == NULL)
+			return 1;
+		
+		exe->debugger->watchpoints = watchpoints;
+		exe->debugger->watchpoint_capacity = capacity;
+	}
+	
+	exe->debugger->watchpoints[exe->debugger->number_of_watchpoints].function_id = function_id;
+	exe->debugger->watchpoints[exe->debugger->number_of_watchpoints].local = local;
+	exe->debugger->number_of_watchpoints++;
+	
+	//only this function pays for watching. Activations already running keep their variant
+	exe->functions[function_id].attributes |= FUNCTION_ATTRIBUTE_WATCHED;
+	dexe_select_variant(exe, function_id);
+	
+	printf("Watching local %d of %s\n", local, function_label(exe, function_id, label));
+	return 0;
+}
+
+void debugger_list(Executable* exe)
+{
+	char label[16];
+	
+	if(!exe->debugger->number_of_breakpoints && !exe->debugger->number_of_watchpoints)
+		puts("  [None]");
+	
+	for(int i = 0; i < exe->debugger->number_of_breakpoints; i++)
+	{
+		Breakpoint* breakpoint = &exe->debugger->breakpoints[i];
+		
+		printf("  break %s @ %d", function_label(exe, breakpoint->function_id, label), breakpoint->pc);
+		if(breakpoint->condition == CONDITION_TOP)
+			printf(" if top %s %d", comparisons[breakpoint->comparison], breakpoint->value);
+		else if(breakpoint->condition == CONDITION_LOCAL)
+			printf(" if local %d %s %d", breakpoint->local, comparisons[breakpoint->comparison], breakpoint->value);
+		puts("");
+	}
+	
+	for(int i = 0; i < exe->debugger->number_of_watchpoints; i++)
+		printf("  watch %s local %d\n", function_label(exe, exe->debugger->watchpoints[i].function_id, label), exe->debugger->watchpoints[i].local);
+}
+
+static int compare(int comparison, int left, int right)
+{
+	switch(comparison)
+	{
+		case COMPARE_EQUAL:         return left == right;
+		case COMPARE_NOT_EQUAL:     return left != right;
+		case COMPARE_LESS:          return left < right;
+		case COMPARE_LESS_EQUAL:    return left <= right;
+		case COMPARE_GREATER:       return left > right;
+		case COMPARE_GREATER_EQUAL: return left >= right;
+		default:                    return 0;
+	}
+}
+
+//stops at the prompt if the breakpoint's condition holds in sf
+static void check_breakpoint(Executable* exe, Stack_Frame* sf, Breakpoint* hit)
+{
+	int stop = 1;
+	char label[16];
+	
+	if(hit->condition == CONDITION_LOCAL)
+		stop = compare(hit->comparison, sf->local_memory[hit->local], hit->value);
+	else if(hit->condition == CONDITION_TOP)
+		stop = sf->stack.stack_pointer > 0 && compare(hit->comparison, (int)stack_peek(&sf->stack), hit->value);
+	
+	if(stop)
+	{
+		printf("\nBreakpoint hit at %s @ %d\n", function_label(exe, sf->function_id, label), sf->pc);
+		breakpoint(exe);
+	}
+}
+
+//called by the debug variants when they reach a Trap. Returns the opcode to execute instead
+unsigned char debugger_trap(Executable* exe, Stack_Frame* sf)
+{
+	int i = find_breakpoint(exe, sf->function_id, sf->pc);
+	if(i < 0)
+		error(exe, INVALID_OPCODE, "Invalid opcode recieved: 0x%X", Trap);
+	
+	//the breakpoint may have been removed at the prompt, so use the copy
+	Breakpoint hit = exe->debugger->breakpoints[i];
+	check_breakpoint(exe, sf, &hit);
+	return hit.original;
+}
+
+//called by native_run before a native runs
+void debugger_native(Executable* exe, Stack_Frame* sf)
+{
+	int i = find_breakpoint(exe, sf->function_id, 0);
+	
+	if(i >= 0)
+	{
+		Breakpoint hit = exe->debugger->breakpoints[i];
+		check_breakpoint(exe, sf, &hit);
+	}
+}
+
+//called by the watch variants after every Store, with pc on the Store's operand
+void debugger_watch(Executable* exe, Stack_Frame* sf, int local, int old_value)
+{
+	char label[16];
+	
+	if(sf->local_memory[local] == old_value)
+		return;
+	
+	for(int i = 0; i < exe->debugger->number_of_watchpoints; i++)
+	{
+		if(exe->debugger->watchpoints[i].function_id == sf->function_id && exe->debugger->watchpoints[i].local == local)
+		{
+			printf("\nWatchpoint hit at %s @ %d: local %d changed from %d to %d\n", function_label(exe, sf->function_id, label), sf->pc - 1, local, old_value, sf->local_memory[local]);
+			breakpoint(exe);
+			return;
+		}
+	}
+}
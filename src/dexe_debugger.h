@@ -0,0 +1,84 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+//what a breakpoint condition looks at
+#define CONDITION_NONE  0
+#define CONDITION_LOCAL 1
+#define CONDITION_TOP   2
+
+#define COMPARE_EQUAL         0
+#define COMPARE_NOT_EQUAL     1
+#define COMPARE_LESS          2
+#define COMPARE_LESS_EQUAL    3
+#define COMPARE_GREATER       4
+#define COMPARE_GREATER_EQUAL 5
+
+
+struct Breakpoint_struct
+{
+	int function_id;
+	int pc;
+	unsigned char original; //the opcode the trap replaced
+	
+	int condition;
+	int local;
+	int comparison;
+	int value;
+};
+typedef struct Breakpoint_struct Breakpoint;
+
+struct Watchpoint_struct
+{
+	int function_id;
+	int local;
+};
+typedef struct Watchpoint_struct Watchpoint;
+
+struct Debugger_struct
+{
+	int number_of_breakpoints;
+	int breakpoint_capacity;
+	Breakpoint* breakpoints;
+	
+	int number_of_watchpoints;
+	int watchpoint_capacity;
+	Watchpoint* watchpoints;
+};
+typedef struct Debugger_struct Debugger;
+
+
+extern int debugger_init(Executable*);
+extern void debugger_free(Executable*);
+
+extern int debugger_add_breakpoint(Executable*, char*);
+extern int debugger_remove_breakpoint(Executable*, char*);
+extern int debugger_add_watchpoint(Executable*, char*, int);
+extern void debugger_list(Executable*);
+
+extern unsigned char debugger_original_opcode(Executable*, int, int);
+extern unsigned char debugger_trap(Executable*, Stack_Frame*);
+extern void debugger_watch(Executable*, Stack_Frame*, int, int);
+extern void debugger_native(Executable*, Stack_Frame*);
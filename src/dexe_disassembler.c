@@ -0,0 +1,552 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_threads.h"
+#include "dexe_disassembler.h"
+
+/*
+	Lists the code of a loaded (not linked) image, as text for people or as JSON or
+	TSV for tools. Every function is formatted into a listing of its own, a batch of
+	functions at a time in parallel, and the listings are written out in order, so
+	the output is the same however the work was split.
+	
+	JSON is one object per function and line, in "functions":
+	
+		{"id":0,"name":"main","args":0,"locals":1,"size":12,"arg_names":[],"local_names":["i"],
+		 "instructions":[{"pc":0,"op":"push","operand":5},{"pc":5,"op":"jmp","operand":-5,"target":0},...],
+		 "mix":{"push":1,"jmp":1},"jump_targets":[0]}
+	
+	Names are null and their arrays missing without debug symbols. Calls also have a
+	"callee" where it has a name, loads and stores a "local". TSV has one record per
+	line, tab separated, the first field saying which:
+	
+		function <id> <name> <args> <locals> <size>
+		instruction <id> <pc> <op> <operand> <target or callee>
+		mix <id> <op> <count>
+		jump <id> <target>
+	
+	The name is '-' without debug symbols. Bytes that aren't an instruction, or one cut
+	short by the end of the function, are listed one at a time as "unknown".
+*/
+
+//text that only grows. Once an allocation fails it stays failed and stops growing
+struct Listing_struct
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+	int failed;
+};
+typedef struct Listing_struct Listing;
+
+struct Disassembly_struct
+{
+	Executable* exe;
+	int format;
+	int first; //the id of the first function of the batch
+	Listing* listings;
+};
+typedef struct Disassembly_struct Disassembly;
+
+//appends a name the way the format needs it escaped
+typedef void (*Append_Name)(Listing*, const char*);
+
+
+static void append(Listing* listing, const char* text, size_t size)
+{
+	if(listing->failed)
+		return;
+	
+	if(listing->length + size > listing->capacity)
+	{
+		size_t capacity = listing->capacity ? listing->capacity : 256;
+		char* data;
+		
+		while(capacity < listing->length + size)
+			capacity *= 2;
+		
+		if((data = (char*)realloc(listing->data, capacity)) == NULL)
+		{
+			listing->failed = 1;
+			return;
+		}
+		listing->data = data;
+		listing->capacity = capacity;
+	}
+	
+	memcpy(listing->data + listing->length, text, size);
+	listing->length += size;
+}
+static void append_string(Listing* listing, const char* string)
+{
+	append(listing, string, strlen(string));
+}
+static void append_number(Listing* listing, long long number)
+{
+	char digits[24];
+	int count = sizeof(digits);
+	unsigned long long magnitude = number < 0 ? 0ULL - (unsigned long long)number : (unsigned long long)number;
+	
+	do
+	{
+		digits[--count] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while(magnitude != 0);
+	
+	if(number < 0)
+		digits[--count] = '-';
+	
+	append(listing, digits + count, sizeof(digits) - count);
+}
+static void append_hex(Listing* listing, unsigned int number)
+{
+	char digits[10];
+	int count = sizeof(digits);
+	
+	do
+	{
+		digits[--count] = "0123456789ABCDEF"[number & 0xF];
+		number >>= 4;
+	} while(number != 0);
+	
+	digits[--count] = 'x';
+	digits[--count] = '0';
+	append(listing, digits + count, sizeof(digits) - count);
+}
+
+//without the quotes
+static void append_json_name(Listing* listing, const char* name)
+{
+	for(; *name != '\0'; name++)
+	{
+		unsigned char c = (unsigned char)*name;
+		
+		if(c == '"' || c == '\\')
+		{
+			char escaped[2] = { '\\', (char)c };
+			append(listing, escaped, 2);
+		}
+		else if(c < ' ')
+		{
+			char escaped[6] = { '\\', 'u', '0', '0', "0123456789ABCDEF"[c >> 4], "0123456789ABCDEF"[c & 0xF] };
+			append(listing, escaped, 6);
+		}
+		else
+			append(listing, name, 1);
+	}
+}
+//tabs and line breaks would start another field or record
+static void append_tsv_name(Listing* listing, const char* name)
+{
+	for(; *name != '\0'; name++)
+		append(listing, (unsigned char)*name < ' ' ? " " : name, 1);
+}
+
+//calls to imports use ids past the functions, as library.name
+static int has_callee_name(Executable* exe, int id)
+{
+	if(id >= 0 && id < exe->number_of_functions)
+		return exe->flags & DEXE_FLAGS_DEBUG;
+	return id >= exe->number_of_functions && id - exe->number_of_functions < exe->number_of_imports;
+}
+static void append_callee_name(Listing* listing, Executable* exe, int id, Append_Name append_name)
+{
+	if(id < exe->number_of_functions)
+	{
+		append_name(listing, exe->debug[id].function_name);
+		return;
+	}
+	
+	append_name(listing, exe->imports[id - exe->number_of_functions].library);
+	append_string(listing, ".");
+	append_name(listing, exe->imports[id - exe->number_of_functions].name);
+}
+
+static int is_jump(unsigned char opcode)
+{
+	return opcode >= Jmp && opcode <= Jle;
+}
+static int is_call(unsigned char opcode)
+{
+	return opcode == Call || opcode == Spawn || opcode == Coroutine;
+}
+
+//the instruction at pc, or NULL if there's none there or its operand is cut short. operand is always set, 0 if there is none
+static Opcode* decode(Executable_Function* function, int pc, int* operand)
+{
+	unsigned char opcode = (unsigned char)function->instructions[pc];
+	Opcode* op;
+	
+	*operand = 0;
+	if(opcode > LAST_OPCODE)
+		return NULL;
+	
+	op = opcode_table[opcode];
+	if(pc + op->parameter_size >= function->size_of_instructions)
+		return NULL;
+	
+	if(op->parameter_size == 4)
+		*operand = bytes_to_int(function->instructions + pc + 1);
+	else if(op->parameter_size == 1)
+		*operand = (unsigned char)function->instructions[pc + 1];
+	
+	return op;
+}
+
+
+static void text_function(Executable* exe, int id, Listing* out)
+{
+	Executable_Function* function = &exe->functions[id];
+	int debug = exe->flags & DEXE_FLAGS_DEBUG;
+	
+	append_string(out, "function ");
+	if(debug)
+	{
+		append_string(out, exe->debug[id].function_name);
+		append_string(out, " (");
+		for(int k = 0; k < function->arg_count; k++)
+		{
+			append_string(out, k ? ", int " : "int ");
+			append_string(out, exe->debug[id].arg_names[k]);
+		}
+		append_string(out, "):\n");
+	}
+	else
+	{
+		append_number(out, id);
+		append_string(out, " (int[");
+		append_number(out, function->arg_count);
+		append_string(out, "]):\n");
+	}
+	
+	for(int pc = 0; pc < function->size_of_instructions;)
+	{
+		int operand;
+		Opcode* op = decode(function, pc, &operand);
+		
+		if(op == NULL)
+		{
+			append_string(out, "  UNKNOWN\n");
+			pc++;
+			continue;
+		}
+		
+		append_string(out, "  ");
+		append_string(out, op->mnemonic);
+		
+		if(op->opcode == Push || op->opcode == Load || op->opcode == Store)
+		{
+			append_string(out, " ");
+			append_hex(out, (unsigned int)operand);
+		}
+		else if(op->parameter_size > 0)
+		{
+			append_string(out, " ");
+			append_number(out, operand);
+		}
+		
+		if(is_call(op->opcode) && has_callee_name(exe, operand))
+		{
+			append_string(out, " [");
+			append_callee_name(out, exe, operand, append_string);
+			append_string(out, "]");
+		}
+		else if((is_call(op->opcode) || op->opcode == Load || op->opcode == Store) && debug)
+		{
+			append_string(out, " [");
+			append_string(out, is_call(op->opcode) || operand >= function->local_count ? "UNKNOWN" : exe->debug[id].local_names[operand]);
+			append_string(out, "]");
+		}
+		
+		append_string(out, "\n");
+		pc += 1 + op->parameter_size;
+	}
+	
+	append_string(out, "end\n\n");
+}
+
+static int compare_ints(const void* a, const void* b)
+{
+	return *(const int*)a < *(const int*)b ? -1 : *(const int*)a > *(const int*)b;
+}
+
+//JSON and TSV share the walk over the code, and only differ in how it's written
+static void data_function(Executable* exe, int id, int format, Listing* out)
+{
+	Executable_Function* function = &exe->functions[id];
+	int debug = exe->flags & DEXE_FLAGS_DEBUG;
+	int json = format == DISASSEMBLY_JSON;
+	Append_Name append_name = json ? append_json_name : append_tsv_name;
+	unsigned int mix[LAST_OPCODE + 2] = { 0 }; //the last counts unknown bytes
+	int* targets = (int*)malloc((function->size_of_instructions / 5 + 1) * sizeof(int));
+	int number_of_targets = 0;
+	
+	if(targets == NULL)
+	{
+		out->failed = 1;
+		return;
+	}
+	
+	if(json)
+	{
+		append_string(out, id ? ",{\"id\":" : "{\"id\":");
+		append_number(out, id);
+		append_string(out, ",\"name\":");
+		if(debug)
+		{
+			append_string(out, "\"");
+			append_json_name(out, exe->debug[id].function_name);
+			append_string(out, "\"");
+		}
+		else
+			append_string(out, "null");
+		append_string(out, ",\"args\":");
+		append_number(out, function->arg_count);
+		append_string(out, ",\"locals\":");
+		append_number(out, function->local_count);
+		append_string(out, ",\"size\":");
+		append_number(out, function->size_of_instructions);
+		
+		for(int list = 0; list < 2 && debug; list++)
+		{
+			char** names = list ? exe->debug[id].local_names : exe->debug[id].arg_names;
+			int count = list ? function->local_count : function->arg_count;
+			
+			append_string(out, list ? "],\"local_names\":[" : ",\"arg_names\":[");
+			for(int k = 0; k < count; k++)
+			{
+				append_string(out, k ? ",\"" : "\"");
+				append_json_name(out, names[k]);
+				append_string(out, "\"");
+			}
+		}
+		append_string(out, debug ? "],\"instructions\":[" : ",\"instructions\":[");
+	}
+	else
+	{
+		append_string(out, "function\t");
+		append_number(out, id);
+		append_string(out, "\t");
+		append_tsv_name(out, debug ? exe->debug[id].function_name : "-");
+		append_string(out, "\t");
+		append_number(out, function->arg_count);
+		append_string(out, "\t");
+		append_number(out, function->local_count);
+		append_string(out, "\t");
+		append_number(out, function->size_of_instructions);
+		append_string(out, "\n");
+	}
+	
+	for(int pc = 0; pc < function->size_of_instructions;)
+	{
+		int operand;
+		Opcode* op = decode(function, pc, &operand);
+		
+		if(json)
+		{
+			append_string(out, pc ? ",{\"pc\":" : "{\"pc\":");
+			append_number(out, pc);
+			append_string(out, ",\"op\":\"");
+		}
+		else
+		{
+			append_string(out, "instruction\t");
+			append_number(out, id);
+			append_string(out, "\t");
+			append_number(out, pc);
+			append_string(out, "\t");
+		}
+		
+		if(op == NULL)
+		{
+			//the byte itself is the operand
+			append_string(out, json ? "unknown\",\"operand\":" : "unknown\t");
+			append_number(out, (unsigned char)function->instructions[pc]);
+			append_string(out, json ? "}" : "\t\n");
+			mix[LAST_OPCODE + 1]++;
+			pc++;
+			continue;
+		}
+		
+		mix[op->opcode]++;
+		append_string(out, op->mnemonic);
+		append_string(out, json ? "\"" : "\t");
+		
+		if(op->parameter_size > 0)
+		{
+			if(json)
+				append_string(out, ",\"operand\":");
+			append_number(out, operand);
+		}
+		if(!json)
+			append_string(out, "\t");
+		
+		if(is_jump(op->opcode))
+		{
+			if(json)
+				append_string(out, ",\"target\":");
+			append_number(out, (long long)pc + operand);
+			targets[number_of_targets++] = pc + operand;
+		}
+		else if(is_call(op->opcode) && has_callee_name(exe, operand))
+		{
+			append_string(out, json ? ",\"callee\":\"" : "");
+			append_callee_name(out, exe, operand, append_name);
+			append_string(out, json ? "\"" : "");
+		}
+		else if((op->opcode == Load || op->opcode == Store) && debug && operand < function->local_count)
+		{
+			append_string(out, json ? ",\"local\":\"" : "");
+			append_name(out, exe->debug[id].local_names[operand]);
+			append_string(out, json ? "\"" : "");
+		}
+		
+		append_string(out, json ? "}" : "\n");
+		pc += 1 + op->parameter_size;
+	}
+	
+	append_string(out, json ? "],\"mix\":{" : "");
+	for(int opcode = 0, written = 0; opcode <= LAST_OPCODE + 1; opcode++)
+	{
+		if(!mix[opcode])
+			continue;
+		
+		if(json)
+			append_string(out, written++ ? ",\"" : "\"");
+		else
+		{
+			append_string(out, "mix\t");
+			append_number(out, id);
+			append_string(out, "\t");
+		}
+		append_string(out, opcode <= LAST_OPCODE ? opcode_table[opcode]->mnemonic : "unknown");
+		append_string(out, json ? "\":" : "\t");
+		append_number(out, mix[opcode]);
+		if(!json)
+			append_string(out, "\n");
+	}
+	
+	//each target once, in order
+	qsort(targets, number_of_targets, sizeof(int), compare_ints);
+	append_string(out, json ? "},\"jump_targets\":[" : "");
+	for(int k = 0; k < number_of_targets; k++)
+	{
+		if(k > 0 && targets[k] == targets[k - 1])
+			continue;
+		
+		if(json)
+			append_string(out, k ? "," : "");
+		else
+		{
+			append_string(out, "jump\t");
+			append_number(out, id);
+			append_string(out, "\t");
+		}
+		append_number(out, targets[k]);
+		if(!json)
+			append_string(out, "\n");
+	}
+	append_string(out, json ? "]}\n" : "");
+	
+	free(targets);
+}
+
+static void disassemble_function(void* context, int index)
+{
+	Disassembly* disassembly = (Disassembly*)context;
+	int id = disassembly->first + index;
+	
+	if(disassembly->format == DISASSEMBLY_TEXT)
+		text_function(disassembly->exe, id, &disassembly->listings[index]);
+	else
+		data_function(disassembly->exe, id, disassembly->format, &disassembly->listings[index]);
+}
+
+/*
+	Writes the listing of every function of exe to out in format. Returns 1 if memory
+	runs out or out can't be written, and then the output stops short.
+*/
+int disassemble(Executable* exe, FILE* out, int format)
+{
+	Disassembly disassembly;
+	Listing header = { NULL, 0, 0, 0 };
+	int threads = exe->info->threads;
+	int failed = 0;
+	
+	disassembly.exe = exe;
+	disassembly.format = format;
+	disassembly.listings = (Listing*)malloc(DISASSEMBLY_BATCH * sizeof(Listing));
+	if(disassembly.listings == NULL)
+		return 1;
+	
+	if(threads <= 0)
+	{
+		long code_size = 0;
+		
+		for(int i = 0; i < exe->number_of_functions; i++)
+			code_size += exe->functions[i].size_of_instructions;
+		threads = code_size >= DISASSEMBLY_PARALLEL_MIN_BYTES ? threads_available() : 1;
+	}
+	
+	if(format == DISASSEMBLY_JSON)
+	{
+		append_string(&header, "{\"file\":\"");
+		append_json_name(&header, exe->info->filename);
+		append_string(&header, "\",\"functions\":[\n");
+	}
+	else if(format == DISASSEMBLY_TSV)
+	{
+		append_string(&header, "# dexe disassembly of ");
+		append_tsv_name(&header, exe->info->filename);
+		append_string(&header, "\n");
+	}
+	else
+		append_string(&header, "\nDecompiled code:\n\n");
+	
+	failed = header.failed || fwrite(header.data, 1, header.length, out) != header.length;
+	free(header.data);
+	
+	for(disassembly.first = 0; disassembly.first < exe->number_of_functions && !failed; disassembly.first += DISASSEMBLY_BATCH)
+	{
+		int count = exe->number_of_functions - disassembly.first < DISASSEMBLY_BATCH ? exe->number_of_functions - disassembly.first : DISASSEMBLY_BATCH;
+		
+		memset(disassembly.listings, 0, count * sizeof(Listing));
+		threads_parallel_for(count, threads, disassemble_function, &disassembly);
+		
+		for(int k = 0; k < count; k++)
+		{
+			Listing* listing = &disassembly.listings[k];
+			
+			failed = failed || listing->failed || fwrite(listing->data, 1, listing->length, out) != listing->length;
+			free(listing->data);
+		}
+	}
+	
+	if(!failed)
+		failed = fputs(format == DISASSEMBLY_JSON ? "]}\n" : format == DISASSEMBLY_TSV ? "" : "\nEnd decompile\n", out) == EOF;
+	
+	free(disassembly.listings);
+	return failed;
+}
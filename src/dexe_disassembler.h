@@ -0,0 +1,38 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+#define DISASSEMBLY_TEXT 0
+#define DISASSEMBLY_JSON 1
+#define DISASSEMBLY_TSV  2
+
+//functions listed per parallel pass, so only that many listings are held at once
+#define DISASSEMBLY_BATCH 1024
+
+//passes only get threads of their own when there's enough code to pay for them
+#define DISASSEMBLY_PARALLEL_MIN_BYTES (256 * 1024)
+
+
+extern int disassemble(Executable*, FILE*, int);
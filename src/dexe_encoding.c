@@ -0,0 +1,334 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_opcodes.h"
+#include "dexe_encoding.h"
+
+static int is_jump(unsigned char opcode)
+{
+	return opcode >= Jmp && opcode <= Jle;
+}
+
+static unsigned int zigzag(int value)
+{
+	return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+static int unzigzag(unsigned int value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static int leb128_size(unsigned int value)
+{
+	int size = 1;
+	
+	while(value >= 0x80)
+	{
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+//writes exactly size bytes, padding with continuation bytes when value needs fewer
+static void write_leb128(char* out, unsigned int value, int size)
+{
+	for(int i = 0; i < size - 1; i++)
+	{
+		out[i] = (char)(0x80 | (value & 0x7F));
+		value >>= 7;
+	}
+	out[size - 1] = (char)(value & 0x7F);
+}
+
+//returns the number of bytes read, 0 if the number is cut off or too long
+static int read_leb128(char* in, int available, unsigned int* value)
+{
+	*value = 0;
+	
+	for(int i = 0; i < available && i < 5; i++)
+	{
+		*value |= (unsigned int)(in[i] & 0x7F) << (7 * i);
+		if(!(in[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+
+/*
+	Two passes. The first finds where every compact instruction lands in the fixed
+	code, the second writes it, converting jump offsets through that map. A jump that
+	lands inside an instruction can't be mapped and makes the code corrupt.
+*/
+int decode_compact_code(char* in, int in_size, char** out, int* out_size)
+{
+	int* position = (int*)malloc((in_size + 1) * sizeof(int));
+	int size = 0;
+	
+	if(position == NULL)
+		return ENCODING_NO_MEMORY;
+	
+	for(int i = 0; i <= in_size; i++)
+		position[i] = -1;
+	
+	for(int pc = 0; pc < in_size;)
+	{
+		unsigned char opcode = (unsigned char)in[pc];
+		unsigned int value;
+		int length = 1;
+		
+		position[pc] = size;
+		
+		if(opcode >= COMPACT_PUSH_SMALL && opcode < COMPACT_PUSH_SMALL + COMPACT_PUSH_COUNT)
+			size += 5;
+		else if(opcode >= COMPACT_LOAD_SMALL && opcode < COMPACT_STORE_SMALL + COMPACT_SMALL_COUNT)
+			size += 2;
+		else if(opcode > LAST_OPCODE)
+		{
+			free(position);
+			return ENCODING_CORRUPT;
+		}
+		else
+		{
+			Opcode op = get_opcode_from_instruction(opcode);
+			
+			if(op.parameter_size == 4)
+				length += read_leb128(in + pc + 1, in_size - pc - 1, &value);
+			else
+				length += op.parameter_size;
+			
+			if((op.parameter_size == 4 && length == 1) || pc + length > in_size)
+			{
+				free(position);
+				return ENCODING_CORRUPT;
+			}
+			size += 1 + op.parameter_size;
+		}
+		pc += length;
+	}
+	position[in_size] = size;
+	
+	*out = (char*)malloc(size > 0 ? size : 1);
+	if(*out == NULL)
+	{
+		free(position);
+		return ENCODING_NO_MEMORY;
+	}
+	*out_size = size;
+	
+	for(int pc = 0; pc < in_size;)
+	{
+		unsigned char opcode = (unsigned char)in[pc];
+		char* code = *out + position[pc];
+		unsigned int value;
+		
+		if(opcode >= COMPACT_PUSH_SMALL && opcode < COMPACT_PUSH_SMALL + COMPACT_PUSH_COUNT)
+		{
+			code[0] = Push;
+			int_to_bytes(opcode - COMPACT_PUSH_SMALL - COMPACT_PUSH_BIAS, code + 1);
+			pc++;
+		}
+		else if(opcode >= COMPACT_LOAD_SMALL && opcode < COMPACT_STORE_SMALL + COMPACT_SMALL_COUNT)
+		{
+			code[0] = opcode < COMPACT_STORE_SMALL ? Load : Store;
+			code[1] = (char)(opcode & 0x0F);
+			pc++;
+		}
+		else if(get_opcode_from_instruction(opcode).parameter_size == 4)
+		{
+			int length = 1 + read_leb128(in + pc + 1, in_size - pc - 1, &value);
+			
+			code[0] = (char)opcode;
+			if(is_jump(opcode))
+			{
+				long target = (long)pc + unzigzag(value);
+				if(target < 0 || target > in_size || position[target] < 0)
+				{
+					free(position);
+					free(*out);
+					*out = NULL;
+					return ENCODING_CORRUPT;
+				}
+				int_to_bytes(position[target] - position[pc], code + 1);
+			}
+			else if(opcode == Push)
+				int_to_bytes(unzigzag(value), code + 1);
+			else
+				int_to_bytes((int)value, code + 1);
+			pc += length;
+		}
+		else
+		{
+			int length = 1 + get_opcode_from_instruction(opcode).parameter_size;
+			memcpy(code, in + pc, length);
+			pc += length;
+		}
+	}
+	
+	free(position);
+	return ENCODING_OK;
+}
+
+/*
+	Jump sizes depend on the offsets, which depend on the sizes of everything in
+	between. Every jump starts at its smallest size and only ever grows until
+	nothing changes. A jump that ends up with more room than it needs is padded.
+*/
+int encode_compact_code(char* in, int in_size, char** out, int* out_size)
+{
+	int count = 0;
+	int* start = (int*)malloc((in_size + 1) * sizeof(int));   //fixed position of each instruction
+	int* index = (int*)malloc((in_size + 1) * sizeof(int));   //instruction at each fixed position
+	int* length = (int*)malloc((in_size + 1) * sizeof(int));  //compact size of each instruction
+	int* position = (int*)malloc((in_size + 1) * sizeof(int)); //compact position of each instruction
+	int result = ENCODING_OK;
+	int changed = 1;
+	
+	*out = NULL;
+	if(start == NULL || index == NULL || length == NULL || position == NULL)
+	{
+		result = ENCODING_NO_MEMORY;
+		goto done;
+	}
+	
+	for(int pc = 0; pc <= in_size; pc++)
+		index[pc] = -1;
+	
+	for(int pc = 0; pc < in_size; count++)
+	{
+		unsigned char opcode = (unsigned char)in[pc];
+		Opcode op = get_opcode_from_instruction(opcode);
+		
+		if(opcode > LAST_OPCODE || pc + op.parameter_size >= in_size)
+		{
+			result = ENCODING_CORRUPT;
+			goto done;
+		}
+		
+		start[count] = pc;
+		index[pc] = count;
+		
+		if(opcode == Push)
+		{
+			int value = bytes_to_int(in + pc + 1);
+			if(value >= -COMPACT_PUSH_BIAS && value < COMPACT_PUSH_COUNT - COMPACT_PUSH_BIAS)
+				length[count] = 1;
+			else
+				length[count] = 1 + leb128_size(zigzag(value));
+		}
+		else if((opcode == Load || opcode == Store) && (unsigned char)in[pc + 1] < COMPACT_SMALL_COUNT)
+			length[count] = 1;
+		else if(opcode == Call || opcode == Spawn || opcode == Coroutine || opcode == Outs || opcode == Pushk)
+			length[count] = 1 + leb128_size((unsigned int)bytes_to_int(in + pc + 1));
+		else if(is_jump(opcode))
+			length[count] = 2;
+		else
+			length[count] = 1 + op.parameter_size;
+		
+		pc += 1 + op.parameter_size;
+	}
+	start[count] = in_size;
+	index[in_size] = count;
+	
+	//every jump has to land on an instruction, or the end of the code
+	for(int i = 0; i < count; i++)
+	{
+		if(is_jump((unsigned char)in[start[i]]))
+		{
+			long target = (long)start[i] + bytes_to_int(in + start[i] + 1);
+			if(target < 0 || target > in_size || index[target] < 0)
+			{
+				result = ENCODING_CORRUPT;
+				goto done;
+			}
+		}
+	}
+	
+	while(changed)
+	{
+		changed = 0;
+		
+		position[0] = 0;
+		for(int i = 0; i < count; i++)
+			position[i + 1] = position[i] + length[i];
+		
+		for(int i = 0; i < count; i++)
+		{
+			if(is_jump((unsigned char)in[start[i]]))
+			{
+				int target = index[start[i] + bytes_to_int(in + start[i] + 1)];
+				int needed = 1 + leb128_size(zigzag(position[target] - position[i]));
+				if(needed > length[i])
+				{
+					length[i] = needed;
+					changed = 1;
+				}
+			}
+		}
+	}
+	
+	*out = (char*)malloc(position[count] > 0 ? position[count] : 1);
+	if(*out == NULL)
+	{
+		result = ENCODING_NO_MEMORY;
+		goto done;
+	}
+	*out_size = position[count];
+	
+	for(int i = 0; i < count; i++)
+	{
+		unsigned char opcode = (unsigned char)in[start[i]];
+		char* code = *out + position[i];
+		int value = get_opcode_from_instruction((char)opcode).parameter_size == 4 ? bytes_to_int(in + start[i] + 1) : 0;
+		
+		if(opcode == Push && length[i] == 1)
+			code[0] = (char)(COMPACT_PUSH_SMALL + COMPACT_PUSH_BIAS + value);
+		else if((opcode == Load || opcode == Store) && length[i] == 1)
+			code[0] = (char)((opcode == Load ? COMPACT_LOAD_SMALL : COMPACT_STORE_SMALL) + (unsigned char)in[start[i] + 1]);
+		else if(opcode == Push)
+		{
+			code[0] = (char)opcode;
+			write_leb128(code + 1, zigzag(value), length[i] - 1);
+		}
+		else if(opcode == Call || opcode == Spawn || opcode == Coroutine || opcode == Outs || opcode == Pushk)
+		{
+			code[0] = (char)opcode;
+			write_leb128(code + 1, (unsigned int)value, length[i] - 1);
+		}
+		else if(is_jump(opcode))
+		{
+			code[0] = (char)opcode;
+			write_leb128(code + 1, zigzag(position[index[start[i] + value]] - position[i]), length[i] - 1);
+		}
+		else
+			memcpy(code, in + start[i], length[i]);
+	}
+	
+done:
+	free(start);
+	free(index);
+	free(length);
+	free(position);
+	return result;
+}
@@ -0,0 +1,55 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+
+//files with this minor version or newer use the compact encoding
+#define DEXE_COMPACT_MINOR_VERSION 0x02
+
+/*
+	The compact encoding keeps every opcode but stores operands as LEB128.
+	Push values and jump offsets are zig-zag encoded first, call, spawn and coroutine
+	ids and constant numbers are unsigned, and Load/Store keep their single byte. Jump offsets are relative
+	to the jump in the compact code. Small immediates get an opcode of their own:
+	
+		0x40 - 0x5F   push -1 .. 30
+		0x60 - 0x6F   load 0 .. 15
+		0x70 - 0x7F   store 0 .. 15
+	
+	Code is always decoded to the fixed form at load, so everything after the
+	parser only ever sees 4 byte operands.
+*/
+#define COMPACT_PUSH_SMALL   0x40
+#define COMPACT_PUSH_BIAS    1
+#define COMPACT_PUSH_COUNT   32
+#define COMPACT_LOAD_SMALL   0x60
+#define COMPACT_STORE_SMALL  0x70
+#define COMPACT_SMALL_COUNT  16
+
+#define ENCODING_OK        0
+#define ENCODING_CORRUPT   1
+#define ENCODING_NO_MEMORY 2
+
+
+extern int decode_compact_code(char*, int, char**, int*);
+extern int encode_compact_code(char*, int, char**, int*);
@@ -24,21 +24,51 @@
 #include "dexe_stack.h"
 #include "dexe_utils.h"
 
+#define FUNCTION_ATTRIBUTE_PURE     0x01
+#define FUNCTION_ATTRIBUTE_VERIFIED 0x02
+#define FUNCTION_ATTRIBUTE_WATCHED  0x04
+#define FUNCTION_ATTRIBUTE_LINKED   0x08 //belongs to a library
+#define FUNCTION_ATTRIBUTE_SHARED   0x10 //its code is the library's read-only copy
+#define FUNCTION_ATTRIBUTE_ARENA    0x20 //its code is in code_arena, see dexe_layout.h
+#define FUNCTION_ATTRIBUTE_PARALLEL 0x40 //a task calling it may run on another thread, see dexe_tasks.h
+#define FUNCTION_ATTRIBUTE_FORKABLE 0x80 //pure and costly enough to run beside the next call, see dexe_registers.h
+
+//everything a call reads, kept small so neighbouring functions share cache lines
 struct Executable_Function_struct
 {
-	char* function_name; //for debug
-	
 	int arg_count;
-	char** arg_names; //for debug
-	
 	int local_count;
-	char** local_names; //for debug
-	
 	int size_of_instructions;
+	int attributes;
+	
 	char* instructions;
+	
+	//the interpreter variant that runs this function
+	int (*run_function)(struct Executable_struct*);
+	
+	//NULL unless it runs in the register interpreter, see dexe_registers.h
+	struct Register_Code_struct* registers;
+	
+	//NULL unless it's native. Calls hand it their arguments in the order they were pushed
+	int (*native)(struct Executable_struct*, long*);
 };
 typedef struct Executable_Function_struct Executable_Function;
 
+//names from the debug symbols. Only printing reads them
+struct Function_Debug_struct
+{
+	char* function_name;
+	char** arg_names;
+	char** local_names;
+};
+typedef struct Function_Debug_struct Function_Debug;
+
+//what a Cmp leaves in a frame's flags
+#define JUMP_NOT_EQUAL 1
+#define JUMP_EQUAL     2
+#define JUMP_GREATER   4
+#define JUMP_LESS      8
+
 struct Stack_Frame_struct
 {
 	int function_id;
@@ -50,6 +80,51 @@ struct Stack_Frame_struct
 };
 typedef struct Stack_Frame_struct Stack_Frame;
 
+//a function this file makes callable by name
+struct Export_struct
+{
+	char* name;
+	int function_id;
+};
+typedef struct Export_struct Export;
+
+//a function this file calls in a library. Calls to it use the id number_of_functions + its index
+struct Import_struct
+{
+	char* library;
+	char* name;
+};
+typedef struct Import_struct Import;
+
+//an entry of the constant pool section, a string or a 4 byte number. Not terminated
+struct Constant_struct
+{
+	int size;
+	char* data;
+};
+typedef struct Constant_struct Constant;
+
+//always collected. Every Executable keeps its own, so threads never share a counter
+struct Metrics_struct
+{
+	unsigned long long instructions; //flushed at every call and return
+	unsigned long long calls;
+	unsigned long long returns;
+	
+	int max_call_depth;
+	int max_operand_depth; //sampled at function entry, return and whenever a report is written
+	
+	unsigned long long loader_bytes;
+	unsigned long long frame_bytes;
+	unsigned long long stack_bytes; //reserved, pages are only committed as they are used
+	
+	//nanoseconds
+	unsigned long long start_time;
+	unsigned long long load_time;
+	unsigned long long execute_start;
+};
+typedef struct Metrics_struct Metrics;
+
 struct Executable_struct
 {
 	struct Dexe_Info_struct* info;
@@ -60,7 +135,50 @@ struct Executable_struct
 	
 	int number_of_functions;
 	Executable_Function* functions;
+	char* code_arena; //NULL until the layout packs the functions' code into it
+	
+	//parallel to functions, NULL without debug symbols. Every name and name array is in debug_pool
+	Function_Debug* debug;
+	char* debug_pool;
+	
+	int number_of_exports;
+	Export* exports;
+	int number_of_imports;
+	Import* imports;
+	
+	//once linked, a library's constants follow this file's and point into the library's pool
+	int number_of_constants;
+	Constant* constants;
+	char* constant_pool;
+	
+	int linked;
 	
 	stack call_stack;
+	stack operand_stack;
+	
+	int variant;
+	
+	Metrics metrics;
+	
+	struct Memo_Cache_struct* memo;
+	struct Profile_struct* profile;
+	struct Counters_struct* counters;
+	struct Debugger_struct* debugger;
+	struct Trace_struct* trace;
+	struct Heap_struct* heap;
+	
+	//NULL unless the program spawns tasks. Each worker thread runs on a copy of the Executable
+	struct Task_Worker_struct* worker;
+	struct Task_Output_struct* output; //where a task that runs out of order writes, NULL for stdout
+	
+	//NULL until the first coroutine. coroutine is the one running, resuming the one about to pick up again
+	struct Coroutine_Pool_struct* coroutines;
+	struct Coroutine_struct* coroutine;
+	struct Coroutine_struct* resuming;
+	
+	struct Snapshot_struct* restoring; //NULL unless -restore, until the last frame is back
+	
+	FILE* input; //what in and ini read. stdin, or the cache's copy of it
+	struct Cache_struct* cache;
 };
 typedef struct Executable_struct Executable;
\ No newline at end of file
@@ -24,11 +24,21 @@
 #include "dexe_stack.h"
 #include "dexe_utils.h"
 #include "dexe_opcodes.h"
-
-#define JUMP_NOT_EQUAL 1
-#define JUMP_EQUAL     2
-#define JUMP_GREATER   4
-#define JUMP_LESS      8
+#include "dexe_memo.h"
+#include "dexe_profile.h"
+#include "dexe_counters.h"
+#include "dexe_debugger.h"
+#include "dexe_trace.h"
+#include "dexe_metrics.h"
+#include "dexe_heap.h"
+#include "dexe_vector.h"
+#include "dexe_registers.h"
+#include "dexe_layout.h"
+#include "dexe_tasks.h"
+#include "dexe_coroutines.h"
+#include "dexe_snapshot.h"
+#include "dexe_native.h"
+#include "dexe_threads.h"
 
 /*
 	TODO: optimize this.
@@ -38,34 +48,609 @@
 
 	Also, calling with Opcode* seems like it produces smaller and hopefully faster code. All it does is a 'lea' instruction
 	while Opcode seems to copy all the contents of the struct into memory and then pushes it. Hopefully another speed improvement
+	
+	Only the checked interpreter variants call this. Verified functions have had their stack sizes proven at load time.
 */
 #if defined(_MSC_VER) || defined(__GNUC__)
-	void /*__fastcall */ /* inline */ test_stack_size(Executable* exe, Opcode* op)
+	void /*__fastcall */ /* inline */ test_stack_size(Executable* exe, stack* stack_ptr, Opcode* op)
 #else
-	void test_stack_size(Executable* exe, Opcode* op)
+	void test_stack_size(Executable* exe, stack* stack_ptr, Opcode* op)
 #endif
 {
-	if(((Stack_Frame*)exe->call_stack.stack_elements[exe->call_stack.stack_pointer-1])->stack.stack_pointer < op->required_stack_size)
-		error(exe, MANIPULATED_EMPTY_STACK, "A(n) '%s' instruction was encountered that requires at least %d item on the stack. Found %d items", op->mnemonic, op->required_stack_size, ((Stack_Frame*)stack_peek(&exe->call_stack))->stack.stack_pointer);
+	if(stack_ptr->stack_pointer < op->required_stack_size)
+		error(exe, MANIPULATED_EMPTY_STACK, "A(n) '%s' instruction was encountered that requires at least %d item on the stack. Found %d items", op->mnemonic, op->required_stack_size, stack_ptr->stack_pointer);
+}
+
+
+/*
+	For ini. Skips whitespace, then reads an optional sign and the digits after it,
+	leaving the byte that ended the number unread. A byte that can't start a number
+	is read and gives 0, so a loop over bad input still moves forward. The end of input gives -1,
+	the same as in. Numbers that don't fit wrap.
+*/
+int read_integer(FILE* file)
+{
+	unsigned int value = 0;
+	int negative = 0;
+	int c;
+	
+	do
+		c = getc(file);
+	while(c == ' ' || c == '\t' || c == '\n' || c == '\r');
+	
+	if(c == EOF)
+		return -1;
+	
+	if(c == '-' || c == '+')
+	{
+		negative = c == '-';
+		c = getc(file);
+	}
+	
+	if(c < '0' || c > '9')
+		return 0;
+	
+	while(c >= '0' && c <= '9')
+	{
+		value = value * 10 + (unsigned int)(c - '0');
+		c = getc(file);
+	}
+	
+	if(c != EOF)
+		ungetc(c, file);
+	
+	return (int)(negative ? 0u - value : value);
 }
 
 
-//prototype
+//prototypes
 void breakpoint(Executable* exe);
 
+
+/*
+	The interpreter variants. Each combination of features gets its own copy of the
+	loop in dexe_interpreter.h. dexe_execute picks one before running anything, and
+	only functions with watchpoints are switched to a watch variant.
+*/
+#define VARIANT_INDEX_CHECKED 0x01
+#define VARIANT_INDEX_DEBUG   0x02
+#define VARIANT_INDEX_PROFILE 0x04
+#define VARIANT_INDEX_TRACE   0x08
+#define VARIANT_INDEX_WATCH   0x10
+
+#define VARIANT_NAME run_verified
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_profile
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_profile
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_profile
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_profile
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_trace
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_trace
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_trace
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_trace
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_profile_trace
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_profile_trace
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 0
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_profile_trace
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_profile_trace
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 0
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_watch
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_watch
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_watch_profile
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_watch_profile
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 0
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_watch_trace
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_watch_trace
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 0
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_verified_debug_watch_profile_trace
+#define VARIANT_CHECKED 0
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+#define VARIANT_NAME run_checked_debug_watch_profile_trace
+#define VARIANT_CHECKED 1
+#define VARIANT_DEBUG 1
+#define VARIANT_WATCH 1
+#define VARIANT_PROFILE 1
+#define VARIANT_TRACE 1
+#include "dexe_interpreter.h"
+#undef VARIANT_NAME
+#undef VARIANT_CHECKED
+#undef VARIANT_DEBUG
+#undef VARIANT_WATCH
+#undef VARIANT_PROFILE
+#undef VARIANT_TRACE
+
+//indexed by VARIANT_INDEX_* flags. Watching always implies debugging
+static int (*interpreter_variants[32])(Executable*) =
+{
+	run_verified,
+	run_checked,
+	run_verified_debug,
+	run_checked_debug,
+	run_verified_profile,
+	run_checked_profile,
+	run_verified_debug_profile,
+	run_checked_debug_profile,
+	run_verified_trace,
+	run_checked_trace,
+	run_verified_debug_trace,
+	run_checked_debug_trace,
+	run_verified_profile_trace,
+	run_checked_profile_trace,
+	run_verified_debug_profile_trace,
+	run_checked_debug_profile_trace,
+	run_verified_debug_watch,
+	run_checked_debug_watch,
+	run_verified_debug_watch,
+	run_checked_debug_watch,
+	run_verified_debug_watch_profile,
+	run_checked_debug_watch_profile,
+	run_verified_debug_watch_profile,
+	run_checked_debug_watch_profile,
+	run_verified_debug_watch_trace,
+	run_checked_debug_watch_trace,
+	run_verified_debug_watch_trace,
+	run_checked_debug_watch_trace,
+	run_verified_debug_watch_profile_trace,
+	run_checked_debug_watch_profile_trace,
+	run_verified_debug_watch_profile_trace,
+	run_checked_debug_watch_profile_trace
+};
+
+
+static int run_entry(Executable* exe, void* context)
+{
+	return exe->restoring != NULL ? snapshot_restore(exe) : dexe_call(exe, exe->entry, NULL);
+}
+
 int dexe_execute(Executable* exe)
 {
-	if(exe->entry < 0 || exe->entry > exe->number_of_functions)
+	if(exe->entry < 0 || exe->entry >= exe->number_of_functions)
 		error(exe, FUNCTION_DOES_NOT_EXIST, "The function specified by the entry point does not exist. There are %d functions. Valid function ids are 0-%d. The value specified by the entry point is: %d", exe->number_of_functions, exe->number_of_functions, exe->entry);
 
+	dexe_prepare(exe);
+	
+	exe->metrics.execute_start = metrics_now();
+	int ret_val = stack_run_guarded(exe, run_entry, NULL);
+	
+	tasks_finish(exe);
+	stack_free(&exe->call_stack);
+	stack_free(&exe->operand_stack);
+
+    return ret_val;
+}
+
+/*
+	Marks the pure functions whose calls average at least the threshold in the
+	profile, for registers_translate to run two of them in a row at once. Returns
+	how many. With one thread the second call would only wait on the first.
+*/
+static int mark_forkable(Executable* exe)
+{
+	int threads = exe->info->threads > 0 ? exe->info->threads : threads_available();
+	int count = 0;
+	Profile* profile;
+	
+	if(threads < 2)
+		return 0;
+	
+	if((profile = profile_read(exe, exe->info->parallel_filename)) == NULL)
+	{
+		warning("could not read the profile '%s', -auto-parallel is off", exe->info->parallel_filename);
+		return 0;
+	}
+	
+	memo_analyze(exe);
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		if(exe->functions[i].attributes & FUNCTION_ATTRIBUTE_PURE && exe->functions[i].native == NULL && profile_call_cost(exe, profile, i) >= exe->info->parallel_threshold)
+		{
+			exe->functions[i].attributes |= FUNCTION_ATTRIBUTE_FORKABLE;
+			count++;
+		}
+	}
+	
+	profile_destroy(profile);
+	return count;
+}
+
+//everything that has to happen once before the first function runs
+void dexe_prepare(Executable* exe)
+{
+	//before the layout moves the pcs the profile counts call sites by
+	int forks = exe->info->commandline & COMMANDLINE_AUTO_PARALLEL ? mark_forkable(exe) : 0;
+	
+	//the code goes in one arena, laid out by a profile if there is one
+	Profile* layout = NULL;
+	int* order = (int*)malloc((exe->number_of_functions + 1) * sizeof(int));
+	if(order == NULL)
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the layout of the code");
+	
+	if(exe->info->layout_filename != NULL && (layout = profile_read(exe, exe->info->layout_filename)) == NULL)
+		warning("could not read the profile '%s', -layout is off", exe->info->layout_filename);
+	
+	layout_order(exe, layout, order);
+	
+	//moving blocks moves pcs, and breakpoints, traces, profiles and snapshots are all given in pcs
+	for(int i = 0; i < exe->number_of_functions && layout != NULL && !(exe->info->commandline & (COMMANDLINE_DEBUG | COMMANDLINE_PROFILE | COMMANDLINE_TRACE | COMMANDLINE_SNAPSHOT | COMMANDLINE_RESTORE)); i++)
+		layout_blocks(exe, i, &layout->functions[i]);
+	
+	layout_arena(exe, order);
+	free(order);
+	profile_destroy(layout);
+	
+	//breakpoints go in before the purity analysis, so functions with one are never memoized
+	if(exe->info->commandline & COMMANDLINE_DEBUG)
+	{
+		if(debugger_init(exe))
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the debugger");
 		
-	stack_init(&exe->call_stack);
+		for(int i = 0; i < exe->info->number_of_breakpoint_specs; i++)
+			debugger_add_breakpoint(exe, exe->info->breakpoint_specs[i]);
+	}
+	
+	if(exe->info->commandline & COMMANDLINE_MEMOIZE && memo_init(exe))
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the memoization cache");
+	
+	if(exe->info->commandline & COMMANDLINE_PROFILE && profile_init(exe))
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the profile counters");
+	
+	if(exe->info->commandline & COMMANDLINE_COUNTERS && counters_init(exe))
+		error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the performance counters");
+	
+	if(exe->info->commandline & COMMANDLINE_TRACE && trace_init(exe, exe->info->trace_filename, exe->info->trace_size, exe->info->commandline & COMMANDLINE_TRACE_TOP))
+		error(exe, FILE_ERROR, "Could not create the trace file '%s'", exe->info->trace_filename);
+	
+	if(heap_needed(exe))
+	{
+		if(heap_init(exe))
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not reserve the heap");
+		vector_init();
+	}
+	
+	//pick the interpreter once. Checks are only dropped when every function verified
+	exe->variant = 0;
+	for(int i = 0; i < exe->number_of_functions; i++)
+		if(!(exe->functions[i].attributes & FUNCTION_ATTRIBUTE_VERIFIED))
+			exe->variant |= VARIANT_INDEX_CHECKED;
+	if(exe->info->commandline & COMMANDLINE_DEBUG)
+		exe->variant |= VARIANT_INDEX_DEBUG;
+	if(exe->profile != NULL)
+		exe->variant |= VARIANT_INDEX_PROFILE;
+	if(exe->trace != NULL)
+		exe->variant |= VARIANT_INDEX_TRACE;
 	
+	//the plain verified interpreter can be replaced by the register form. Snapshots are of stack frames
+	for(int i = 0; i < exe->number_of_functions && exe->variant == 0 && !(exe->info->commandline & (COMMANDLINE_NO_REGISTERS | COMMANDLINE_SNAPSHOT)); i++)
+		registers_translate(exe, i);
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+		dexe_select_variant(exe, i);
+	
+	for(int i = 0; i < exe->info->number_of_watchpoint_specs && exe->debugger != NULL; i++)
+		debugger_add_watchpoint(exe, exe->info->watchpoint_specs[i], -1);
+		
+	stack_install_guard_handler(exe, 0);
+	
+	if(stack_init(&exe->call_stack) || stack_init(&exe->operand_stack))
+		error(exe, ALLOCATION_ERROR_IN_STACK, "Could not reserve %lu bytes of address space for the stacks", (unsigned long)STACK_RESERVE_SIZE);
+	exe->metrics.stack_bytes = 2 * (unsigned long long)STACK_RESERVE_SIZE;
+	
+	//the workers copy the Executable, so they come last. Debugging, profiling, tracing and counting keep to one thread
+	if(tasks_needed(exe) || forks)
+	{
+		int threads = exe->variant & ~VARIANT_INDEX_CHECKED || exe->counters != NULL ? 1 : exe->info->threads > 0 ? exe->info->threads : threads_available();
+		
+		if(tasks_init(exe, threads))
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate the task workers");
+	}
+}
+
+//runs one function from the bottom of the stacks. args are in the order a caller pushes them, NULL for all 0
+int dexe_call(Executable* exe, int function_id, int* args)
+{
 	Stack_Frame sf;
-	sf.function_id = exe->entry;
+	sf.function_id = function_id;
 	sf.pc = 0;
 	sf.flags = 0;
-	stack_init(&sf.stack);
+	
+	for(int i = 0; i < exe->functions[function_id].arg_count; i++)
+		stack_push(&exe->operand_stack, args != NULL ? args[i] : 0);
+	stack_window(&exe->operand_stack, &sf.stack, exe->functions[function_id].arg_count);
 	
 	stack_push(&exe->call_stack, (long)&sf);
 	
@@ -73,364 +658,44 @@ int dexe_execute(Executable* exe)
 		
 	stack_pop(&exe->call_stack);
 	
-	stack_free(&exe->call_stack);
-
-    return ret_val;
+	//what the call spawned and never joined finishes before it counts as returned
+	if(exe->worker != NULL)
+		tasks_sync(exe, exe->call_stack.stack_pointer, exe->operand_stack.stack_elements + exe->operand_stack.stack_pointer, exe->operand_stack.length - exe->operand_stack.stack_pointer);
+	
+	return ret_val;
 }
 
 int dexe_run_function(Executable* exe)
 {
-	//set up the stack frame
-	Stack_Frame* sf = (Stack_Frame*)stack_peek(&exe->call_stack);
-	
-	if (exe->functions[sf->function_id].local_count != 0)
-	{
-		sf->local_memory = (int*)malloc(exe->functions[sf->function_id].local_count * sizeof(int));
+	return exe->functions[((Stack_Frame*)stack_peek(&exe->call_stack))->function_id].run_function(exe);
+}
 
-		if (!sf->local_memory)
-			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %d bytes of memory for locals", exe->functions[sf->function_id].local_count * sizeof(int));
-		
-		memset(sf->local_memory,'\0',exe->functions[sf->function_id].local_count * sizeof(int));
-	}
-	else
-		sf->local_memory = NULL;
+static int function_variant(Executable* exe, int function_id)
+{
+	if(exe->functions[function_id].attributes & FUNCTION_ATTRIBUTE_WATCHED)
+		return exe->variant | VARIANT_INDEX_WATCH | VARIANT_INDEX_DEBUG;
+	return exe->variant;
+}
 
-	//additional variables for the sake of increasing readability (and hopefully, optimization purposes)
-	char* code_ptr = exe->functions[sf->function_id].instructions;
-	int size = exe->functions[sf->function_id].size_of_instructions;
-	stack* stack_ptr = &sf->stack;
+//the same, but never in the register form. Restored frames are always stack frames
+int dexe_run_stack_function(Executable* exe)
+{
+	return interpreter_variants[function_variant(exe, ((Stack_Frame*)stack_peek(&exe->call_stack))->function_id)](exe);
+}
 
+void dexe_select_variant(Executable* exe, int function_id)
+{
+	int variant = function_variant(exe, function_id);
 	
-	for(sf->pc = 0; sf->pc < size; sf->pc++)
-	{
-		unsigned char opcode = code_ptr[sf->pc];
-		
-		switch(opcode)
-		{
-			case Nop:
-			{
-				//do nothing by definition
-				break;
-			}
-			case Break:
-			{
-				if(exe->flags & DEXE_FLAGS_DEBUG && exe->info->commandline & COMMANDLINE_DEBUG)
-					breakpoint(exe);
-			}
-			case Load:
-			{
-				sf->pc++;
-				if(opcode > exe->functions[sf->function_id].local_count)
-					error(exe, VARIABLE_INDEX_OUT_OF_RANGE, "Index recieved: %d. This occured in function %d.",opcode, sf->function_id);
-					
-				stack_push(stack_ptr, sf->local_memory[(unsigned char)opcode]);
-				
-				break;
-			}
-			case Push:
-			{
-				sf->pc++;
-				if(sf->pc < size - 4)
-					error(exe, ABRUPT_END_OF_FUNCTION, "Ran out of executable code while attempting to push a literal onto the stack.");
-				
-				stack_push(stack_ptr, bytes_to_int((char*)(code_ptr + sf->pc)));
-				
-				break;
-			}
-			case Store:
-			{
-				sf->pc++;
-				if(opcode > exe->functions[sf->function_id].local_count)
-					error(exe, VARIABLE_INDEX_OUT_OF_RANGE, "Index recieved: %d. This occured in function %d.",opcode, sf->function_id);
-				if(stack_ptr->stack_pointer < 1)
-					error(exe, MANIPULATED_EMPTY_STACK, "A store instruction was encountered that requires at least 1 item on the stack. Found %d items", stack_ptr->stack_pointer);
-			
-				sf->local_memory[opcode] = stack_pop(stack_ptr);
-				
-				break;
-			}
-			case Dup:
-			{
-				test_stack_size(exe, &DUP);
-
-				stack_push(stack_ptr, stack_peek(stack_ptr));
-				
-				break;
-			}
-			case Pop:
-			{
-				test_stack_size(exe, &POP);
-
-				stack_pop(stack_ptr);
-				
-				break;
-			}
-			case Inc:
-			{
-				test_stack_size(exe, &INC);
-				
-				stack_push(stack_ptr,stack_pop(stack_ptr)+1);
-				
-				break;
-			}
-			case Dec:
-			{
-				test_stack_size(exe, &DEC);
-				
-				stack_push(stack_ptr,stack_pop(stack_ptr)-1);
-				
-				break;
-			}
-			case Add:
-			{
-				test_stack_size(exe, &ADD);
-				
-				stack_push(stack_ptr, stack_pop(stack_ptr) + stack_pop(stack_ptr));
-				
-				break;
-			}
-			case Sub:
-			{
-				test_stack_size(exe, &SUB);
-				
-				register int value1 = stack_pop(stack_ptr);
-				register int value2 = stack_pop(stack_ptr);
-				stack_push(stack_ptr, value2 - value1);
-				
-				break;
-			}
-			case Mul:
-			{
-				test_stack_size(exe, &MUL);
-				
-				stack_push(stack_ptr, stack_pop(stack_ptr) * stack_pop(stack_ptr));
-				
-				break;
-			}
-			case Div:
-			{
-				test_stack_size(exe, &DIV);
-				
-				register int value1 = stack_pop(stack_ptr);
-				register int value2 = stack_pop(stack_ptr);
-				if(value2 == 0)
-					error(exe,DIVISION_BY_ZERO, "A division by zero was encountered while trying to divide %d by %d", value2, value1);
-				
-				stack_push(stack_ptr, value2 / value1);
-				
-				break;
-			}
-			case Rem:
-			{
-				test_stack_size(exe, &REM);
-				
-				register int value1 = stack_pop(stack_ptr);
-				register int value2 = stack_pop(stack_ptr);
-				if(value2 == 0)
-					error(exe,DIVISION_BY_ZERO, "A division by zero was encountered trying to divide %d by %d", value2, value1);
-				
-				stack_push(stack_ptr, value2 % value1);
-				
-				break;
-			}
-			case And:
-			{
-				test_stack_size(exe, &AND);
-				
-				stack_push(stack_ptr, stack_pop(stack_ptr) & stack_pop(stack_ptr));
-				
-				break;
-			}
-			case Or:
-			{
-				test_stack_size(exe, &OR);
-				
-				stack_push(stack_ptr, stack_pop(stack_ptr) | stack_pop(stack_ptr));
-				
-				break;
-			}
-			case Xor:
-			{
-				test_stack_size(exe, &XOR);
-				
-				stack_push(stack_ptr, stack_pop(stack_ptr) ^ stack_pop(stack_ptr));
-				
-				break;
-			}
-			case Not:
-			{
-				test_stack_size(exe, &NOT);
-				
-				stack_push(stack_ptr, ~stack_peek(stack_ptr));
-				
-				break;
-			}
-			case Neg:
-			{
-				test_stack_size(exe, &NEG);
-				
-				stack_push(stack_ptr, -stack_peek(stack_ptr));
-				
-				break;
-			}
-			case Shl:
-			{
-				test_stack_size(exe, &SHL);
-				
-				register int value1 = stack_pop(stack_ptr);
-				register int value2 = stack_pop(stack_ptr);
-				
-				stack_push(stack_ptr, value2 << value1);
-				
-				break;
-			}
-			case Shr:
-			{
-				test_stack_size(exe, &SHR);
-				
-				register int value1 = stack_pop(stack_ptr);
-				register int value2 = stack_pop(stack_ptr);
-				
-				stack_push(stack_ptr, value2 >> value1);
-				
-				break;
-			}
-			case Cmp:
-			{
-				test_stack_size(exe, &CMP);
-				
-				register int value1 = stack_pop(stack_ptr);
-				register int value2 = stack_pop(stack_ptr);
-
-				sf->flags = (value1 == value2 ? JUMP_EQUAL : JUMP_NOT_EQUAL) |
-					(value2 > value1 ? JUMP_GREATER : 0) |
-					(value2 < value1 ? JUMP_LESS : 0);
-					
-				break;
-			}
-			case Jmp:
-			{
-				sf->pc += bytes_to_int(code_ptr + sf->pc + 1);
-				if(sf->pc < 0 || sf->pc > size)
-					error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				break;
-			}
-			case Je:
-			{
-				if (sf->flags & JUMP_EQUAL)
-				{
-					sf->pc += code_ptr[sf->pc + 1];
-					if(sf->pc < 0 || sf->pc > size)
-						error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				}
-				break;
-			}
-			case Jne:
-			{
-				if (sf->flags & JUMP_NOT_EQUAL)
-				{
-					sf->pc += code_ptr[sf->pc + 1];
-					if(sf->pc < 0 || sf->pc > size)
-						error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				}
-				break;
-			}
-			case Jg:
-			{
-				if(sf->flags & JUMP_GREATER)
-				{
-					sf->pc += code_ptr[sf->pc + 1];
-					if(sf->pc < 0 || sf->pc > size)
-						error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				}
-				break;
-			}
-			case Jge:
-			{
-				if(sf->flags & (JUMP_GREATER | JUMP_EQUAL))
-				{
-					sf->pc += code_ptr[sf->pc + 1];
-					if(sf->pc < 0 || sf->pc > size)
-						error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				}
-				break;
-			}
-			case Jl:
-			{
-				if(sf->flags & JUMP_LESS)
-				{
-					sf->pc += code_ptr[sf->pc + 1];
-					if(sf->pc < 0 || sf->pc > size)
-						error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				}
-				break;
-			}
-			case Jle:
-			{
-				if(sf->flags & (JUMP_LESS | JUMP_EQUAL))
-				{
-					sf->pc += code_ptr[sf->pc + 1];
-					if(sf->pc < 0 || sf->pc > size)
-						error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc);
-				}
-				break;
-			}
-			case In:
-			{
-				stack_push(stack_ptr, getc(stdin));
-				
-				break;
-			}
-			case Out:
-			{
-				test_stack_size(exe, &OUT);
-				
-				putc(stack_pop(stack_ptr), stdout);
-				
-				break;
-			}
-			case Call:
-			{
-				Stack_Frame frame;
-				frame.function_id = bytes_to_int(code_ptr + sf->pc + 1);
-				frame.pc = 0;
-				frame.flags = 0;
-				
-				if(frame.function_id < 0 || frame.function_id > exe->number_of_functions)
-					error(exe, FUNCTION_DOES_NOT_EXIST, "The function specified by a call does not exist. There are %d functions. Valid function ids are 0-%d. The value specified by the entry point is: %d", exe->number_of_functions, exe->number_of_functions, frame.function_id);
-
-				if(stack_ptr->stack_pointer < exe->functions[frame.function_id].arg_count)
-					error(exe, NOT_ENOUGH_ARGUMENTS, "Arguments required %d. Recieved %d", exe->functions[frame.function_id].arg_count, stack_ptr->stack_pointer + 1);
-					
-				stack_init(&frame.stack);
-				for(int x = 0; x < exe->functions[frame.function_id].arg_count; x++)
-					stack_push(&frame.stack, stack_pop(stack_ptr));
-				
-				stack_push(&exe->call_stack, (long)&frame);
-				
-				stack_push(stack_ptr, dexe_run_function(exe));
-				
-				stack_pop(&exe->call_stack);
-							
-				sf->pc += 4;
-				
-				break;
-			}
-			case Ret:
-			{
-				//Is there anything remaining on the stack? That's our return value. If not, maybe this is a void function? return 0
-				int ret_value = stack_ptr->stack_pointer < 1 ? 0 : stack_pop(stack_ptr);
-				stack_free(stack_ptr);
-				free(sf->local_memory);
-				
-				return ret_value;
-			}
-			default:
-				error(exe, INVALID_OPCODE, "Invalid opcode recieved: 0x%X", opcode);
-		}
-	}
+	if(exe->functions[function_id].native != NULL)
+		exe->functions[function_id].run_function = native_run;
+	else if(variant == 0 && exe->functions[function_id].registers != NULL)
+		exe->functions[function_id].run_function = registers_run;
+	else
+		exe->functions[function_id].run_function = interpreter_variants[variant];
 	
-	error(exe, ABRUPT_END_OF_FUNCTION, "This occured in function %d", sf->function_id);
+	if(exe->counters != NULL)
+		counters_wrap(exe, function_id);
 }
 
 
@@ -439,14 +704,25 @@ void breakpoint(Executable* exe)
 	Stack_Frame* sf = (Stack_Frame*)stack_peek(&exe->call_stack);
 	int locals = exe->functions[sf->function_id].local_count;
 	int exit = 0;
-	int debug = exe->info->commandline & COMMANDLINE_DEBUG;
+	int debug = exe->flags & DEXE_FLAGS_DEBUG;
+	char line[256];
 	
 	puts("\nDebugger) [e - examine all memory] [s - stack] [d - call stack] [c - continue]");
+	puts("          [b <function>[:<pc>][,<condition>] - set breakpoint] [r <function>:<pc> - remove breakpoint]");
+	puts("          [w [<function>:]<local> - watch local] [l - list breakpoints and watchpoints]");
 	do
 	{
 		
 		printf("\nDebugger) ");
-		switch(getc(stdin))
+		if(fgets(line, sizeof(line), stdin) == NULL)
+			break;
+		line[strcspn(line, "\r\n")] = '\0';
+		
+		char* argument = line + 1;
+		while(*argument == ' ')
+			argument++;
+		
+		switch(line[0])
 		{
 			case 'e':
 			case 'E':
@@ -457,7 +733,7 @@ void breakpoint(Executable* exe)
 				for(int i = 0; i < locals; i++)
 				{
 					if(debug)
-						printf("%3d) [%-10s] %-10d\n", i, exe->functions[sf->function_id].local_names[i],sf->local_memory[i]);
+						printf("%3d) [%-10s] %-10d\n", i, exe->debug[sf->function_id].local_names[i],sf->local_memory[i]);
 					else
 						printf("%3d) %-10d\n",i, sf->local_memory[i]);
 				}
@@ -483,17 +759,36 @@ void breakpoint(Executable* exe)
 				for(int i = exe->call_stack.stack_pointer -1; i >= 0; i--)
 				{
 					if(debug)
-						printf("  %s @ %d\n", exe->functions[((Stack_Frame*)exe->call_stack.stack_elements[i])->function_id].function_name, ((Stack_Frame*)exe->call_stack.stack_elements[i])->pc);
+						printf("  %s @ %d\n", exe->debug[((Stack_Frame*)exe->call_stack.stack_elements[i])->function_id].function_name, ((Stack_Frame*)exe->call_stack.stack_elements[i])->pc);
 					else
 						printf("  %d @ %d\n", ((Stack_Frame*)exe->call_stack.stack_elements[i])->function_id, ((Stack_Frame*)exe->call_stack.stack_elements[i])->pc);
 				}
 				break;
+			
+			case 'b':
+			case 'B':
+				debugger_add_breakpoint(exe, argument);
+				break;
+			
+			case 'r':
+			case 'R':
+				debugger_remove_breakpoint(exe, argument);
+				break;
+			
+			case 'w':
+			case 'W':
+				//a watch on a running function takes effect from its next call
+				debugger_add_watchpoint(exe, argument, sf->function_id);
+				break;
+			
+			case 'l':
+			case 'L':
+				debugger_list(exe);
+				break;
 
 			default:
 				puts("Unknown option");
 				break;
 		}
-		//flush the stream
-		while(getc(stdin) != '\n');
 	} while(!exit);
-}
\ No newline at end of file
+}
@@ -27,5 +27,12 @@
 #include "dexe_stack.h"
 
 extern int dexe_execute(Executable*);
+extern void dexe_prepare(Executable*);
+extern int dexe_call(Executable*, int, int*);
 
-extern int dexe_run_function(Executable*);
\ No newline at end of file
+extern int dexe_run_function(Executable*);
+extern int dexe_run_stack_function(Executable*);
+extern void dexe_select_variant(Executable*, int);
+
+extern void breakpoint(Executable*);
+extern int read_integer(FILE*);
\ No newline at end of file
@@ -0,0 +1,184 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_stack.h"
+#include "dexe_heap.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+	#include <sys/mman.h>
+	
+	#ifndef MAP_ANONYMOUS
+		#define MAP_ANONYMOUS MAP_ANON
+	#endif
+	#ifndef MAP_NORESERVE
+		#define MAP_NORESERVE 0
+	#endif
+#endif
+
+static size_t page_words()
+{
+	#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize / sizeof(int);
+	#else
+		return (size_t)sysconf(_SC_PAGESIZE) / sizeof(int);
+	#endif
+}
+
+//only programs that use the heap pay for the reservation
+int heap_needed(Executable* exe)
+{
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		Executable_Function* function = &exe->functions[i];
+		
+		for(int pc = 0; pc < function->size_of_instructions;)
+		{
+			unsigned char opcode = (unsigned char)function->instructions[pc];
+			
+			if(IS_HEAP_OPCODE(opcode))
+				return 1;
+			
+			pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction((char)opcode).parameter_size : 0);
+		}
+	}
+	
+	return 0;
+}
+
+int heap_init(Executable* exe)
+{
+	size_t size = HEAP_RESERVE_WORDS * sizeof(int);
+	Heap* heap = (Heap*)calloc(1, sizeof(Heap));
+	
+	if(heap == NULL)
+		return 1;
+	
+	#ifdef _WIN32
+		heap->memory = (int*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+		if(heap->memory == NULL)
+		{
+			free(heap);
+			return 1;
+		}
+	#else
+		heap->memory = (int*)mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(heap->memory == (int*)MAP_FAILED)
+		{
+			free(heap);
+			return 1;
+		}
+	#endif
+	
+	stack_guard_heap((char*)heap->memory, size);
+	exe->heap = heap;
+	return 0;
+}
+
+void heap_free(Executable* exe)
+{
+	if(exe->heap == NULL)
+		return;
+	
+	stack_guard_heap(NULL, 0);
+	
+	#ifdef _WIN32
+		VirtualFree(exe->heap->memory, 0, MEM_RELEASE);
+	#else
+		munmap(exe->heap->memory, HEAP_RESERVE_WORDS * sizeof(int));
+	#endif
+	
+	free(exe->heap);
+	exe->heap = NULL;
+}
+
+/*
+	Pages past the top are given back when the heap shrinks, so new pages always
+	read as zeroes and only what was committed before has to be cleared.
+*/
+int heap_alloc(Executable* exe, int count)
+{
+	Heap* heap = exe->heap;
+	unsigned int address = heap->top;
+	size_t end = (size_t)address + (size_t)count;
+	
+	if(count < 0)
+		error(exe, HEAP_EXHAUSTED, "Tried to allocate %d ints", count);
+	if(end > HEAP_RESERVE_WORDS - 1)
+		error(exe, HEAP_EXHAUSTED, "Tried to allocate %d ints with %u in use. The heap holds at most %lu", count, heap->top, (unsigned long)(HEAP_RESERVE_WORDS - 1));
+	
+	if(end > heap->committed)
+	{
+		size_t page = page_words();
+		size_t committed = (end + page - 1) / page * page;
+		
+		#ifdef _WIN32
+			if(VirtualAlloc(heap->memory + heap->committed, (committed - heap->committed) * sizeof(int), MEM_COMMIT, PAGE_READWRITE) == NULL)
+		#else
+			if(mprotect(heap->memory + heap->committed, (committed - heap->committed) * sizeof(int), PROT_READ | PROT_WRITE))
+		#endif
+				error(exe, HEAP_EXHAUSTED, "Could not commit %lu bytes for the heap", (unsigned long)((committed - heap->committed) * sizeof(int)));
+		
+		memset(heap->memory + address, 0, (heap->committed - address) * sizeof(int));
+		heap->committed = (unsigned int)committed;
+	}
+	else
+		memset(heap->memory + address, 0, (size_t)count * sizeof(int));
+	
+	heap->top = (unsigned int)end;
+	return (int)address;
+}
+
+void heap_reset(Executable* exe, int address)
+{
+	Heap* heap = exe->heap;
+	size_t page = page_words();
+	size_t committed;
+	
+	if(address < 0 || (unsigned int)address > heap->top)
+		error(exe, HEAP_INDEX_OUT_OF_RANGE, "Reset to %d, but only %u ints are in use", address, heap->top);
+	
+	heap->top = (unsigned int)address;
+	
+	committed = (heap->top + page - 1) / page * page;
+	if(committed < heap->committed)
+	{
+		#ifdef _WIN32
+			VirtualFree(heap->memory + committed, (heap->committed - committed) * sizeof(int), MEM_DECOMMIT);
+		#else
+			madvise(heap->memory + committed, (heap->committed - committed) * sizeof(int), MADV_DONTNEED);
+			mprotect(heap->memory + committed, (heap->committed - committed) * sizeof(int), PROT_NONE);
+		#endif
+		heap->committed = (unsigned int)committed;
+	}
+}
@@ -0,0 +1,59 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include <stdint.h>
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	The heap is one linear array of ints. alloc hands out the next n of them and
+	reset gives back everything from an address on, so it's an arena: a function
+	can take "alloc 0" as a mark and reset to it when it's done.
+	
+	On 64 bit hosts the reservation covers every address an int can hold, so the
+	heap grows in place, and only the pages up to the top of the heap are
+	accessible. Every variant still checks each access against the top: the
+	pages only protect to the page, and what a program gets must not depend on
+	which interpreter runs it.
+*/
+#if UINTPTR_MAX > 0xFFFFFFFFu
+	#define HEAP_RESERVE_WORDS ((size_t)1 << 32)
+#else
+	#define HEAP_RESERVE_WORDS ((size_t)64 << 20)
+#endif
+
+struct Heap_struct
+{
+	int* memory;
+	unsigned int top;       //ints in use
+	unsigned int committed; //ints accessible, a whole number of pages
+};
+typedef struct Heap_struct Heap;
+
+
+extern int heap_needed(Executable*);
+extern int heap_init(Executable*);
+extern void heap_free(Executable*);
+
+extern int heap_alloc(Executable*, int);
+extern void heap_reset(Executable*, int);
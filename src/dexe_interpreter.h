@@ -0,0 +1,770 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+/*
+	The interpreter loop. This file is a template: dexe_executer.c includes it once
+	per interpreter variant, so there is deliberately no include guard. Before each
+	inclusion it defines
+	
+		VARIANT_NAME     the name of the function to generate
+		VARIANT_CHECKED  1 to check operands and stack sizes at runtime, 0 when the
+		                 verifier has already proven them
+		VARIANT_DEBUG    1 to honour Break instructions and breakpoints
+		VARIANT_WATCH    1 to report Stores to watched locals (needs VARIANT_DEBUG)
+		VARIANT_PROFILE  1 to count calls, instructions and branches per function
+		VARIANT_TRACE    1 to record every instruction in the trace
+	
+	Everything that is switched off compiles away entirely, while all variants
+	share this one definition of what each opcode does.
+*/
+
+#if VARIANT_CHECKED
+	#define CHECK_STACK(op) test_stack_size(exe, stack_ptr, &op)
+	#define CHECK_JUMP() \
+		if(sf->pc < 0 || sf->pc > size) \
+			error(exe, INVALID_JUMP_POSITION, "Range expected: 0 - %d. Recieved %d", size, sf->pc)
+	#define CHECK_CONSTANT(constant, bytes) \
+		if(constant < 0 || constant >= exe->number_of_constants || (bytes >= 0 && exe->constants[constant].size != bytes)) \
+			error(exe, CONSTANT_DOES_NOT_EXIST, "Constant %d of the %d in the pool, %d bytes wanted", constant, exe->number_of_constants, bytes)
+#else
+	#define CHECK_STACK(op)
+	#define CHECK_JUMP()
+	#define CHECK_CONSTANT(constant, bytes)
+#endif
+
+//every variant checks, the verifier can't know the addresses. Past the top but within its page wouldn't fault
+#define CHECK_HEAP(address) \
+	if((unsigned int)(address) >= exe->heap->top) \
+		error(exe, HEAP_INDEX_OUT_OF_RANGE, "Address %d is outside of the heap's %u ints", address, exe->heap->top)
+
+#if VARIANT_PROFILE
+	#define PROFILE_BRANCH(taken) exe->profile->functions[sf->function_id].branches[2 * sf->pc + !(taken)]++
+#else
+	#define PROFILE_BRANCH(taken)
+#endif
+
+//instructions are counted in a local and only added to the totals at calls and returns
+#if VARIANT_PROFILE
+	#define FLUSH_EXECUTED() \
+		exe->metrics.instructions += executed; \
+		exe->profile->functions[sf->function_id].instructions += executed; \
+		executed = 0
+#else
+	#define FLUSH_EXECUTED() \
+		exe->metrics.instructions += executed; \
+		executed = 0
+#endif
+
+#define SAMPLE_OPERAND_DEPTH() \
+	if(stack_ptr->stack_elements + stack_ptr->stack_pointer - exe->operand_stack.stack_elements > exe->metrics.max_operand_depth) \
+		exe->metrics.max_operand_depth = (int)(stack_ptr->stack_elements + stack_ptr->stack_pointer - exe->operand_stack.stack_elements)
+
+//conditional jumps skip their operand when they aren't taken
+#define JUMP_IF(condition) \
+	if(condition) \
+	{ \
+		PROFILE_BRANCH(1); \
+		sf->pc += bytes_to_int(code_ptr + sf->pc + 1); \
+		CHECK_JUMP(); \
+		sf->pc--; \
+	} \
+	else \
+	{ \
+		PROFILE_BRANCH(0); \
+		sf->pc += 4; \
+	}
+
+
+static int VARIANT_NAME(Executable* exe)
+{
+	//set up the stack frame
+	Stack_Frame* sf = (Stack_Frame*)stack_peek(&exe->call_stack);
+	int start = 0;
+	
+	//a resumed coroutine already has its locals, and carries on after its yield
+	if(exe->resuming != NULL)
+	{
+		long value;
+		start = coroutine_enter(exe, sf, &value);
+		stack_push(&sf->stack, value);
+	}
+	else if(exe->restoring != NULL)
+		start = snapshot_enter(exe, sf);
+	else if (exe->functions[sf->function_id].local_count != 0)
+	{
+		sf->local_memory = (int*)malloc(exe->functions[sf->function_id].local_count * sizeof(int));
+
+		if (!sf->local_memory)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %d bytes of memory for locals", exe->functions[sf->function_id].local_count * sizeof(int));
+		exe->metrics.frame_bytes += exe->functions[sf->function_id].local_count * sizeof(int);
+		
+		memset(sf->local_memory,'\0',exe->functions[sf->function_id].local_count * sizeof(int));
+	}
+	else
+		sf->local_memory = NULL;
+
+	//additional variables for the sake of increasing readability (and hopefully, optimization purposes)
+	char* code_ptr = exe->functions[sf->function_id].instructions;
+	int size = exe->functions[sf->function_id].size_of_instructions;
+	stack* stack_ptr = &sf->stack;
+	int* heap_memory = exe->heap != NULL ? exe->heap->memory : NULL;
+	
+	unsigned long executed = 0;
+	exe->metrics.calls++;
+	if(exe->call_stack.stack_pointer > exe->metrics.max_call_depth)
+		exe->metrics.max_call_depth = exe->call_stack.stack_pointer;
+	SAMPLE_OPERAND_DEPTH();
+	
+#if VARIANT_PROFILE
+	exe->profile->functions[sf->function_id].calls++;
+#endif
+
+	
+	for(sf->pc = start; sf->pc < size; sf->pc++)
+	{
+		unsigned char opcode = code_ptr[sf->pc];
+		
+		executed++;
+#if VARIANT_PROFILE
+		exe->profile->functions[sf->function_id].classes[opcode_classes[opcode]]++;
+#endif
+#if VARIANT_TRACE
+		trace_record(exe->trace, sf->function_id, sf->pc, opcode, stack_ptr);
+#endif
+		
+#if VARIANT_DEBUG
+	dispatch:
+#endif
+		switch(opcode)
+		{
+			case Nop:
+			{
+				//do nothing by definition
+				break;
+			}
+			case Break:
+			{
+#if VARIANT_DEBUG
+				if(exe->flags & DEXE_FLAGS_DEBUG)
+					breakpoint(exe);
+#endif
+				break;
+			}
+			case Load:
+			{
+				unsigned char index = code_ptr[++sf->pc];
+#if VARIANT_CHECKED
+				if(index >= exe->functions[sf->function_id].local_count)
+					error(exe, VARIABLE_INDEX_OUT_OF_RANGE, "Index recieved: %d. This occured in function %d.",index, sf->function_id);
+#endif
+					
+				stack_push(stack_ptr, sf->local_memory[index]);
+				
+				break;
+			}
+			case Push:
+			{
+#if VARIANT_CHECKED
+				if(sf->pc + 4 >= size)
+					error(exe, ABRUPT_END_OF_FUNCTION, "Ran out of executable code while attempting to push a literal onto the stack.");
+#endif
+				
+				stack_push(stack_ptr, bytes_to_int(code_ptr + sf->pc + 1));
+				sf->pc += 4;
+				
+				break;
+			}
+			case Store:
+			{
+				unsigned char index = code_ptr[++sf->pc];
+#if VARIANT_CHECKED
+				if(index >= exe->functions[sf->function_id].local_count)
+					error(exe, VARIABLE_INDEX_OUT_OF_RANGE, "Index recieved: %d. This occured in function %d.",index, sf->function_id);
+#endif
+				CHECK_STACK(STORE);
+			
+#if VARIANT_WATCH
+				int old_value = sf->local_memory[index];
+				sf->local_memory[index] = (int)stack_pop(stack_ptr);
+				debugger_watch(exe, sf, index, old_value);
+#else
+				sf->local_memory[index] = (int)stack_pop(stack_ptr);
+#endif
+				
+				break;
+			}
+			case Dup:
+			{
+				CHECK_STACK(DUP);
+
+				stack_push(stack_ptr, stack_peek(stack_ptr));
+				
+				break;
+			}
+			case Pop:
+			{
+				CHECK_STACK(POP);
+
+				stack_pop(stack_ptr);
+				
+				break;
+			}
+			case Inc:
+			{
+				CHECK_STACK(INC);
+				
+				stack_push(stack_ptr, (int)((unsigned int)stack_pop(stack_ptr) + 1));
+				
+				break;
+			}
+			case Dec:
+			{
+				CHECK_STACK(DEC);
+				
+				stack_push(stack_ptr, (int)((unsigned int)stack_pop(stack_ptr) - 1));
+				
+				break;
+			}
+			case Add:
+			{
+				CHECK_STACK(ADD);
+				
+				register unsigned int value1 = (unsigned int)stack_pop(stack_ptr);
+				register unsigned int value2 = (unsigned int)stack_pop(stack_ptr);
+				stack_push(stack_ptr, (int)(value2 + value1));
+				
+				break;
+			}
+			case Sub:
+			{
+				CHECK_STACK(SUB);
+				
+				register unsigned int value1 = (unsigned int)stack_pop(stack_ptr);
+				register unsigned int value2 = (unsigned int)stack_pop(stack_ptr);
+				stack_push(stack_ptr, (int)(value2 - value1));
+				
+				break;
+			}
+			case Mul:
+			{
+				CHECK_STACK(MUL);
+				
+				register unsigned int value1 = (unsigned int)stack_pop(stack_ptr);
+				register unsigned int value2 = (unsigned int)stack_pop(stack_ptr);
+				stack_push(stack_ptr, (int)(value2 * value1));
+				
+				break;
+			}
+			case Div:
+			{
+				CHECK_STACK(DIV);
+				
+				register int value1 = (int)stack_pop(stack_ptr);
+				register int value2 = (int)stack_pop(stack_ptr);
+				if(value1 == 0)
+					error(exe,DIVISION_BY_ZERO, "A division by zero was encountered while trying to divide %d by %d", value2, value1);
+				
+				//-INT_MIN doesn't fit, and on x86 it traps instead of wrapping
+				stack_push(stack_ptr, value1 == -1 ? (int)(0u - (unsigned int)value2) : value2 / value1);
+				
+				break;
+			}
+			case Rem:
+			{
+				CHECK_STACK(REM);
+				
+				register int value1 = (int)stack_pop(stack_ptr);
+				register int value2 = (int)stack_pop(stack_ptr);
+				if(value1 == 0)
+					error(exe,DIVISION_BY_ZERO, "A division by zero was encountered trying to divide %d by %d", value2, value1);
+				
+				stack_push(stack_ptr, value1 == -1 ? 0 : value2 % value1);
+				
+				break;
+			}
+			case And:
+			{
+				CHECK_STACK(AND);
+				
+				stack_push(stack_ptr, stack_pop(stack_ptr) & stack_pop(stack_ptr));
+				
+				break;
+			}
+			case Or:
+			{
+				CHECK_STACK(OR);
+				
+				stack_push(stack_ptr, stack_pop(stack_ptr) | stack_pop(stack_ptr));
+				
+				break;
+			}
+			case Xor:
+			{
+				CHECK_STACK(XOR);
+				
+				stack_push(stack_ptr, stack_pop(stack_ptr) ^ stack_pop(stack_ptr));
+				
+				break;
+			}
+			case Not:
+			{
+				CHECK_STACK(NOT);
+				
+				stack_push(stack_ptr, ~stack_pop(stack_ptr));
+				
+				break;
+			}
+			case Neg:
+			{
+				CHECK_STACK(NEG);
+				
+				stack_push(stack_ptr, (int)(0u - (unsigned int)stack_pop(stack_ptr)));
+				
+				break;
+			}
+			case Shl:
+			{
+				CHECK_STACK(SHL);
+				
+				register int value1 = (int)stack_pop(stack_ptr);
+				register unsigned int value2 = (unsigned int)stack_pop(stack_ptr);
+				
+				stack_push(stack_ptr, (int)(value2 << (value1 & 31)));
+				
+				break;
+			}
+			case Shr:
+			{
+				CHECK_STACK(SHR);
+				
+				register int value1 = (int)stack_pop(stack_ptr);
+				register int value2 = (int)stack_pop(stack_ptr);
+				
+				stack_push(stack_ptr, value2 >> (value1 & 31));
+				
+				break;
+			}
+			case Cmp:
+			{
+				CHECK_STACK(CMP);
+				
+				register int value1 = (int)stack_pop(stack_ptr);
+				register int value2 = (int)stack_pop(stack_ptr);
+
+				sf->flags = (value1 == value2 ? JUMP_EQUAL : JUMP_NOT_EQUAL) |
+					(value2 > value1 ? JUMP_GREATER : 0) |
+					(value2 < value1 ? JUMP_LESS : 0);
+					
+				break;
+			}
+			case Jmp:
+			{
+				sf->pc += bytes_to_int(code_ptr + sf->pc + 1);
+				CHECK_JUMP();
+				sf->pc--;
+				break;
+			}
+			case Je:
+			{
+				JUMP_IF(sf->flags & JUMP_EQUAL);
+				break;
+			}
+			case Jne:
+			{
+				JUMP_IF(sf->flags & JUMP_NOT_EQUAL);
+				break;
+			}
+			case Jg:
+			{
+				JUMP_IF(sf->flags & JUMP_GREATER);
+				break;
+			}
+			case Jge:
+			{
+				JUMP_IF(sf->flags & (JUMP_GREATER | JUMP_EQUAL));
+				break;
+			}
+			case Jl:
+			{
+				JUMP_IF(sf->flags & JUMP_LESS);
+				break;
+			}
+			case Jle:
+			{
+				JUMP_IF(sf->flags & (JUMP_LESS | JUMP_EQUAL));
+				break;
+			}
+			case In:
+			{
+				if(exe->info->commandline & COMMANDLINE_SNAPSHOT)
+					snapshot_write(exe);
+				
+				stack_push(stack_ptr, getc(exe->input));
+				
+				break;
+			}
+			case Out:
+			{
+				CHECK_STACK(OUT);
+				
+				if(exe->output == NULL)
+					putc((int)stack_pop(stack_ptr), stdout);
+				else
+				{
+					char c = (char)stack_pop(stack_ptr);
+					tasks_output(exe, &c, 1);
+				}
+				
+				break;
+			}
+			case Alloc:
+			{
+				CHECK_STACK(ALLOC);
+				
+				stack_push(stack_ptr, heap_alloc(exe, (int)stack_pop(stack_ptr)));
+				
+				break;
+			}
+			case Ldi:
+			{
+				CHECK_STACK(LDI);
+				
+				register int address = (int)stack_pop(stack_ptr);
+				CHECK_HEAP(address);
+				
+				stack_push(stack_ptr, heap_memory[(unsigned int)address]);
+				
+				break;
+			}
+			case Sti:
+			{
+				CHECK_STACK(STI);
+				
+				register int value = (int)stack_pop(stack_ptr);
+				register int address = (int)stack_pop(stack_ptr);
+				CHECK_HEAP(address);
+				
+				heap_memory[(unsigned int)address] = value;
+				
+				break;
+			}
+			case Reset:
+			{
+				CHECK_STACK(RESET);
+				
+				heap_reset(exe, (int)stack_pop(stack_ptr));
+				
+				break;
+			}
+			case Fill:
+			{
+				CHECK_STACK(FILL);
+				
+				register int value = (int)stack_pop(stack_ptr);
+				register int count = (int)stack_pop(stack_ptr);
+				vector_fill(exe, (int)stack_pop(stack_ptr), count, value);
+				
+				break;
+			}
+			case Copy:
+			{
+				CHECK_STACK(COPY);
+				
+				register int count = (int)stack_pop(stack_ptr);
+				register int source = (int)stack_pop(stack_ptr);
+				vector_copy(exe, (int)stack_pop(stack_ptr), source, count);
+				
+				break;
+			}
+			case Sum:
+			case Min:
+			case Max:
+			{
+				CHECK_STACK(SUM);
+				
+				register int count = (int)stack_pop(stack_ptr);
+				register int address = (int)stack_pop(stack_ptr);
+				stack_push(stack_ptr, opcode == Sum ? vector_sum(exe, address, count) : opcode == Min ? vector_min(exe, address, count) : vector_max(exe, address, count));
+				
+				break;
+			}
+			case Vadd:
+			case Vmul:
+			{
+				CHECK_STACK(VADD);
+				
+				register int count = (int)stack_pop(stack_ptr);
+				register int b = (int)stack_pop(stack_ptr);
+				register int a = (int)stack_pop(stack_ptr);
+				register int destination = (int)stack_pop(stack_ptr);
+				
+				if(opcode == Vadd)
+					vector_add(exe, destination, a, b, count);
+				else
+					vector_mul(exe, destination, a, b, count);
+				
+				break;
+			}
+			case Find:
+			{
+				CHECK_STACK(FIND);
+				
+				register int value = (int)stack_pop(stack_ptr);
+				register int count = (int)stack_pop(stack_ptr);
+				stack_push(stack_ptr, vector_find(exe, (int)stack_pop(stack_ptr), count, value));
+				
+				break;
+			}
+			case Outs:
+			{
+#if VARIANT_CHECKED
+				if(sf->pc + 4 >= size)
+					error(exe, ABRUPT_END_OF_FUNCTION, "Ran out of executable code while attempting to write a constant.");
+#endif
+				register int constant = bytes_to_int(code_ptr + sf->pc + 1);
+				CHECK_CONSTANT(constant, -1);
+				
+				tasks_output(exe, exe->constants[constant].data, exe->constants[constant].size);
+				sf->pc += 4;
+				
+				break;
+			}
+			case Outi:
+			{
+				CHECK_STACK(OUTI);
+				
+				char text[12];
+				tasks_output(exe, text, sprintf(text, "%d", (int)stack_pop(stack_ptr)));
+				
+				break;
+			}
+			case Ini:
+			{
+				if(exe->info->commandline & COMMANDLINE_SNAPSHOT)
+					snapshot_write(exe);
+				
+				stack_push(stack_ptr, read_integer(exe->input));
+				
+				break;
+			}
+			case Pushk:
+			{
+#if VARIANT_CHECKED
+				if(sf->pc + 4 >= size)
+					error(exe, ABRUPT_END_OF_FUNCTION, "Ran out of executable code while attempting to push a constant.");
+#endif
+				register int constant = bytes_to_int(code_ptr + sf->pc + 1);
+				CHECK_CONSTANT(constant, 4);
+				
+				stack_push(stack_ptr, bytes_to_int(exe->constants[constant].data));
+				sf->pc += 4;
+				
+				break;
+			}
+			case Call:
+			{
+				Stack_Frame frame;
+				frame.function_id = bytes_to_int(code_ptr + sf->pc + 1);
+				frame.pc = 0;
+				frame.flags = 0;
+				
+#if VARIANT_CHECKED
+				if(frame.function_id < 0 || frame.function_id >= exe->number_of_functions)
+					error(exe, FUNCTION_DOES_NOT_EXIST, "The function specified by a call does not exist. There are %d functions. Valid function ids are 0-%d. The value specified by the entry point is: %d", exe->number_of_functions, exe->number_of_functions, frame.function_id);
+
+				if(stack_ptr->stack_pointer < exe->functions[frame.function_id].arg_count)
+					error(exe, NOT_ENOUGH_ARGUMENTS, "Arguments required %d. Recieved %d", exe->functions[frame.function_id].arg_count, stack_ptr->stack_pointer + 1);
+#endif
+				
+				PROFILE_BRANCH(1);
+				
+#if !VARIANT_DEBUG
+				//natives run on the arguments where they are, without a frame. The debugger wants one to show
+				if(exe->functions[frame.function_id].native != NULL)
+				{
+					int arg_count = exe->functions[frame.function_id].arg_count;
+					
+					exe->metrics.calls++;
+#if VARIANT_PROFILE
+					exe->profile->functions[frame.function_id].calls++;
+#endif
+					int result = exe->functions[frame.function_id].native(exe, stack_ptr->stack_elements + stack_ptr->stack_pointer - arg_count);
+					
+					stack_ptr->stack_pointer -= arg_count;
+					stack_push(stack_ptr, result);
+					sf->pc += 4;
+					break;
+				}
+#endif
+				
+				//pure functions can be answered straight from the cache
+				int memoize = exe->memo != NULL && exe->functions[frame.function_id].attributes & FUNCTION_ATTRIBUTE_PURE && exe->functions[frame.function_id].arg_count <= MEMO_MAX_ARGS;
+				long memo_args[MEMO_MAX_ARGS];
+				
+				if(memoize)
+				{
+					long* args = stack_ptr->stack_elements + stack_ptr->stack_pointer - exe->functions[frame.function_id].arg_count;
+					long result;
+					
+					if(memo_lookup(exe, frame.function_id, args, &result))
+					{
+						stack_ptr->stack_pointer -= exe->functions[frame.function_id].arg_count;
+						stack_push(stack_ptr, result);
+						sf->pc += 4;
+						break;
+					}
+					
+					memcpy(memo_args, args, exe->functions[frame.function_id].arg_count * sizeof(long));
+				}
+					
+				//the arguments become the bottom of the callee's stack, in place
+				stack_window(stack_ptr, &frame.stack, exe->functions[frame.function_id].arg_count);
+				
+				stack_push(&exe->call_stack, (long)&frame);
+				
+				FLUSH_EXECUTED();
+				int ret_value = exe->functions[frame.function_id].run_function(exe);
+				
+				if(memoize)
+					memo_insert(exe, frame.function_id, memo_args, ret_value);
+				
+				stack_push(stack_ptr, ret_value);
+				
+				stack_pop(&exe->call_stack);
+							
+				sf->pc += 4;
+				
+				break;
+			}
+			case Spawn:
+			{
+				register int function_id = bytes_to_int(code_ptr + sf->pc + 1);
+				
+#if VARIANT_CHECKED
+				if(function_id < 0 || function_id >= exe->number_of_functions)
+					error(exe, FUNCTION_DOES_NOT_EXIST, "The function specified by a spawn does not exist. There are %d functions. Valid function ids are 0-%d. The value specified is: %d", exe->number_of_functions, exe->number_of_functions - 1, function_id);
+				
+				if(stack_ptr->stack_pointer < exe->functions[function_id].arg_count)
+					error(exe, NOT_ENOUGH_ARGUMENTS, "Arguments required %d. Recieved %d", exe->functions[function_id].arg_count, stack_ptr->stack_pointer);
+#endif
+				
+				//the task keeps a copy of its arguments, so they come off like a call's would
+				stack_ptr->stack_pointer -= exe->functions[function_id].arg_count;
+				long* args = stack_ptr->stack_elements + stack_ptr->stack_pointer;
+				long* space = args + exe->functions[function_id].arg_count;
+				
+				FLUSH_EXECUTED();
+				stack_push(stack_ptr, tasks_spawn(exe, function_id, args, space, stack_ptr->length - stack_ptr->stack_pointer - exe->functions[function_id].arg_count));
+				sf->pc += 4;
+				
+				break;
+			}
+			case Join:
+			{
+				CHECK_STACK(JOIN);
+				
+				register long handle = stack_pop(stack_ptr);
+				
+				FLUSH_EXECUTED();
+				stack_push(stack_ptr, tasks_join(exe, handle, stack_ptr->stack_elements + stack_ptr->stack_pointer, stack_ptr->length - stack_ptr->stack_pointer));
+				
+				break;
+			}
+			case Coroutine:
+			{
+				register int function_id = bytes_to_int(code_ptr + sf->pc + 1);
+				
+#if VARIANT_CHECKED
+				if(function_id < 0 || function_id >= exe->number_of_functions)
+					error(exe, FUNCTION_DOES_NOT_EXIST, "The function specified by a coroutine does not exist. There are %d functions. Valid function ids are 0-%d. The value specified is: %d", exe->number_of_functions, exe->number_of_functions - 1, function_id);
+				
+				if(stack_ptr->stack_pointer < exe->functions[function_id].arg_count)
+					error(exe, NOT_ENOUGH_ARGUMENTS, "Arguments required %d. Recieved %d", exe->functions[function_id].arg_count, stack_ptr->stack_pointer);
+#endif
+				
+				stack_ptr->stack_pointer -= exe->functions[function_id].arg_count;
+				stack_push(stack_ptr, coroutine_create(exe, function_id, stack_ptr->stack_elements + stack_ptr->stack_pointer));
+				sf->pc += 4;
+				
+				break;
+			}
+			case Resume:
+			{
+				CHECK_STACK(RESUME);
+				
+				register long value = stack_pop(stack_ptr);
+				register long handle = stack_pop(stack_ptr);
+				
+				FLUSH_EXECUTED();
+				stack_push(stack_ptr, coroutine_resume(exe, handle, value, stack_ptr->stack_elements + stack_ptr->stack_pointer, stack_ptr->length - stack_ptr->stack_pointer));
+				
+				break;
+			}
+			case Yield:
+			{
+				CHECK_STACK(YIELD);
+				
+				//the locals stay with the coroutine, so unlike a return nothing is freed
+				int value = (int)stack_pop(stack_ptr);
+				coroutine_yield(exe, sf, sf->pc + 1, stack_ptr->stack_elements, stack_ptr->stack_pointer);
+				
+				FLUSH_EXECUTED();
+				return value;
+			}
+			case Ret:
+			{
+				SAMPLE_OPERAND_DEPTH();
+				
+				//Is there anything remaining on the stack? That's our return value. If not, maybe this is a void function? return 0
+				int ret_value = stack_ptr->stack_pointer < 1 ? 0 : (int)stack_pop(stack_ptr);
+				free(sf->local_memory);
+				
+				FLUSH_EXECUTED();
+				exe->metrics.returns++;
+				
+				return ret_value;
+			}
+#if VARIANT_DEBUG
+			case Trap:
+			{
+				//a breakpoint. Once the debugger is done, run the instruction it replaced
+				opcode = debugger_trap(exe, sf);
+				goto dispatch;
+			}
+#endif
+			default:
+				error(exe, INVALID_OPCODE, "Invalid opcode recieved: 0x%X", opcode);
+		}
+	}
+	
+	error(exe, ABRUPT_END_OF_FUNCTION, "This occured in function %d", sf->function_id);
+}
+
+
+#undef CHECK_STACK
+#undef CHECK_JUMP
+#undef CHECK_HEAP
+#undef CHECK_CONSTANT
+#undef PROFILE_BRANCH
+#undef FLUSH_EXECUTED
+#undef SAMPLE_OPERAND_DEPTH
+#undef JUMP_IF
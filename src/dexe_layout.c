@@ -0,0 +1,564 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_verifier.h"
+#include "dexe_profile.h"
+#include "dexe_layout.h"
+
+#define JUMP_SIZE 5
+
+struct Block_struct
+{
+	int start; //the block is [start, end) of the old code
+	int end;
+	int last;  //pc of its last instruction
+	int invertible; //the instruction before the last is a Cmp, so the flags are known
+	
+	int taken; //the block its last instruction jumps to, or -1
+	int fall;  //the block it falls into, or -1
+	unsigned long taken_count;
+	unsigned long fall_count;
+	
+	unsigned long count; //how often it ran, worked out from the branches
+	int new_start;
+};
+typedef struct Block_struct Block;
+
+//a caller and a callee, and how often the one called the other
+struct Call_Edge_struct
+{
+	int caller;
+	int callee;
+	unsigned long count;
+};
+typedef struct Call_Edge_struct Call_Edge;
+
+
+static int is_conditional(unsigned char opcode)
+{
+	return opcode >= Je && opcode <= Jle;
+}
+
+static int instruction_size(unsigned char opcode)
+{
+	return 1 + get_opcode_from_instruction((char)opcode).parameter_size;
+}
+
+//the jump that is taken exactly when opcode isn't, once a Cmp has set the flags
+static unsigned char inverse(unsigned char opcode)
+{
+	switch(opcode)
+	{
+		case Je:  return Jne;
+		case Jne: return Je;
+		case Jg:  return Jle;
+		case Jle: return Jg;
+		case Jge: return Jl;
+		default:  return Jge;
+	}
+}
+
+static void write_jump(char* code, int pc, unsigned char opcode, int target)
+{
+	code[pc] = (char)opcode;
+	int_to_bytes(target - pc, code + pc + 1);
+}
+
+/*
+	The bytes the block takes once next follows it: its own instructions, besides a
+	jump to next, and a Jmp wherever it used to fall through to something else.
+*/
+static int block_size(Block* block, unsigned char* code, int next)
+{
+	unsigned char opcode = code[block->last];
+	int size = block->last - block->start;
+	
+	if(opcode == Jmp)
+		return size + (block->taken == next ? 0 : JUMP_SIZE);
+	if(is_conditional(opcode))
+		return size + JUMP_SIZE + (block->fall == next || (block->taken == next && block->invertible) ? 0 : JUMP_SIZE);
+	
+	size += instruction_size(opcode);
+	return size + (block->fall < 0 || block->fall == next ? 0 : JUMP_SIZE);
+}
+
+static void write_block(Block* blocks, int b, unsigned char* code, char* out, int next)
+{
+	Block* block = &blocks[b];
+	unsigned char opcode = code[block->last];
+	int pc = block->new_start + block->last - block->start;
+	
+	memcpy(out + block->new_start, code + block->start, block->last - block->start);
+	
+	if(opcode == Jmp)
+	{
+		if(block->taken != next)
+			write_jump(out, pc, Jmp, blocks[block->taken].new_start);
+		return;
+	}
+	
+	if(is_conditional(opcode))
+	{
+		if(block->fall == next)
+			write_jump(out, pc, opcode, blocks[block->taken].new_start);
+		else if(block->taken == next && block->invertible)
+			write_jump(out, pc, inverse(opcode), blocks[block->fall].new_start);
+		else
+		{
+			write_jump(out, pc, opcode, blocks[block->taken].new_start);
+			write_jump(out, pc + JUMP_SIZE, Jmp, blocks[block->fall].new_start);
+		}
+		return;
+	}
+	
+	memcpy(out + pc, code + block->last, instruction_size(opcode));
+	if(block->fall >= 0 && block->fall != next)
+		write_jump(out, pc + instruction_size(opcode), Jmp, blocks[block->fall].new_start);
+}
+
+//every block's count from the function's calls and its branches. Loops without a branch just stop growing
+static void count_blocks(Block* blocks, int count, unsigned long calls, unsigned long* scratch)
+{
+	for(int round = 0; round <= count; round++)
+	{
+		int changed = 0;
+		
+		memset(scratch, 0, count * sizeof(unsigned long));
+		scratch[0] = calls;
+		
+		for(int b = 0; b < count; b++)
+		{
+			if(blocks[b].taken >= 0)
+				scratch[blocks[b].taken] += blocks[b].taken_count;
+			if(blocks[b].fall >= 0)
+				scratch[blocks[b].fall] += blocks[b].fall_count;
+		}
+		
+		for(int b = 0; b < count; b++)
+		{
+			changed |= scratch[b] != blocks[b].count;
+			blocks[b].count = scratch[b];
+		}
+		
+		//unconditional edges carry everything that ran the block
+		for(int b = 0; b < count; b++)
+		{
+			if(blocks[b].taken >= 0 && blocks[b].fall < 0)
+				blocks[b].taken_count = blocks[b].count;
+			else if(blocks[b].fall >= 0 && blocks[b].taken < 0)
+				blocks[b].fall_count = blocks[b].count;
+		}
+		
+		if(!changed)
+			break;
+	}
+}
+
+/*
+	Reorders the basic blocks of a verified function so the hot successor of every
+	block follows it: the greedy chain starts at the entry and keeps taking the more
+	often used way out, and blocks that never ran are appended in their old order.
+	A conditional jump right after a Cmp is inverted when its target comes next,
+	any other one keeps a Jmp behind it. The result has to verify again or the old
+	code is kept. Returns 0 if the function was changed.
+*/
+int layout_blocks(Executable* exe, int id, Function_Profile* profile)
+{
+	Executable_Function* function = &exe->functions[id];
+	unsigned char* code = (unsigned char*)function->instructions;
+	int size = function->size_of_instructions;
+	int result = 1;
+	
+	if(!(function->attributes & FUNCTION_ATTRIBUTE_VERIFIED) || size == 0 || profile->calls == 0)
+		return 1;
+	
+	int* block_of = (int*)malloc((size + 1) * sizeof(int));
+	Block* blocks = (Block*)malloc((size + 1) * sizeof(Block));
+	int* order = (int*)malloc((size + 1) * sizeof(int));
+	char* leader = (char*)calloc(size + 1, 1);
+	char* placed = (char*)calloc(size + 1, 1);
+	unsigned long* scratch = (unsigned long*)malloc((size + 1) * sizeof(unsigned long));
+	char* out = NULL;
+	int count = 0;
+	
+	if(block_of == NULL || blocks == NULL || order == NULL || leader == NULL || placed == NULL || scratch == NULL)
+		goto done;
+	
+	//the leaders: the entry, every jump target and whatever follows a jump or a return.
+	//Jumps in unreachable code were never verified, so anything odd leaves the function alone
+	for(int pc = 0; pc <= size; pc++)
+		block_of[pc] = -1;
+	for(int pc = 0; pc < size; pc += instruction_size(code[pc]))
+		block_of[pc] = 0;
+	block_of[size] = 0;
+	
+	leader[0] = 1;
+	for(int pc = 0; pc < size; pc += instruction_size(code[pc]))
+	{
+		if(code[pc] >= Jmp && code[pc] <= Jle)
+		{
+			int target = pc + bytes_to_int((char*)code + pc + 1);
+			if(target < 0 || target >= size || block_of[target] < 0)
+				goto done;
+			leader[target] = 1;
+		}
+		if((code[pc] >= Jmp && code[pc] <= Jle) || code[pc] == Ret)
+			leader[pc + instruction_size(code[pc])] = 1;
+	}
+	
+	for(int pc = 0; pc < size; pc += instruction_size(code[pc]))
+	{
+		if(leader[pc])
+		{
+			blocks[count].start = pc;
+			blocks[count].invertible = 0;
+			count++;
+		}
+		else
+			blocks[count - 1].invertible = code[blocks[count - 1].last] == Cmp;
+		
+		block_of[pc] = count - 1;
+		blocks[count - 1].last = pc;
+		blocks[count - 1].end = pc + instruction_size(code[pc]);
+	}
+	
+	for(int b = 0; b < count; b++)
+	{
+		Block* block = &blocks[b];
+		unsigned char opcode = code[block->last];
+		
+		block->taken = opcode >= Jmp && opcode <= Jle ? block_of[block->last + bytes_to_int((char*)code + block->last + 1)] : -1;
+		block->fall = opcode != Jmp && opcode != Ret && block->end < size ? block_of[block->end] : -1;
+		block->taken_count = is_conditional(opcode) ? profile->branches[2 * block->last] : 0;
+		block->fall_count = is_conditional(opcode) ? profile->branches[2 * block->last + 1] : 0;
+		block->count = 0;
+	}
+	
+	count_blocks(blocks, count, profile->calls, scratch);
+	
+	//the hot chains, then the cold blocks
+	int placed_count = 0;
+	for(int current = 0; current >= 0; )
+	{
+		Block* block = &blocks[current];
+		int next = -1;
+		unsigned long best = 0;
+		
+		order[placed_count++] = current;
+		placed[current] = 1;
+		
+		if(block->fall >= 0 && !placed[block->fall] && block->fall_count > best)
+		{
+			next = block->fall;
+			best = block->fall_count;
+		}
+		if(block->taken >= 0 && !placed[block->taken] && block->taken_count > best)
+			next = block->taken;
+		
+		for(int b = 0; b < count && next < 0; b++)
+			if(!placed[b] && blocks[b].count > 0)
+				next = b;
+		
+		current = next;
+	}
+	for(int b = 0; b < count; b++)
+		if(!placed[b])
+			order[placed_count++] = b;
+	
+	int moved = 0;
+	for(int k = 0; k < count; k++)
+		moved |= order[k] != k;
+	if(!moved)
+		goto done;
+	
+	int new_size = 0;
+	for(int k = 0; k < count; k++)
+	{
+		blocks[order[k]].new_start = new_size;
+		new_size += block_size(&blocks[order[k]], code, k + 1 < count ? order[k + 1] : -1);
+	}
+	
+	out = (char*)malloc(new_size > 0 ? new_size : 1);
+	if(out == NULL)
+		goto done;
+	for(int k = 0; k < count; k++)
+		write_block(blocks, order[k], code, out, k + 1 < count ? order[k + 1] : -1);
+	
+	char message[VERIFY_MESSAGE_SIZE];
+	char* old_code = function->instructions;
+	function->instructions = out;
+	function->size_of_instructions = new_size;
+	
+	if(verify_function(exe, id, message))
+	{
+		function->instructions = old_code;
+		function->size_of_instructions = size;
+	}
+	else
+	{
+		//the old code is freed by whoever owns it, the arena or the function
+		if(!(function->attributes & (FUNCTION_ATTRIBUTE_SHARED | FUNCTION_ATTRIBUTE_ARENA)))
+			free(old_code);
+		function->attributes &= ~(FUNCTION_ATTRIBUTE_SHARED | FUNCTION_ATTRIBUTE_ARENA);
+		out = NULL;
+		result = 0;
+	}
+	
+done:
+	free(block_of);
+	free(blocks);
+	free(order);
+	free(leader);
+	free(placed);
+	free(scratch);
+	free(out);
+	
+	return result;
+}
+
+
+static int compare_edges(const void* a, const void* b)
+{
+	unsigned long count_a = ((const Call_Edge*)a)->count;
+	unsigned long count_b = ((const Call_Edge*)b)->count;
+	
+	return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+static int chain_of(int* parent, int f)
+{
+	while(parent[f] != f)
+		f = parent[f] = parent[parent[f]];
+	return f;
+}
+
+/*
+	Fills order with every function id, in the order the code should be laid out.
+	The call graph from the profile's call sites is merged heaviest edge first,
+	each merge putting the caller's chain in front of the callee's (Pettis and
+	Hansen). The chains go hottest first by the instructions they ran, and
+	functions that never ran follow in id order. Without a profile it's id order.
+*/
+void layout_order(Executable* exe, Profile* profile, int* order)
+{
+	int n = exe->number_of_functions;
+	int placed_count = 0;
+	
+	int* parent = (int*)malloc(n * sizeof(int));
+	int* next = (int*)malloc(n * sizeof(int));
+	int* last = (int*)malloc(n * sizeof(int));
+	unsigned long* weight = (unsigned long*)calloc(n, sizeof(unsigned long));
+	int edge_capacity = 16;
+	int edge_count = 0;
+	Call_Edge* edges = (Call_Edge*)malloc(edge_capacity * sizeof(Call_Edge));
+	
+	if(profile == NULL || parent == NULL || next == NULL || last == NULL || weight == NULL || edges == NULL)
+		goto fallback;
+	
+	for(int f = 0; f < n; f++)
+	{
+		unsigned char* code = (unsigned char*)exe->functions[f].instructions;
+		
+		parent[f] = f;
+		next[f] = -1;
+		last[f] = f;
+		
+		for(int pc = 0; pc < exe->functions[f].size_of_instructions && code[pc] <= LAST_OPCODE; pc += instruction_size(code[pc]))
+		{
+			if(code[pc] != Call || pc + 4 >= exe->functions[f].size_of_instructions || profile->functions[f].branches[2 * pc] == 0)
+				continue;
+			
+			int callee = bytes_to_int((char*)code + pc + 1);
+			if(callee < 0 || callee >= n || callee == f)
+				continue;
+			
+			if(edge_count == edge_capacity)
+			{
+				Call_Edge* grown = (Call_Edge*)realloc(edges, 2 * edge_capacity * sizeof(Call_Edge));
+				if(grown == NULL)
+					goto fallback;
+				edges = grown;
+				edge_capacity *= 2;
+			}
+			edges[edge_count].caller = f;
+			edges[edge_count].callee = callee;
+			edges[edge_count].count = profile->functions[f].branches[2 * pc];
+			edge_count++;
+		}
+	}
+	
+	qsort(edges, edge_count, sizeof(Call_Edge), compare_edges);
+	
+	for(int e = 0; e < edge_count; e++)
+	{
+		int a = chain_of(parent, edges[e].caller);
+		int b = chain_of(parent, edges[e].callee);
+		
+		if(a == b)
+			continue;
+		
+		next[last[a]] = b;
+		last[a] = last[b];
+		parent[b] = a;
+	}
+	
+	//a chain is as hot as its hottest function
+	for(int f = 0; f < n; f++)
+		if(profile->functions[f].instructions > weight[chain_of(parent, f)])
+			weight[chain_of(parent, f)] = profile->functions[f].instructions;
+	
+	for(;;)
+	{
+		int best = -1;
+		
+		for(int f = 0; f < n; f++)
+			if(parent[f] == f && weight[f] > 0 && (best < 0 || weight[f] > weight[best]))
+				best = f;
+		if(best < 0)
+			break;
+		
+		for(int f = best; f >= 0; f = next[f])
+		{
+			if(profile->functions[f].calls > 0)
+			{
+				order[placed_count++] = f;
+				parent[f] = -1;
+			}
+		}
+		weight[best] = 0;
+	}
+	
+	//parent is only -1 for what's already placed
+	for(int f = 0; f < n; f++)
+		if(parent[f] >= 0)
+			order[placed_count++] = f;
+	
+	if(placed_count == n)
+		goto done;
+	
+fallback:
+	for(int f = 0; f < n; f++)
+		order[f] = f;
+	
+done:
+	free(parent);
+	free(next);
+	free(last);
+	free(weight);
+	free(edges);
+}
+
+/*
+	Moves the code of every function into one block, in order. Library code stays
+	in the library's own read-only copy. Returns 1 if the arena can't be allocated,
+	and then nothing has moved.
+*/
+int layout_arena(Executable* exe, int* order)
+{
+	size_t total = 1;
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+		if(!(exe->functions[i].attributes & FUNCTION_ATTRIBUTE_SHARED))
+			total += exe->functions[i].size_of_instructions;
+	
+	char* arena = (char*)malloc(total);
+	if(arena == NULL)
+		return 1;
+	
+	size_t offset = 0;
+	for(int k = 0; k < exe->number_of_functions; k++)
+	{
+		Executable_Function* function = &exe->functions[order[k]];
+		
+		if(function->attributes & FUNCTION_ATTRIBUTE_SHARED)
+			continue;
+		
+		memcpy(arena + offset, function->instructions, function->size_of_instructions);
+		if(!(function->attributes & FUNCTION_ATTRIBUTE_ARENA))
+			free(function->instructions);
+		
+		function->instructions = arena + offset;
+		function->attributes |= FUNCTION_ATTRIBUTE_ARENA;
+		offset += function->size_of_instructions;
+	}
+	
+	free(exe->code_arena);
+	exe->code_arena = arena;
+	return 0;
+}
+
+/*
+	Renumbers the functions so function k is the old order[k], for dexe-opt to write
+	them in that order. Calls, the entry point and the exports follow. Calls to
+	imports are numbered past the functions and don't change.
+*/
+void layout_renumber(Executable* exe, int* order)
+{
+	int n = exe->number_of_functions;
+	int* new_id = (int*)malloc((n + 1) * sizeof(int));
+	Executable_Function* functions = (Executable_Function*)malloc((n + 1) * sizeof(Executable_Function));
+	Function_Debug* debug = exe->debug != NULL ? (Function_Debug*)malloc((n + 1) * sizeof(Function_Debug)) : NULL;
+	
+	if(new_id == NULL || functions == NULL || (exe->debug != NULL && debug == NULL))
+		error(exe, ALLOCATION_ERROR_IN_MAIN, "Could not allocate the renumbered function table");
+	
+	for(int k = 0; k < n; k++)
+	{
+		new_id[order[k]] = k;
+		functions[k] = exe->functions[order[k]];
+		if(debug != NULL)
+			debug[k] = exe->debug[order[k]];
+	}
+	
+	for(int f = 0; f < n; f++)
+	{
+		unsigned char* code = (unsigned char*)functions[f].instructions;
+		
+		for(int pc = 0; pc < functions[f].size_of_instructions && code[pc] <= LAST_OPCODE; pc += instruction_size(code[pc]))
+		{
+			if((code[pc] != Call && code[pc] != Spawn && code[pc] != Coroutine) || pc + 4 >= functions[f].size_of_instructions)
+				continue;
+			
+			int callee = bytes_to_int((char*)code + pc + 1);
+			if(callee >= 0 && callee < n)
+				int_to_bytes(new_id[callee], (char*)code + pc + 1);
+		}
+	}
+	
+	if(exe->entry >= 0 && exe->entry < n)
+		exe->entry = new_id[exe->entry];
+	for(int i = 0; i < exe->number_of_exports; i++)
+		if(exe->exports[i].function_id >= 0 && exe->exports[i].function_id < n)
+			exe->exports[i].function_id = new_id[exe->exports[i].function_id];
+	
+	free(exe->functions);
+	exe->functions = functions;
+	if(debug != NULL)
+	{
+		free(exe->debug);
+		exe->debug = debug;
+	}
+	free(new_id);
+}
@@ -0,0 +1,44 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_profile.h"
+
+/*
+	Profile guided layout of the code, from a profile written by -profile.
+	
+	Functions that call each other often are put next to each other, hottest
+	first, and the cold ones after them all. dexe puts them in that order in one
+	code arena when it starts, dexe-opt renumbers them so the file is in that
+	order and even a run without a profile reads the code hot first.
+	
+	Inside a function, the basic blocks are reordered so the more often taken
+	side of each branch falls through and blocks that never ran go to the end.
+	That moves pcs, so dexe only does it when nothing reports them.
+*/
+
+extern void layout_order(Executable*, Profile*, int*);
+extern int layout_blocks(Executable*, int, Function_Profile*);
+extern int layout_arena(Executable*, int*);
+extern void layout_renumber(Executable*, int*);
@@ -0,0 +1,589 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_parser.h"
+#include "dexe_verifier.h"
+#include "dexe_threads.h"
+#include "dexe_native.h"
+#include "dexe_linker.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	
+	#ifndef MAP_ANONYMOUS
+		#define MAP_ANONYMOUS MAP_ANON
+	#endif
+#endif
+
+/*
+	Linking puts every function an executable can reach into its own function table:
+	first the executable's, then each library's, in the order they're first imported.
+	Call and spawn operands are rewritten to those ids once, so the interpreter still calls
+	straight through exe->functions[id]. Constant pools are joined the same way. Imports
+	from the library "native" aren't files, each native gets one entry of its own.
+	
+	Libraries are read once per process and kept in the list below. The relocated
+	code of a library only depends on where it lands in the table and where its own
+	imports land, so executables that place it the same way share one read-only
+	copy. Everything is released when the last linked executable is freed.
+*/
+struct Link_Module_struct
+{
+	Executable* image;
+	Library* library; //NULL for the executable being linked
+	int base;
+	int constant_base;
+	int* resolved;
+};
+typedef struct Link_Module_struct Link_Module;
+
+struct Link_Native_struct
+{
+	Native* native;
+	int id;
+};
+typedef struct Link_Native_struct Link_Native;
+
+static Library* libraries;
+static int users;
+
+
+static char* allocate_code(size_t size)
+{
+	#ifdef _WIN32
+		return (char*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	#else
+		char* code = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return code == (char*)MAP_FAILED ? NULL : code;
+	#endif
+}
+static void protect_code(char* code, size_t size)
+{
+	#ifdef _WIN32
+		DWORD old;
+		VirtualProtect(code, size, PAGE_READONLY, &old);
+	#else
+		mprotect(code, size, PROT_READ);
+	#endif
+}
+static void free_code(char* code, size_t size)
+{
+	#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+	#else
+		munmap(code, size);
+	#endif
+}
+
+static char* copy_string(char* string)
+{
+	char* copy = (char*)malloc(strlen(string) + 1);
+	if(copy != NULL)
+		strcpy(copy, string);
+	return copy;
+}
+
+//the directory part of a file name, "." if it has none
+static char* directory_of(char* filename)
+{
+	char* end = NULL;
+	char* directory;
+	
+	for(char* c = filename; *c != '\0'; c++)
+		if(*c == '/' || *c == '\\')
+			end = c;
+	
+	if(end == NULL)
+		return copy_string(".");
+	
+	if(end == filename)
+		end++;
+	
+	directory = (char*)malloc(end - filename + 1);
+	if(directory != NULL)
+	{
+		memcpy(directory, filename, end - filename);
+		directory[end - filename] = '\0';
+	}
+	return directory;
+}
+
+//tries <directory>/<name>.dexe. Returns the path if it can be opened
+static char* try_library(char* directory, size_t directory_length, char* name)
+{
+	char* path = (char*)malloc(directory_length + strlen(name) + strlen(LIBRARY_EXTENSION) + 2);
+	FILE* file;
+	
+	if(path == NULL)
+		return NULL;
+	
+	memcpy(path, directory, directory_length);
+	path[directory_length] = '/';
+	strcpy(path + directory_length + 1, name);
+	strcat(path, LIBRARY_EXTENSION);
+	
+	if((file = fopen(path, "rb")) != NULL)
+	{
+		fclose(file);
+		return path;
+	}
+	
+	free(path);
+	return NULL;
+}
+
+//looks next to the importing file first, then along -library-path (or DEXE_LIBRARY_PATH)
+static char* find_library(Executable* exe, char* name, char* directory)
+{
+	char* search = exe->info->library_path != NULL ? exe->info->library_path : getenv("DEXE_LIBRARY_PATH");
+	char* path = try_library(directory, strlen(directory), name);
+	
+	while(path == NULL && search != NULL && *search != '\0')
+	{
+		char* end = strchr(search, LIBRARY_PATH_SEPARATOR);
+		size_t length = end != NULL ? (size_t)(end - search) : strlen(search);
+		
+		if(length > 0)
+			path = try_library(search, length, name);
+		search = end != NULL ? end + 1 : NULL;
+	}
+	
+	return path;
+}
+
+/*
+	Names for a library without debug symbols, so an executable that has them can still
+	print every function in its table. Exported functions go by their export name.
+	They're pooled like the names the parser reads: one pass sizes the pool, one fills it.
+*/
+static void name_functions(Executable* exe, Library* library)
+{
+	Executable* image = &library->image;
+	size_t pointers = 0;
+	size_t bytes = 0;
+	char** slots = NULL;
+	char* text = NULL;
+	char name[64];
+	
+	for(int pass = 0; pass < 2; pass++)
+	{
+		if(pass == 1)
+		{
+			image->debug = (Function_Debug*)calloc(image->number_of_functions, sizeof(Function_Debug));
+			image->debug_pool = (char*)malloc(pointers * sizeof(char*) + bytes + 1);
+			if(image->debug == NULL || image->debug_pool == NULL)
+				error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the names of library '%s'", library->name);
+			
+			slots = (char**)image->debug_pool;
+			text = image->debug_pool + pointers * sizeof(char*);
+		}
+		
+		for(int i = 0; i < image->number_of_functions; i++)
+		{
+			Executable_Function* function = &image->functions[i];
+			Function_Debug* debug = pass ? &image->debug[i] : NULL;
+			
+			if(pass)
+			{
+				debug->arg_names = slots;
+				debug->local_names = slots + function->arg_count;
+				slots += function->arg_count + function->local_count;
+			}
+			else
+				pointers += function->arg_count + function->local_count;
+			
+			//the function's own name first, then its args and locals
+			for(int k = -1; k < function->arg_count + function->local_count; k++)
+			{
+				if(k >= function->arg_count)
+					sprintf(name, "local%d", k - function->arg_count);
+				else if(k >= 0)
+					sprintf(name, "arg%d", k);
+				else
+				{
+					sprintf(name, "%.40s.%d", library->name, i);
+					for(int e = 0; e < image->number_of_exports; e++)
+						if(image->exports[e].function_id == i)
+							sprintf(name, "%.60s", image->exports[e].name);
+				}
+				
+				if(!pass)
+				{
+					bytes += strlen(name) + 1;
+					continue;
+				}
+				
+				strcpy(text, name);
+				if(k < 0)
+					debug->function_name = text;
+				else
+					debug->arg_names[k] = text; //local names follow the arg names
+				text += strlen(name) + 1;
+			}
+		}
+	}
+	
+	image->flags |= DEXE_FLAGS_DEBUG;
+}
+
+static Library* load_library(Executable* exe, char* name, char* directory)
+{
+	Library* library;
+	char* path;
+	
+	for(library = libraries; library != NULL; library = library->next)
+		if(!strcmp(library->name, name))
+			return library;
+	
+	path = find_library(exe, name, directory);
+	if(path == NULL)
+		error(exe, UNRESOLVED_IMPORT, "Library '%s' was not found in '%s' or on the library path", name, directory);
+	
+	library = (Library*)calloc(1, sizeof(Library));
+	if(library == NULL || (library->name = copy_string(name)) == NULL || (library->image.info = (Dexe_Info*)calloc(1, sizeof(Dexe_Info))) == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate library '%s'", name);
+	
+	//errors in the library are reported the way this executable reports its own
+	library->image.info->filename = path;
+	library->image.info->commandline = exe->info->commandline & (COMMANDLINE_SILENT | COMMANDLINE_VERBOSE);
+	library->image.info->threads = exe->info->threads;
+	library->image.info->library_path = exe->info->library_path;
+	
+	dexe_load(&library->image);
+	
+	if(!(library->image.flags & DEXE_FLAGS_DEBUG))
+		name_functions(exe, library);
+	
+	exe->metrics.loader_bytes += library->image.metrics.loader_bytes;
+	
+	library->next = libraries;
+	libraries = library;
+	return library;
+}
+
+static int find_export(Executable* image, char* name)
+{
+	for(int i = 0; i < image->number_of_exports; i++)
+		if(!strcmp(image->exports[i].name, name))
+			return image->exports[i].function_id;
+	return -1;
+}
+
+//own ids move up by base and imports become the ids they resolved to. Anything else can never be valid
+static void relocate(char* code, int size, int base, int own, int* resolved, int imports, int constant_base, int constants)
+{
+	for(int pc = 0; pc < size;)
+	{
+		unsigned char opcode = (unsigned char)code[pc];
+		
+		if((opcode == Call || opcode == Spawn || opcode == Coroutine) && pc + 4 < size)
+		{
+			int id = bytes_to_int(code + pc + 1);
+			
+			if(id >= 0 && id < own)
+				id += base;
+			else if(id >= own && id - own < imports)
+				id = resolved[id - own];
+			else
+				id = -1;
+			
+			int_to_bytes(id, code + pc + 1);
+		}
+		else if((opcode == Outs || opcode == Pushk) && pc + 4 < size)
+		{
+			int constant = bytes_to_int(code + pc + 1);
+			
+			int_to_bytes(constant >= 0 && constant < constants ? constant + constant_base : -1, code + pc + 1);
+		}
+		
+		pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction(opcode).parameter_size : 0);
+	}
+}
+
+static Library_Instance* get_instance(Executable* exe, Link_Module* module)
+{
+	Executable* image = module->image;
+	Library* library = module->library;
+	Library_Instance* instance;
+	size_t offset = 0;
+	
+	for(int i = 0; i < library->number_of_instances; i++)
+	{
+		instance = &library->instances[i];
+		if(instance->base == module->base && instance->constant_base == module->constant_base && !memcmp(instance->resolved, module->resolved, image->number_of_imports * sizeof(int)))
+			return instance;
+	}
+	
+	instance = (Library_Instance*)realloc(library->instances, (library->number_of_instances + 1) * sizeof(Library_Instance));
+	if(instance == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate library '%s'", library->name);
+	library->instances = instance;
+	instance += library->number_of_instances;
+	
+	instance->base = module->base;
+	instance->constant_base = module->constant_base;
+	instance->size = 1;
+	for(int i = 0; i < image->number_of_functions; i++)
+		instance->size += image->functions[i].size_of_instructions;
+	
+	instance->resolved = (int*)malloc((image->number_of_imports + 1) * sizeof(int));
+	instance->instructions = (char**)malloc((image->number_of_functions + 1) * sizeof(char*));
+	instance->code = allocate_code(instance->size);
+	if(instance->resolved == NULL || instance->instructions == NULL || instance->code == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the code of library '%s'", library->name);
+	library->number_of_instances++;
+	
+	memcpy(instance->resolved, module->resolved, image->number_of_imports * sizeof(int));
+	
+	for(int i = 0; i < image->number_of_functions; i++)
+	{
+		instance->instructions[i] = instance->code + offset;
+		memcpy(instance->instructions[i], image->functions[i].instructions, image->functions[i].size_of_instructions);
+		relocate(instance->instructions[i], image->functions[i].size_of_instructions, module->base, image->number_of_functions, module->resolved, image->number_of_imports, module->constant_base, image->number_of_constants);
+		offset += image->functions[i].size_of_instructions;
+	}
+	
+	protect_code(instance->code, instance->size);
+	return instance;
+}
+
+//the id of the native an import names, placed at the end of the table the first time it's imported
+static int place_native(Executable* exe, Import* import, Link_Native** natives, int* count, int* total)
+{
+	Native* native = native_find(import->name);
+	
+	if(native == NULL)
+		error(exe, UNRESOLVED_IMPORT, "There is no native function '%s'", import->name);
+	
+	for(int i = 0; i < *count; i++)
+		if((*natives)[i].native == native)
+			return (*natives)[i].id;
+	
+	Link_Native* grown = (Link_Native*)realloc(*natives, (*count + 1) * sizeof(Link_Native));
+	if(grown == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the link table");
+	*natives = grown;
+	
+	grown[*count].native = native;
+	grown[*count].id = (*total)++;
+	return grown[(*count)++].id;
+}
+
+static void verify_linked(void* context, int function_id)
+{
+	Executable* exe = (Executable*)context;
+	char message[VERIFY_MESSAGE_SIZE];
+	
+	//natives have no code, they're verified from the start
+	if(exe->functions[function_id].native != NULL)
+		return;
+	
+	if(!verify_function(exe, function_id, message))
+		exe->functions[function_id].attributes |= FUNCTION_ATTRIBUTE_VERIFIED;
+	else
+		exe->functions[function_id].attributes &= ~FUNCTION_ATTRIBUTE_VERIFIED;
+}
+
+void linker_link(Executable* exe)
+{
+	int capacity = 8;
+	int count = 1;
+	int total = exe->number_of_functions;
+	int constants = exe->number_of_constants;
+	Link_Native* natives = NULL;
+	int number_of_natives = 0;
+	Link_Module* modules = (Link_Module*)calloc(capacity, sizeof(Link_Module));
+	
+	if(modules == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the link table");
+	modules[0].image = exe;
+	
+	//breadth first, so every library is placed the first time anything imports it
+	for(int m = 0; m < count; m++)
+	{
+		Executable* image = modules[m].image;
+		char* directory = directory_of(image->info->filename);
+		
+		modules[m].resolved = (int*)malloc((image->number_of_imports + 1) * sizeof(int));
+		if(directory == NULL || modules[m].resolved == NULL)
+			error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the link table");
+		
+		for(int k = 0; k < image->number_of_imports; k++)
+		{
+			Library* library;
+			int placed;
+			int id;
+			
+			if(!strcmp(image->imports[k].library, NATIVE_LIBRARY))
+			{
+				modules[m].resolved[k] = place_native(exe, &image->imports[k], &natives, &number_of_natives, &total);
+				continue;
+			}
+			
+			library = load_library(exe, image->imports[k].library, directory);
+			for(placed = 0; placed < count && modules[placed].library != library; placed++);
+			
+			if(placed == count)
+			{
+				if(count == capacity)
+				{
+					Link_Module* grown = (Link_Module*)realloc(modules, capacity * 2 * sizeof(Link_Module));
+					if(grown == NULL)
+						error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the link table");
+					modules = grown;
+					capacity *= 2;
+				}
+				
+				modules[count].image = &library->image;
+				modules[count].library = library;
+				modules[count].base = total;
+				modules[count].constant_base = constants;
+				modules[count].resolved = NULL;
+				total += library->image.number_of_functions;
+				constants += library->image.number_of_constants;
+				count++;
+			}
+			
+			if((id = find_export(&library->image, image->imports[k].name)) < 0)
+				error(exe, UNRESOLVED_IMPORT, "Library '%s' does not export '%s'", library->name, image->imports[k].name);
+			
+			modules[m].resolved[k] = modules[placed].base + id;
+		}
+		
+		free(directory);
+	}
+	
+	Executable_Function* functions = (Executable_Function*)realloc(exe->functions, total * sizeof(Executable_Function));
+	if(functions == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the linked function table");
+	exe->functions = functions;
+	
+	if(exe->flags & DEXE_FLAGS_DEBUG)
+	{
+		Function_Debug* debug = (Function_Debug*)realloc(exe->debug, total * sizeof(Function_Debug));
+		if(debug == NULL)
+			error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the linked function table");
+		exe->debug = debug;
+	}
+	
+	//the library entries point into the libraries' own pools
+	Constant* constant_table = (Constant*)realloc(exe->constants, (constants + 1) * sizeof(Constant));
+	if(constant_table == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the linked constant pool");
+	exe->constants = constant_table;
+	for(int m = 1; m < count; m++)
+		if(modules[m].image->number_of_constants > 0)
+			memcpy(exe->constants + modules[m].constant_base, modules[m].image->constants, modules[m].image->number_of_constants * sizeof(Constant));
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+		relocate(exe->functions[i].instructions, exe->functions[i].size_of_instructions, 0, exe->number_of_functions, modules[0].resolved, exe->number_of_imports, 0, exe->number_of_constants);
+	
+	for(int m = 1; m < count; m++)
+	{
+		Library_Instance* instance = get_instance(exe, &modules[m]);
+		
+		for(int i = 0; i < modules[m].image->number_of_functions; i++)
+		{
+			Executable_Function* function = &exe->functions[modules[m].base + i];
+			
+			*function = modules[m].image->functions[i];
+			function->instructions = instance->instructions[i];
+			function->attributes = FUNCTION_ATTRIBUTE_LINKED | FUNCTION_ATTRIBUTE_SHARED;
+			
+			//the names stay in the library's pool
+			if(exe->flags & DEXE_FLAGS_DEBUG)
+				exe->debug[modules[m].base + i] = modules[m].image->debug[i];
+		}
+	}
+	
+	for(int i = 0; i < number_of_natives; i++)
+	{
+		Native* native = natives[i].native;
+		Executable_Function* function = &exe->functions[natives[i].id];
+		
+		memset(function, 0, sizeof(Executable_Function));
+		function->arg_count = native->arg_count;
+		function->attributes = FUNCTION_ATTRIBUTE_LINKED | FUNCTION_ATTRIBUTE_SHARED | FUNCTION_ATTRIBUTE_VERIFIED;
+		function->run_function = native_run;
+		function->native = native->function;
+		
+		//the names are the registry's. A native has no locals
+		if(exe->flags & DEXE_FLAGS_DEBUG)
+		{
+			exe->debug[natives[i].id].function_name = native->name;
+			exe->debug[natives[i].id].arg_names = native->arg_names;
+			exe->debug[natives[i].id].local_names = native->arg_names + native->arg_count;
+		}
+	}
+	
+	exe->number_of_functions = total;
+	exe->number_of_constants = constants;
+	exe->linked = 1;
+	users++;
+	
+	for(int m = 0; m < count; m++)
+		free(modules[m].resolved);
+	free(modules);
+	free(natives);
+	
+	//calls now reach further, so everything is verified again against the whole table
+	threads_parallel_for(exe->number_of_functions, exe->info->threads > 0 ? exe->info->threads : 1, verify_linked, exe);
+}
+
+void linker_release(Executable* exe)
+{
+	if(!exe->linked)
+		return;
+	
+	exe->linked = 0;
+	if(--users > 0)
+		return;
+	
+	while(libraries != NULL)
+	{
+		Library* library = libraries;
+		char* path = library->image.info->filename;
+		
+		libraries = library->next;
+		
+		for(int i = 0; i < library->number_of_instances; i++)
+		{
+			free_code(library->instances[i].code, library->instances[i].size);
+			free(library->instances[i].instructions);
+			free(library->instances[i].resolved);
+		}
+		free(library->instances);
+		
+		free_memory(&library->image);
+		free(path);
+		free(library->name);
+		free(library);
+	}
+}
@@ -0,0 +1,70 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+//files with this minor version or newer may have sections after their functions
+#define DEXE_SECTIONS_MINOR_VERSION 0x03
+
+#define SECTION_EXPORTS 0x01
+#define SECTION_IMPORTS 0x02
+#define SECTION_CONSTANTS 0x03
+
+#define LIBRARY_EXTENSION ".dexe"
+
+#ifdef _WIN32
+	#define LIBRARY_PATH_SEPARATOR ';'
+#else
+	#define LIBRARY_PATH_SEPARATOR ':'
+#endif
+
+
+//the code of a library, relocated for one place in the function table
+struct Library_Instance_struct
+{
+	int base;
+	int constant_base;
+	int* resolved; //global id of each of the library's imports
+	
+	char* code; //every function back to back, read-only once written
+	size_t size;
+	char** instructions;
+};
+typedef struct Library_Instance_struct Library_Instance;
+
+struct Library_struct
+{
+	char* name;
+	Executable image;
+	
+	int number_of_instances;
+	Library_Instance* instances;
+	
+	struct Library_struct* next;
+};
+typedef struct Library_struct Library;
+
+
+extern void linker_link(Executable*);
+extern void linker_release(Executable*);
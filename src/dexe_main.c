@@ -21,22 +21,40 @@
 */
 
 //includes
+#include <ctype.h>
+
 #include "dexe_utils.h"
 #include "dexe_parser.h"
 #include "dexe_executer.h"
+#include "dexe_memo.h"
+#include "dexe_profile.h"
+#include "dexe_counters.h"
+#include "dexe_verifier.h"
+#include "dexe_trace.h"
+#include "dexe_snapshot.h"
+#include "dexe_cache.h"
+#include "dexe_metrics.h"
+#include "dexe_writer.h"
+#include "dexe_batch.h"
+#include "dexe_tasks.h"
+#include "dexe_disassembler.h"
+#include "dexe_stack.h"
 
 //prototypes
 void dump(Executable*);
 void print_help();
 void print_version();
-char* get_commandline(int*,int,char**);
+char* get_commandline(Dexe_Info*,int,char**);
 void handle_commandline(Executable*);
-void decompile(Executable*);
+int run_batch(Executable*, void*);
 
 //functions
 int main(int argc, char** argv)
 {
 	Executable exe;
+	
+	memset(&exe.metrics, 0, sizeof(Metrics));
+	exe.metrics.start_time = metrics_now();
 
 	//set up executable
 	exe.info = (Dexe_Info*)malloc(sizeof(Dexe_Info));
@@ -44,35 +62,138 @@ int main(int argc, char** argv)
 		error(&exe, ALLOCATION_ERROR_IN_MAIN, "The info struct (containing the filename, commandline args, and file pointer) could not be allocated.");
 	exe.info->commandline = 0;
 	exe.info->file = NULL;
+	exe.info->profile_filename = NULL;
+	exe.info->layout_filename = NULL;
+	exe.info->trace_filename = NULL;
+	exe.info->trace_dump_filename = NULL;
+	exe.info->trace_size = 0;
+	exe.info->counters_filename = NULL;
+	exe.info->metrics_filename = NULL;
+	exe.info->metrics_format = METRICS_FORMAT_JSON;
+	exe.info->decompile_format = DISASSEMBLY_TEXT;
+	exe.info->convert_filename = NULL;
+	exe.info->convert_compact = 0;
+	exe.info->threads = 0;
+	exe.info->parallel_filename = NULL;
+	exe.info->parallel_threshold = TASKS_DEFAULT_FORK_COST;
+	exe.info->library_path = NULL;
+	exe.info->snapshot_filename = NULL;
+	exe.info->restore_filename = NULL;
+	exe.info->cache_directory = NULL;
+	exe.info->cache_size = CACHE_DEFAULT_SIZE;
+	exe.info->batch_function = NULL;
+	exe.info->number_of_breakpoint_specs = 0;
+	exe.info->breakpoint_specs = NULL;
+	exe.info->number_of_watchpoint_specs = 0;
+	exe.info->watchpoint_specs = NULL;
 	exe.call_stack = (stack){0,0,0};
+	exe.operand_stack = (stack){0,0,0};
 	exe.functions = NULL;
+	exe.code_arena = NULL;
+	exe.debug = NULL;
+	exe.debug_pool = NULL;
+	exe.number_of_exports = 0;
+	exe.exports = NULL;
+	exe.number_of_imports = 0;
+	exe.imports = NULL;
+	exe.number_of_constants = 0;
+	exe.constants = NULL;
+	exe.constant_pool = NULL;
+	exe.linked = 0;
+	exe.memo = NULL;
+	exe.profile = NULL;
+	exe.counters = NULL;
+	exe.debugger = NULL;
+	exe.trace = NULL;
+	exe.heap = NULL;
+	exe.worker = NULL;
+	exe.output = NULL;
+	exe.coroutines = NULL;
+	exe.coroutine = NULL;
+	exe.resuming = NULL;
+	exe.restoring = NULL;
+	exe.input = stdin;
+	exe.cache = NULL;
 
 	//get command line arguments
-	exe.info->filename = get_commandline(&exe.info->commandline, argc, argv);
+	exe.info->filename = get_commandline(exe.info, argc, argv);
 
 	//handle command line
-	if(exe.info->filename == NULL && !(exe.info->commandline & COMMANDLINE_VERSION)) 
+	if(exe.info->filename == NULL && !(exe.info->commandline & (COMMANDLINE_VERSION | COMMANDLINE_TRACE_DUMP | COMMANDLINE_RESTORE)))
 		exe.info->commandline |= COMMANDLINE_HELP;
 	
 	handle_commandline(&exe);
 	
+	if(exe.info->commandline & COMMANDLINE_METRICS && metrics_init(&exe, exe.info->metrics_filename, exe.info->metrics_format))
+		warning("could not open '%s' for the metrics", exe.info->metrics_filename);
+	
+	//a snapshot is of a run from the entry point
+	if(exe.info->commandline & COMMANDLINE_BATCH)
+		exe.info->commandline &= ~(COMMANDLINE_SNAPSHOT | COMMANDLINE_RESTORE);
+	
+	//a restore runs the image the snapshot was taken of, unless another is given
+	if(exe.info->commandline & COMMANDLINE_RESTORE)
+	{
+		char message[SNAPSHOT_MESSAGE_SIZE];
+		
+		if(snapshot_open(&exe, exe.info->restore_filename, message))
+		{
+			printf("The snapshot '%s' %s\n", exe.info->restore_filename, message);
+			free_memory(&exe);
+			exit(FILE_ERROR);
+		}
+	}
+	
 	//read file into memory
 	dexe_read(&exe);
+	exe.metrics.load_time = metrics_now() - exe.metrics.start_time;
 	
-	//execute
-	int ret_value = dexe_execute(&exe);
+	//a run that was cached before is only printed
+	int ret_value;
+	if(exe.info->commandline & COMMANDLINE_CACHE && cache_begin(&exe, &ret_value))
+	{
+		free_memory(&exe);
+		return ret_value;
+	}
 	
-	//free resources
-	free_memory(&exe);
+	//execute, or run one function over every tuple on stdin
+	if(exe.info->commandline & COMMANDLINE_BATCH)
+	{
+		dexe_prepare(&exe);
+		exe.metrics.execute_start = metrics_now();
+		ret_value = stack_run_guarded(&exe, run_batch, NULL);
+		tasks_finish(&exe);
+	}
+	else
+		ret_value = dexe_execute(&exe);
 	
-	//debug exit
+	if(exe.memo != NULL && exe.info->commandline & COMMANDLINE_VERBOSE)
+		memo_print_statistics(&exe);
+	
+	if(exe.profile != NULL && profile_write(&exe, exe.info->profile_filename))
+		warning("could not write the profile to '%s'", exe.info->profile_filename);
+	
+	if(exe.counters != NULL && counters_write(&exe, exe.info->counters_filename))
+		warning("could not write the performance counters to '%s'", exe.info->counters_filename);
+	
+	//debug exit (error() frees resources itself)
 	if(exe.info->commandline & COMMANDLINE_DEBUG)
 		error(&exe, OK, "The program executed without error");
+	
+	cache_finish(&exe, ret_value);
+	
+	//free resources
+	free_memory(&exe);
 		
 	//normal exit
 	return ret_value;
 }
 
+int run_batch(Executable* exe, void* context)
+{
+	return batch_run_stream(exe, exe->info->batch_function, exe->input, stdout);
+}
+
 void print_help()
 {
 	puts("Usage: dexe [options] file");
@@ -82,8 +203,52 @@ void print_help()
 	puts("  -db, -debug          Turn on debug. Allows for breakpoints. Implies -v");
 	puts("  -dp, -dump           Dump file information");
 	puts("  -dc, -decompile      Decompile the file. Implies -dump");
+	puts("  -df, -decompile-format <text|json|tsv> Format of the decompiled code (default text).");
+	puts("                         json and tsv print only the code, with each function's");
+	puts("                         instruction mix and jump targets. Implies -decompile");
 	puts("  -s,  -silent         Silent errors (exit immediately on error)");
 	puts("  -vb, -verbose        Verbose errors (print additional information on error)");
+	puts("  -mm, -memoize        Cache the results of pure functions");
+	puts("  -pf, -profile <file> Write call, instruction and branch counts to <file>");
+	puts("  -pc, -perf-counters <file> Write cycles, instructions, branch misses, L1i/L1d and");
+	puts("                         iTLB misses per function to <file>, from the hardware");
+	puts("                         counters. With -profile, also per opcode class");
+	puts("  -lo, -layout <file>  Lay the code out by a profile written by -profile: hot");
+	puts("                         functions together and hot branches falling through");
+	puts("  -tr, -trace <file>   Record the last instructions executed to <file>");
+	puts("  -tt, -trace-top      With -trace, also record the top of the stack");
+	puts("  -ts, -trace-size <n> Keep the last <n> instructions in the trace (default 4194304)");
+	puts("  -td, -trace-dump <file> Print the trace in <file>. The image is read from the trace");
+	puts("                         unless a file is also given");
+	puts("  -mt, -metrics <out>  Write run metrics to <out> at exit, on error and on SIGUSR1.");
+	puts("                         <out> is a file, fd:<n> or - for stdout");
+	puts("  -mf, -metrics-format <json|prometheus> Format of the metrics (default json)");
+	puts("  -cv, -convert <out>  Write the file to <out> with the compact encoding (version 0.2)");
+	puts("  -ex, -expand <out>   Write the file to <out> with the fixed encoding (version 0.1.2)");
+	puts("  -th, -threads <n>    Use <n> threads to load the file and run spawned tasks");
+	puts("                         (default: one per processor, loading only for large files)");
+	puts("  -bt, -batch <function> Run <function> once per line of integers on stdin and print");
+	puts("                         each result. Runs 8 lines at a time with SIMD when it can");
+	puts("  -ap, -auto-parallel <file> Run two independent pure calls in a row at the same time");
+	puts("                         when both cost at least the threshold by the profile <file>");
+	puts("  -pt, -parallel-threshold <n> Instructions a call must average for -auto-parallel");
+	puts("                         (default 10000)");
+	puts("  -nr, -no-registers   Run verified code on the stack interpreter instead of translating");
+	puts("                         it to the register form first");
+	puts("  -ss, -snapshot-at-first-in <out> Write the whole state of the program to <out> just");
+	puts("                         before it first reads input. Runs on the stack interpreter");
+	puts("  -rs, -restore <snapshot> Carry on from a snapshot instead of the entry point. The");
+	puts("                         image is read from the snapshot unless a file is also given");
+	puts("  -ca, -cache <dir>    Keep the output and exit code of runs in <dir>, and print them");
+	puts("                         instead of running when the image and all of stdin are the same.");
+	puts("                         The output only comes out once the run is over");
+	puts("  -cs, -cache-size <n> Bytes the cache directory may hold (default 268435456)");
+	puts("  -lp, -library-path <dirs> Look for imported libraries in <dirs> after the file's own");
+	puts("                         directory. Separated like PATH (default: $DEXE_LIBRARY_PATH)");
+	puts("  -b,  -break <spec>   Set a breakpoint. Implies -debug. <spec> is");
+	puts("                         <function>[:<pc>][,<condition>], eg fib:10,local0<2");
+	puts("  -w,  -watch <spec>   Stop when a local changes. Implies -debug. <spec> is");
+	puts("                         <function>:<local>");
 	puts("");
 	puts("Note, Unix style double dash specifiers (eg, --help) are also accepted.");
 	exit(EXIT_SUCCESS);
@@ -113,9 +278,10 @@ void print_version()
 }
 
 
-char* get_commandline(int* commandline, int argc, char** argv)
+char* get_commandline(Dexe_Info* info, int argc, char** argv)
 {
 	char* ptr = NULL;
+	int* commandline = &info->commandline;
 
 	for(int i = 1; i < argc; i++)
 	{
@@ -142,6 +308,22 @@ char* get_commandline(int* commandline, int argc, char** argv)
 			{
 				*commandline |= COMMANDLINE_DECOMPILE | COMMANDLINE_DUMP;
 			}
+			else if(!strcmp(argv[i], "--decompile-format") || !strcmp(argv[i], "-decompile-format") || !strcmp(argv[i], "-df"))
+			{
+				if(i + 1 < argc && !strcmp(argv[i + 1], "text"))
+					info->decompile_format = DISASSEMBLY_TEXT;
+				else if(i + 1 < argc && !strcmp(argv[i + 1], "json"))
+					info->decompile_format = DISASSEMBLY_JSON;
+				else if(i + 1 < argc && !strcmp(argv[i + 1], "tsv"))
+					info->decompile_format = DISASSEMBLY_TSV;
+				else
+				{
+					printf("%s warning: '%s' needs text, json or tsv, ignoring it\n\n", argv[0], argv[i]);
+					continue;
+				}
+				*commandline |= COMMANDLINE_DECOMPILE | COMMANDLINE_DUMP;
+				i++;
+			}
 			else if(!strcmp(argv[i], "--silent") ||  !strcmp(argv[i], "-silent") || !strcmp(argv[i], "-s"))
 			{
 				*commandline |= COMMANDLINE_SILENT;
@@ -150,6 +332,220 @@ char* get_commandline(int* commandline, int argc, char** argv)
 			{
 				*commandline |= COMMANDLINE_VERBOSE;
 			}
+			else if(!strcmp(argv[i], "--memoize") || !strcmp(argv[i], "-memoize") || !strcmp(argv[i], "-mm"))
+			{
+				*commandline |= COMMANDLINE_MEMOIZE;
+			}
+			else if(!strcmp(argv[i], "--profile") || !strcmp(argv[i], "-profile") || !strcmp(argv[i], "-pf"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_PROFILE;
+					info->profile_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--perf-counters") || !strcmp(argv[i], "-perf-counters") || !strcmp(argv[i], "-pc"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_COUNTERS;
+					info->counters_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--layout") || !strcmp(argv[i], "-layout") || !strcmp(argv[i], "-lo"))
+			{
+				if(i + 1 < argc)
+					info->layout_filename = argv[++i];
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--trace") || !strcmp(argv[i], "-trace") || !strcmp(argv[i], "-tr"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_TRACE;
+					info->trace_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--trace-top") || !strcmp(argv[i], "-trace-top") || !strcmp(argv[i], "-tt"))
+			{
+				*commandline |= COMMANDLINE_TRACE_TOP;
+			}
+			else if(!strcmp(argv[i], "--trace-size") || !strcmp(argv[i], "-trace-size") || !strcmp(argv[i], "-ts"))
+			{
+				if(i + 1 < argc)
+					info->trace_size = strtoul(argv[++i], NULL, 0);
+				else
+					printf("%s warning: '%s' needs a number of records, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--trace-dump") || !strcmp(argv[i], "-trace-dump") || !strcmp(argv[i], "-td"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_TRACE_DUMP;
+					info->trace_dump_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--metrics") || !strcmp(argv[i], "-metrics") || !strcmp(argv[i], "-mt"))
+			{
+				if(i + 1 < argc && !strncmp(argv[i + 1], "fd:", 3) && metrics_descriptor(argv[i + 1]) < 0)
+				{
+					printf("%s warning: '%s' needs a descriptor number after fd:, ignoring it\n\n", argv[0], argv[i]);
+					i++;
+				}
+				else if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_METRICS;
+					info->metrics_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--metrics-format") || !strcmp(argv[i], "-metrics-format") || !strcmp(argv[i], "-mf"))
+			{
+				if(i + 1 < argc && !strcmp(argv[i + 1], "json"))
+					info->metrics_format = METRICS_FORMAT_JSON;
+				else if(i + 1 < argc && !strcmp(argv[i + 1], "prometheus"))
+					info->metrics_format = METRICS_FORMAT_PROMETHEUS;
+				else
+				{
+					printf("%s warning: '%s' needs json or prometheus, ignoring it\n\n", argv[0], argv[i]);
+					continue;
+				}
+				i++;
+			}
+			else if(!strcmp(argv[i], "--convert") || !strcmp(argv[i], "-convert") || !strcmp(argv[i], "-cv") ||
+					!strcmp(argv[i], "--expand") || !strcmp(argv[i], "-expand") || !strcmp(argv[i], "-ex"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_CONVERT;
+					info->convert_compact = argv[i][strspn(argv[i], "-")] == 'c';
+					info->convert_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--threads") || !strcmp(argv[i], "-threads") || !strcmp(argv[i], "-th"))
+			{
+				if(i + 1 < argc)
+					info->threads = atoi(argv[++i]);
+				else
+					printf("%s warning: '%s' needs a number of threads, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--auto-parallel") || !strcmp(argv[i], "-auto-parallel") || !strcmp(argv[i], "-ap"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_AUTO_PARALLEL;
+					info->parallel_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--parallel-threshold") || !strcmp(argv[i], "-parallel-threshold") || !strcmp(argv[i], "-pt"))
+			{
+				if(i + 1 < argc)
+					info->parallel_threshold = strtoul(argv[++i], NULL, 0);
+				else
+					printf("%s warning: '%s' needs a number of instructions, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--batch") || !strcmp(argv[i], "-batch") || !strcmp(argv[i], "-bt"))
+			{
+				if(i + 1 < argc)
+				{
+					info->batch_function = argv[++i];
+					*commandline |= COMMANDLINE_BATCH;
+				}
+				else
+					printf("%s warning: '%s' needs a function, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--no-registers") || !strcmp(argv[i], "-no-registers") || !strcmp(argv[i], "-nr"))
+			{
+				*commandline |= COMMANDLINE_NO_REGISTERS;
+			}
+			else if(!strcmp(argv[i], "--snapshot-at-first-in") || !strcmp(argv[i], "-snapshot-at-first-in") || !strcmp(argv[i], "-ss"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_SNAPSHOT;
+					info->snapshot_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--restore") || !strcmp(argv[i], "-restore") || !strcmp(argv[i], "-rs"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_RESTORE;
+					info->restore_filename = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a file name, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--cache") || !strcmp(argv[i], "-cache") || !strcmp(argv[i], "-ca"))
+			{
+				if(i + 1 < argc)
+				{
+					*commandline |= COMMANDLINE_CACHE;
+					info->cache_directory = argv[++i];
+				}
+				else
+					printf("%s warning: '%s' needs a directory, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--cache-size") || !strcmp(argv[i], "-cache-size") || !strcmp(argv[i], "-cs"))
+			{
+				if(i + 1 < argc)
+					info->cache_size = strtoull(argv[++i], NULL, 0);
+				else
+					printf("%s warning: '%s' needs a number of bytes, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--library-path") || !strcmp(argv[i], "-library-path") || !strcmp(argv[i], "-lp"))
+			{
+				if(i + 1 < argc)
+					info->library_path = argv[++i];
+				else
+					printf("%s warning: '%s' needs a list of directories, ignoring it\n\n", argv[0], argv[i]);
+			}
+			else if(!strcmp(argv[i], "--break") || !strcmp(argv[i], "-break") || !strcmp(argv[i], "-b") ||
+					!strcmp(argv[i], "--watch") || !strcmp(argv[i], "-watch") || !strcmp(argv[i], "-w"))
+			{
+				int watch = argv[i][strspn(argv[i], "-")] == 'w';
+				
+				if(i + 1 >= argc)
+				{
+					printf("%s warning: '%s' needs a location, ignoring it\n\n", argv[0], argv[i]);
+					continue;
+				}
+				
+				//there can't be more specs than arguments
+				if(info->breakpoint_specs == NULL)
+				{
+					info->breakpoint_specs = (char**)malloc(argc * sizeof(char*));
+					info->watchpoint_specs = (char**)malloc(argc * sizeof(char*));
+					if(info->breakpoint_specs == NULL || info->watchpoint_specs == NULL)
+					{
+						puts("Could not allocate memory for the breakpoints");
+						exit(ALLOCATION_ERROR_IN_MAIN);
+					}
+				}
+				
+				if(watch)
+					info->watchpoint_specs[info->number_of_watchpoint_specs++] = argv[++i];
+				else
+					info->breakpoint_specs[info->number_of_breakpoint_specs++] = argv[++i];
+				
+				*commandline |= COMMANDLINE_DEBUG | COMMANDLINE_VERBOSE;
+			}
 			else
 			{
 				printf("%s warning: ignoring unrecognized option '%s'\n\n", argv[0], argv[i]);
@@ -178,11 +574,39 @@ void handle_commandline(Executable* exe)
 	}
 	else if(exe->info->commandline & COMMANDLINE_DUMP)
 	{
-		dexe_read(exe);
-		dump(exe);
-		if(exe->info->commandline & COMMANDLINE_DECOMPILE)
+		dexe_load(exe);
+		memo_analyze(exe);
+		
+		//the machine readable formats are the code alone
+		if(exe->info->decompile_format == DISASSEMBLY_TEXT)
+			dump(exe);
+		
+		if(exe->info->commandline & COMMANDLINE_DECOMPILE && disassemble(exe, stdout, exe->info->decompile_format))
+			error(exe, ALLOCATION_ERROR_IN_MAIN, "Could not decompile '%s'", exe->info->filename);
+		free_memory(exe);
+		exit(EXIT_SUCCESS);
+	}
+	else if(exe->info->commandline & COMMANDLINE_CONVERT)
+	{
+		char message[WRITE_MESSAGE_SIZE];
+		
+		dexe_load(exe);
+		if(dexe_write(exe, exe->info->convert_filename, exe->info->convert_compact, message))
+		{
+			printf("Could not convert '%s': %s\n", exe->info->filename, message);
+			free_memory(exe);
+			exit(FILE_ERROR);
+		}
+		free_memory(exe);
+		exit(EXIT_SUCCESS);
+	}
+	else if(exe->info->commandline & COMMANDLINE_TRACE_DUMP)
+	{
+		if(trace_dump(exe, exe->info->trace_dump_filename))
 		{
-			decompile(exe);
+			printf("'%s' is not a dexe trace or could not be read\n", exe->info->trace_dump_filename);
+			free_memory(exe);
+			exit(FILE_ERROR);
 		}
 		free_memory(exe);
 		exit(EXIT_SUCCESS);
@@ -214,138 +638,57 @@ void dump(Executable* exe)
 		printf("  [Function %d]\n", i);
 	
 		if(exe->flags & DEXE_FLAGS_DEBUG)
-			printf("    Function name: %s\n", exe->functions[i].function_name);
+			printf("    Function name: %s\n", exe->debug[i].function_name);
 		printf("    Argument count: %d\n", exe->functions[i].arg_count);
 		
 		for(int k = 0; k < exe->functions[i].arg_count && exe->flags & DEXE_FLAGS_DEBUG; k++)
-			printf("      %d) %s\n",k,exe->functions[i].arg_names[k]);
+			printf("      %d) %s\n",k,exe->debug[i].arg_names[k]);
 			
 		printf("    Locals count: %d\n", exe->functions[i].local_count);
 		
 		for(int k = 0; k < exe->functions[i].local_count && exe->flags & DEXE_FLAGS_DEBUG; k++)
-			printf("      %d) %s\n", k, exe->functions[i].local_names[k]);
+			printf("      %d) %s\n", k, exe->debug[i].local_names[k]);
+		
+		printf("    Size of code: %d\n", exe->functions[i].size_of_instructions);
+		printf("    Pure: %s\n", exe->functions[i].attributes & FUNCTION_ATTRIBUTE_PURE ? "yes" : "no");
 		
-		printf("    Size of code: %d\n\n", exe->functions[i].size_of_instructions);
+		if(exe->functions[i].attributes & FUNCTION_ATTRIBUTE_VERIFIED)
+			puts("    Verified: yes\n");
+		else
+		{
+			char message[VERIFY_MESSAGE_SIZE];
+			verify_function(exe, i, message);
+			printf("    Verified: no. %s\n\n", message);
+		}
 	}
-	puts("\nEnd dump");
-}
-void decompile(Executable* exe)
-{
-	puts("\nDecompiled code:\n");
-
-	int has_debug_symbols = exe->flags & DEXE_FLAGS_DEBUG;
 	
-	for(int i = 0; i < exe->number_of_functions; i++)
+	if(exe->number_of_exports > 0)
 	{
-		if(has_debug_symbols)
-		{
-			//maximum possible string length is 66,560, but I doubt anyone will have 255 
-			//arguments with a length of 255 characters. This buffer can handle a maximum of 15 arguments
-			
-			//I guess making this a call to malloc instead would be better.
-			char buffer[4096] = "";
-			
-			if(exe->functions[i].arg_count > 0)
-			{
-				sprintf(buffer, "int %s", exe->functions[i].arg_names[0]);
-				
-				for(int x = 1; x < exe->functions[i].arg_count; x++)
-					sprintf(buffer, "%s, int %s", buffer, exe->functions[i].arg_names[x]);
-			}
-			printf("function %s (%s):\n", exe->functions[i].function_name, buffer);
-		}
-		else
-			printf("function %d (int[%d]):\n", i, exe->functions[i].arg_count);
-			
-		for(int k = 0; k < exe->functions[i].size_of_instructions; k++)
+		printf("Exports: %d\n", exe->number_of_exports);
+		for(int i = 0; i < exe->number_of_exports; i++)
+			printf("  %s = Function %d\n", exe->exports[i].name, exe->exports[i].function_id);
+	}
+	if(exe->number_of_imports > 0)
+	{
+		printf("%sImports: %d\n", exe->number_of_exports > 0 ? "\n" : "", exe->number_of_imports);
+		for(int i = 0; i < exe->number_of_imports; i++)
+			printf("  Function %d = %s from %s\n", exe->number_of_functions + i, exe->imports[i].name, exe->imports[i].library);
+	}
+	if(exe->number_of_constants > 0)
+	{
+		printf("%sConstants: %d\n", exe->number_of_exports > 0 || exe->number_of_imports > 0 ? "\n" : "", exe->number_of_constants);
+		for(int i = 0; i < exe->number_of_constants; i++)
 		{
-			char opcode = exe->functions[i].instructions[k];
-			
-			if(opcode < 0 || opcode > Ret)
-			{
-				puts("UNKNOWN");
-				continue;
-			}
-		
-			Opcode instruct = get_opcode_from_instruction(opcode);
+			//strings are shown up to the first unprintable byte
+			int shown = 0;
+			while(shown < exe->constants[i].size && shown < 48 && isprint((unsigned char)exe->constants[i].data[shown]))
+				shown++;
 			
-			switch(instruct.opcode)
-			{
-				case Nop:
-				case Break:
-				case Dup:
-				case Pop:
-				case Inc:
-				case Dec:
-				case Add:
-				case Sub:
-				case Mul:
-				case Div:
-				case Rem:
-				case And:
-				case Or:
-				case Xor:
-				case Not:
-				case Neg:
-				case Shl:
-				case Shr:
-				case Cmp:
-				case In:
-				case Out:
-				case Ret:
-					printf("  %s\n", instruct.mnemonic);
-					break;
-					
-				case Jmp:
-				case Je:
-				case Jne:
-				case Jg:
-				case Jge:
-				case Jl:
-				case Jle:
-					printf("  %s %d\n", instruct.mnemonic, bytes_to_int(exe->functions[i].instructions + k + 1));
-					k += 4;
-					break;
-					
-				case Call:
-					if(has_debug_symbols)
-					{
-						int id = bytes_to_int(exe->functions[i].instructions + k + 1);
-						char* name;
-						
-						if(id < 0 || id > exe->number_of_functions)
-							name = "UNKNOWN";
-						else
-							name = exe->functions[i].function_name;
-
-						printf("  %s %d [%s]\n", instruct.mnemonic, id, name);
-					}
-					else
-						printf("  %s %d\n", instruct.mnemonic, bytes_to_int(exe->functions[i].instructions + k + 1));
-					
-					k += 4;
-					break;
-					
-				case Push:
-					printf("  %s 0x%X\n", instruct.mnemonic, bytes_to_int(exe->functions[i].instructions + k + 1));
-					k += 4;
-					break;
-					
-				case Load:
-				case Store:
-					if(has_debug_symbols)
-					{
-						int id = exe->functions[i].instructions[++k];
-						char* name = (id < 0 || id > exe->functions[i].local_count ? "UNKNOWN" : exe->functions[i].local_names[id]);
-						
-						printf("  %s 0x%X [%s]\n", instruct.mnemonic, id, name);
-					}
-					else
-						printf("  %s 0x%X\n", instruct.mnemonic, exe->functions[i].instructions[++k]);
-					break;
-			}
+			printf("  %d: %d bytes \"%.*s\"%s", i, exe->constants[i].size, shown, exe->constants[i].data, shown < exe->constants[i].size ? "..." : "");
+			if(exe->constants[i].size == 4)
+				printf(" = %d", bytes_to_int(exe->constants[i].data));
+			putchar('\n');
 		}
-		puts("end\n");
 	}
-	puts("\nEnd decompile");
-}
\ No newline at end of file
+	puts("\nEnd dump");
+}
@@ -0,0 +1,213 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_memo.h"
+
+/*
+	Purity analysis. A function is pure when it never touches the outside world
+	(no I/O, Break or heap access) and only calls other pure functions. Its return value
+	then depends on nothing but its arguments, so it can be cached.
+	
+	Recursion is fine: every function starts out as pure and is only demoted
+	once it is proven to be impure, so cycles in the call graph stay pure.
+*/
+static int is_locally_pure(Executable* exe, Executable_Function* function)
+{
+	for(int k = 0; k < function->size_of_instructions; k++)
+	{
+		unsigned char opcode = function->instructions[k];
+		
+		if(opcode > LAST_OPCODE || IS_IO_OPCODE(opcode) || opcode == Break || IS_HEAP_OPCODE(opcode) || IS_TASK_OPCODE(opcode) || IS_COROUTINE_OPCODE(opcode))
+			return 0;
+		
+		int parameter_size = get_opcode_from_instruction(opcode).parameter_size;
+		
+		if(k + parameter_size >= function->size_of_instructions)
+			return 0;
+		
+		if(opcode == Call)
+		{
+			int id = bytes_to_int(function->instructions + k + 1);
+			if(id < 0 || id >= exe->number_of_functions)
+				return 0;
+		}
+		
+		k += parameter_size;
+	}
+	
+	return 1;
+}
+
+static int calls_impure_function(Executable* exe, Executable_Function* function)
+{
+	for(int k = 0; k < function->size_of_instructions; k++)
+	{
+		unsigned char opcode = function->instructions[k];
+		
+		if(opcode == Call && !(exe->functions[bytes_to_int(function->instructions + k + 1)].attributes & FUNCTION_ATTRIBUTE_PURE))
+			return 1;
+		
+		k += get_opcode_from_instruction(opcode).parameter_size;
+	}
+	
+	return 0;
+}
+
+void memo_analyze(Executable* exe)
+{
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		if(is_locally_pure(exe, &exe->functions[i]))
+			exe->functions[i].attributes |= FUNCTION_ATTRIBUTE_PURE;
+		else
+			exe->functions[i].attributes &= ~FUNCTION_ATTRIBUTE_PURE;
+	}
+	
+	//propagate impurity up the call graph until nothing changes
+	int changed;
+	do
+	{
+		changed = 0;
+		
+		for(int i = 0; i < exe->number_of_functions; i++)
+		{
+			if(exe->functions[i].attributes & FUNCTION_ATTRIBUTE_PURE && calls_impure_function(exe, &exe->functions[i]))
+			{
+				exe->functions[i].attributes &= ~FUNCTION_ATTRIBUTE_PURE;
+				changed = 1;
+			}
+		}
+	} while(changed);
+}
+
+
+int memo_init(Executable* exe)
+{
+	memo_analyze(exe);
+	
+	exe->memo = (Memo_Cache*)malloc(sizeof(Memo_Cache));
+	if(exe->memo == NULL)
+		return 1;
+	
+	//calloc so that the table is only committed as it is used
+	exe->memo->entries = (Memo_Entry*)calloc(MEMO_DEFAULT_CAPACITY, sizeof(Memo_Entry));
+	if(exe->memo->entries == NULL)
+	{
+		free(exe->memo);
+		exe->memo = NULL;
+		return 1;
+	}
+	
+	exe->memo->capacity = MEMO_DEFAULT_CAPACITY;
+	exe->memo->hits = 0;
+	exe->memo->misses = 0;
+	
+	return 0;
+}
+void memo_free(Executable* exe)
+{
+	if(exe->memo != NULL)
+	{
+		free(exe->memo->entries);
+		free(exe->memo);
+		
+		exe->memo = NULL;
+	}
+}
+
+
+static unsigned int memo_hash(int function_id, long* args, int arg_count)
+{
+	//FNV-1a over the function id and the arguments, folded down at the end
+	unsigned long long hash = 14695981039346656037ULL ^ (unsigned int)function_id;
+	
+	for(int i = 0; i < arg_count; i++)
+		hash = (hash ^ (unsigned long)args[i]) * 1099511628211ULL;
+	
+	return (unsigned int)(hash ^ (hash >> 32));
+}
+
+//args must hold exactly functions[function_id].arg_count values, in the order they were pushed
+int memo_lookup(Executable* exe, int function_id, long* args, long* result)
+{
+	Memo_Cache* cache = exe->memo;
+	int arg_count = exe->functions[function_id].arg_count;
+	unsigned int mask = cache->capacity - 1;
+	unsigned int hash = memo_hash(function_id, args, arg_count);
+	
+	for(unsigned int i = 0; i < MEMO_PROBE_LIMIT; i++)
+	{
+		Memo_Entry* entry = &cache->entries[(hash + i) & mask];
+		
+		if(entry->key == 0)
+			break;
+		
+		if(entry->key == function_id + 1 && !memcmp(entry->args, args, arg_count * sizeof(long)))
+		{
+			*result = entry->result;
+			cache->hits++;
+			return 1;
+		}
+	}
+	
+	cache->misses++;
+	return 0;
+}
+void memo_insert(Executable* exe, int function_id, long* args, long result)
+{
+	Memo_Cache* cache = exe->memo;
+	int arg_count = exe->functions[function_id].arg_count;
+	unsigned int mask = cache->capacity - 1;
+	unsigned int hash = memo_hash(function_id, args, arg_count);
+	
+	//take the first free slot in the probe window. If there is none, the table
+	//is full around here and the home slot gets evicted to keep it bounded
+	Memo_Entry* entry = &cache->entries[hash & mask];
+	
+	for(unsigned int i = 0; i < MEMO_PROBE_LIMIT; i++)
+	{
+		Memo_Entry* candidate = &cache->entries[(hash + i) & mask];
+		
+		if(candidate->key == 0)
+		{
+			entry = candidate;
+			break;
+		}
+	}
+	
+	entry->key = function_id + 1;
+	entry->result = result;
+	memcpy(entry->args, args, arg_count * sizeof(long));
+}
+
+void memo_print_statistics(Executable* exe)
+{
+	int pure = 0;
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+		if(exe->functions[i].attributes & FUNCTION_ATTRIBUTE_PURE)
+			pure++;
+	
+	printf("\nMemoization: %d of %d functions are pure. %lu hits, %lu misses\n", pure, exe->number_of_functions, exe->memo->hits, exe->memo->misses);
+}
@@ -0,0 +1,60 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+//the number of entries must be a power of 2
+#define MEMO_DEFAULT_CAPACITY 65536
+#define MEMO_MAX_ARGS 8
+#define MEMO_PROBE_LIMIT 8
+
+
+struct Memo_Entry_struct
+{
+	int key; //function id + 1, so a zeroed entry is an empty slot
+	long result;
+	long args[MEMO_MAX_ARGS];
+};
+typedef struct Memo_Entry_struct Memo_Entry;
+
+struct Memo_Cache_struct
+{
+	unsigned int capacity;
+	Memo_Entry* entries;
+	
+	unsigned long hits;
+	unsigned long misses;
+};
+typedef struct Memo_Cache_struct Memo_Cache;
+
+
+extern void memo_analyze(Executable*);
+
+extern int memo_init(Executable*);
+extern void memo_free(Executable*);
+
+extern int memo_lookup(Executable*, int, long*, long*);
+extern void memo_insert(Executable*, int, long*, long);
+
+extern void memo_print_statistics(Executable*);
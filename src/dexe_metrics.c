@@ -0,0 +1,304 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_metrics.h"
+
+#include <limits.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <psapi.h>
+	#include <io.h>
+	#include <fcntl.h>
+	
+	#define ftruncate _chsize
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <signal.h>
+	#include <time.h>
+	#include <sys/resource.h>
+#endif
+
+/*
+	Reports are built with the append functions below instead of printf, and written
+	with write(), so the SIGUSR1 handler can produce one in the middle of a run. An
+	output given as fd:<n> (or - for stdout) gets one report appended per write. A
+	file is rewritten each time, so it always holds just the latest numbers.
+	
+	On stdout the final report comes after everything the program printed, which is
+	flushed first. A report from SIGUSR1 can't flush, so it may come out ahead of
+	output that is still buffered.
+*/
+struct Metrics_Buffer_struct
+{
+	char data[METRICS_BUFFER_SIZE];
+	int length;
+};
+typedef struct Metrics_Buffer_struct Metrics_Buffer;
+
+static Executable* metrics_exe;
+static int metrics_fd = -1;
+static int metrics_rewrite;
+static int metrics_format;
+
+
+unsigned long long metrics_now()
+{
+	#ifdef _WIN32
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL + (unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+	#else
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+	#endif
+}
+
+static unsigned long long peak_rss()
+{
+	#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return 0;
+		return counters.PeakWorkingSetSize;
+	#else
+		struct rusage usage;
+		if(getrusage(RUSAGE_SELF, &usage))
+			return 0;
+		#ifdef __APPLE__
+			return (unsigned long long)usage.ru_maxrss;
+		#else
+			return (unsigned long long)usage.ru_maxrss * 1024;
+		#endif
+	#endif
+}
+
+#ifndef _WIN32
+static void metrics_signal_handler(int signal_number)
+{
+	if(metrics_exe != NULL)
+		metrics_write(metrics_exe);
+}
+#endif
+
+
+static void append_string(Metrics_Buffer* buffer, const char* string)
+{
+	while(*string != '\0' && buffer->length < METRICS_BUFFER_SIZE)
+		buffer->data[buffer->length++] = *string++;
+}
+static void append_json_string(Metrics_Buffer* buffer, const char* string)
+{
+	append_string(buffer, "\"");
+	for(; *string != '\0' && buffer->length < METRICS_BUFFER_SIZE - 2; string++)
+	{
+		if(*string == '"' || *string == '\\')
+			buffer->data[buffer->length++] = '\\';
+		if((unsigned char)*string >= ' ')
+			buffer->data[buffer->length++] = *string;
+	}
+	append_string(buffer, "\"");
+}
+static void append_number(Metrics_Buffer* buffer, unsigned long long number)
+{
+	char digits[20];
+	int count = 0;
+	
+	do
+	{
+		digits[count++] = (char)('0' + number % 10);
+		number /= 10;
+	} while(number != 0);
+	
+	while(count > 0 && buffer->length < METRICS_BUFFER_SIZE)
+		buffer->data[buffer->length++] = digits[--count];
+}
+static void append_seconds(Metrics_Buffer* buffer, unsigned long long nanoseconds)
+{
+	unsigned long long fraction = nanoseconds % 1000000000ULL;
+	char digits[10];
+	
+	append_number(buffer, nanoseconds / 1000000000ULL);
+	
+	digits[0] = '.';
+	for(int i = 9; i > 0; i--)
+	{
+		digits[i] = (char)('0' + fraction % 10);
+		fraction /= 10;
+	}
+	for(int i = 0; i < 10 && buffer->length < METRICS_BUFFER_SIZE; i++)
+		buffer->data[buffer->length++] = digits[i];
+}
+
+static void append_metric(Metrics_Buffer* buffer, const char* name, const char* type, unsigned long long value, int seconds)
+{
+	if(metrics_format == METRICS_FORMAT_PROMETHEUS)
+	{
+		append_string(buffer, "# TYPE dexe_");
+		append_string(buffer, name);
+		append_string(buffer, " ");
+		append_string(buffer, type);
+		append_string(buffer, "\ndexe_");
+		append_string(buffer, name);
+		append_string(buffer, " ");
+	}
+	else
+	{
+		append_string(buffer, ",\"");
+		append_string(buffer, name);
+		append_string(buffer, "\":");
+	}
+	
+	if(seconds)
+		append_seconds(buffer, value);
+	else
+		append_number(buffer, value);
+	
+	if(metrics_format == METRICS_FORMAT_PROMETHEUS)
+		append_string(buffer, "\n");
+}
+
+
+//the descriptor of an output given as fd:<n>, or -1 if <n> isn't a plain number
+int metrics_descriptor(char* output)
+{
+	char* end;
+	long fd;
+	
+	if(strncmp(output, "fd:", 3) || output[3] < '0' || output[3] > '9')
+		return -1;
+	
+	fd = strtol(output + 3, &end, 10);
+	if(*end != '\0' || fd > INT_MAX)
+		return -1;
+	return (int)fd;
+}
+
+int metrics_init(Executable* exe, char* output, int format)
+{
+	if(!strcmp(output, "-"))
+		metrics_fd = 1;
+	else if(!strncmp(output, "fd:", 3))
+		metrics_fd = metrics_descriptor(output);
+	else
+	{
+		metrics_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		metrics_rewrite = 1;
+	}
+	
+	if(metrics_fd < 0)
+		return 1;
+	
+	metrics_exe = exe;
+	metrics_format = format;
+	
+	#ifndef _WIN32
+		signal(SIGUSR1, metrics_signal_handler);
+	#endif
+	
+	return 0;
+}
+
+//writes the final report. free_memory calls this, so error() reports too
+void metrics_free(Executable* exe)
+{
+	if(metrics_exe != exe || metrics_fd < 0)
+		return;
+	
+	#ifndef _WIN32
+		signal(SIGUSR1, SIG_DFL);
+	#endif
+	
+	if(metrics_fd == 1)
+		fflush(stdout);
+	metrics_write(exe);
+	
+	if(metrics_rewrite)
+		close(metrics_fd);
+	
+	metrics_exe = NULL;
+	metrics_fd = -1;
+	metrics_rewrite = 0;
+}
+
+void metrics_write(Executable* exe)
+{
+	Metrics_Buffer buffer;
+	Metrics* metrics = &exe->metrics;
+	unsigned long long now = metrics_now();
+	
+	if(metrics_fd < 0)
+		return;
+	
+	//the depth is otherwise only sampled at calls, so include wherever the running frame is now
+	if(exe->call_stack.stack_elements != NULL && exe->call_stack.stack_pointer > 0)
+	{
+		stack* top = &((Stack_Frame*)exe->call_stack.stack_elements[exe->call_stack.stack_pointer - 1])->stack;
+		if(top->stack_elements + top->stack_pointer - exe->operand_stack.stack_elements > metrics->max_operand_depth)
+			metrics->max_operand_depth = (int)(top->stack_elements + top->stack_pointer - exe->operand_stack.stack_elements);
+	}
+	
+	buffer.length = 0;
+	
+	if(metrics_format == METRICS_FORMAT_JSON)
+	{
+		append_string(&buffer, "{\"image\":");
+		append_json_string(&buffer, exe->info != NULL && exe->info->filename != NULL ? exe->info->filename : "");
+	}
+	
+	append_metric(&buffer, "instructions_total", "counter", metrics->instructions, 0);
+	append_metric(&buffer, "calls_total", "counter", metrics->calls, 0);
+	append_metric(&buffer, "returns_total", "counter", metrics->returns, 0);
+	append_metric(&buffer, "max_call_depth", "gauge", (unsigned long long)metrics->max_call_depth, 0);
+	append_metric(&buffer, "max_operand_depth", "gauge", (unsigned long long)metrics->max_operand_depth, 0);
+	append_metric(&buffer, "loader_bytes", "gauge", metrics->loader_bytes, 0);
+	append_metric(&buffer, "frame_bytes_total", "counter", metrics->frame_bytes, 0);
+	append_metric(&buffer, "stack_reserved_bytes", "gauge", metrics->stack_bytes, 0);
+	append_metric(&buffer, "peak_rss_bytes", "gauge", peak_rss(), 0);
+	append_metric(&buffer, "load_seconds", "gauge", metrics->load_time, 1);
+	append_metric(&buffer, "execution_seconds", "gauge", metrics->execute_start ? now - metrics->execute_start : 0, 1);
+	
+	if(metrics_format == METRICS_FORMAT_JSON)
+		append_string(&buffer, "}\n");
+	
+	if(metrics_rewrite)
+	{
+		lseek(metrics_fd, 0, SEEK_SET);
+		if(ftruncate(metrics_fd, 0))
+		{
+			//the old report is overwritten below anyway
+		}
+	}
+	
+	for(int written = 0, result; written < buffer.length; written += result)
+		if((result = (int)write(metrics_fd, buffer.data + written, buffer.length - written)) <= 0)
+			break;
+}
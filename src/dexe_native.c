@@ -0,0 +1,188 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_stack.h"
+#include "dexe_profile.h"
+#include "dexe_debugger.h"
+#include "dexe_native.h"
+
+//arguments are ints like everything else on the stack, and so are the results, wrapping around
+static int native_abs(Executable* exe, long* args)
+{
+	int x = (int)args[0];
+	
+	return x < 0 ? (int)(0u - (unsigned int)x) : x;
+}
+
+static int native_min(Executable* exe, long* args)
+{
+	return (int)args[0] < (int)args[1] ? (int)args[0] : (int)args[1];
+}
+
+static int native_max(Executable* exe, long* args)
+{
+	return (int)args[0] > (int)args[1] ? (int)args[0] : (int)args[1];
+}
+
+//of the magnitudes, gcd(0, 0) is 0
+static int native_gcd(Executable* exe, long* args)
+{
+	unsigned int a = (int)args[0] < 0 ? 0u - (unsigned int)args[0] : (unsigned int)args[0];
+	unsigned int b = (int)args[1] < 0 ? 0u - (unsigned int)args[1] : (unsigned int)args[1];
+	
+	while(b != 0)
+	{
+		unsigned int rest = a % b;
+		a = b;
+		b = rest;
+	}
+	
+	return (int)a;
+}
+
+//by squaring
+static int native_pow(Executable* exe, long* args)
+{
+	unsigned int base = (unsigned int)args[0];
+	int exponent = (int)args[1];
+	unsigned int result = 1;
+	
+	if(exponent < 0)
+		error(exe, NATIVE_DOMAIN_ERROR, "pow was given the negative exponent %d", exponent);
+	
+	for(; exponent != 0; exponent >>= 1)
+	{
+		if(exponent & 1)
+			result *= base;
+		base *= base;
+	}
+	
+	return (int)result;
+}
+
+//rounded down, one bit of the root at a time
+static int native_isqrt(Executable* exe, long* args)
+{
+	int x = (int)args[0];
+	unsigned int rest = (unsigned int)x;
+	unsigned int root = 0;
+	unsigned int bit = 1u << 30;
+	
+	if(x < 0)
+		error(exe, NATIVE_DOMAIN_ERROR, "isqrt was given the negative number %d", x);
+	
+	while(bit > rest)
+		bit >>= 2;
+	
+	for(; bit != 0; bit >>= 2)
+	{
+		if(rest >= root + bit)
+		{
+			rest -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+			root >>= 1;
+	}
+	
+	return (int)root;
+}
+
+static int native_popcount(Executable* exe, long* args)
+{
+	unsigned int x = (unsigned int)args[0];
+	
+	#ifdef __GNUC__
+		return __builtin_popcount(x);
+	#else
+		x = x - ((x >> 1) & 0x55555555u);
+		x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+		x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+		return (int)((x * 0x01010101u) >> 24);
+	#endif
+}
+
+//every bit of x affects every bit of the hash (MurmurHash3's finalizer)
+static int native_hash(Executable* exe, long* args)
+{
+	unsigned int x = (unsigned int)args[0];
+	
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35u;
+	x ^= x >> 16;
+	
+	return (int)x;
+}
+
+static Native natives[] =
+{
+	{ "abs",      1, native_abs,      { "x" } },
+	{ "min",      2, native_min,      { "a", "b" } },
+	{ "max",      2, native_max,      { "a", "b" } },
+	{ "gcd",      2, native_gcd,      { "a", "b" } },
+	{ "pow",      2, native_pow,      { "base", "exponent" } },
+	{ "isqrt",    1, native_isqrt,    { "x" } },
+	{ "popcount", 1, native_popcount, { "x" } },
+	{ "hash",     1, native_hash,     { "x" } }
+};
+
+//the native called name, or NULL
+Native* native_find(char* name)
+{
+	for(size_t i = 0; i < sizeof(natives) / sizeof(natives[0]); i++)
+		if(!strcmp(natives[i].name, name))
+			return &natives[i];
+	
+	return NULL;
+}
+
+/*
+	The run_function of every native. Only calls that need a frame get here: the
+	debug variants, and spawns, coroutines and dexe_call, which always push one.
+*/
+int native_run(Executable* exe)
+{
+	Stack_Frame* sf = (Stack_Frame*)stack_peek(&exe->call_stack);
+	Executable_Function* function = &exe->functions[sf->function_id];
+	long args[NATIVE_MAX_ARGS];
+	
+	sf->local_memory = NULL;
+	
+	exe->metrics.calls++;
+	if(exe->call_stack.stack_pointer > exe->metrics.max_call_depth)
+		exe->metrics.max_call_depth = exe->call_stack.stack_pointer;
+	if(exe->profile != NULL)
+		exe->profile->functions[sf->function_id].calls++;
+	
+	if(exe->debugger != NULL)
+		debugger_native(exe, sf);
+	
+	//the frame holds them last first, see stack_window
+	for(int i = 0; i < function->arg_count; i++)
+		args[i] = sf->stack.stack_elements[function->arg_count - 1 - i];
+	
+	return function->native(exe, args);
+}
@@ -0,0 +1,55 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	Native functions, C versions of helpers that are slow as bytecode. An image binds
+	one with an ordinary import from the library "native", and the linker gives it an
+	id in the function table like any library function. Its entry has no code: a Call
+	to it hands the arguments, in the order they were pushed, to the C function and
+	pushes what it returns, without a frame or locals.
+	
+	Only the debug variants call them through a frame (see native_run), so a breakpoint
+	can stop on one and the call stack shows it by name.
+*/
+
+#define NATIVE_LIBRARY  "native"
+#define NATIVE_MAX_ARGS 3
+
+typedef int (*Native_Function)(Executable*, long*);
+
+struct Native_struct
+{
+	char* name;
+	int arg_count;
+	Native_Function function;
+	char* arg_names[NATIVE_MAX_ARGS];
+};
+typedef struct Native_struct Native;
+
+
+extern Native* native_find(char*);
+
+extern int native_run(Executable*);
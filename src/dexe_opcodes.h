@@ -56,51 +56,139 @@ enum Instruction_Enum
 	In    = 0x1D,
 	Out   = 0x1E,
 	Call  = 0x1F,
-	Ret   = 0x20
+	Ret   = 0x20,
+	
+	//the heap, see dexe_heap.h. Addresses are int indexes into it
+	Alloc = 0x21,
+	Ldi   = 0x22,
+	Sti   = 0x23,
+	Reset = 0x24,
+	
+	//bulk operations on ranges of the heap, see dexe_vector.h
+	Fill  = 0x25,
+	Copy  = 0x26,
+	Sum   = 0x27,
+	Min   = 0x28,
+	Max   = 0x29,
+	Vadd  = 0x2A,
+	Vmul  = 0x2B,
+	Find  = 0x2C,
+	
+	//formatted I/O and the constant pool section
+	Outs  = 0x2D,
+	Outi  = 0x2E,
+	Ini   = 0x2F,
+	Pushk = 0x30,
+	
+	//fork/join tasks, see dexe_tasks.h
+	Spawn = 0x31,
+	Join  = 0x32,
+	
+	//stackless coroutines, see dexe_coroutines.h
+	Coroutine = 0x33,
+	Resume    = 0x34,
+	Yield     = 0x35,
+	
+	//never appears in a file. The debugger patches it over instructions that have a breakpoint
+	Trap  = 0xFE
 };
 typedef enum Instruction_Enum Instruction;
 
+//anything above this (besides Trap) is not an instruction. Compact code needs it below 0x40
+#define LAST_OPCODE Yield
+
+//instructions that read or write the heap
+#define IS_HEAP_OPCODE(opcode) ((opcode) >= Alloc && (opcode) <= Find)
+
+//instructions that read stdin or write stdout
+#define IS_IO_OPCODE(opcode) ((opcode) == In || (opcode) == Out || ((opcode) >= Outs && (opcode) <= Ini))
+
+//instructions that start or wait for a task
+#define IS_TASK_OPCODE(opcode) ((opcode) == Spawn || (opcode) == Join)
+
+//instructions that create, run or suspend a coroutine
+#define IS_COROUTINE_OPCODE(opcode) ((opcode) >= Coroutine && (opcode) <= Yield)
+
+//what -perf-counters splits its counts between, see opcode_classes
+#define OPCODE_CLASS_OTHER      0
+#define OPCODE_CLASS_STACK      1
+#define OPCODE_CLASS_ARITHMETIC 2
+#define OPCODE_CLASS_BRANCH     3
+#define OPCODE_CLASS_CALL       4
+#define OPCODE_CLASS_HEAP       5
+#define OPCODE_CLASS_VECTOR     6
+#define OPCODE_CLASS_IO         7
+#define OPCODE_CLASSES          8
+
+/*
+	Jump offsets are relative to the start of the jump instruction.
+	A call, a spawn or a coroutine pops the callee's arguments and pushes its
+	return value or a handle, the table below only describes the fixed part of
+	each instruction.
+*/
 
 struct Opcode_Struct
 {
 	Instruction opcode;
 	char* mnemonic;
 	int parameter_size;
-	int required_stack_size;
+	int required_stack_size; //items popped
+	int pushed_stack_size;   //items pushed back
 };
 typedef struct Opcode_Struct Opcode;
 
 
-static Opcode NOP   = { Nop,   "nop",   0,0};
-static Opcode BREAK = { Break, "break", 0,0};
-static Opcode LOAD  = { Load,  "load",  1,0};
-static Opcode PUSH  = { Push,  "push",  4,0};
-static Opcode STORE = { Store, "store", 1,1};
-static Opcode DUP   = { Dup,   "dup",   0,1};
-static Opcode POP   = { Pop,   "pop",   0,1};
-static Opcode INC   = { Inc,   "inc",   0,1};
-static Opcode DEC   = { Dec,   "dec",   0,1};
-static Opcode ADD   = { Add,   "add",   0,2};
-static Opcode SUB   = { Sub,   "sub",   0,2};
-static Opcode MUL   = { Mul,   "mul",   0,2};
-static Opcode DIV   = { Div,   "div",   0,2};
-static Opcode REM   = { Rem,   "rem",   0,2};
-static Opcode AND   = { And,   "and",   0,2};
-static Opcode OR    = { Or,    "or",    0,2};
-static Opcode XOR   = { Xor,   "xor",   0,2};
-static Opcode NOT   = { Not,   "not",   0,1};
-static Opcode NEG   = { Neg,   "neg",   0,1};
-static Opcode SHL   = { Shl,   "shl",   0,2};
-static Opcode SHR   = { Shr,   "shr",   0,2};
-static Opcode CMP   = { Cmp,   "cmp",   0,2};
-static Opcode JMP   = { Jmp,   "jmp",   4,0};
-static Opcode JE    = { Je,    "je",    4,0};
-static Opcode JNE   = { Jne,   "jne",   4,0};
-static Opcode JG    = { Jg,    "jg",    4,0};
-static Opcode JGE   = { Jge,   "jge",   4,0};
-static Opcode JL    = { Jl,    "jl",    4,0};
-static Opcode JLE   = { Jle,   "jle",   4,0};
-static Opcode IN    = { In,    "in",    0,0};
-static Opcode OUT   = { Out,   "out",   0,1};
-static Opcode CALL  = { Call,  "call",  4,0};
-static Opcode RET   = { Ret,   "ret",   0,1};
\ No newline at end of file
+static Opcode NOP   = { Nop,   "nop",   0,0,0};
+static Opcode BREAK = { Break, "break", 0,0,0};
+static Opcode LOAD  = { Load,  "load",  1,0,1};
+static Opcode PUSH  = { Push,  "push",  4,0,1};
+static Opcode STORE = { Store, "store", 1,1,0};
+static Opcode DUP   = { Dup,   "dup",   0,1,2};
+static Opcode POP   = { Pop,   "pop",   0,1,0};
+static Opcode INC   = { Inc,   "inc",   0,1,1};
+static Opcode DEC   = { Dec,   "dec",   0,1,1};
+static Opcode ADD   = { Add,   "add",   0,2,1};
+static Opcode SUB   = { Sub,   "sub",   0,2,1};
+static Opcode MUL   = { Mul,   "mul",   0,2,1};
+static Opcode DIV   = { Div,   "div",   0,2,1};
+static Opcode REM   = { Rem,   "rem",   0,2,1};
+static Opcode AND   = { And,   "and",   0,2,1};
+static Opcode OR    = { Or,    "or",    0,2,1};
+static Opcode XOR   = { Xor,   "xor",   0,2,1};
+static Opcode NOT   = { Not,   "not",   0,1,1};
+static Opcode NEG   = { Neg,   "neg",   0,1,1};
+static Opcode SHL   = { Shl,   "shl",   0,2,1};
+static Opcode SHR   = { Shr,   "shr",   0,2,1};
+static Opcode CMP   = { Cmp,   "cmp",   0,2,0};
+static Opcode JMP   = { Jmp,   "jmp",   4,0,0};
+static Opcode JE    = { Je,    "je",    4,0,0};
+static Opcode JNE   = { Jne,   "jne",   4,0,0};
+static Opcode JG    = { Jg,    "jg",    4,0,0};
+static Opcode JGE   = { Jge,   "jge",   4,0,0};
+static Opcode JL    = { Jl,    "jl",    4,0,0};
+static Opcode JLE   = { Jle,   "jle",   4,0,0};
+static Opcode IN    = { In,    "in",    0,0,1};
+static Opcode OUT   = { Out,   "out",   0,1,0};
+static Opcode CALL  = { Call,  "call",  4,0,1};
+static Opcode RET   = { Ret,   "ret",   0,1,0};
+static Opcode ALLOC = { Alloc, "alloc", 0,1,1}; //n -> address of n zeroed ints
+static Opcode LDI   = { Ldi,   "ldi",   0,1,1}; //address -> value
+static Opcode STI   = { Sti,   "sti",   0,2,0}; //address value ->
+static Opcode RESET = { Reset, "reset", 0,1,0}; //address -> (frees it and everything allocated after it)
+static Opcode FILL  = { Fill,  "fill",  0,3,0}; //address count value ->
+static Opcode COPY  = { Copy,  "copy",  0,3,0}; //destination source count ->
+static Opcode SUM   = { Sum,   "sum",   0,2,1}; //address count -> sum
+static Opcode MIN   = { Min,   "min",   0,2,1}; //address count -> smallest (INT_MAX when count is 0)
+static Opcode MAX   = { Max,   "max",   0,2,1}; //address count -> largest (INT_MIN when count is 0)
+static Opcode VADD  = { Vadd,  "vadd",  0,4,0}; //destination a b count ->
+static Opcode VMUL  = { Vmul,  "vmul",  0,4,0}; //destination a b count ->
+static Opcode FIND  = { Find,  "find",  0,3,1}; //address count value -> index of the first match, or -1
+static Opcode OUTS  = { Outs,  "outs",  4,0,0}; //writes constant <operand>
+static Opcode OUTI  = { Outi,  "outi",  0,1,0}; //value -> (writes it in decimal)
+static Opcode INI   = { Ini,   "ini",   0,0,1}; //-> the next decimal number read, -1 at the end of input
+static Opcode PUSHK = { Pushk, "pushk", 4,0,1}; //-> constant <operand>, which must be 4 bytes
+static Opcode SPAWN = { Spawn, "spawn", 4,0,1}; //arguments -> handle of a task calling function <operand>
+static Opcode JOIN  = { Join,  "join",  0,1,1}; //handle -> what the task's call returned
+static Opcode COROUTINE = { Coroutine, "coroutine", 4,0,1}; //arguments -> handle of a coroutine of function <operand>
+static Opcode RESUME    = { Resume,    "resume",    0,2,1}; //handle, value -> what it yielded or returned
+static Opcode YIELD     = { Yield,     "yield",     0,1,1}; //value -> the value of the next resume
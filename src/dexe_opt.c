@@ -0,0 +1,184 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+//includes
+#include "dexe_utils.h"
+#include "dexe_parser.h"
+#include "dexe_encoding.h"
+#include "dexe_writer.h"
+#include "dexe_optimizer.h"
+#include "dexe_profile.h"
+#include "dexe_layout.h"
+
+/*
+	dexe-opt. Reads an image, optimizes every verified function (see dexe_optimizer.c)
+	and writes the result as a new image. Names and sections are kept, imports are
+	not linked. Runs once at build time, so it's a separate program from dexe.
+*/
+
+//prototypes
+void print_help();
+void print_report(Optimize_Stats*);
+
+static void percent(long before, long after)
+{
+	if(before > 0)
+		printf(" (%+.1f%%)", 100.0 * (after - before) / before);
+	putchar('\n');
+}
+
+//functions
+int main(int argc, char** argv)
+{
+	Executable exe;
+	Optimize_Stats stats;
+	char message[WRITE_MESSAGE_SIZE];
+	char* output = NULL;
+	char* profile_filename = NULL;
+	Profile* profile = NULL;
+	int* order = NULL;
+	int compact = -1;
+	int verbose = 0;
+	int laid_out = 0;
+	
+	memset(&exe, 0, sizeof(Executable));
+	exe.input = stdin;
+	exe.info = (Dexe_Info*)calloc(1, sizeof(Dexe_Info));
+	if(exe.info == NULL)
+		error(&exe, ALLOCATION_ERROR_IN_MAIN, "The info struct could not be allocated.");
+	
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--help") || !strcmp(argv[i], "-help") || !strcmp(argv[i], "-h"))
+			print_help();
+		else if(!strcmp(argv[i], "--verbose") || !strcmp(argv[i], "-verbose") || !strcmp(argv[i], "-vb"))
+		{
+			verbose = 1;
+			exe.info->commandline |= COMMANDLINE_VERBOSE;
+		}
+		else if(!strcmp(argv[i], "--compact") || !strcmp(argv[i], "-compact") || !strcmp(argv[i], "-cv"))
+			compact = 1;
+		else if(!strcmp(argv[i], "--expand") || !strcmp(argv[i], "-expand") || !strcmp(argv[i], "-ex"))
+			compact = 0;
+		else if(!strcmp(argv[i], "--profile") || !strcmp(argv[i], "-profile") || !strcmp(argv[i], "-pf"))
+		{
+			if(++i >= argc)
+				print_help();
+			profile_filename = argv[i];
+		}
+		else if(argv[i][0] == '-')
+		{
+			printf("Unknown option '%s'\n", argv[i]);
+			print_help();
+		}
+		else if(exe.info->filename == NULL)
+			exe.info->filename = argv[i];
+		else if(output == NULL)
+			output = argv[i];
+		else
+			print_help();
+	}
+	
+	if(exe.info->filename == NULL || output == NULL)
+		print_help();
+	
+	dexe_load(&exe);
+	
+	//the same encoding as the input unless asked otherwise
+	if(compact < 0)
+		compact = ((exe.version >> 8) & 0xFF) >= DEXE_COMPACT_MINOR_VERSION;
+	
+	//the blocks are laid out first so the optimizer threads the jumps the layout leaves behind
+	if(profile_filename != NULL)
+	{
+		if((profile = profile_read(&exe, profile_filename)) == NULL)
+		{
+			printf("Could not read the profile '%s'\n", profile_filename);
+			free_memory(&exe);
+			exit(FILE_ERROR);
+		}
+		
+		order = (int*)malloc((exe.number_of_functions + 1) * sizeof(int));
+		if(order == NULL)
+			error(&exe, ALLOCATION_ERROR_IN_MAIN, "The layout could not be allocated.");
+		
+		layout_order(&exe, profile, order);
+		for(int i = 0; i < exe.number_of_functions; i++)
+			if(!layout_blocks(&exe, i, &profile->functions[i]))
+				laid_out++;
+	}
+	
+	optimize_executable(&exe, &stats);
+	
+	//the hot functions are written first and next to each other
+	if(order != NULL)
+	{
+		layout_renumber(&exe, order);
+		free(order);
+		profile_destroy(profile);
+	}
+	
+	if(verbose)
+		for(int i = 0; i < exe.number_of_functions; i++)
+			if(!(exe.functions[i].attributes & FUNCTION_ATTRIBUTE_VERIFIED))
+				printf("Function %d was not verified and is left as it is\n", i);
+	
+	if(dexe_write(&exe, output, compact, message))
+	{
+		printf("Could not write '%s': %s\n", output, message);
+		free_memory(&exe);
+		exit(FILE_ERROR);
+	}
+	
+	print_report(&stats);
+	if(profile_filename != NULL)
+		printf("Laid out:     %d functions\n", laid_out);
+	
+	free_memory(&exe);
+	return EXIT_SUCCESS;
+}
+
+void print_report(Optimize_Stats* stats)
+{
+	printf("Functions:    %d optimized, %d not verified\n", stats->optimized, stats->skipped);
+	printf("Instructions: %ld -> %ld", stats->instructions_before, stats->instructions_after);
+	percent(stats->instructions_before, stats->instructions_after);
+	printf("Code bytes:   %ld -> %ld", stats->bytes_before, stats->bytes_after);
+	percent(stats->bytes_before, stats->bytes_after);
+}
+
+void print_help()
+{
+	puts("Usage: dexe-opt [options] input output");
+	puts("Options:");
+	puts("  -h,  -help           Display this information");
+	puts("  -vb, -verbose        List the functions that could not be optimized");
+	puts("  -cv, -compact        Write the compact encoding (the default for compact input)");
+	puts("  -ex, -expand         Write the fixed encoding (the default for fixed input)");
+	puts("  -pf, -profile <file> Lay the code out by a profile written by dexe -profile");
+	puts("");
+	puts("Folds constants, turns multiplications by powers of two into shifts, threads");
+	puts("jumps, and removes nops, unreachable code, dead stores and pushes that are");
+	puts("popped straight away. Only verified functions are changed. With a profile,");
+	puts("hot blocks fall through to each other and hot functions are written together.");
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,506 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include <stdint.h>
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_verifier.h"
+#include "dexe_optimizer.h"
+
+/*
+	The offline optimizer behind dexe-opt. Each verified function is decoded into a
+	list of nodes and the passes below rewrite it until none of them finds anything
+	more to do. Then it's encoded again with its jumps remapped, and verified once
+	more before it replaces the original. Unverified functions are left as they
+	are, nothing is known about their stacks.
+	
+	A rewrite never merges an instruction that something jumps to into the one
+	before it, so every path through the function still sees the same effect.
+*/
+
+//one instruction. Jumps keep the node they land on instead of an offset
+struct Node_struct
+{
+	unsigned char opcode;
+	int operand;
+	int target;
+	int removed;
+};
+typedef struct Node_struct Node;
+
+//one bit per local, a byte operand can name 256 of them
+struct Local_Set_struct
+{
+	uint64_t bits[4];
+};
+typedef struct Local_Set_struct Local_Set;
+
+#define SET_HAS(set, local) ((set).bits[(local) >> 6] >> ((local) & 63) & 1)
+#define SET_ADD(set, local) ((set).bits[(local) >> 6] |= (uint64_t)1 << ((local) & 63))
+#define SET_REMOVE(set, local) ((set).bits[(local) >> 6] &= ~((uint64_t)1 << ((local) & 63)))
+
+
+static int is_jump(unsigned char opcode)
+{
+	return opcode >= Jmp && opcode <= Jle;
+}
+
+static int instruction_size(unsigned char opcode)
+{
+	return 1 + get_opcode_from_instruction((char)opcode).parameter_size;
+}
+
+//returns the number of nodes, or -1 when out of memory
+static int decode(Executable_Function* function, Node* nodes)
+{
+	char* code = function->instructions;
+	int size = function->size_of_instructions;
+	int* index = (int*)malloc((size + 1) * sizeof(int));
+	int* start = (int*)malloc((size + 1) * sizeof(int));
+	int count = 0;
+	
+	if(index == NULL || start == NULL)
+	{
+		free(index);
+		free(start);
+		return -1;
+	}
+	
+	for(int pc = 0; pc < size; pc += instruction_size((unsigned char)code[pc]), count++)
+	{
+		unsigned char opcode = (unsigned char)code[pc];
+		int parameter_size = get_opcode_from_instruction((char)opcode).parameter_size;
+		
+		index[pc] = count;
+		start[count] = pc;
+		nodes[count].opcode = opcode;
+		nodes[count].operand = parameter_size == 4 ? bytes_to_int(code + pc + 1) : parameter_size == 1 ? (unsigned char)code[pc + 1] : 0;
+		nodes[count].target = -1;
+		nodes[count].removed = 0;
+	}
+	
+	//verified, so every jump lands on the start of an instruction
+	for(int i = 0; i < count; i++)
+		if(is_jump(nodes[i].opcode))
+			nodes[i].target = index[start[i] + nodes[i].operand];
+	
+	free(index);
+	free(start);
+	return count;
+}
+
+/*
+	Drops the removed nodes. A jump to a removed node goes to the first node after
+	it that's left, which is right because everything removed had no effect.
+*/
+static int compact(Node* nodes, int count, int* remap)
+{
+	int n = 0;
+	
+	for(int i = 0; i < count; i++)
+	{
+		remap[i] = n;
+		if(!nodes[i].removed)
+			n++;
+	}
+	remap[count] = n;
+	
+	for(int i = 0; i < count; i++)
+	{
+		if(nodes[i].removed)
+			continue;
+		
+		nodes[remap[i]] = nodes[i];
+		if(is_jump(nodes[i].opcode))
+			nodes[remap[i]].target = remap[nodes[i].target];
+	}
+	
+	return n;
+}
+
+static int strip_nops(Node* nodes, int count)
+{
+	int changes = 0;
+	
+	for(int i = 0; i < count; i++)
+	{
+		if(nodes[i].opcode == Nop)
+		{
+			nodes[i].removed = 1;
+			changes++;
+		}
+	}
+	
+	return changes;
+}
+
+/*
+	A jump to a jmp goes straight to where that one goes, and a jmp to a ret is a ret.
+	A jump to the next instruction does nothing either way: jumps only read the flags.
+*/
+static int thread_jumps(Node* nodes, int count)
+{
+	int changes = 0;
+	
+	for(int i = 0; i < count; i++)
+	{
+		if(!is_jump(nodes[i].opcode))
+			continue;
+		
+		//a chain that loops back on itself is left as it is
+		int target = nodes[i].target;
+		int steps = 0;
+		while(nodes[target].opcode == Jmp && steps++ < count)
+			target = nodes[target].target;
+		if(nodes[target].opcode == Jmp)
+			target = nodes[i].target;
+		
+		if(target != nodes[i].target)
+		{
+			nodes[i].target = target;
+			changes++;
+		}
+		
+		if(nodes[i].opcode == Jmp && nodes[target].opcode == Ret)
+		{
+			nodes[i].opcode = Ret;
+			changes++;
+		}
+		else if(target == i + 1)
+		{
+			nodes[i].removed = 1;
+			changes++;
+		}
+	}
+	
+	return changes;
+}
+
+static int remove_unreachable(Node* nodes, int count, int* worklist)
+{
+	int pending = 0;
+	int changes = 0;
+	
+	for(int i = 0; i < count; i++)
+		nodes[i].removed = 1;
+	
+	nodes[0].removed = 0;
+	worklist[pending++] = 0;
+	while(pending)
+	{
+		int i = worklist[--pending];
+		int successors[2];
+		int successor_count = 0;
+		
+		if(is_jump(nodes[i].opcode))
+			successors[successor_count++] = nodes[i].target;
+		if(nodes[i].opcode != Ret && nodes[i].opcode != Jmp && i + 1 < count)
+			successors[successor_count++] = i + 1;
+		
+		for(int k = 0; k < successor_count; k++)
+		{
+			if(nodes[successors[k]].removed)
+			{
+				nodes[successors[k]].removed = 0;
+				worklist[pending++] = successors[k];
+			}
+		}
+	}
+	
+	for(int i = 0; i < count; i++)
+		changes += nodes[i].removed;
+	
+	return changes;
+}
+
+//the locals each node's successors may still read. Iterated backwards until it settles
+static void find_live_locals(Node* nodes, int count, Local_Set* live_out)
+{
+	int changed = 1;
+	
+	memset(live_out, 0, count * sizeof(Local_Set));
+	
+	while(changed)
+	{
+		changed = 0;
+		
+		for(int i = count - 1; i >= 0; i--)
+		{
+			Local_Set out = {{0, 0, 0, 0}};
+			int successors[2];
+			int successor_count = 0;
+			
+			if(is_jump(nodes[i].opcode))
+				successors[successor_count++] = nodes[i].target;
+			if(nodes[i].opcode != Ret && nodes[i].opcode != Jmp && i + 1 < count)
+				successors[successor_count++] = i + 1;
+			
+			for(int k = 0; k < successor_count; k++)
+			{
+				//live in = live out, less what the node stores, plus what it loads
+				int s = successors[k];
+				Local_Set in = live_out[s];
+				
+				if(nodes[s].opcode == Store)
+					SET_REMOVE(in, nodes[s].operand);
+				if(nodes[s].opcode == Load)
+					SET_ADD(in, nodes[s].operand);
+				
+				for(int w = 0; w < 4; w++)
+					out.bits[w] |= in.bits[w];
+			}
+			
+			if(memcmp(&out, &live_out[i], sizeof(Local_Set)))
+			{
+				live_out[i] = out;
+				changed = 1;
+			}
+		}
+	}
+}
+
+//the shift that multiplies by value, or -1. Multiplying by INT_MIN wraps the same as shifting by 31
+static int power_of_two(int value)
+{
+	unsigned int bits = (unsigned int)value;
+	int shift = 0;
+	
+	if(bits == 0 || (bits & (bits - 1)))
+		return -1;
+	while(bits >> shift != 1)
+		shift++;
+	return shift;
+}
+
+/*
+	Rewrites of two or three neighbouring nodes. incoming counts the jumps that
+	land on each node. Division by a power of two is left alone: a shift rounds
+	negative numbers down where division rounds them toward zero, and fixing that
+	up costs more dispatches than the division.
+*/
+static int peephole(Node* nodes, int count, int* incoming, Local_Set* live_out)
+{
+	int changes = 0;
+	int result;
+	
+	for(int i = 0; i < count; i++)
+	{
+		Node* a = &nodes[i];
+		Node* b = i + 1 < count && !incoming[i + 1] ? &nodes[i + 1] : NULL;
+		Node* c = b != NULL && i + 2 < count && !incoming[i + 2] ? &nodes[i + 2] : NULL;
+		
+		if(b == NULL)
+		{
+			//a store nothing reads again is just a pop
+			if(a->opcode == Store && !SET_HAS(live_out[i], a->operand))
+			{
+				a->opcode = Pop;
+				changes++;
+			}
+			continue;
+		}
+		
+		if(a->opcode == Push && b->opcode == Push && c != NULL && fold_binary(c->opcode, a->operand, b->operand, &result))
+		{
+			a->operand = result;
+			b->removed = c->removed = 1;
+			i += 2;
+		}
+		else if(a->opcode == Push && fold_unary(b->opcode, a->operand, &result))
+		{
+			a->operand = result;
+			b->removed = 1;
+			i++;
+		}
+		else if(a->opcode == Push &&
+			((a->operand == 0 && (b->opcode == Add || b->opcode == Sub || b->opcode == Or || b->opcode == Xor || b->opcode == Shl || b->opcode == Shr)) ||
+			 (a->operand == 1 && (b->opcode == Mul || b->opcode == Div))))
+		{
+			a->removed = b->removed = 1;
+			i++;
+		}
+		else if(a->opcode == Push && b->opcode == Mul && power_of_two(a->operand) > 0)
+		{
+			a->operand = power_of_two(a->operand);
+			b->opcode = Shl;
+			i++;
+		}
+		else if((a->opcode == Push || a->opcode == Load || a->opcode == Dup) && b->opcode == Pop)
+		{
+			a->removed = b->removed = 1;
+			i++;
+		}
+		else if(a->opcode == Store && b->opcode == Load && a->operand == b->operand && !SET_HAS(live_out[i + 1], a->operand))
+		{
+			//the value stays on the stack instead of making the round trip
+			a->removed = b->removed = 1;
+			i++;
+		}
+		else if(a->opcode == Store && !SET_HAS(live_out[i], a->operand))
+		{
+			a->opcode = Pop;
+		}
+		else
+			continue;
+		
+		changes++;
+	}
+	
+	return changes;
+}
+
+static int encode(Node* nodes, int count, char** out, int* out_size)
+{
+	int* position = (int*)malloc((count + 1) * sizeof(int));
+	char* code;
+	
+	if(position == NULL)
+		return 1;
+	
+	position[0] = 0;
+	for(int i = 0; i < count; i++)
+		position[i + 1] = position[i] + instruction_size(nodes[i].opcode);
+	
+	code = (char*)malloc(position[count] > 0 ? position[count] : 1);
+	if(code == NULL)
+	{
+		free(position);
+		return 1;
+	}
+	
+	for(int i = 0; i < count; i++)
+	{
+		char* at = code + position[i];
+		int parameter_size = get_opcode_from_instruction((char)nodes[i].opcode).parameter_size;
+		
+		at[0] = (char)nodes[i].opcode;
+		if(is_jump(nodes[i].opcode))
+			int_to_bytes(position[nodes[i].target] - position[i], at + 1);
+		else if(parameter_size == 4)
+			int_to_bytes(nodes[i].operand, at + 1);
+		else if(parameter_size == 1)
+			at[1] = (char)nodes[i].operand;
+	}
+	
+	*out = code;
+	*out_size = position[count];
+	free(position);
+	return 0;
+}
+
+/*
+	Returns 0 when the function was rewritten, 1 when it was left alone because it
+	isn't verified. The rewritten code is verified again, and one that somehow fails
+	is thrown away (2).
+*/
+int optimize_function(Executable* exe, int function_id, Optimize_Stats* stats)
+{
+	Executable_Function* function = &exe->functions[function_id];
+	int size = function->size_of_instructions;
+	int original;
+	int count;
+	int changes;
+	
+	if(!(function->attributes & FUNCTION_ATTRIBUTE_VERIFIED))
+	{
+		stats->skipped++;
+		return 1;
+	}
+	
+	Node* nodes = (Node*)malloc((size + 1) * sizeof(Node));
+	int* scratch = (int*)malloc((size + 1) * sizeof(int));
+	int* incoming = (int*)malloc((size + 1) * sizeof(int));
+	Local_Set* live_out = (Local_Set*)malloc((size + 1) * sizeof(Local_Set));
+	
+	if(nodes == NULL || scratch == NULL || incoming == NULL || live_out == NULL || (count = decode(function, nodes)) < 0)
+		error(exe, ALLOCATION_ERROR_IN_MAIN, "Could not allocate the optimizer's copy of function %d", function_id);
+	original = count;
+	
+	do
+	{
+		changes = strip_nops(nodes, count);
+		count = compact(nodes, count, scratch);
+		
+		changes += thread_jumps(nodes, count);
+		count = compact(nodes, count, scratch);
+		
+		changes += remove_unreachable(nodes, count, scratch);
+		count = compact(nodes, count, scratch);
+		
+		memset(incoming, 0, count * sizeof(int));
+		for(int i = 0; i < count; i++)
+			if(is_jump(nodes[i].opcode))
+				incoming[nodes[i].target]++;
+		find_live_locals(nodes, count, live_out);
+		
+		changes += peephole(nodes, count, incoming, live_out);
+		count = compact(nodes, count, scratch);
+	}
+	while(changes);
+	
+	char* code;
+	int code_size;
+	char message[VERIFY_MESSAGE_SIZE];
+	int result = 0;
+	
+	if(encode(nodes, count, &code, &code_size))
+		error(exe, ALLOCATION_ERROR_IN_MAIN, "Could not allocate the optimized code of function %d", function_id);
+	
+	char* old_code = function->instructions;
+	function->instructions = code;
+	function->size_of_instructions = code_size;
+	
+	if(verify_function(exe, function_id, message))
+	{
+		function->instructions = old_code;
+		function->size_of_instructions = size;
+		free(code);
+		count = original;
+		result = 2;
+	}
+	else
+	{
+		free(old_code);
+		stats->optimized++;
+	}
+	
+	stats->instructions_before += original;
+	stats->instructions_after += count;
+	stats->bytes_before += size;
+	stats->bytes_after += function->size_of_instructions;
+	
+	free(nodes);
+	free(scratch);
+	free(incoming);
+	free(live_out);
+	return result;
+}
+
+void optimize_executable(Executable* exe, Optimize_Stats* stats)
+{
+	memset(stats, 0, sizeof(Optimize_Stats));
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+		optimize_function(exe, i, stats);
+}
@@ -22,6 +22,23 @@
 
 #include "dexe_utils.h"
 #include "dexe_executable.h"
+#include "dexe_verifier.h"
+#include "dexe_encoding.h"
+#include "dexe_threads.h"
+#include "dexe_linker.h"
+
+//parse_header picks how the code of each function is decoded, NULL when it's stored as is
+static int (*decode_code)(char*, int, char**, int*);
+
+//the per-function pass only gets its own threads when there's enough code to pay for them
+#define PARALLEL_LOAD_MIN_BYTES (256 * 1024)
+
+struct Load_Pass_struct
+{
+	Executable* exe;
+	int* results; //ENCODING_* per function
+};
+typedef struct Load_Pass_struct Load_Pass;
 
 int read_int(Executable* exe)
 {
@@ -48,6 +65,7 @@ char* read_string(Executable* exe, int size)
 	
 	if(str == NULL)
 		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate a string long enough to store one of the strings in the file.");
+	exe->metrics.loader_bytes += n;
 	
 	if(fread(str,1,n,exe->info->file) != n)
 		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
@@ -55,6 +73,72 @@ char* read_string(Executable* exe, int size)
 	return str;
 }
 
+//section names are always terminated, whatever the file says
+static char* read_name(Executable* exe)
+{
+	int n = fgetc(exe->info->file);
+	char* name;
+	
+	if(n == EOF)
+		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+	
+	name = (char*)malloc(n + 1);
+	if(name == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate a string long enough to store one of the strings in the file.");
+	exe->metrics.loader_bytes += n + 1;
+	
+	if(fread(name, 1, n, exe->info->file) != (size_t)n)
+	{
+		free(name);
+		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+	}
+	name[n] = '\0';
+	
+	return name;
+}
+
+//read_string treats a size of 0 as "read the length", so empty functions are handled here
+static void read_code(Executable* exe, int function_id)
+{
+	Executable_Function* function = &exe->functions[function_id];
+	
+	function->size_of_instructions = read_int(exe);
+	if(function->size_of_instructions < 0)
+		error(exe, CORRUPT_DEXE_FILE, "Function %d has a negative size (%d)", function_id, function->size_of_instructions);
+	
+	function->instructions = function->size_of_instructions ? read_string(exe, function->size_of_instructions) : (char*)malloc(1);
+	if(function->instructions == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the code of function %d", function_id);
+}
+
+/*
+	Everything done to a function after its bytes are read. It only touches its own
+	function and its own result, so any number of them can run at once.
+*/
+static void process_function(void* context, int function_id)
+{
+	Load_Pass* pass = (Load_Pass*)context;
+	Executable_Function* function = &pass->exe->functions[function_id];
+	char message[VERIFY_MESSAGE_SIZE];
+	
+	if(decode_code != NULL)
+	{
+		char* code;
+		int size;
+		
+		pass->results[function_id] = decode_code(function->instructions, function->size_of_instructions, &code, &size);
+		if(pass->results[function_id] != ENCODING_OK)
+			return;
+		
+		free(function->instructions);
+		function->instructions = code;
+		function->size_of_instructions = size;
+	}
+	
+	if(!verify_function(pass->exe, function_id, message))
+		function->attributes |= FUNCTION_ATTRIBUTE_VERIFIED;
+}
+
 void verify_valid_file(Executable* exe)
 {
 	char ch[5];
@@ -75,72 +159,336 @@ void parse_header(Executable* exe)
 
 	if((exe->version >> 16) > DEXE_MAJOR_VERSION)
 		error(exe, VERSION_MISMATCH, "The major versions do not match. There is no guarantee that a newer version file will run on this interpreter. Suggestion: Update this interpreter. Interpreter version: [%u.%u.%u]. File version: [%u.%u.%u]", DEXE_MAJOR_VERSION, DEXE_MINOR_VERSION, DEXE_REVISION_VERSION, (exe->version >> 16) & 0xFF, (exe->version >> 8) & 0xFF, exe->version & 0xFF);
+	
+	if(exe->version < DEXE_OLDEST_VERSION)
+		error(exe, VERSION_MISMATCH, "The file is older than the instruction semantics this interpreter runs, and would be misread. Suggestion: Rebuild the file. Oldest version: [%u.%u.%u]. File version: [%u.%u.%u]", (DEXE_OLDEST_VERSION >> 16) & 0xFF, (DEXE_OLDEST_VERSION >> 8) & 0xFF, DEXE_OLDEST_VERSION & 0xFF, (exe->version >> 16) & 0xFF, (exe->version >> 8) & 0xFF, exe->version & 0xFF);
+	
+	//a newer minor version may store its code in a way this interpreter doesn't know
+	if((exe->version >> 16) == DEXE_MAJOR_VERSION && ((exe->version >> 8) & 0xFF) > DEXE_MINOR_VERSION)
+		error(exe, VERSION_MISMATCH, "The file uses a newer encoding than this interpreter understands. Suggestion: Update this interpreter. Interpreter version: [%u.%u.%u]. File version: [%u.%u.%u]", DEXE_MAJOR_VERSION, DEXE_MINOR_VERSION, DEXE_REVISION_VERSION, (exe->version >> 16) & 0xFF, (exe->version >> 8) & 0xFF, exe->version & 0xFF);
+	
+	if(((exe->version >> 8) & 0xFF) >= DEXE_COMPACT_MINOR_VERSION)
+		decode_code = decode_compact_code;
+	else
+		decode_code = NULL;
 }
+/*
+	Sections sit between the functions and the end byte. Each is a tag byte, the
+	size of its contents as an int, and the contents. Tags this interpreter doesn't
+	know are skipped.
+*/
+void parse_sections(Executable* exe)
+{
+	int tag;
+	
+	while((tag = fgetc(exe->info->file)) != 0xFF)
+	{
+		if(tag == EOF)
+			error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+		
+		int size = read_int(exe);
+		long end = ftell(exe->info->file) + size;
+		
+		if(size < 0)
+			error(exe, CORRUPT_DEXE_FILE, "Section 0x%X has a negative size (%d)", tag, size);
+		
+		if(tag == SECTION_EXPORTS && exe->exports == NULL)
+		{
+			int count = read_int(exe);
+			if(count < 0 || count > size)
+				error(exe, CORRUPT_DEXE_FILE, "The export section lists %d exports in %d bytes", count, size);
+			
+			exe->exports = (Export*)calloc(count + 1, sizeof(Export));
+			if(exe->exports == NULL)
+				error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the export table");
+			
+			for(int i = 0; i < count; i++)
+			{
+				exe->exports[i].name = read_name(exe);
+				exe->number_of_exports = i + 1;
+				exe->exports[i].function_id = read_int(exe);
+				
+				if(exe->exports[i].function_id < 0 || exe->exports[i].function_id >= exe->number_of_functions)
+					error(exe, CORRUPT_DEXE_FILE, "Export '%s' names function %d. There are %d functions", exe->exports[i].name, exe->exports[i].function_id, exe->number_of_functions);
+			}
+		}
+		else if(tag == SECTION_IMPORTS && exe->imports == NULL)
+		{
+			int count = read_int(exe);
+			if(count < 0 || count > size)
+				error(exe, CORRUPT_DEXE_FILE, "The import section lists %d imports in %d bytes", count, size);
+			
+			exe->imports = (Import*)calloc(count + 1, sizeof(Import));
+			if(exe->imports == NULL)
+				error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the import table");
+			
+			for(int i = 0; i < count; i++)
+			{
+				exe->imports[i].library = read_name(exe);
+				exe->number_of_imports = i + 1;
+				exe->imports[i].name = read_name(exe);
+			}
+		}
+		else if(tag == SECTION_CONSTANTS && exe->constants == NULL)
+		{
+			//each constant is its size and then its bytes, so the bytes all fit in size
+			int count = read_int(exe);
+			char* cursor;
+			if(count < 0 || count > size / 4)
+				error(exe, CORRUPT_DEXE_FILE, "The constant section lists %d constants in %d bytes", count, size);
+			
+			exe->constants = (Constant*)calloc(count + 1, sizeof(Constant));
+			exe->constant_pool = (char*)malloc(size + 1);
+			if(exe->constants == NULL || exe->constant_pool == NULL)
+				error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the constant pool");
+			exe->metrics.loader_bytes += (count + 1) * sizeof(Constant) + size + 1;
+			
+			cursor = exe->constant_pool;
+			for(int i = 0; i < count; i++)
+			{
+				int n = read_int(exe);
+				if(n < 0 || n > end - ftell(exe->info->file))
+					error(exe, CORRUPT_DEXE_FILE, "Constant %d is %d bytes, more than is left of its section", i, n);
+				if(fread(cursor, 1, n, exe->info->file) != (size_t)n)
+					error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+				
+				exe->constants[i].size = n;
+				exe->constants[i].data = cursor;
+				exe->number_of_constants = i + 1;
+				cursor += n;
+			}
+		}
+		
+		if(ftell(exe->info->file) > end)
+			error(exe, CORRUPT_DEXE_FILE, "Section 0x%X is longer than its size (%d)", tag, size);
+		if(fseek(exe->info->file, end, SEEK_SET))
+			error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+	}
+	
+	ungetc(tag, exe->info->file);
+}
+
+/*
+	The debug names of every function go into one pool: first the arrays of arg and
+	local names, then the strings. This walks the function headers once without
+	keeping anything to size it, then puts the file back where it was. A header it
+	can't read ends the walk early, the real read reports it.
+*/
+static void measure_debug_info(Executable* exe, size_t* pointers, size_t* bytes)
+{
+	FILE* file = exe->info->file;
+	long start = ftell(file);
+	
+	*pointers = 0;
+	*bytes = 0;
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		char size[4];
+		int n;
+		
+		//the name, then the arg names and the local names, each after its count
+		for(int list = 0, count = 1; list < 3; list++)
+		{
+			if(list > 0)
+			{
+				if((count = fgetc(file)) == EOF)
+					goto done;
+				*pointers += count;
+			}
+			
+			for(int k = 0; k < count; k++)
+			{
+				if((n = fgetc(file)) == EOF || fseek(file, n, SEEK_CUR))
+					goto done;
+				*bytes += n + 1;
+			}
+		}
+		
+		if(fread(size, 1, 4, file) != 4 || bytes_to_int(size) < 0 || fseek(file, bytes_to_int(size), SEEK_CUR))
+			goto done;
+	}
+	
+done:
+	clearerr(file);
+	if(fseek(file, start, SEEK_SET))
+		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+}
+
+//the cursors measure_debug_info sized. Running past them means the file changed under us
+struct Name_Pool_struct
+{
+	char** slots;
+	char** slots_end;
+	char* text;
+	char* text_end;
+};
+typedef struct Name_Pool_struct Name_Pool;
+
+static char** pool_slots(Executable* exe, Name_Pool* pool, int count)
+{
+	char** slots = pool->slots;
+	
+	if(count > pool->slots_end - pool->slots)
+		error(exe, CORRUPT_DEXE_FILE, "The debug symbols changed while they were being read");
+	pool->slots += count;
+	
+	return slots;
+}
+
+//names are stored with their terminator, but it's added here rather than trusted
+static char* pool_name(Executable* exe, Name_Pool* pool)
+{
+	int n = fgetc(exe->info->file);
+	char* name = pool->text;
+	
+	if(n == EOF)
+		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+	if(n + 1 > pool->text_end - pool->text)
+		error(exe, CORRUPT_DEXE_FILE, "The debug symbols changed while they were being read");
+	
+	if(fread(name, 1, n, exe->info->file) != (size_t)n)
+		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+	name[n] = '\0';
+	pool->text += n + 1;
+	
+	return name;
+}
+
+static int read_count(Executable* exe)
+{
+	int count = fgetc(exe->info->file);
+	
+	if(count == EOF)
+		error(exe, CORRUPT_DEXE_FILE, "While reading the file, reached EOF before finished reading.");
+	return count;
+}
+
 void parse_functions(Executable* exe)
 {
+	Name_Pool pool = {NULL, NULL, NULL, NULL};
 	int ch;
 	//expect '\xE0' byte
 	if((ch = fgetc(exe->info->file)) != 0xE0)
 		error(exe, CORRUPT_DEXE_FILE, "Expected function start byte (0xE0), but recieved byte 0x%X", ch);
 
-	exe->functions = (Executable_Function*)malloc(sizeof(Executable_Function) * exe->number_of_functions);
+	//zeroed, so error() can free a partly read table
+	exe->functions = (Executable_Function*)calloc(exe->number_of_functions, sizeof(Executable_Function));
 	
 	if(exe->functions == NULL)
 		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate enough memory long enough to store an array of functions from the file.");
+	exe->metrics.loader_bytes += sizeof(Executable_Function) * exe->number_of_functions;
+	
+	//debug executables have additional items for debug purposes of course
+	if(exe->flags & DEXE_FLAGS_DEBUG)
+	{
+		size_t pointers, bytes;
+		
+		measure_debug_info(exe, &pointers, &bytes);
+		
+		exe->debug = (Function_Debug*)calloc(exe->number_of_functions, sizeof(Function_Debug));
+		exe->debug_pool = (char*)malloc(pointers * sizeof(char*) + bytes + 1);
+		if(exe->debug == NULL || exe->debug_pool == NULL)
+			error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the debug symbols of the file.");
+		exe->metrics.loader_bytes += sizeof(Function_Debug) * exe->number_of_functions + pointers * sizeof(char*) + bytes;
+		
+		pool.slots = (char**)exe->debug_pool;
+		pool.slots_end = pool.slots + pointers;
+		pool.text = exe->debug_pool + pointers * sizeof(char*);
+		pool.text_end = pool.text + bytes;
+	}
 
 	for(int i = 0; i < exe->number_of_functions; i++)
 	{
-		//debug executables have additional items for debug purposes of course
+		Executable_Function* function = &exe->functions[i];
+		
 		if(exe->flags & DEXE_FLAGS_DEBUG)
 		{
-			//read function name
-			exe->functions[i].function_name = read_string(exe,0);
+			Function_Debug* debug = &exe->debug[i];
 			
-			//read arg_names
-			exe->functions[i].arg_count = fgetc(exe->info->file);
-			exe->functions[i].arg_names = (char**)malloc(sizeof(char*) * exe->functions[i].arg_count);
-			if(exe->functions[i].arg_names == NULL)
-				error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate a string long enough to store an array of strings in the file.");
+			debug->function_name = pool_name(exe, &pool);
 			
-			for(int k = 0; k < exe->functions[i].arg_count; k++)
-				exe->functions[i].arg_names[k] = read_string(exe,0);
+			function->arg_count = read_count(exe);
+			debug->arg_names = pool_slots(exe, &pool, function->arg_count);
+			for(int k = 0; k < function->arg_count; k++)
+				debug->arg_names[k] = pool_name(exe, &pool);
 			
-			//read local_names
-			exe->functions[i].local_count = fgetc(exe->info->file);
-			exe->functions[i].local_names = (char**)malloc(sizeof(char*) * exe->functions[i].local_count);
-			if(exe->functions[i].local_names == NULL)
-				error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate a string long enough to store an array of strings in the file.");
-
-			for(int k = 0; k < exe->functions[i].local_count; k++)
-				exe->functions[i].local_names[k] = read_string(exe,0);
-				
+			function->local_count = read_count(exe);
+			debug->local_names = pool_slots(exe, &pool, function->local_count);
+			for(int k = 0; k < function->local_count; k++)
+				debug->local_names[k] = pool_name(exe, &pool);
 		}
 		else
 		{
 			//read arg_count, and local_count
-			exe->functions[i].arg_count = fgetc(exe->info->file);
-			exe->functions[i].local_count = fgetc(exe->info->file);
-			
-			//set everything else to NULL
-			exe->functions[i].function_name = NULL;
-			exe->functions[i].arg_names = NULL;
-			exe->functions[i].local_names = NULL;
+			function->arg_count = read_count(exe);
+			function->local_count = read_count(exe);
 		}
 		
 		//read code
-		exe->functions[i].size_of_instructions = read_int(exe);
-		exe->functions[i].instructions = read_string(exe, exe->functions[i].size_of_instructions);
-
+		function->attributes = 0;
+		read_code(exe, i);
 	}
 	
 	if((ch = fgetc(exe->info->file)) != 0xEF)
 		error(exe, CORRUPT_DEXE_FILE, "Expected function end byte (0xEF), but recieved byte 0x%X", ch);
 	
+	if(((exe->version >> 8) & 0xFF) >= DEXE_SECTIONS_MINOR_VERSION)
+		parse_sections(exe);
+	
 	if((ch = fgetc(exe->info->file)) != 0xFF)
 		error(exe, CORRUPT_DEXE_FILE, "Expected DEXE end byte (0xFF), but recieved byte 0x%X", ch);
 }
 
-void dexe_read(Executable* exe)
+/*
+	Runs process_function over every function, in parallel when the image is big
+	enough. Failures are reported afterwards in function order, so the error is
+	the same however the work was split.
+*/
+void process_functions(Executable* exe)
+{
+	Load_Pass pass;
+	long code_size = 0;
+	int threads = exe->info->threads;
+	
+	pass.exe = exe;
+	pass.results = (int*)calloc(exe->number_of_functions + 1, sizeof(int));
+	if(pass.results == NULL)
+		error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the results of the load pass");
+	
+	if(threads <= 0)
+	{
+		for(int i = 0; i < exe->number_of_functions; i++)
+			code_size += exe->functions[i].size_of_instructions;
+		threads = code_size >= PARALLEL_LOAD_MIN_BYTES ? threads_available() : 1;
+	}
+	
+	threads_parallel_for(exe->number_of_functions, threads, process_function, &pass);
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		int result = pass.results[i];
+		
+		if(result == ENCODING_NO_MEMORY)
+		{
+			free(pass.results);
+			error(exe, ALLOCATION_ERROR_IN_READER, "Unable to allocate the decoded code of function %d", i);
+		}
+		else if(result != ENCODING_OK)
+		{
+			free(pass.results);
+			error(exe, CORRUPT_DEXE_FILE, "The compact code of function %d could not be decoded", i);
+		}
+		
+		if(decode_code != NULL)
+			exe->metrics.loader_bytes += exe->functions[i].size_of_instructions;
+	}
+	
+	free(pass.results);
+}
+
+//reads a file without linking it, which is all a library or a dump needs
+void dexe_load(Executable* exe)
 {
 	exe->info->file = fopen(exe->info->filename, "rb");
 	
@@ -155,4 +503,14 @@ void dexe_read(Executable* exe)
 	
 	fclose(exe->info->file);
 	exe->info->file = NULL;
+	
+	process_functions(exe);
+}
+
+void dexe_read(Executable* exe)
+{
+	dexe_load(exe);
+	
+	if(exe->number_of_imports > 0)
+		linker_link(exe);
 }
\ No newline at end of file
@@ -28,6 +28,9 @@
 extern void verify_valid_file(Executable* exe);
 extern void parse_header(Executable* exe);
 extern void parse_functions(Executable* exe);
+extern void parse_sections(Executable* exe);
+extern void process_functions(Executable* exe);
 
 
+extern void dexe_load(Executable* exe);
 extern void dexe_read(Executable* exe);
\ No newline at end of file
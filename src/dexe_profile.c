@@ -0,0 +1,231 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_profile.h"
+
+//zeroed counters for every function of exe, or NULL
+static Profile* profile_allocate(Executable* exe)
+{
+	Profile* profile = (Profile*)malloc(sizeof(Profile));
+	if(profile == NULL)
+		return NULL;
+	
+	profile->number_of_functions = exe->number_of_functions;
+	profile->functions = (Function_Profile*)calloc(exe->number_of_functions, sizeof(Function_Profile));
+	if(profile->functions == NULL)
+	{
+		profile_destroy(profile);
+		return NULL;
+	}
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		profile->functions[i].branches = (unsigned long*)calloc(2 * exe->functions[i].size_of_instructions + 2, sizeof(unsigned long));
+		if(profile->functions[i].branches == NULL)
+		{
+			profile_destroy(profile);
+			return NULL;
+		}
+	}
+	
+	return profile;
+}
+void profile_destroy(Profile* profile)
+{
+	if(profile != NULL)
+	{
+		if(profile->functions != NULL)
+		{
+			for(int i = 0; i < profile->number_of_functions; i++)
+				free(profile->functions[i].branches);
+			free(profile->functions);
+		}
+		free(profile);
+	}
+}
+
+int profile_init(Executable* exe)
+{
+	exe->profile = profile_allocate(exe);
+	
+	return exe->profile == NULL;
+}
+void profile_free(Executable* exe)
+{
+	profile_destroy(exe->profile);
+	exe->profile = NULL;
+}
+
+/*
+	The profile is plain text, one record per line:
+	
+		function <id> <name> calls <count> instructions <count>
+		branch <id> <pc> taken <count> not_taken <count>
+		call <id> <pc> count <count>
+	
+	The name is '-' when the file has no debug symbols. Only branches and
+	call sites that were reached are written.
+*/
+int profile_write(Executable* exe, char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if(file == NULL)
+		return 1;
+	
+	fprintf(file, "# dexe profile of %s\n", exe->info->filename);
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		Function_Profile* function = &exe->profile->functions[i];
+		
+		fprintf(file, "function %d %s calls %lu instructions %lu\n", i, exe->flags & DEXE_FLAGS_DEBUG ? exe->debug[i].function_name : "-", function->calls, function->instructions);
+		
+		for(int pc = 0; pc < exe->functions[i].size_of_instructions; pc++)
+		{
+			if((unsigned char)exe->functions[i].instructions[pc] == Call && function->branches[2 * pc])
+				fprintf(file, "call %d %d count %lu\n", i, pc, function->branches[2 * pc]);
+			else if(function->branches[2 * pc] || function->branches[2 * pc + 1])
+				fprintf(file, "branch %d %d taken %lu not_taken %lu\n", i, pc, function->branches[2 * pc], function->branches[2 * pc + 1]);
+		}
+	}
+	
+	return fclose(file);
+}
+
+static void set_counters(Executable* exe, Profile* profile, int id, int pc, unsigned long taken, unsigned long not_taken)
+{
+	if(id >= 0 && id < exe->number_of_functions && pc >= 0 && pc < exe->functions[id].size_of_instructions)
+	{
+		profile->functions[id].branches[2 * pc] = taken;
+		profile->functions[id].branches[2 * pc + 1] = not_taken;
+	}
+}
+
+/*
+	Reads a profile written by profile_write back in for exe. Records for functions
+	or pcs exe doesn't have are skipped, so a stale profile can only make for a
+	worse layout. Returns NULL if the file can't be read.
+*/
+Profile* profile_read(Executable* exe, char* filename)
+{
+	FILE* file = fopen(filename, "r");
+	if(file == NULL)
+		return NULL;
+	
+	Profile* profile = profile_allocate(exe);
+	if(profile == NULL)
+	{
+		fclose(file);
+		return NULL;
+	}
+	
+	char line[512];
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		int id;
+		int pc;
+		unsigned long first;
+		unsigned long second;
+		
+		if(sscanf(line, "function %d %*s calls %lu instructions %lu", &id, &first, &second) == 3)
+		{
+			if(id >= 0 && id < exe->number_of_functions)
+			{
+				profile->functions[id].calls = first;
+				profile->functions[id].instructions = second;
+			}
+		}
+		else if(sscanf(line, "branch %d %d taken %lu not_taken %lu", &id, &pc, &first, &second) == 4)
+			set_counters(exe, profile, id, pc, first, second);
+		else if(sscanf(line, "call %d %d count %lu", &id, &pc, &first) == 3)
+			set_counters(exe, profile, id, pc, first, 0);
+	}
+	
+	fclose(file);
+	return profile;
+}
+
+/*
+	Roughly how many instructions a call to the function takes, callees included: the
+	instructions of everything it can reach, over the calls into it from outside of
+	that. Recursive calls are part of the work, not calls of their own, and a helper
+	that others call too is counted in full, so this leans high. 0 if it never ran or
+	memory runs out.
+*/
+unsigned long profile_call_cost(Executable* exe, Profile* profile, int id)
+{
+	int n = exe->number_of_functions;
+	char* reached = (char*)calloc(n, 1);
+	int* pending = (int*)malloc(n * sizeof(int));
+	int count = 0;
+	unsigned long instructions = 0;
+	unsigned long calls = 0;
+	
+	if(reached == NULL || pending == NULL)
+	{
+		free(reached);
+		free(pending);
+		return 0;
+	}
+	
+	reached[id] = 1;
+	pending[count++] = id;
+	while(count)
+	{
+		int f = pending[--count];
+		char* code = exe->functions[f].instructions;
+		
+		instructions += profile->functions[f].instructions;
+		
+		for(int pc = 0; pc < exe->functions[f].size_of_instructions && (unsigned char)code[pc] <= LAST_OPCODE; pc += 1 + get_opcode_from_instruction(code[pc]).parameter_size)
+		{
+			int callee = (code[pc] == Call || code[pc] == Spawn || code[pc] == Coroutine) && pc + 4 < exe->functions[f].size_of_instructions ? bytes_to_int(code + pc + 1) : -1;
+			
+			if(callee >= 0 && callee < n && !reached[callee])
+			{
+				reached[callee] = 1;
+				pending[count++] = callee;
+			}
+		}
+	}
+	
+	//the call sites outside of what it reaches
+	for(int f = 0; f < n; f++)
+	{
+		char* code = exe->functions[f].instructions;
+		
+		for(int pc = 0; pc < exe->functions[f].size_of_instructions && !reached[f] && (unsigned char)code[pc] <= LAST_OPCODE; pc += 1 + get_opcode_from_instruction(code[pc]).parameter_size)
+			if(code[pc] == Call && pc + 4 < exe->functions[f].size_of_instructions && bytes_to_int(code + pc + 1) == id)
+				calls += profile->functions[f].branches[2 * pc];
+	}
+	
+	//the entry point, or a function only ever called by itself
+	if(calls == 0)
+		calls = profile->functions[id].calls;
+	
+	free(reached);
+	free(pending);
+	
+	return calls ? instructions / calls : 0;
+}
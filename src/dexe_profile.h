@@ -0,0 +1,55 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+
+struct Function_Profile_struct
+{
+	unsigned long calls;
+	unsigned long instructions; //excluding callees
+	unsigned long classes[OPCODE_CLASSES]; //the same, by the OPCODE_CLASS_* of each
+	
+	//two counters per pc, taken and not taken. Only conditional jumps use theirs,
+	//besides calls which count how often each call site ran in the taken one
+	unsigned long* branches;
+};
+typedef struct Function_Profile_struct Function_Profile;
+
+struct Profile_struct
+{
+	int number_of_functions;
+	Function_Profile* functions;
+};
+typedef struct Profile_struct Profile;
+
+
+extern int profile_init(Executable*);
+extern void profile_free(Executable*);
+
+extern int profile_write(Executable*, char*);
+extern Profile* profile_read(Executable*, char*);
+extern void profile_destroy(Profile*);
+
+extern unsigned long profile_call_cost(Executable*, Profile*, int);
@@ -0,0 +1,982 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+	
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+	
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_executer.h"
+#include "dexe_opcodes.h"
+#include "dexe_memo.h"
+#include "dexe_heap.h"
+#include "dexe_vector.h"
+#include "dexe_registers.h"
+#include "dexe_tasks.h"
+#include "dexe_coroutines.h"
+
+#define UNVISITED -1
+#define NOT_A_TARGET -1
+#define TARGET -2
+
+/*
+	While translating, each item on the stack is either a register that holds it or
+	a number that hasn't been written anywhere yet. An item in its own slot (item i
+	in register i) is where the stack code would have it. Anything else is only
+	written to its slot when something needs it there: a jump, a label, a call's
+	arguments, or a Store to the local it was loaded from.
+	
+	An item may name a slot below its own. That slot can't change while the item is
+	on the stack, since writing it means popping everything above it first.
+*/
+struct Operand_struct
+{
+	int immediate; //1 if value is the number itself, 0 if it's a register
+	int value;
+};
+typedef struct Operand_struct Operand;
+
+struct Translation_struct
+{
+	Register_Code* code;
+	int capacity;
+	
+	Operand* stack;
+	int depth;
+	
+	int pc;
+	int barrier; //a Store can only retarget instructions from here on, the last label
+	int result;  //the last instruction if it wrote dst, otherwise -1
+	int fork;    //a call to a forkable function the next one could run beside, otherwise -1
+};
+typedef struct Translation_struct Translation;
+
+
+//returns NULL when out of memory
+static Register_Instruction* emit(Translation* t, int opcode, int dst, int a, int b, int has_result)
+{
+	if(t->code->count == t->capacity)
+	{
+		Register_Code* grown = (Register_Code*)realloc(t->code, sizeof(Register_Code) + 2 * t->capacity * sizeof(Register_Instruction));
+		if(grown == NULL)
+			return NULL;
+		t->code = grown;
+		t->capacity *= 2;
+	}
+	
+	Register_Instruction* in = &t->code->instructions[t->code->count];
+	in->opcode = (unsigned char)opcode;
+	in->mask = 0;
+	in->dst = dst;
+	in->a = a;
+	in->b = b;
+	in->pc = t->pc;
+	
+	t->result = has_result ? t->code->count : -1;
+	t->code->count++;
+	
+	return in;
+}
+
+//puts item i in its own slot. Returns 1 when out of memory
+static int materialize(Translation* t, int i)
+{
+	Operand* item = &t->stack[i];
+	
+	if(item->immediate && emit(t, Reg_Mov_Imm, i, 0, item->value, 1) == NULL)
+		return 1;
+	if(!item->immediate && item->value != i && emit(t, Reg_Mov, i, item->value, 0, 1) == NULL)
+		return 1;
+		
+	item->immediate = 0;
+	item->value = i;
+	return 0;
+}
+
+static int flush(Translation* t)
+{
+	for(int i = 0; i < t->depth; i++)
+		if(materialize(t, i))
+			return 1;
+	return 0;
+}
+
+//the register holding item i, or -1 when out of memory. Numbers are written to the item's slot
+static int in_register(Translation* t, int i)
+{
+	if(t->stack[i].immediate && materialize(t, i))
+		return -1;
+	return t->stack[i].value;
+}
+
+static void push_slot(Translation* t)
+{
+	t->stack[t->depth].immediate = 0;
+	t->stack[t->depth].value = t->depth;
+	t->depth++;
+}
+
+static int binary_opcode(unsigned char opcode)
+{
+	switch(opcode)
+	{
+		case Add: return Reg_Add;
+		case Sub: return Reg_Sub;
+		case Mul: return Reg_Mul;
+		case Div: return Reg_Div;
+		case Rem: return Reg_Rem;
+		case And: return Reg_And;
+		case Or:  return Reg_Or;
+		case Xor: return Reg_Xor;
+		case Shl: return Reg_Shl;
+		default:  return Reg_Shr;
+	}
+}
+
+static int jump_mask(unsigned char opcode)
+{
+	switch(opcode)
+	{
+		case Je:  return JUMP_EQUAL;
+		case Jne: return JUMP_NOT_EQUAL;
+		case Jg:  return JUMP_GREATER;
+		case Jge: return JUMP_GREATER | JUMP_EQUAL;
+		case Jl:  return JUMP_LESS;
+		default:  return JUMP_LESS | JUMP_EQUAL;
+	}
+}
+
+/*
+	Whether the call at first can run at the same time as the one just emitted. The
+	second call can't take the first one's result as an argument, and what came in
+	between may only move numbers around, must not touch that result and can't fail,
+	or the error would come before the first call's.
+*/
+static int independent(Executable* exe, Translation* t, int first)
+{
+	int result = t->code->instructions[first].dst;
+	Register_Instruction* second = &t->code->instructions[t->code->count - 1];
+	
+	if(result >= second->a && result < second->a + exe->functions[second->b].arg_count)
+		return 0;
+	
+	for(int i = first + 1; i < t->code->count - 1; i++)
+	{
+		Register_Instruction* in = &t->code->instructions[i];
+		
+		if(in->opcode > Reg_Neg || (in->opcode >= Reg_Div && in->opcode <= Reg_Rem_Imm))
+			return 0;
+		if(in->dst == result || in->a == result || in->b == result)
+			return 0;
+	}
+	
+	return 1;
+}
+
+//the stack code of one instruction. Returns 1 when out of memory
+static int translate_instruction(Executable* exe, Translation* t, unsigned char* code, int* label, int max_depth)
+{
+	int pc = t->pc;
+	unsigned char opcode = code[pc];
+	
+	switch(opcode)
+	{
+		case Nop:
+		case Break: //only the debug interpreters stop on it
+			return 0;
+		case Push:
+		case Pushk:
+		{
+			int value = bytes_to_int((char*)code + pc + 1);
+			
+			t->stack[t->depth].immediate = 1;
+			t->stack[t->depth].value = opcode == Push ? value : bytes_to_int(exe->constants[value].data);
+			t->depth++;
+			return 0;
+		}
+		case Load:
+		{
+			t->stack[t->depth].immediate = 0;
+			t->stack[t->depth].value = max_depth + code[pc + 1];
+			t->depth++;
+			return 0;
+		}
+		case Dup:
+		{
+			t->stack[t->depth] = t->stack[t->depth - 1];
+			t->depth++;
+			return 0;
+		}
+		case Pop:
+		{
+			t->depth--;
+			return 0;
+		}
+		case Store:
+		{
+			int local = max_depth + code[pc + 1];
+			Operand value = t->stack[--t->depth];
+			
+			//anything still to be loaded from the local has to be read before it changes
+			for(int i = 0; i < t->depth; i++)
+				if(!t->stack[i].immediate && t->stack[i].value == local && materialize(t, i))
+					return 1;
+					
+			//the value was just computed into its slot, so compute it into the local instead
+			if(!value.immediate && value.value == t->depth && t->result >= t->barrier && t->code->instructions[t->result].dst == t->depth)
+				t->code->instructions[t->result].dst = local;
+			else if(value.immediate)
+				return emit(t, Reg_Mov_Imm, local, 0, value.value, 1) == NULL;
+			else if(value.value != local)
+				return emit(t, Reg_Mov, local, value.value, 0, 1) == NULL;
+			return 0;
+		}
+		case Inc:
+		case Dec:
+		case Not:
+		case Neg:
+		{
+			int p = t->depth - 1;
+			int folded;
+			
+			if(t->stack[p].immediate && fold_unary(opcode, t->stack[p].value, &folded))
+			{
+				t->stack[p].value = folded;
+				return 0;
+			}
+			
+			if(opcode == Inc || opcode == Dec)
+			{
+				if(emit(t, Reg_Add_Imm, p, t->stack[p].value, opcode == Inc ? 1 : -1, 1) == NULL)
+					return 1;
+			}
+			else if(emit(t, opcode == Not ? Reg_Not : Reg_Neg, p, t->stack[p].value, 0, 1) == NULL)
+				return 1;
+				
+			t->depth--;
+			push_slot(t);
+			return 0;
+		}
+		case Add:
+		case Sub:
+		case Mul:
+		case Div:
+		case Rem:
+		case And:
+		case Or:
+		case Xor:
+		case Shl:
+		case Shr:
+		{
+			Operand b = t->stack[--t->depth];
+			Operand a = t->stack[--t->depth];
+			int p = t->depth;
+			int folded;
+			
+			//division by zero is left for the interpreter to report
+			if(a.immediate && b.immediate && fold_binary(opcode, a.value, b.value, &folded))
+			{
+				t->stack[p].immediate = 1;
+				t->stack[p].value = folded;
+				t->depth++;
+				return 0;
+			}
+			
+			if(a.immediate && !b.immediate && (opcode == Add || opcode == Mul || opcode == And || opcode == Or || opcode == Xor))
+			{
+				Operand swap = a;
+				a = b;
+				b = swap;
+			}
+			if(a.immediate)
+			{
+				if(materialize(t, p))
+					return 1;
+				a = t->stack[p];
+			}
+			
+			if(emit(t, binary_opcode(opcode) + b.immediate, p, a.value, b.value, 1) == NULL)
+				return 1;
+			push_slot(t);
+			return 0;
+		}
+		case Cmp:
+		{
+			Operand b = t->stack[--t->depth];
+			Operand a = t->stack[--t->depth];
+			int next = pc + 1;
+			
+			if(a.immediate)
+			{
+				if(materialize(t, t->depth))
+					return 1;
+				a = t->stack[t->depth];
+			}
+			
+			//a conditional jump right after, that nothing else jumps to, becomes part of the compare
+			if(code[next] >= Je && code[next] <= Jle && label[next] == NOT_A_TARGET)
+			{
+				Register_Instruction* in;
+				
+				if(flush(t))
+					return 1;
+				if((in = emit(t, b.immediate ? Reg_Cmp_Jump_Imm : Reg_Cmp_Jump, next + bytes_to_int((char*)code + next + 1), a.value, b.value, 0)) == NULL)
+					return 1;
+				in->mask = (unsigned char)jump_mask(code[next]);
+				t->pc = next;
+				return 0;
+			}
+			
+			return emit(t, b.immediate ? Reg_Cmp_Imm : Reg_Cmp, 0, a.value, b.value, 0) == NULL;
+		}
+		case Jmp:
+		case Je:
+		case Jne:
+		case Jg:
+		case Jge:
+		case Jl:
+		case Jle:
+		{
+			Register_Instruction* in;
+			
+			if(flush(t))
+				return 1;
+			if((in = emit(t, opcode == Jmp ? Reg_Jmp : Reg_Jump_If, pc + bytes_to_int((char*)code + pc + 1), 0, 0, 0)) == NULL)
+				return 1;
+			in->mask = (unsigned char)(opcode == Jmp ? 0 : jump_mask(opcode));
+			return 0;
+		}
+		case In:
+		case Ini:
+		{
+			if(emit(t, opcode == In ? Reg_In : Reg_Ini, t->depth, 0, 0, 1) == NULL)
+				return 1;
+			push_slot(t);
+			return 0;
+		}
+		case Out:
+		case Outi:
+		case Reset:
+		{
+			int a = in_register(t, --t->depth);
+			
+			return a < 0 || emit(t, opcode == Out ? Reg_Out : opcode == Outi ? Reg_Outi : Reg_Reset, 0, a, 0, 0) == NULL;
+		}
+		case Outs:
+		{
+			return emit(t, Reg_Outs, 0, 0, bytes_to_int((char*)code + pc + 1), 0) == NULL;
+		}
+		case Alloc:
+		case Ldi:
+		case Join:
+		{
+			int a = in_register(t, --t->depth);
+			
+			if(a < 0 || emit(t, opcode == Alloc ? Reg_Alloc : opcode == Ldi ? Reg_Ldi : Reg_Join, t->depth, a, 0, 1) == NULL)
+				return 1;
+			push_slot(t);
+			return 0;
+		}
+		case Sti:
+		{
+			int value = in_register(t, --t->depth);
+			int address = in_register(t, --t->depth);
+			
+			return value < 0 || address < 0 || emit(t, Reg_Sti, 0, address, value, 0) == NULL;
+		}
+		case Fill:
+		case Copy:
+		case Sum:
+		case Min:
+		case Max:
+		case Vadd:
+		case Vmul:
+		case Find:
+		{
+			//the operands are read straight from their slots, in the order they were pushed
+			Opcode op = get_opcode_from_instruction((char)opcode);
+			int base = t->depth - op.required_stack_size;
+			
+			for(int i = base; i < t->depth; i++)
+				if(materialize(t, i))
+					return 1;
+			if(emit(t, Reg_Vector, base, base, opcode, op.pushed_stack_size) == NULL)
+				return 1;
+				
+			t->depth = base;
+			if(op.pushed_stack_size)
+				push_slot(t);
+			return 0;
+		}
+		case Call:
+		case Spawn:
+		case Coroutine:
+		{
+			int function = bytes_to_int((char*)code + pc + 1);
+			int base = t->depth - exe->functions[function].arg_count;
+			int forkable = opcode == Call && exe->functions[function].attributes & FUNCTION_ATTRIBUTE_FORKABLE;
+			int first = t->fork;
+			
+			for(int i = base; i < t->depth; i++)
+				if(materialize(t, i))
+					return 1;
+			if(emit(t, opcode == Call ? Reg_Call : opcode == Spawn ? Reg_Spawn : Reg_Coroutine, base, base, function, 1) == NULL)
+				return 1;
+				
+			t->depth = base;
+			push_slot(t);
+			
+			//the first call becomes a task this one runs beside, joined as soon as this returns
+			t->fork = forkable ? t->code->count - 1 : -1;
+			if(forkable && first >= 0 && independent(exe, t, first))
+			{
+				int dst = t->code->instructions[first].dst;
+				Register_Instruction* join;
+				
+				t->code->instructions[first].opcode = Reg_Spawn;
+				t->code->instructions[first].mask = 1;
+				t->fork = -1;
+				if((join = emit(t, Reg_Join, dst, dst, 0, 1)) == NULL)
+					return 1;
+				join->mask = 1;
+			}
+			return 0;
+		}
+		case Resume:
+		{
+			int value = in_register(t, --t->depth);
+			int handle = in_register(t, --t->depth);
+			
+			if(value < 0 || handle < 0 || emit(t, Reg_Resume, t->depth, handle, value, 1) == NULL)
+				return 1;
+			push_slot(t);
+			return 0;
+		}
+		case Yield:
+		{
+			int a = in_register(t, --t->depth);
+			
+			if(a < 0 || emit(t, Reg_Yield, t->depth, a, 0, 1) == NULL)
+				return 1;
+			push_slot(t);
+			return 0;
+		}
+		case Ret:
+		{
+			//an empty stack returns 0
+			if(t->depth == 0)
+				return emit(t, Reg_Ret_Imm, 0, 0, 0, 0) == NULL;
+				
+			Operand value = t->stack[t->depth - 1];
+			return emit(t, value.immediate ? Reg_Ret_Imm : Reg_Ret, 0, value.value, value.value, 0) == NULL;
+		}
+		default:
+			return 1;
+	}
+}
+
+/*
+	Translates a verified function and sets its registers. Returns 1 and leaves the
+	function to the stack interpreter if it isn't verified or memory runs out.
+*/
+int registers_translate(Executable* exe, int id)
+{
+	Executable_Function* function = &exe->functions[id];
+	unsigned char* code = (unsigned char*)function->instructions;
+	int size = function->size_of_instructions;
+	int result = 1;
+	Translation t;
+	
+	if(!(function->attributes & FUNCTION_ATTRIBUTE_VERIFIED) || size == 0)
+		return 1;
+		
+	int* depth = (int*)malloc(size * sizeof(int));
+	int* label = (int*)malloc(size * sizeof(int));
+	int* worklist = (int*)malloc(size * sizeof(int));
+	t.capacity = size + 8;
+	t.code = (Register_Code*)malloc(sizeof(Register_Code) + t.capacity * sizeof(Register_Instruction));
+	t.stack = NULL;
+	
+	if(depth == NULL || label == NULL || worklist == NULL || t.code == NULL)
+		goto done;
+		
+	//the depth at every pc, the same walk the verifier does
+	for(int pc = 0; pc < size; pc++)
+	{
+		depth[pc] = UNVISITED;
+		label[pc] = NOT_A_TARGET;
+	}
+	
+	int max_depth = function->arg_count;
+	int pending = 0;
+	depth[0] = function->arg_count;
+	worklist[pending++] = 0;
+	
+	while(pending)
+	{
+		int pc = worklist[--pending];
+		int current = depth[pc];
+		unsigned char opcode = code[pc];
+		Opcode op = get_opcode_from_instruction((char)opcode);
+		int successors[2];
+		int successor_count = 0;
+		
+		if(opcode == Call || opcode == Spawn || opcode == Coroutine)
+			current -= exe->functions[bytes_to_int((char*)code + pc + 1)].arg_count;
+		if(opcode != Ret)
+			current += op.pushed_stack_size - op.required_stack_size;
+		if(current > max_depth)
+			max_depth = current;
+			
+		if(opcode >= Jmp && opcode <= Jle)
+		{
+			successors[successor_count++] = pc + bytes_to_int((char*)code + pc + 1);
+			label[successors[0]] = TARGET;
+		}
+		if(opcode != Ret && opcode != Jmp)
+			successors[successor_count++] = pc + 1 + op.parameter_size;
+			
+		for(int i = 0; i < successor_count; i++)
+		{
+			if(depth[successors[i]] == UNVISITED)
+			{
+				depth[successors[i]] = current;
+				worklist[pending++] = successors[i];
+			}
+		}
+	}
+	
+	t.stack = (Operand*)malloc((max_depth + 1) * sizeof(Operand));
+	if(t.stack == NULL)
+		goto done;
+		
+	t.code->max_depth = max_depth;
+	t.code->frame_size = max_depth + function->local_count;
+	t.code->count = 0;
+	t.depth = 0;
+	t.barrier = 0;
+	t.result = -1;
+	t.fork = -1;
+	
+	//code nothing reaches is skipped. Whatever comes after a jump or a return is reached by a jump
+	int falls_through = 0;
+	
+	for(int pc = 0; pc < size; pc += 1 + get_opcode_from_instruction((char)code[pc]).parameter_size)
+	{
+		if(depth[pc] == UNVISITED)
+		{
+			falls_through = 0;
+			continue;
+		}
+		
+		//everything is in its slot at the start and at a label
+		if(pc == 0 || label[pc] != NOT_A_TARGET)
+		{
+			if(falls_through && flush(&t))
+				goto done;
+				
+			if(label[pc] != NOT_A_TARGET)
+				label[pc] = t.code->count;
+			t.barrier = t.code->count;
+			t.fork = -1;
+			t.depth = 0;
+			while(t.depth < depth[pc])
+				push_slot(&t);
+		}
+		
+		t.pc = pc;
+		if(translate_instruction(exe, &t, code, label, max_depth))
+			goto done;
+			
+		//a fused compare moves t.pc on to its jump
+		pc = t.pc;
+		falls_through = code[pc] != Jmp && code[pc] != Ret;
+	}
+	
+	for(int i = 0; i < t.code->count; i++)
+	{
+		Register_Instruction* in = &t.code->instructions[i];
+		
+		if(in->opcode == Reg_Jmp || in->opcode == Reg_Jump_If || in->opcode == Reg_Cmp_Jump || in->opcode == Reg_Cmp_Jump_Imm)
+			in->dst = label[in->dst];
+	}
+	
+	free(function->registers);
+	function->registers = t.code;
+	t.code = NULL;
+	result = 0;
+
+done:
+	free(depth);
+	free(label);
+	free(worklist);
+	free(t.stack);
+	free(t.code);
+	
+	return result;
+}
+
+
+//as in the stack interpreter, the heap's pages only protect to the page
+#define CHECK_HEAP(address) \
+	if((unsigned int)(address) >= exe->heap->top) \
+		error(exe, HEAP_INDEX_OUT_OF_RANGE, "Address %d is outside of the heap's %u ints", address, exe->heap->top)
+
+#define COMPARE(value1, value2) \
+	flags = ((value1) == (value2) ? JUMP_EQUAL : JUMP_NOT_EQUAL) | \
+		((value1) > (value2) ? JUMP_GREATER : 0) | \
+		((value1) < (value2) ? JUMP_LESS : 0)
+
+//instructions are counted in a local and only added to the totals at calls and returns
+#define FLUSH_EXECUTED() \
+	exe->metrics.instructions += executed; \
+	executed = 0
+
+/*
+	Runs the function on top of the call stack from its register code. The metrics
+	count register instructions, so they come out lower than the stack code's.
+*/
+int registers_run(Executable* exe)
+{
+	Stack_Frame* sf = (Stack_Frame*)stack_peek(&exe->call_stack);
+	Register_Code* code = exe->functions[sf->function_id].registers;
+	Register_Instruction* ip = code->instructions;
+	long* r = sf->stack.stack_elements;
+	int* heap_memory = exe->heap != NULL ? exe->heap->memory : NULL;
+	int flags = 0;
+	
+	if(code->frame_size > sf->stack.length)
+		error(exe, STACK_OVERFLOW, "The stack grew past its limit of %lu bytes.", (unsigned long)STACK_RESERVE_SIZE);
+	
+	//a resumed coroutine has all its registers back and carries on after its yield
+	if(exe->resuming != NULL)
+	{
+		long value;
+		
+		ip = code->instructions + coroutine_enter(exe, sf, &value);
+		flags = sf->flags;
+		r[ip[-1].dst] = value;
+	}
+	else
+	{
+		//the arguments are already in the first registers, the locals start at 0
+		memset(r + code->max_depth, 0, (code->frame_size - code->max_depth) * sizeof(long));
+		sf->local_memory = NULL;
+	}
+	
+	unsigned long executed = 0;
+	exe->metrics.calls++;
+	if(exe->call_stack.stack_pointer > exe->metrics.max_call_depth)
+		exe->metrics.max_call_depth = exe->call_stack.stack_pointer;
+	if(r + code->frame_size - exe->operand_stack.stack_elements > exe->metrics.max_operand_depth)
+		exe->metrics.max_operand_depth = (int)(r + code->frame_size - exe->operand_stack.stack_elements);
+		
+	for(;;)
+	{
+		Register_Instruction* in = ip++;
+		
+		executed++;
+		
+		switch(in->opcode)
+		{
+			case Reg_Mov:
+				r[in->dst] = r[in->a];
+				break;
+			case Reg_Mov_Imm:
+				r[in->dst] = in->b;
+				break;
+			case Reg_Add:
+				r[in->dst] = (int)((unsigned int)r[in->a] + (unsigned int)r[in->b]);
+				break;
+			case Reg_Add_Imm:
+				r[in->dst] = (int)((unsigned int)r[in->a] + (unsigned int)in->b);
+				break;
+			case Reg_Sub:
+				r[in->dst] = (int)((unsigned int)r[in->a] - (unsigned int)r[in->b]);
+				break;
+			case Reg_Sub_Imm:
+				r[in->dst] = (int)((unsigned int)r[in->a] - (unsigned int)in->b);
+				break;
+			case Reg_Mul:
+				r[in->dst] = (int)((unsigned int)r[in->a] * (unsigned int)r[in->b]);
+				break;
+			case Reg_Mul_Imm:
+				r[in->dst] = (int)((unsigned int)r[in->a] * (unsigned int)in->b);
+				break;
+			case Reg_Div:
+			case Reg_Div_Imm:
+			{
+				register int value1 = in->opcode == Reg_Div ? (int)r[in->b] : in->b;
+				register int value2 = (int)r[in->a];
+				if(value1 == 0)
+				{
+					sf->pc = in->pc;
+					error(exe,DIVISION_BY_ZERO, "A division by zero was encountered while trying to divide %d by %d", value2, value1);
+				}
+				
+				//-INT_MIN doesn't fit, and on x86 it traps instead of wrapping
+				r[in->dst] = value1 == -1 ? (int)(0u - (unsigned int)value2) : value2 / value1;
+				break;
+			}
+			case Reg_Rem:
+			case Reg_Rem_Imm:
+			{
+				register int value1 = in->opcode == Reg_Rem ? (int)r[in->b] : in->b;
+				register int value2 = (int)r[in->a];
+				if(value1 == 0)
+				{
+					sf->pc = in->pc;
+					error(exe,DIVISION_BY_ZERO, "A division by zero was encountered trying to divide %d by %d", value2, value1);
+				}
+				
+				r[in->dst] = value1 == -1 ? 0 : value2 % value1;
+				break;
+			}
+			case Reg_And:
+				r[in->dst] = r[in->a] & r[in->b];
+				break;
+			case Reg_And_Imm:
+				r[in->dst] = r[in->a] & in->b;
+				break;
+			case Reg_Or:
+				r[in->dst] = r[in->a] | r[in->b];
+				break;
+			case Reg_Or_Imm:
+				r[in->dst] = r[in->a] | in->b;
+				break;
+			case Reg_Xor:
+				r[in->dst] = r[in->a] ^ r[in->b];
+				break;
+			case Reg_Xor_Imm:
+				r[in->dst] = r[in->a] ^ in->b;
+				break;
+			case Reg_Shl:
+				r[in->dst] = (int)((unsigned int)r[in->a] << ((int)r[in->b] & 31));
+				break;
+			case Reg_Shl_Imm:
+				r[in->dst] = (int)((unsigned int)r[in->a] << (in->b & 31));
+				break;
+			case Reg_Shr:
+				r[in->dst] = (int)r[in->a] >> ((int)r[in->b] & 31);
+				break;
+			case Reg_Shr_Imm:
+				r[in->dst] = (int)r[in->a] >> (in->b & 31);
+				break;
+			case Reg_Not:
+				r[in->dst] = ~r[in->a];
+				break;
+			case Reg_Neg:
+				r[in->dst] = (int)(0u - (unsigned int)r[in->a]);
+				break;
+			case Reg_Cmp:
+				COMPARE((int)r[in->a], (int)r[in->b]);
+				break;
+			case Reg_Cmp_Imm:
+				COMPARE((int)r[in->a], in->b);
+				break;
+			case Reg_Jmp:
+				ip = code->instructions + in->dst;
+				break;
+			case Reg_Jump_If:
+				if(flags & in->mask)
+					ip = code->instructions + in->dst;
+				break;
+			case Reg_Cmp_Jump:
+				COMPARE((int)r[in->a], (int)r[in->b]);
+				if(flags & in->mask)
+					ip = code->instructions + in->dst;
+				break;
+			case Reg_Cmp_Jump_Imm:
+				COMPARE((int)r[in->a], in->b);
+				if(flags & in->mask)
+					ip = code->instructions + in->dst;
+				break;
+			case Reg_In:
+				r[in->dst] = getc(exe->input);
+				break;
+			case Reg_Out:
+				if(exe->output == NULL)
+					putc((int)r[in->a], stdout);
+				else
+				{
+					char c = (char)r[in->a];
+					tasks_output(exe, &c, 1);
+				}
+				break;
+			case Reg_Outs:
+				tasks_output(exe, exe->constants[in->b].data, exe->constants[in->b].size);
+				break;
+			case Reg_Outi:
+			{
+				char text[12];
+				tasks_output(exe, text, sprintf(text, "%d", (int)r[in->a]));
+				break;
+			}
+			case Reg_Ini:
+				r[in->dst] = read_integer(exe->input);
+				break;
+			case Reg_Alloc:
+				sf->pc = in->pc;
+				r[in->dst] = heap_alloc(exe, (int)r[in->a]);
+				break;
+			case Reg_Ldi:
+			{
+				register int address = (int)r[in->a];
+				sf->pc = in->pc;
+				CHECK_HEAP(address);
+				
+				r[in->dst] = heap_memory[(unsigned int)address];
+				break;
+			}
+			case Reg_Sti:
+			{
+				register int address = (int)r[in->a];
+				sf->pc = in->pc;
+				CHECK_HEAP(address);
+				
+				heap_memory[(unsigned int)address] = (int)r[in->b];
+				break;
+			}
+			case Reg_Reset:
+				sf->pc = in->pc;
+				heap_reset(exe, (int)r[in->a]);
+				break;
+			case Reg_Vector:
+			{
+				long* v = r + in->a;
+				sf->pc = in->pc;
+				
+				switch(in->b)
+				{
+					case Fill: vector_fill(exe, (int)v[0], (int)v[1], (int)v[2]); break;
+					case Copy: vector_copy(exe, (int)v[0], (int)v[1], (int)v[2]); break;
+					case Sum:  r[in->dst] = vector_sum(exe, (int)v[0], (int)v[1]); break;
+					case Min:  r[in->dst] = vector_min(exe, (int)v[0], (int)v[1]); break;
+					case Max:  r[in->dst] = vector_max(exe, (int)v[0], (int)v[1]); break;
+					case Vadd: vector_add(exe, (int)v[0], (int)v[1], (int)v[2], (int)v[3]); break;
+					case Vmul: vector_mul(exe, (int)v[0], (int)v[1], (int)v[2], (int)v[3]); break;
+					default:   r[in->dst] = vector_find(exe, (int)v[0], (int)v[1], (int)v[2]); break;
+				}
+				break;
+			}
+			case Reg_Call:
+			call:
+			{
+				Stack_Frame frame;
+				int arg_count = exe->functions[in->b].arg_count;
+				long* args = r + in->a;
+				frame.function_id = in->b;
+				frame.pc = 0;
+				frame.flags = 0;
+				sf->pc = in->pc;
+				
+				//natives run on the arguments where they are, without a frame
+				if(exe->functions[in->b].native != NULL)
+				{
+					exe->metrics.calls++;
+					r[in->dst] = exe->functions[in->b].native(exe, args);
+					break;
+				}
+				
+				//pure functions can be answered straight from the cache
+				int memoize = exe->memo != NULL && exe->functions[in->b].attributes & FUNCTION_ATTRIBUTE_PURE && arg_count <= MEMO_MAX_ARGS;
+				
+				if(memoize)
+				{
+					long result;
+					
+					if(memo_lookup(exe, in->b, args, &result))
+					{
+						r[in->dst] = result;
+						break;
+					}
+				}
+				
+				//the callee's window starts past this frame, with the arguments the way stack_window leaves them
+				frame.stack.stack_elements = r + code->frame_size;
+				frame.stack.length = sf->stack.length - code->frame_size;
+				frame.stack.stack_pointer = arg_count;
+				for(int i = 0; i < arg_count; i++)
+					frame.stack.stack_elements[i] = args[arg_count - 1 - i];
+					
+				stack_push(&exe->call_stack, (long)&frame);
+				
+				FLUSH_EXECUTED();
+				int ret_value = exe->functions[in->b].run_function(exe);
+				
+				if(memoize)
+					memo_insert(exe, in->b, args, ret_value);
+					
+				stack_pop(&exe->call_stack);
+				
+				r[in->dst] = ret_value;
+				break;
+			}
+			case Reg_Spawn:
+				//a fork is only worth a task near the top of the call stack, further down it's a call
+				if(in->mask && exe->call_stack.stack_pointer > TASKS_FORK_DEPTH)
+					goto call;
+				
+				sf->pc = in->pc;
+				FLUSH_EXECUTED();
+				r[in->dst] = (in->mask ? tasks_fork : tasks_spawn)(exe, in->b, r + in->a, r + code->frame_size, sf->stack.length - code->frame_size);
+				break;
+			case Reg_Join:
+				//the same depth as the fork, so whatever it did
+				if(in->mask && exe->call_stack.stack_pointer > TASKS_FORK_DEPTH)
+					break;
+				
+				sf->pc = in->pc;
+				FLUSH_EXECUTED();
+				r[in->dst] = tasks_join(exe, r[in->a], r + code->frame_size, sf->stack.length - code->frame_size);
+				break;
+			case Reg_Coroutine:
+				r[in->dst] = coroutine_create(exe, in->b, r + in->a);
+				break;
+			case Reg_Resume:
+				sf->pc = in->pc;
+				FLUSH_EXECUTED();
+				r[in->dst] = coroutine_resume(exe, r[in->a], r[in->b], r + code->frame_size, sf->stack.length - code->frame_size);
+				break;
+			case Reg_Yield:
+				sf->pc = in->pc;
+				sf->flags = flags;
+				coroutine_yield(exe, sf, (int)(ip - code->instructions), r, code->frame_size);
+				FLUSH_EXECUTED();
+				return (int)r[in->a];
+			case Reg_Ret:
+			case Reg_Ret_Imm:
+			{
+				int ret_value = in->opcode == Reg_Ret ? (int)r[in->a] : in->b;
+				
+				FLUSH_EXECUTED();
+				exe->metrics.returns++;
+				
+				return ret_value;
+			}
+			default:
+				error(exe, INVALID_OPCODE, "Invalid register opcode recieved: 0x%X", in->opcode);
+		}
+	}
+}
+
+
+#undef CHECK_HEAP
+#undef COMPARE
+#undef FLUSH_EXECUTED
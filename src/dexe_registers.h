@@ -0,0 +1,148 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	The register form of a function. Verified functions are translated once when the
+	program starts and run by registers_run instead of the stack interpreter.
+	
+	Every value the stack code can name gets a register: the stack depth at each pc
+	is known from the verifier's abstract interpretation, so the item at depth i is
+	always register i, and local j is register max_depth + j. Loads, pushes, dups and
+	pops only move values around, so translating follows them at load time and hands
+	the producer of a value straight to its consumer, eg "load 0, push 1, add, store 0"
+	becomes one "add r5, r5, 1". A Cmp followed by a conditional jump becomes one
+	instruction as well.
+	
+	All the registers live in the operand stack, at the bottom of the frame's window,
+	so a call is a copy of its arguments to just past the caller's registers. Only the
+	plain verified interpreter is replaced: debugging, profiling and tracing keep the
+	stack interpreter, which counts what they report per stack instruction.
+	
+	With -auto-parallel, a call to a forkable function followed by another one that
+	doesn't need its result becomes a spawn of the first, the second call and a join,
+	so the two run at once on the task workers (see dexe_tasks.h). Only frames down to
+	TASKS_FORK_DEPTH fork, deeper ones make both calls as they were, so recursive
+	functions don't pay for a task on every call.
+	
+	A coroutine's registers are its whole frame, so a yield keeps all of them and the
+	instruction after it, and resuming copies them back and jumps there.
+*/
+
+enum Register_Opcode_Enum
+{
+	Reg_Mov,
+	Reg_Mov_Imm,
+	
+	//op r[dst], r[a], r[b] and op r[dst], r[a], b
+	Reg_Add,
+	Reg_Add_Imm,
+	Reg_Sub,
+	Reg_Sub_Imm,
+	Reg_Mul,
+	Reg_Mul_Imm,
+	Reg_Div,
+	Reg_Div_Imm,
+	Reg_Rem,
+	Reg_Rem_Imm,
+	Reg_And,
+	Reg_And_Imm,
+	Reg_Or,
+	Reg_Or_Imm,
+	Reg_Xor,
+	Reg_Xor_Imm,
+	Reg_Shl,
+	Reg_Shl_Imm,
+	Reg_Shr,
+	Reg_Shr_Imm,
+	Reg_Not,
+	Reg_Neg,
+	
+	//the jumps go to instruction dst. mask is the flags they jump on
+	Reg_Cmp,
+	Reg_Cmp_Imm,
+	Reg_Jmp,
+	Reg_Jump_If,
+	Reg_Cmp_Jump,
+	Reg_Cmp_Jump_Imm,
+	
+	Reg_In,
+	Reg_Out,
+	Reg_Outs,
+	Reg_Outi,
+	Reg_Ini,
+	
+	Reg_Alloc,
+	Reg_Ldi,
+	Reg_Sti,
+	Reg_Reset,
+	
+	//a bulk opcode, b, with its operands in r[a] onwards
+	Reg_Vector,
+	
+	//the arguments are r[a] onwards in the order they were pushed, b is the function.
+	//Joins take the handle in r[a]. A spawn and join with mask 1 are a fork, see above
+	Reg_Call,
+	Reg_Spawn,
+	Reg_Join,
+	
+	//coroutines take their arguments like calls. Resumes take the handle in r[a] and the
+	//value in r[b], yields the value in r[a] and leave the next resume's value in r[dst]
+	Reg_Coroutine,
+	Reg_Resume,
+	Reg_Yield,
+	
+	Reg_Ret,
+	Reg_Ret_Imm
+};
+typedef enum Register_Opcode_Enum Register_Opcode;
+
+struct Register_Instruction_struct
+{
+	unsigned char opcode;
+	unsigned char mask;
+	
+	int dst;
+	int a;
+	int b;
+	
+	int pc; //of the stack instruction it came from, for errors
+};
+typedef struct Register_Instruction_struct Register_Instruction;
+
+//one allocation, the instructions follow the header
+struct Register_Code_struct
+{
+	int max_depth;   //registers below this are stack slots, the locals follow
+	int frame_size;  //max_depth + the locals. A call's arguments go here
+	int count;
+	
+	Register_Instruction instructions[];
+};
+typedef struct Register_Code_struct Register_Code;
+
+
+extern int registers_translate(Executable*, int);
+extern int registers_run(Executable*);
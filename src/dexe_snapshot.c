@@ -0,0 +1,371 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_stack.h"
+#include "dexe_heap.h"
+#include "dexe_executer.h"
+#include "dexe_coroutines.h"
+#include "dexe_snapshot.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#define PADDED(size) (((size) + 7) & ~(size_t)7)
+
+
+static size_t frame_size(Snapshot_Frame* frame)
+{
+	return sizeof(Snapshot_Frame) + PADDED(frame->stack_size * sizeof(long) + frame->local_count * sizeof(int));
+}
+
+//why the program can't be saved as it is, or NULL
+static char* refused(Executable* exe)
+{
+	Coroutine_Pool* pool = exe->coroutines;
+	
+	if(exe->worker != NULL)
+		return "it runs tasks";
+	
+	for(int i = 0; pool != NULL && i < pool->count; i++)
+		if(pool->coroutines[i]->state != COROUTINE_FREE)
+			return "it has a coroutine that hasn't returned";
+	
+	for(int i = 0; i < exe->call_stack.stack_pointer - 1; i++)
+	{
+		Stack_Frame* sf = (Stack_Frame*)exe->call_stack.stack_elements[i];
+		
+		if((unsigned char)exe->functions[sf->function_id].instructions[sf->pc] != Call)
+			return "a function on the call stack wasn't called by a call instruction";
+	}
+	
+	return NULL;
+}
+
+static int write_padding(FILE* file, size_t size)
+{
+	static const char zeroes[8];
+	
+	return PADDED(size) == size || fwrite(zeroes, 1, PADDED(size) - size, file) == PADDED(size) - size;
+}
+
+static int write_snapshot(Executable* exe, char* filename)
+{
+	Snapshot_Header header;
+	FILE* file;
+	int result = 1;
+	
+	memset(&header, 0, sizeof(Snapshot_Header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+	header.version = SNAPSHOT_VERSION;
+	header.word_size = sizeof(long);
+	header.number_of_functions = exe->number_of_functions;
+	header.number_of_frames = exe->call_stack.stack_pointer;
+	header.heap_words = exe->heap != NULL ? exe->heap->top : 0;
+	strncpy(header.image, exe->info->filename, SNAPSHOT_IMAGE_NAME_SIZE - 1);
+	
+	if(hash_file(exe->info->filename, &header.image_hash) || (file = fopen(filename, "wb")) == NULL)
+		return 1;
+	
+	if(fwrite(&header, sizeof(Snapshot_Header), 1, file) != 1)
+		goto done;
+	if(header.heap_words && (fwrite(exe->heap->memory, sizeof(int), header.heap_words, file) != header.heap_words || !write_padding(file, header.heap_words * sizeof(int))))
+		goto done;
+	
+	for(int i = 0; i < exe->call_stack.stack_pointer; i++)
+	{
+		Stack_Frame* sf = (Stack_Frame*)exe->call_stack.stack_elements[i];
+		Snapshot_Frame frame;
+		
+		frame.function_id = sf->function_id;
+		frame.pc = sf->pc;
+		frame.flags = sf->flags;
+		frame.stack_size = sf->stack.stack_pointer;
+		frame.local_count = exe->functions[sf->function_id].local_count;
+		frame.offset = (int)(sf->stack.stack_elements - exe->operand_stack.stack_elements);
+		
+		if(fwrite(&frame, sizeof(Snapshot_Frame), 1, file) != 1 ||
+			(size_t)frame.stack_size != fwrite(sf->stack.stack_elements, sizeof(long), frame.stack_size, file) ||
+			(size_t)frame.local_count != fwrite(sf->local_memory, sizeof(int), frame.local_count, file) ||
+			!write_padding(file, frame.stack_size * sizeof(long) + frame.local_count * sizeof(int)))
+			goto done;
+	}
+	
+	result = 0;
+done:
+	if(fclose(file))
+		result = 1;
+	return result;
+}
+
+//the interpreters call this at an input while there's a snapshot to take. Only the first one is
+void snapshot_write(Executable* exe)
+{
+	char* filename = exe->info->snapshot_filename;
+	char* reason = refused(exe);
+	
+	exe->info->commandline &= ~COMMANDLINE_SNAPSHOT;
+	
+	if(reason != NULL)
+		warning("no snapshot was written to '%s', %s", filename, reason);
+	else if(write_snapshot(exe, filename))
+		warning("could not write the snapshot to '%s'", filename);
+}
+
+
+/*
+	Maps the snapshot and checks it's one of the image it names, or of the image on
+	the command line when there is one. The frames are checked against the code once
+	it's loaded, by snapshot_restore.
+*/
+int snapshot_open(Executable* exe, char* filename, char* message)
+{
+	static char image[SNAPSHOT_IMAGE_NAME_SIZE];
+	Snapshot* snapshot = (Snapshot*)calloc(1, sizeof(Snapshot));
+	Snapshot_Header* header = NULL;
+	unsigned long long hash;
+	
+	if(snapshot == NULL)
+	{
+		snprintf(message, SNAPSHOT_MESSAGE_SIZE, "out of memory");
+		return 1;
+	}
+	
+	#ifdef _WIN32
+		LARGE_INTEGER size;
+		
+		snapshot->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(snapshot->file != INVALID_HANDLE_VALUE && GetFileSizeEx(snapshot->file, &size) && size.QuadPart > 0)
+		{
+			snapshot->size = (size_t)size.QuadPart;
+			snapshot->mapping = CreateFileMappingA(snapshot->file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if(snapshot->mapping != NULL)
+				header = (Snapshot_Header*)MapViewOfFile(snapshot->mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+	#else
+		struct stat info;
+		
+		snapshot->file = open(filename, O_RDONLY);
+		if(snapshot->file >= 0 && !fstat(snapshot->file, &info) && info.st_size > 0)
+		{
+			snapshot->size = (size_t)info.st_size;
+			header = (Snapshot_Header*)mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, snapshot->file, 0);
+			if(header == (Snapshot_Header*)MAP_FAILED)
+				header = NULL;
+		}
+	#endif
+	
+	snapshot->header = header;
+	exe->restoring = snapshot;
+	
+	if(header == NULL)
+	{
+		snprintf(message, SNAPSHOT_MESSAGE_SIZE, "could not be read");
+		return 1;
+	}
+	if(snapshot->size < sizeof(Snapshot_Header) || memcmp(header->magic, SNAPSHOT_MAGIC, 4) || header->version != SNAPSHOT_VERSION || header->word_size != sizeof(long))
+	{
+		snprintf(message, SNAPSHOT_MESSAGE_SIZE, "is not a dexe snapshot, or is one from another version or machine");
+		return 1;
+	}
+	
+	if(exe->info->filename == NULL)
+	{
+		memcpy(image, header->image, SNAPSHOT_IMAGE_NAME_SIZE - 1);
+		exe->info->filename = image;
+	}
+	
+	if(hash_file(exe->info->filename, &hash))
+	{
+		snprintf(message, SNAPSHOT_MESSAGE_SIZE, "was taken of '%.*s', which could not be read", SNAPSHOT_IMAGE_NAME_SIZE, exe->info->filename);
+		return 1;
+	}
+	if(hash != header->image_hash)
+	{
+		snprintf(message, SNAPSHOT_MESSAGE_SIZE, "was not taken of '%.*s' as it is now", SNAPSHOT_IMAGE_NAME_SIZE, exe->info->filename);
+		return 1;
+	}
+	
+	if(snapshot->size - sizeof(Snapshot_Header) < PADDED((size_t)header->heap_words * sizeof(int)))
+	{
+		snprintf(message, SNAPSHOT_MESSAGE_SIZE, "is cut short");
+		return 1;
+	}
+	
+	snapshot->next = (char*)(header + 1) + PADDED((size_t)header->heap_words * sizeof(int));
+	return 0;
+}
+
+//every frame has to be one the code could have left, since the verified interpreters trust it
+static int check_frames(Executable* exe, Snapshot* snapshot)
+{
+	Snapshot_Header* header = snapshot->header;
+	char* end = (char*)header + snapshot->size;
+	char* next = snapshot->next;
+	int offset = 0;
+	
+	if(header->number_of_functions != exe->number_of_functions || header->number_of_frames < 1 ||
+		(header->heap_words && (exe->heap == NULL || (int)header->heap_words < 0)))
+		return 1;
+	
+	for(int i = 0; i < header->number_of_frames; i++)
+	{
+		Snapshot_Frame* frame = (Snapshot_Frame*)next;
+		Executable_Function* function;
+		int last = i == header->number_of_frames - 1;
+		
+		if(end - next < (long)sizeof(Snapshot_Frame) || frame->function_id < 0 || frame->function_id >= exe->number_of_functions)
+			return 1;
+		
+		function = &exe->functions[frame->function_id];
+		if(frame->stack_size < 0 || frame->stack_size > exe->operand_stack.length || frame->local_count != function->local_count ||
+			frame->offset != offset || frame->stack_size > exe->operand_stack.length - offset || (size_t)(end - next) < frame_size(frame) ||
+			frame->pc < 0 || frame->pc >= function->size_of_instructions)
+			return 1;
+		
+		//the top frame is at the input it was saved at, the others at the call to the next one
+		unsigned char opcode = (unsigned char)function->instructions[frame->pc];
+		
+		if(last && opcode != In && opcode != Ini)
+			return 1;
+		if(!last && (opcode != Call || frame->pc + 4 >= function->size_of_instructions || (size_t)(end - next) < frame_size(frame) + sizeof(Snapshot_Frame) ||
+			bytes_to_int(function->instructions + frame->pc + 1) != ((Snapshot_Frame*)(next + frame_size(frame)))->function_id))
+			return 1;
+		
+		offset += frame->stack_size;
+		next += frame_size(frame);
+	}
+	
+	return 0;
+}
+
+//runs the program from the snapshot instead of from its entry point
+int snapshot_restore(Executable* exe)
+{
+	Snapshot* snapshot = exe->restoring;
+	Snapshot_Frame* frame = (Snapshot_Frame*)snapshot->next;
+	Stack_Frame sf;
+	
+	if(check_frames(exe, snapshot))
+		error(exe, FILE_ERROR, "The snapshot '%s' does not fit the code of '%s'", exe->info->restore_filename, exe->info->filename);
+	
+	if(snapshot->header->heap_words)
+		memcpy(exe->heap->memory + heap_alloc(exe, (int)snapshot->header->heap_words), snapshot->header + 1, snapshot->header->heap_words * sizeof(int));
+	
+	sf.function_id = frame->function_id;
+	sf.pc = 0;
+	sf.flags = 0;
+	sf.stack.stack_elements = exe->operand_stack.stack_elements;
+	sf.stack.length = exe->operand_stack.length;
+	sf.stack.stack_pointer = 0;
+	
+	stack_push(&exe->call_stack, (long)&sf);
+	int ret_val = dexe_run_stack_function(exe);
+	stack_pop(&exe->call_stack);
+	
+	return ret_val;
+}
+
+/*
+	The stack interpreter's prologue calls this while there are frames left to restore.
+	It fills sf in from the next one and gives the pc to go on from. A frame in the middle
+	of a call makes it again, into the next frame, and goes on after the call with what
+	it returned. Once the top frame is back the snapshot is closed.
+*/
+int snapshot_enter(Executable* exe, Stack_Frame* sf)
+{
+	Snapshot* snapshot = exe->restoring;
+	Snapshot_Frame* frame = (Snapshot_Frame*)snapshot->next;
+	long* elements = (long*)(frame + 1);
+	int pc = frame->pc;
+	
+	memcpy(sf->stack.stack_elements, elements, frame->stack_size * sizeof(long));
+	sf->stack.stack_pointer = frame->stack_size;
+	sf->flags = frame->flags;
+	sf->local_memory = NULL;
+	
+	if(frame->local_count)
+	{
+		if((sf->local_memory = (int*)malloc(frame->local_count * sizeof(int))) == NULL)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %d bytes for locals", frame->local_count * (int)sizeof(int));
+		memcpy(sf->local_memory, elements + frame->stack_size, frame->local_count * sizeof(int));
+	}
+	
+	snapshot->next += frame_size(frame);
+	if(++snapshot->restored == snapshot->header->number_of_frames)
+	{
+		snapshot_free(exe);
+		return pc;
+	}
+	
+	Stack_Frame callee;
+	callee.function_id = ((Snapshot_Frame*)snapshot->next)->function_id;
+	callee.pc = 0;
+	callee.flags = 0;
+	callee.stack.stack_elements = sf->stack.stack_elements + sf->stack.stack_pointer;
+	callee.stack.length = sf->stack.length - sf->stack.stack_pointer;
+	callee.stack.stack_pointer = 0;
+	
+	stack_push(&exe->call_stack, (long)&callee);
+	int ret_value = dexe_run_stack_function(exe);
+	stack_pop(&exe->call_stack);
+	
+	stack_push(&sf->stack, ret_value);
+	
+	return pc + 5;
+}
+
+void snapshot_free(Executable* exe)
+{
+	Snapshot* snapshot = exe->restoring;
+	
+	if(snapshot == NULL)
+		return;
+	
+	#ifdef _WIN32
+		if(snapshot->header != NULL)
+			UnmapViewOfFile(snapshot->header);
+		if(snapshot->mapping != NULL)
+			CloseHandle(snapshot->mapping);
+		if(snapshot->file != INVALID_HANDLE_VALUE)
+			CloseHandle(snapshot->file);
+	#else
+		if(snapshot->header != NULL)
+			munmap(snapshot->header, snapshot->size);
+		if(snapshot->file >= 0)
+			close(snapshot->file);
+	#endif
+	
+	free(snapshot);
+	exe->restoring = NULL;
+}
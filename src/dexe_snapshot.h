@@ -0,0 +1,99 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+#define SNAPSHOT_MAGIC           "DSNP"
+#define SNAPSHOT_VERSION         1
+#define SNAPSHOT_IMAGE_NAME_SIZE 224
+#define SNAPSHOT_MESSAGE_SIZE    512
+
+
+/*
+	A snapshot is the state of a program just before it first reads input: the
+	heap, and every frame on the call stack with its operand stack, locals, flags
+	and pc. -restore maps it and carries on from there, so whatever the program
+	worked out before reading anything doesn't have to be worked out again.
+	
+	The file is the header, the heap's ints, then one Snapshot_Frame per frame from
+	the bottom of the call stack up, each followed by its stack and its locals.
+	Everything is native endian and padded to 8 bytes, like the trace. A snapshot
+	only fits the image it was taken of, which is checked by the hash of the whole
+	image file.
+	
+	Frames are only ever saved from the stack interpreter, so a run that takes one
+	doesn't use the register form and keeps the code where the file has it. Every
+	frame but the top one is in the middle of a call, and restoring the frame makes
+	that call again into the next one before carrying on after it. Tasks and
+	coroutines live outside the call stack, so a program that has any when it first
+	reads isn't saved.
+*/
+struct Snapshot_Header_struct
+{
+	char magic[4];
+	unsigned int version;
+	unsigned long long image_hash; //FNV-1a of the image file
+	unsigned int word_size;        //sizeof(long) where it was taken
+	int number_of_functions;
+	int number_of_frames;
+	unsigned int heap_words;
+	char image[SNAPSHOT_IMAGE_NAME_SIZE];
+};
+typedef struct Snapshot_Header_struct Snapshot_Header;
+
+struct Snapshot_Frame_struct
+{
+	int function_id;
+	int pc;         //of the input in the top frame, of the call in the others
+	int flags;
+	int stack_size; //longs on its operand stack
+	int local_count;
+	int offset;     //of its operand stack from the bottom of the whole stack, in longs
+};
+typedef struct Snapshot_Frame_struct Snapshot_Frame;
+
+//an open snapshot, until the last frame is restored
+struct Snapshot_struct
+{
+	Snapshot_Header* header;
+	size_t size;
+	
+	char* next; //the next frame to restore
+	int restored;
+	
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+};
+typedef struct Snapshot_struct Snapshot;
+
+
+extern void snapshot_write(Executable*);
+
+extern int snapshot_open(Executable*, char*, char*);
+extern int snapshot_restore(Executable*);
+extern int snapshot_enter(Executable*, Stack_Frame*);
+extern void snapshot_free(Executable*);
@@ -20,29 +20,188 @@
 	THE SOFTWARE.
 */
 
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
 #include "dexe_utils.h"
 #include "dexe_stack.h"
 
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+	#include <setjmp.h>
+	#include <pthread.h>
+	#include <sys/mman.h>
+	#include <sys/resource.h>
+	
+	#ifndef MAP_ANONYMOUS
+		#define MAP_ANONYMOUS MAP_ANON
+	#endif
+	#ifndef MAP_NORESERVE
+		#define MAP_NORESERVE 0
+	#endif
+#endif
 
-int stack_init(stack* st)
+/*
+	Every stack is a single reservation laid out as
+
+		[guard page][usable space ......................][guard page]
+
+	stack_elements points at the start of the usable space. Pushing past the end or
+	popping below the start touches a guard page, and the fault handler below turns
+	that into a normal error() instead of a crash. That way stack_push never has to
+	compare against the length and the stack never has to be moved to grow it.
+*/
+struct Stack_Region_struct
+{
+	char* base; //start of the low guard page, NULL if the slot is free
+	char* end;  //end of the high guard page
+};
+typedef struct Stack_Region_struct Stack_Region;
+
+#if defined(_MSC_VER)
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
+//what a thread running DEXE code needs when it faults. Each thread has its own
+struct Stack_Guard_struct
 {
-	st->stack_elements = (long*)malloc(DEFAULT_STACK_SIZE * sizeof(long));
+	Executable* exe;
+	char* native_stack_top;
+	size_t native_stack_limit;
+	char* alternate_stack;
+	
+	//set by the handler for stack_run_guarded to report
+	enum DEXE_ERROR error;
+	char* address;
+	volatile int running;
+#ifndef _WIN32
+	sigjmp_buf recovery;
+#endif
+};
+typedef struct Stack_Guard_struct Stack_Guard;
+
+//stacks are registered from any thread, the handler reads them without the lock
+static Stack_Region regions[STACK_MAX_REGIONS];
+#ifdef _WIN32
+	static SRWLOCK regions_lock = SRWLOCK_INIT;
+	#define LOCK_REGIONS() AcquireSRWLockExclusive(&regions_lock)
+	#define UNLOCK_REGIONS() ReleaseSRWLockExclusive(&regions_lock)
+#else
+	static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+	#define LOCK_REGIONS() pthread_mutex_lock(&regions_lock)
+	#define UNLOCK_REGIONS() pthread_mutex_unlock(&regions_lock)
+#endif
+static size_t page_size;
+
+static THREAD_LOCAL Stack_Guard guard;
+
+//the heap's reservation (see dexe_heap.c). Faults past its committed top are bad addresses
+static char* heap_base;
+static char* heap_end;
+
+
+static size_t get_page_size()
+{
+	if(!page_size)
+	{
+		#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			page_size = info.dwPageSize;
+		#else
+			page_size = (size_t)sysconf(_SC_PAGESIZE);
+		#endif
+	}
+	return page_size;
+}
 
-	if(st->stack_elements == NULL)
+int stack_init(stack* st)
+{
+	size_t page = get_page_size();
+	size_t size = STACK_RESERVE_SIZE + 2 * page;
+	char* base;
+	int slot;
+	
+	#ifdef _WIN32
+		//reserve only, pages are committed by the exception handler as they are touched
+		base = (char*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+		if(base == NULL)
+			return 1;
+	#else
+		//the kernel commits anonymous pages on first touch, so all that's needed is the guards
+		base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(base == (char*)MAP_FAILED)
+			return 1;
+		
+		if(mprotect(base, page, PROT_NONE) || mprotect(base + size - page, page, PROT_NONE))
+		{
+			munmap(base, size);
+			return 1;
+		}
+	#endif
+	
+	LOCK_REGIONS();
+	for(slot = 0; slot < STACK_MAX_REGIONS && regions[slot].base != NULL; slot++);
+	if(slot < STACK_MAX_REGIONS)
+	{
+		regions[slot].end = base + size;
+		regions[slot].base = base;
+	}
+	UNLOCK_REGIONS();
+	
+	if(slot == STACK_MAX_REGIONS)
+	{
+		#ifdef _WIN32
+			VirtualFree(base, 0, MEM_RELEASE);
+		#else
+			munmap(base, size);
+		#endif
 		return 1;
+	}
 	
-	st->length = DEFAULT_STACK_SIZE;
+	st->stack_elements = (long*)(base + page);
+	st->length = (int)(STACK_RESERVE_SIZE / sizeof(long));
 	st->stack_pointer = 0;
 	
 	return 0;
 }
 void stack_free(stack* st)
 {
-	if(st != NULL)
+	if(st != NULL && st->stack_elements != NULL)
 	{
-		free(st->stack_elements);
+		char* base = (char*)st->stack_elements - get_page_size();
+		char* end = NULL;
+		
+		LOCK_REGIONS();
+		for(int slot = 0; slot < STACK_MAX_REGIONS; slot++)
+		{
+			if(regions[slot].base == base)
+			{
+				end = regions[slot].end;
+				regions[slot].base = NULL;
+				regions[slot].end = NULL;
+				break;
+			}
+		}
+		UNLOCK_REGIONS();
 		
-		st = NULL;
+		if(end != NULL)
+		{
+			#ifdef _WIN32
+				VirtualFree(base, 0, MEM_RELEASE);
+			#else
+				munmap(base, end - base);
+			#endif
+		}
+		
+		st->stack_elements = NULL;
+		st->length = 0;
+		st->stack_pointer = 0;
 	}
 }
 
@@ -51,21 +210,31 @@ void stack_empty(stack* st)
 	st->stack_pointer = 0;
 }
 
-int stack_push(stack* st, long value)
+/*
+	Makes child a view of the free space above the top of parent, and moves the top
+	count elements of parent into it in reverse order (the order a pop/push loop would
+	leave them in). Nothing is allocated or copied besides the moved elements, and
+	child must not be passed to stack_free.
+*/
+void stack_window(stack* parent, stack* child, int count)
 {
-	if(st->stack_pointer >= st->length)
-	{
-		//allocate more memory
+	parent->stack_pointer -= count;
 	
-		st->length += INCREASE_STACK_SIZE_BY;
-		long* ptr = (long*)realloc(st->stack_elements, st->length * sizeof(long)); 
-		
-		if(ptr == NULL)
-			return 1;
-		
-		st->stack_elements = ptr;
-	}
+	child->stack_elements = parent->stack_elements + parent->stack_pointer;
+	child->length = parent->length - parent->stack_pointer;
+	child->stack_pointer = count;
 	
+	for(int i = 0, k = count - 1; i < k; i++, k--)
+	{
+		long temp = child->stack_elements[i];
+		child->stack_elements[i] = child->stack_elements[k];
+		child->stack_elements[k] = temp;
+	}
+}
+
+//No bounds check, running off either end hits a guard page
+int stack_push(stack* st, long value)
+{
 	st->stack_elements[st->stack_pointer++] = value;
 	
 	return 0;
@@ -80,4 +249,229 @@ long stack_peek(stack* st)
 long stack_pop(stack* st)
 {
 	return st->stack_elements[--st->stack_pointer];
-}
\ No newline at end of file
+}
+
+
+
+
+/*
+	Fault handling. Guard page hits are reported like any other runtime error, and so
+	is running out of native stack (from very deep DEXE recursion). Anything else is
+	not ours, so the default action is restored and the faulting instruction re-runs
+	into it. classify_fault only reads, so it is safe from a signal handler.
+*/
+static int classify_fault(char* address)
+{
+	size_t page = get_page_size();
+	
+	guard.error = OK;
+	guard.address = address;
+	
+	for(int slot = 0; slot < STACK_MAX_REGIONS; slot++)
+	{
+		char* base = regions[slot].base;
+		char* end = regions[slot].end;
+		
+		if(base == NULL || end == NULL)
+			continue;
+		
+		if(address >= base && address < base + page)
+			guard.error = MANIPULATED_EMPTY_STACK;
+		else if(address >= end - page && address < end)
+			guard.error = STACK_OVERFLOW;
+	}
+	
+	if(address >= heap_base && address < heap_end)
+		guard.error = HEAP_INDEX_OUT_OF_RANGE;
+	
+	if(guard.native_stack_limit && address < guard.native_stack_top && address >= guard.native_stack_top - guard.native_stack_limit - 16 * page)
+		guard.error = STACK_OVERFLOW;
+	
+	return guard.error != OK;
+}
+
+static void report_fault(Executable* exe)
+{
+	if(guard.error == MANIPULATED_EMPTY_STACK)
+		error(exe, MANIPULATED_EMPTY_STACK, "An item was popped off of an empty stack.");
+	
+	if(guard.error == HEAP_INDEX_OUT_OF_RANGE)
+		error(exe, HEAP_INDEX_OUT_OF_RANGE, "Address %lu is past the top of the heap.", (unsigned long)((guard.address - heap_base) / sizeof(int)));
+	
+	if(guard.native_stack_limit && guard.address < guard.native_stack_top && guard.address >= guard.native_stack_top - guard.native_stack_limit - 16 * get_page_size())
+		error(exe, STACK_OVERFLOW, "The call stack is too deep for the interpreter's native stack (%lu bytes).", (unsigned long)guard.native_stack_limit);
+	
+	error(exe, STACK_OVERFLOW, "The stack grew past its limit of %lu bytes.", (unsigned long)STACK_RESERVE_SIZE);
+}
+
+void stack_guard_heap(char* base, size_t size)
+{
+	heap_base = base;
+	heap_end = base != NULL ? base + size : NULL;
+}
+
+#ifdef _WIN32
+
+/*
+	An exception handler runs on the faulting thread like a call from the faulting
+	instruction, so error() is fine from it. The one exception is a native stack overflow,
+	where next to nothing is left to run on and only a fixed message goes out.
+*/
+static LONG CALLBACK guard_handler(PEXCEPTION_POINTERS info)
+{
+	if(info->ExceptionRecord->ExceptionCode == EXCEPTION_STACK_OVERFLOW && guard.running)
+	{
+		static const char message[] = "\n\nError\n\nThe execution of this DEXE file has been terminated for the following reason:\nThe stack has overflowed. The program recursed too deeply or pushed too many items.\n";
+		DWORD written;
+		
+		if(!(guard.exe->info->commandline & COMMANDLINE_SILENT))
+			WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), message, sizeof(message) - 1, &written, NULL);
+		TerminateProcess(GetCurrentProcess(), STACK_OVERFLOW);
+	}
+	
+	if(info->ExceptionRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION)
+		return EXCEPTION_CONTINUE_SEARCH;
+	
+	char* address = (char*)info->ExceptionRecord->ExceptionInformation[1];
+	size_t page = get_page_size();
+	
+	//commit pages lazily, anywhere in a reservation that is not a guard page
+	for(int slot = 0; slot < STACK_MAX_REGIONS; slot++)
+	{
+		if(regions[slot].base != NULL && address >= regions[slot].base + page && address < regions[slot].end - page)
+		{
+			if(VirtualAlloc((void*)((size_t)address & ~(page - 1)), page, MEM_COMMIT, PAGE_READWRITE) != NULL)
+				return EXCEPTION_CONTINUE_EXECUTION;
+		}
+	}
+	
+	if(guard.running && classify_fault(address))
+		report_fault(guard.exe);
+	
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+void stack_install_guard_handler(Executable* exe, size_t native_stack_size)
+{
+	static int installed = 0;
+	
+	guard.exe = exe;
+	
+	LOCK_REGIONS();
+	if(!installed)
+	{
+		AddVectoredExceptionHandler(1, guard_handler);
+		installed = 1;
+	}
+	UNLOCK_REGIONS();
+}
+
+void stack_remove_guard_handler()
+{
+	guard.exe = NULL;
+}
+
+int stack_run_guarded(Executable* exe, int (*run)(Executable*, void*), void* context)
+{
+	int result;
+	
+	guard.running = 1;
+	result = run(exe, context);
+	guard.running = 0;
+	
+	return result;
+}
+
+#else
+
+//nothing that prints or frees is safe in here, so the fault is reported once stack_run_guarded is back in control
+static void guard_handler(int signal_number, siginfo_t* info, void* context)
+{
+	if(guard.running && classify_fault((char*)info->si_addr))
+		siglongjmp(guard.recovery, 1);
+	
+	signal(signal_number, SIG_DFL);
+}
+
+/*
+	Sets the calling thread up to have its faults reported on exe. native_stack_size is
+	the size of the thread's own stack, 0 for the process's limit, and is measured from
+	here, so call it near the top of the thread.
+*/
+void stack_install_guard_handler(Executable* exe, size_t native_stack_size)
+{
+	static int installed = 0;
+	char marker;
+	struct rlimit limit;
+	
+	guard.exe = exe;
+	guard.native_stack_top = &marker;
+	guard.native_stack_limit = native_stack_size;
+	if(!native_stack_size && !getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY)
+		guard.native_stack_limit = (size_t)limit.rlim_cur;
+	
+	//the handler needs a stack of its own, the native one may be what overflowed. It's per thread
+	if(guard.alternate_stack == NULL && (guard.alternate_stack = (char*)malloc(SIGSTKSZ * 4)) != NULL)
+	{
+		stack_t ss;
+		
+		ss.ss_sp = guard.alternate_stack;
+		ss.ss_size = SIGSTKSZ * 4;
+		ss.ss_flags = 0;
+		sigaltstack(&ss, NULL);
+	}
+	
+	LOCK_REGIONS();
+	if(!installed)
+	{
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = guard_handler;
+		action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, NULL);
+		sigaction(SIGBUS, &action, NULL);
+		installed = 1;
+	}
+	UNLOCK_REGIONS();
+}
+
+//for a thread that is about to end
+void stack_remove_guard_handler()
+{
+	stack_t ss;
+	
+	memset(&ss, 0, sizeof(ss));
+	ss.ss_flags = SS_DISABLE;
+	sigaltstack(&ss, NULL);
+	
+	free(guard.alternate_stack);
+	guard.alternate_stack = NULL;
+	guard.exe = NULL;
+}
+
+/*
+	Runs run(exe, context) with faults reported on exe. The handler jumps back here
+	and error() is called outside of it. The frames on the call stack were locals of
+	the native stack the jump unwound, so they are dropped first.
+*/
+int stack_run_guarded(Executable* exe, int (*run)(Executable*, void*), void* context)
+{
+	int result;
+	
+	//running stays set, error() may still run a forked call and its faults come back here too
+	if(sigsetjmp(guard.recovery, 1))
+	{
+		guard.exe->call_stack.stack_pointer = 0;
+		report_fault(guard.exe);
+	}
+	
+	guard.exe = exe;
+	guard.running = 1;
+	result = run(exe, context);
+	guard.running = 0;
+	
+	return result;
+}
+
+#endif
@@ -23,8 +23,12 @@
 #pragma once
 #include "dexe_utils.h"
 
-#define DEFAULT_STACK_SIZE 20
-#define INCREASE_STACK_SIZE_BY 20
+//Address space reserved for each stack. Pages are only committed once they are touched,
+//and a guard page on either side turns overflow and underflow into a fault instead of a check.
+#define STACK_RESERVE_SIZE ((size_t)(sizeof(void*) > 4 ? 256 : 16) * 1024 * 1024)
+
+//the most stacks that can be guarded at the same time
+#define STACK_MAX_REGIONS 256
 
 
 
@@ -36,11 +40,19 @@ struct Stack_struct
 };
 typedef struct Stack_struct stack;
 
+struct Executable_struct;
+
 
 extern int stack_init(stack*);
 extern void stack_free(stack*);
 extern void stack_empty(stack*);
+extern void stack_window(stack*, stack*, int);
+
+extern void stack_install_guard_handler(struct Executable_struct*, size_t);
+extern void stack_remove_guard_handler();
+extern int stack_run_guarded(struct Executable_struct*, int (*)(struct Executable_struct*, void*), void*);
+extern void stack_guard_heap(char*, size_t);
 
 extern int stack_push(stack*, long);
 extern long stack_peek(stack*);
-extern long stack_pop(stack*);
\ No newline at end of file
+extern long stack_pop(stack*);
@@ -0,0 +1,735 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_opcodes.h"
+#include "dexe_stack.h"
+#include "dexe_threads.h"
+#include "dexe_tasks.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <time.h>
+#endif
+
+/*
+	Every worker has a Chase-Lev deque of the tasks it spawned that may run elsewhere.
+	The owner pushes and takes at the bottom and thieves steal from the top, so only
+	a steal or taking the last task needs a compare and swap. Tasks are lazy: a spawn
+	only writes the call down, and unless it was stolen the join takes it back and
+	runs it right there, like the call would have been.
+	
+	A join takes the deque down to its task, and anything spawned after it runs
+	first, out of order. Tasks that run out of order or on a thief write to a buffer
+	of their own that is copied out at the join. Waiting on a stolen task, the owner
+	steals back from the thief, which only ever holds work the task spawned.
+	
+	Without GCC's atomics everything runs on the thread that spawned it.
+*/
+#if defined(__GNUC__)
+	#define TASKS_THREADED 1
+	#define ATOMIC_LOAD(p, order) __atomic_load_n((p), __ATOMIC_##order)
+	#define ATOMIC_STORE(p, v, order) __atomic_store_n((p), (v), __ATOMIC_##order)
+	#define ATOMIC_CAS(p, expected, v) __atomic_compare_exchange_n((p), (expected), (v), 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+	#define ATOMIC_FENCE(order) __atomic_thread_fence(__ATOMIC_##order)
+#else
+	#define TASKS_THREADED 0
+	#define ATOMIC_LOAD(p, order) (*(p))
+	#define ATOMIC_STORE(p, v, order) (*(p) = (v))
+	#define ATOMIC_CAS(p, expected, v) (*(p) == *(expected) ? (*(p) = (v), 1) : (*(expected) = *(p), 0))
+	#define ATOMIC_FENCE(order)
+#endif
+
+//the deque is a ring of this many slots, it never holds more than a worker's pending tasks
+#define DEQUE_MASK (TASKS_MAX_PENDING - 1)
+
+struct Task_struct
+{
+	int function_id;
+	int depth;     //call depth of the frame that spawned it
+	long* arguments; //in the spawning worker's argument space, in the order they were pushed
+	int result;
+	int done;      //set once result and output are written, by whoever ran it
+	int thief;     //the worker that stole it, -1 until then
+	char joined;
+	char stealable;
+	char forked;   //the first call of an -auto-parallel fork, see tasks_settle
+	
+	Task_Output output;
+};
+typedef struct Task_struct Task;
+
+struct Task_Worker_struct
+{
+	//the thieves' end of the deque gets a cache line of its own
+	long long top;
+	char padding[64 - sizeof(long long)];
+	long long bottom;
+	Task** slots;
+	
+	//every task spawned here and not joined yet, oldest first. A handle is an index
+	Task* tasks;
+	int count;
+	long* arguments;
+	int arguments_used;
+	
+	struct Task_Pool_struct* pool;
+	Executable* executable; //the one this worker runs on, the program's own for worker 0
+	Executable copy;
+	int index;
+	unsigned int random;
+	
+	int started;
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+typedef struct Task_Worker_struct Task_Worker;
+
+struct Task_Pool_struct
+{
+	int size;
+	int count; //of workers with stacks, the rest are left out
+	int stop;
+	int finished;
+	Task_Worker* workers;
+};
+typedef struct Task_Pool_struct Task_Pool;
+
+
+static int run(Task_Worker* worker, Task* task, long* space, int length, int buffered);
+static int join(Task_Worker* worker, int index, long* space, int length);
+
+
+static void deque_push(Task_Worker* worker, Task* task)
+{
+	long long bottom = ATOMIC_LOAD(&worker->bottom, RELAXED);
+	
+	//a thief that reads the slot sees everything written to the task before it
+	ATOMIC_STORE(&worker->slots[bottom & DEQUE_MASK], task, RELEASE);
+	ATOMIC_STORE(&worker->bottom, bottom + 1, RELEASE);
+}
+
+//the owner's end. NULL when it's empty or a thief got the last one first
+static Task* deque_take(Task_Worker* worker)
+{
+	long long bottom = ATOMIC_LOAD(&worker->bottom, RELAXED) - 1;
+	long long top;
+	Task* task = NULL;
+	
+	ATOMIC_STORE(&worker->bottom, bottom, RELAXED);
+	ATOMIC_FENCE(SEQ_CST);
+	top = ATOMIC_LOAD(&worker->top, RELAXED);
+	
+	if(top <= bottom)
+	{
+		task = ATOMIC_LOAD(&worker->slots[bottom & DEQUE_MASK], RELAXED);
+		if(top == bottom)
+		{
+			if(!ATOMIC_CAS(&worker->top, &top, top + 1))
+				task = NULL;
+			ATOMIC_STORE(&worker->bottom, bottom + 1, RELAXED);
+		}
+	}
+	else
+		ATOMIC_STORE(&worker->bottom, bottom + 1, RELAXED);
+	
+	return task;
+}
+
+static Task* deque_steal(Task_Worker* victim)
+{
+	long long top = ATOMIC_LOAD(&victim->top, ACQUIRE);
+	long long bottom;
+	Task* task;
+	
+	ATOMIC_FENCE(SEQ_CST);
+	bottom = ATOMIC_LOAD(&victim->bottom, ACQUIRE);
+	
+	if(top >= bottom)
+		return NULL;
+	
+	task = ATOMIC_LOAD(&victim->slots[top & DEQUE_MASK], ACQUIRE);
+	if(!ATOMIC_CAS(&victim->top, &top, top + 1))
+		return NULL;
+	
+	return task;
+}
+
+//spins first, then gives the processor away, then sleeps, the longer nothing turns up
+static void back_off(int* idle)
+{
+	(*idle)++;
+	
+	if(*idle < 64)
+		return;
+	
+	#ifdef _WIN32
+		if(*idle < 256)
+			SwitchToThread();
+		else
+			Sleep(1);
+	#else
+		if(*idle < 256)
+			sched_yield();
+		else
+		{
+			struct timespec pause = {0, 100000};
+			nanosleep(&pause, NULL);
+		}
+	#endif
+}
+
+static void buffer_write(Executable* exe, Task_Output* output, char* data, size_t size)
+{
+	if(output->size + size > output->capacity)
+	{
+		size_t capacity = output->capacity ? output->capacity : 256;
+		char* grown;
+		
+		while(capacity < output->size + size)
+			capacity *= 2;
+		
+		grown = (char*)realloc(output->data, capacity);
+		if(grown == NULL)
+			error(exe, ALLOCATION_ERROR_IN_EXECUTER, "Could not allocate %lu bytes for the output of a task", (unsigned long)capacity);
+		output->data = grown;
+		output->capacity = capacity;
+	}
+	
+	memcpy(output->data + output->size, data, size);
+	output->size += size;
+}
+
+//Out, Outs and Outi all end up here, except for Out straight to stdout
+void tasks_output(Executable* exe, char* data, int size)
+{
+	if(exe->output == NULL)
+		fwrite(data, 1, size, stdout);
+	else
+		buffer_write(exe, exe->output, data, size);
+}
+
+//a task another worker spawned, run in the free space past this one's frames
+static void run_stolen(Task_Worker* worker, Task* task, long* space, int length)
+{
+	ATOMIC_STORE(&task->thief, worker->index, RELAXED);
+	task->result = run(worker, task, space, length, 1);
+	ATOMIC_STORE(&task->done, 1, RELEASE);
+}
+
+static Task* steal_any(Task_Worker* worker)
+{
+	Task_Pool* pool = worker->pool;
+	
+	for(int tries = 0; tries < pool->count; tries++)
+	{
+		Task* task;
+		
+		worker->random = worker->random * 1103515245u + 12345u;
+		int victim = (int)((worker->random >> 16) % (unsigned int)pool->count);
+		
+		if(victim != worker->index && (task = deque_steal(&pool->workers[victim])) != NULL)
+			return task;
+	}
+	
+	return NULL;
+}
+
+//joins every task from first on that isn't joined yet, oldest first, and drops the results
+static void sync_from(Task_Worker* worker, int first, long* space, int length)
+{
+	for(int i = first; i < worker->count; i++)
+		if(!worker->tasks[i].joined)
+			join(worker, i, space, length);
+}
+
+//tasks spawned deeper than depth belong to frames that have returned
+void tasks_sync(Executable* exe, int depth, long* space, int length)
+{
+	Task_Worker* worker = exe->worker;
+	int first = worker->count;
+	
+	while(first > 0 && worker->tasks[first - 1].depth > depth)
+		first--;
+	
+	if(first < worker->count)
+		sync_from(worker, first, space, length);
+}
+
+/*
+	Makes the call a task stands for, in a frame at space. Buffered tasks write their
+	output to the task. Whatever the call spawned and left behind is joined before
+	it counts as done, so that goes in its output too.
+*/
+static int run(Task_Worker* worker, Task* task, long* space, int length, int buffered)
+{
+	Executable* exe = worker->executable;
+	Task_Output* output = exe->output;
+	int arg_count = exe->functions[task->function_id].arg_count;
+	int mark = worker->count;
+	int result;
+	Stack_Frame frame;
+	
+	frame.function_id = task->function_id;
+	frame.pc = 0;
+	frame.flags = 0;
+	frame.stack.stack_elements = space;
+	frame.stack.length = length;
+	frame.stack.stack_pointer = arg_count;
+	for(int i = 0; i < arg_count; i++)
+		space[i] = task->arguments[arg_count - 1 - i];
+	
+	if(buffered)
+		exe->output = &task->output;
+	
+	stack_push(&exe->call_stack, (long)&frame);
+	result = exe->functions[task->function_id].run_function(exe);
+	stack_pop(&exe->call_stack);
+	
+	sync_from(worker, mark, space, length);
+	
+	exe->output = output;
+	return result;
+}
+
+static int join(Task_Worker* worker, int index, long* space, int length)
+{
+	Executable* exe = worker->executable;
+	Task* task = &worker->tasks[index];
+	int idle = 0;
+	
+	if(!task->stealable && !task->done)
+	{
+		task->result = run(worker, task, space, length, 0);
+		task->done = 1;
+	}
+	else if(!ATOMIC_LOAD(&task->done, ACQUIRE))
+	{
+		//the deque only holds tasks newer than this one, unless a thief took it
+		Task* taken;
+		
+		while((taken = deque_take(worker)) != NULL && taken != task)
+		{
+			taken->result = run(worker, taken, space, length, 1);
+			taken->done = 1;
+		}
+		
+		if(taken == task)
+		{
+			task->result = run(worker, task, space, length, 0);
+			task->done = 1;
+		}
+	}
+	
+	//stolen. Help the thief with what the task spawned until it's done
+	while(!ATOMIC_LOAD(&task->done, ACQUIRE))
+	{
+		int thief = ATOMIC_LOAD(&task->thief, RELAXED);
+		Task* other = thief >= 0 ? deque_steal(&worker->pool->workers[thief]) : NULL;
+		
+		if(other != NULL)
+		{
+			run_stolen(worker, other, space, length);
+			idle = 0;
+		}
+		else
+			back_off(&idle);
+	}
+	
+	if(task->output.size)
+		tasks_output(exe, task->output.data, (int)task->output.size);
+	free(task->output.data);
+	task->joined = 1;
+	
+	//handles above the last one still waiting are free again
+	while(worker->count > 0 && worker->tasks[worker->count - 1].joined)
+	{
+		worker->count--;
+		worker->arguments_used = (int)(worker->tasks[worker->count].arguments - worker->arguments);
+	}
+	
+	return task->result;
+}
+
+//args are in the order they were pushed. Anything the spawn has to run goes in the free space at space
+long tasks_spawn(Executable* exe, int function_id, long* args, long* space, int length)
+{
+	Task_Worker* worker = exe->worker;
+	int depth = exe->call_stack.stack_pointer;
+	int arg_count = exe->functions[function_id].arg_count;
+	Task* task;
+	
+	if(worker->count > 0 && worker->tasks[worker->count - 1].depth > depth)
+		tasks_sync(exe, depth, space, length);
+	
+	if(worker->count == TASKS_MAX_PENDING || worker->arguments_used + arg_count > TASKS_MAX_ARGUMENTS)
+		error(exe, STACK_OVERFLOW, "More than %d tasks, or %d arguments between them, are waiting to be joined.", TASKS_MAX_PENDING, TASKS_MAX_ARGUMENTS);
+	
+	task = &worker->tasks[worker->count];
+	task->function_id = function_id;
+	task->depth = depth;
+	task->arguments = worker->arguments + worker->arguments_used;
+	task->result = 0;
+	task->done = 0;
+	task->thief = -1;
+	task->joined = 0;
+	task->stealable = worker->pool->count > 1 && exe->functions[function_id].attributes & FUNCTION_ATTRIBUTE_PARALLEL;
+	task->forked = 0;
+	task->output.data = NULL;
+	task->output.size = 0;
+	task->output.capacity = 0;
+	
+	memcpy(task->arguments, args, arg_count * sizeof(long));
+	worker->arguments_used += arg_count;
+	
+	if(task->stealable)
+		deque_push(worker, task);
+	
+	return worker->count++;
+}
+
+//the same as tasks_spawn, for the first of two calls -auto-parallel runs side by side
+long tasks_fork(Executable* exe, int function_id, long* args, long* space, int length)
+{
+	long handle = tasks_spawn(exe, function_id, args, space, length);
+	
+	exe->worker->tasks[handle].forked = 1;
+	return handle;
+}
+
+int tasks_join(Executable* exe, long handle, long* space, int length)
+{
+	Task_Worker* worker = exe->worker;
+	int depth = exe->call_stack.stack_pointer;
+	
+	if(worker->count > 0 && worker->tasks[worker->count - 1].depth > depth)
+		tasks_sync(exe, depth, space, length);
+	
+	if(handle < 0 || handle >= worker->count || worker->tasks[handle].joined || worker->tasks[handle].depth != depth)
+		error(exe, TASK_DOES_NOT_EXIST, "Joined %ld, which is not a task this frame spawned and has not joined yet", handle);
+	
+	return join(worker, (int)handle, space, length);
+}
+
+
+/*
+	Called by error() before it reports anything. A forked call that hasn't been
+	joined was made before whatever went wrong, so run one after the other, it
+	would have finished first. It's joined now, and if it fails too, that is the
+	error reported instead. The frames the error came from are never returned to,
+	so the task can run anywhere on the operand stack.
+*/
+void tasks_settle(Executable* exe)
+{
+	Task_Worker* worker = exe->worker;
+	
+	for(int i = 0; worker != NULL && i < worker->count; i++)
+	{
+		if(worker->tasks[i].forked && !worker->tasks[i].joined)
+		{
+			//an error in the task comes back through here, and it shouldn't run twice
+			worker->tasks[i].forked = 0;
+			join(worker, i, exe->operand_stack.stack_elements, exe->operand_stack.length);
+		}
+	}
+}
+
+//steals until the pool stops
+static int work(Executable* exe, void* context)
+{
+	Task_Worker* worker = (Task_Worker*)context;
+	int idle = 0;
+	
+	while(!ATOMIC_LOAD(&worker->pool->stop, ACQUIRE))
+	{
+		Task* task = steal_any(worker);
+		
+		if(task != NULL)
+		{
+			run_stolen(worker, task, exe->operand_stack.stack_elements, exe->operand_stack.length);
+			idle = 0;
+		}
+		else
+			back_off(&idle);
+	}
+	
+	return 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID argument)
+#else
+static void* worker_main(void* argument)
+#endif
+{
+	Task_Worker* worker = (Task_Worker*)argument;
+	
+	//faults are reported on this worker's copy, from a signal stack of its own
+	stack_install_guard_handler(worker->executable, TASKS_WORKER_STACK);
+	stack_run_guarded(worker->executable, work, worker);
+	stack_remove_guard_handler();
+	
+	return 0;
+}
+
+//only programs with spawns or joins get workers
+int tasks_needed(Executable* exe)
+{
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		Executable_Function* function = &exe->functions[i];
+		
+		for(int pc = 0; pc < function->size_of_instructions;)
+		{
+			unsigned char opcode = (unsigned char)function->instructions[pc];
+			
+			if(IS_TASK_OPCODE(opcode))
+				return 1;
+			
+			pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction((char)opcode).parameter_size : 0);
+		}
+	}
+	
+	return 0;
+}
+
+/*
+	A task may run on another thread when nothing it can reach reads input, touches
+	the heap, stops for the debugger or drives a coroutine. The heap is shared by
+	every worker, and a stolen task runs at the same time as the code between its
+	spawn and its join, so even a read could see a store the call wouldn't have.
+	Everything starts out parallel and is demoted until nothing changes, so
+	recursion is fine.
+*/
+static void mark_parallel(Executable* exe)
+{
+	int changed = 1;
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+		exe->functions[i].attributes |= FUNCTION_ATTRIBUTE_PARALLEL;
+	
+	while(changed)
+	{
+		changed = 0;
+		
+		for(int i = 0; i < exe->number_of_functions; i++)
+		{
+			Executable_Function* function = &exe->functions[i];
+			
+			for(int pc = 0; pc < function->size_of_instructions && function->attributes & FUNCTION_ATTRIBUTE_PARALLEL;)
+			{
+				unsigned char opcode = (unsigned char)function->instructions[pc];
+				int parallel = opcode <= LAST_OPCODE && opcode != In && opcode != Ini && !IS_HEAP_OPCODE(opcode) && opcode != Break && !IS_COROUTINE_OPCODE(opcode);
+				
+				if(parallel && (opcode == Call || opcode == Spawn))
+				{
+					int callee = pc + 4 < function->size_of_instructions ? bytes_to_int(function->instructions + pc + 1) : -1;
+					
+					parallel = callee >= 0 && callee < exe->number_of_functions && exe->functions[callee].attributes & FUNCTION_ATTRIBUTE_PARALLEL;
+				}
+				
+				if(!parallel)
+				{
+					function->attributes &= ~FUNCTION_ATTRIBUTE_PARALLEL;
+					changed = 1;
+				}
+				
+				pc += 1 + (opcode <= LAST_OPCODE ? get_opcode_from_instruction((char)opcode).parameter_size : 0);
+			}
+		}
+	}
+}
+
+static int start(Task_Worker* worker)
+{
+	#ifdef _WIN32
+		worker->thread = CreateThread(NULL, TASKS_WORKER_STACK, worker_main, worker, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+		return worker->thread == NULL;
+	#else
+		pthread_attr_t attributes;
+		int result;
+		
+		pthread_attr_init(&attributes);
+		pthread_attr_setstacksize(&attributes, TASKS_WORKER_STACK);
+		result = pthread_create(&worker->thread, &attributes, worker_main, worker);
+		pthread_attr_destroy(&attributes);
+		
+		return result != 0;
+	#endif
+}
+
+/*
+	Sets up threads workers, the thread running the program being the first. The
+	others each get a copy of the Executable with stacks of their own. Call it once
+	everything else is prepared, since the copies are taken then.
+*/
+int tasks_init(Executable* exe, int threads)
+{
+	Task_Pool* pool = (Task_Pool*)calloc(1, sizeof(Task_Pool));
+	
+	if(!TASKS_THREADED || threads < 1)
+		threads = 1;
+	if(threads > THREADS_MAX)
+		threads = THREADS_MAX;
+	
+	if(pool == NULL || (pool->workers = (Task_Worker*)calloc(threads, sizeof(Task_Worker))) == NULL)
+	{
+		free(pool);
+		return 1;
+	}
+	
+	mark_parallel(exe);
+	pool->size = threads;
+	exe->worker = &pool->workers[0];
+	
+	for(int i = 0; i < threads; i++)
+	{
+		Task_Worker* worker = &pool->workers[i];
+		
+		worker->pool = pool;
+		worker->index = i;
+		worker->random = 2654435761u * (unsigned int)(i + 1);
+		worker->slots = (Task**)malloc(TASKS_MAX_PENDING * sizeof(Task*));
+		worker->tasks = (Task*)malloc(TASKS_MAX_PENDING * sizeof(Task));
+		worker->arguments = (long*)malloc(TASKS_MAX_ARGUMENTS * sizeof(long));
+		if(worker->slots == NULL || worker->tasks == NULL || worker->arguments == NULL)
+			return 1;
+		
+		if(i == 0)
+		{
+			worker->executable = exe;
+			pool->count = 1;
+			continue;
+		}
+		
+		//the copy shares the code and the heap, but counts and caches nothing of its own
+		memcpy(&worker->copy, exe, sizeof(Executable));
+		memset(&worker->copy.metrics, 0, sizeof(Metrics));
+		worker->copy.memo = NULL;
+		worker->copy.worker = worker;
+		worker->copy.output = NULL;
+		worker->copy.coroutines = NULL;
+		worker->executable = &worker->copy;
+		
+		if(stack_init(&worker->copy.call_stack))
+			break;
+		if(stack_init(&worker->copy.operand_stack))
+		{
+			stack_free(&worker->copy.call_stack);
+			break;
+		}
+		pool->count = i + 1;
+		exe->metrics.stack_bytes += 2 * (unsigned long long)STACK_RESERVE_SIZE;
+	}
+	
+	//the deques are read by every worker, so they're all set up before any thread starts
+	for(int i = 1; i < pool->count; i++)
+		pool->workers[i].started = !start(&pool->workers[i]);
+	
+	return 0;
+}
+
+//workers only exist while the program runs, error() leaves them to the exit
+int tasks_running(Executable* exe)
+{
+	return exe->worker != NULL && exe->worker->pool->count > 1 && !exe->worker->pool->finished;
+}
+
+//stops the workers and adds up what they counted
+static void stop(Executable* exe, Task_Pool* pool)
+{
+	ATOMIC_STORE(&pool->stop, 1, RELEASE);
+	for(int i = 1; i < pool->count; i++)
+	{
+		Task_Worker* worker = &pool->workers[i];
+		Metrics* metrics = &worker->copy.metrics;
+		
+		if(worker->started)
+		{
+			#ifdef _WIN32
+				WaitForSingleObject(worker->thread, INFINITE);
+				CloseHandle(worker->thread);
+			#else
+				pthread_join(worker->thread, NULL);
+			#endif
+		}
+		
+		exe->metrics.instructions += metrics->instructions;
+		exe->metrics.calls += metrics->calls;
+		exe->metrics.returns += metrics->returns;
+		exe->metrics.frame_bytes += metrics->frame_bytes;
+		if(metrics->max_call_depth > exe->metrics.max_call_depth)
+			exe->metrics.max_call_depth = metrics->max_call_depth;
+		if(metrics->max_operand_depth > exe->metrics.max_operand_depth)
+			exe->metrics.max_operand_depth = metrics->max_operand_depth;
+		
+		stack_free(&worker->copy.call_stack);
+		stack_free(&worker->copy.operand_stack);
+	}
+	
+	pool->finished = 1;
+}
+
+//joins what's left once the program is done, then stops the workers
+void tasks_finish(Executable* exe)
+{
+	if(exe->worker == NULL || exe->worker->pool->finished)
+		return;
+	
+	tasks_sync(exe, -1, exe->operand_stack.stack_elements + exe->operand_stack.stack_pointer, exe->operand_stack.length - exe->operand_stack.stack_pointer);
+	stop(exe, exe->worker->pool);
+}
+
+//nothing left waiting is joined, so call tasks_finish first unless this is an error
+void tasks_free(Executable* exe)
+{
+	Task_Pool* pool;
+	
+	if(exe->worker == NULL)
+		return;
+	pool = exe->worker->pool;
+	
+	if(!pool->finished)
+		stop(exe, pool);
+	
+	for(int i = 0; i < pool->size; i++)
+	{
+		free(pool->workers[i].slots);
+		free(pool->workers[i].tasks);
+		free(pool->workers[i].arguments);
+	}
+	free(pool->workers);
+	free(pool);
+	exe->worker = NULL;
+}
@@ -0,0 +1,72 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	Fork/join. spawn f pops f's arguments and pushes a handle, and join pops a handle
+	and pushes what the call returned. A handle is only good in the frame that spawned
+	it, and only once. A task that is never joined is joined the next time its worker
+	spawns or joins from a shallower frame, or when the program ends.
+	
+	Whatever a task writes comes out at its join, as if the call had been made right
+	there, so the output doesn't depend on which thread ran what. Tasks that read
+	input or use the heap, or call anything that does, never leave the thread that
+	spawned them.
+*/
+
+//per worker, the tasks waiting to be joined and the arguments they hold between them
+#define TASKS_MAX_PENDING   65536
+#define TASKS_MAX_ARGUMENTS (1 << 20)
+
+//instructions a call has to average before -auto-parallel runs it beside the next one
+#define TASKS_DEFAULT_FORK_COST 10000
+#define TASKS_FORK_DEPTH 12
+
+//native stack of each worker thread, only committed as it's used
+#define TASKS_WORKER_STACK ((size_t)64 * 1024 * 1024)
+
+struct Task_Output_struct
+{
+	char* data;
+	size_t size;
+	size_t capacity;
+};
+typedef struct Task_Output_struct Task_Output;
+
+
+extern int tasks_needed(Executable*);
+extern int tasks_init(Executable*, int);
+extern int tasks_running(Executable*);
+extern void tasks_finish(Executable*);
+extern void tasks_free(Executable*);
+
+extern long tasks_spawn(Executable*, int, long*, long*, int);
+extern long tasks_fork(Executable*, int, long*, long*, int);
+extern int tasks_join(Executable*, long, long*, int);
+extern void tasks_sync(Executable*, int, long*, int);
+extern void tasks_settle(Executable*);
+
+extern void tasks_output(Executable*, char*, int);
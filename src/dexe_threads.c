@@ -0,0 +1,159 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_threads.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+/*
+	A parallel for loop. Workers take the next index from a shared counter until
+	there are none left, so uneven items balance themselves out. The calling thread
+	works too, which means the loop still finishes if no worker could be started.
+	Each index is handed out exactly once, and the work function is responsible for
+	writing its results somewhere that only that index owns.
+*/
+struct Parallel_For_struct
+{
+	int next;
+	int count;
+	void (*work)(void*, int);
+	void* context;
+	
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+typedef struct Parallel_For_struct Parallel_For;
+
+
+int threads_available()
+{
+	int count;
+	
+	#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		count = (int)info.dwNumberOfProcessors;
+	#else
+		count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+	
+	if(count < 1)
+		return 1;
+	return count > THREADS_MAX ? THREADS_MAX : count;
+}
+
+static int take_index(Parallel_For* loop)
+{
+	int index;
+	
+	#ifdef _WIN32
+		EnterCriticalSection(&loop->lock);
+		index = loop->next++;
+		LeaveCriticalSection(&loop->lock);
+	#else
+		pthread_mutex_lock(&loop->lock);
+		index = loop->next++;
+		pthread_mutex_unlock(&loop->lock);
+	#endif
+	
+	return index;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker(LPVOID argument)
+#else
+static void* worker(void* argument)
+#endif
+{
+	Parallel_For* loop = (Parallel_For*)argument;
+	
+	for(int index = take_index(loop); index < loop->count; index = take_index(loop))
+		loop->work(loop->context, index);
+	
+	return 0;
+}
+
+void threads_parallel_for(int count, int threads, void (*work)(void*, int), void* context)
+{
+	Parallel_For loop;
+	int started = 0;
+	
+	if(threads > THREADS_MAX)
+		threads = THREADS_MAX;
+	if(threads > count)
+		threads = count;
+	
+	if(threads <= 1)
+	{
+		for(int i = 0; i < count; i++)
+			work(context, i);
+		return;
+	}
+	
+	loop.next = 0;
+	loop.count = count;
+	loop.work = work;
+	loop.context = context;
+	
+	#ifdef _WIN32
+		HANDLE handles[THREADS_MAX];
+		
+		InitializeCriticalSection(&loop.lock);
+		for(int i = 1; i < threads; i++)
+			if((handles[started] = CreateThread(NULL, 0, worker, &loop, 0, NULL)) != NULL)
+				started++;
+		
+		worker(&loop);
+		
+		if(started)
+			WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+		for(int i = 0; i < started; i++)
+			CloseHandle(handles[i]);
+		DeleteCriticalSection(&loop.lock);
+	#else
+		pthread_t handles[THREADS_MAX];
+		
+		pthread_mutex_init(&loop.lock, NULL);
+		for(int i = 1; i < threads; i++)
+			if(!pthread_create(&handles[started], NULL, worker, &loop))
+				started++;
+		
+		worker(&loop);
+		
+		for(int i = 0; i < started; i++)
+			pthread_join(handles[i], NULL);
+		pthread_mutex_destroy(&loop.lock);
+	#endif
+}
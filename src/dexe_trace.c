@@ -0,0 +1,259 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_parser.h"
+#include "dexe_trace.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+#endif
+
+#include <stdint.h>
+
+int trace_init(Executable* exe, char* filename, unsigned long capacity, int top)
+{
+	unsigned long long records = 1;
+	int record_words = top ? 3 : 2;
+	Trace* trace;
+	
+	if(capacity == 0)
+		capacity = TRACE_DEFAULT_CAPACITY;
+	while(records < capacity)
+		records <<= 1;
+	
+	if(records > (SIZE_MAX - sizeof(Trace_Header)) / (record_words * sizeof(unsigned int)))
+		return 1;
+	
+	trace = (Trace*)calloc(1, sizeof(Trace));
+	if(trace == NULL)
+		return 1;
+	
+	trace->mask = records - 1;
+	trace->record_words = record_words;
+	trace->size = sizeof(Trace_Header) + (size_t)records * record_words * sizeof(unsigned int);
+	
+	//the file is sized up front but only the pages that get written take up space
+	#ifdef _WIN32
+		trace->file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(trace->file == INVALID_HANDLE_VALUE)
+		{
+			free(trace);
+			return 1;
+		}
+		
+		trace->mapping = CreateFileMappingA(trace->file, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)trace->size >> 32), (DWORD)trace->size, NULL);
+		if(trace->mapping != NULL)
+			trace->header = (Trace_Header*)MapViewOfFile(trace->mapping, FILE_MAP_WRITE, 0, 0, trace->size);
+		if(trace->header == NULL)
+		{
+			if(trace->mapping != NULL)
+				CloseHandle(trace->mapping);
+			CloseHandle(trace->file);
+			free(trace);
+			return 1;
+		}
+	#else
+		trace->file = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(trace->file < 0)
+		{
+			free(trace);
+			return 1;
+		}
+		
+		void* mapping = MAP_FAILED;
+		if(!ftruncate(trace->file, (off_t)trace->size))
+			mapping = mmap(NULL, trace->size, PROT_READ | PROT_WRITE, MAP_SHARED, trace->file, 0);
+		if(mapping == MAP_FAILED)
+		{
+			close(trace->file);
+			free(trace);
+			return 1;
+		}
+		trace->header = (Trace_Header*)mapping;
+	#endif
+	
+	memcpy(trace->header->magic, TRACE_MAGIC, 4);
+	trace->header->version = TRACE_VERSION;
+	trace->header->flags = top ? TRACE_FLAG_TOP : 0;
+	trace->header->record_size = record_words * sizeof(unsigned int);
+	trace->header->capacity = records;
+	trace->header->head = 0;
+	strncpy(trace->header->image, exe->info->filename, TRACE_IMAGE_NAME_SIZE - 1);
+	
+	trace->records = (unsigned int*)(trace->header + 1);
+	
+	exe->trace = trace;
+	return 0;
+}
+
+/*
+	Closing the trace is all the flushing it needs, the mapping is shared with the file.
+	free_memory calls this, so error() flushes the trace too. The file is cut down to
+	the records that were written when the ring never wrapped.
+*/
+void trace_free(Executable* exe)
+{
+	Trace* trace = exe->trace;
+	
+	if(trace == NULL)
+		return;
+	
+	unsigned long long used = trace->header->head < trace->header->capacity ? trace->header->head : trace->header->capacity;
+	unsigned long long size = sizeof(Trace_Header) + used * trace->header->record_size;
+	
+	#ifdef _WIN32
+		LARGE_INTEGER end;
+		end.QuadPart = (LONGLONG)size;
+		
+		UnmapViewOfFile(trace->header);
+		CloseHandle(trace->mapping);
+		if(SetFilePointerEx(trace->file, end, NULL, FILE_BEGIN))
+			SetEndOfFile(trace->file);
+		CloseHandle(trace->file);
+	#else
+		munmap(trace->header, trace->size);
+		if(ftruncate(trace->file, (off_t)size))
+		{
+			//the file is still readable at its full size
+		}
+		close(trace->file);
+	#endif
+	
+	free(trace);
+	exe->trace = NULL;
+}
+
+
+static void print_record(Executable* exe, unsigned long long sequence, int depth, unsigned int* record, int has_top)
+{
+	unsigned int function_id = record[0];
+	int pc = (int)(record[1] >> 8);
+	unsigned char opcode = (unsigned char)record[1];
+	Executable_Function* function = NULL;
+	
+	if(exe->functions != NULL && function_id < (unsigned int)exe->number_of_functions)
+		function = &exe->functions[function_id];
+	
+	//breakpoints are recorded as the trap that replaced the instruction, the image has the original
+	if(opcode == Trap && function != NULL && pc < function->size_of_instructions)
+		opcode = (unsigned char)function->instructions[pc];
+	
+	printf("%10llu %*s", sequence, depth * 2, "");
+	if(function != NULL && exe->flags & DEXE_FLAGS_DEBUG)
+		printf("%s @ %d: ", exe->debug[function_id].function_name, pc);
+	else
+		printf("%u @ %d: ", function_id, pc);
+	
+	Opcode op = get_opcode_from_instruction(opcode);
+	if(opcode > LAST_OPCODE)
+		printf("0x%X", opcode);
+	else if(function != NULL && op.parameter_size == 4 && pc + 4 < function->size_of_instructions)
+		printf("%s %d", op.mnemonic, bytes_to_int(function->instructions + pc + 1));
+	else if(function != NULL && op.parameter_size == 1 && pc + 1 < function->size_of_instructions)
+		printf("%s %d", op.mnemonic, (unsigned char)function->instructions[pc + 1]);
+	else
+		printf("%s", op.mnemonic);
+	
+	if(has_top)
+		printf("\t[top %d]", (int)record[2]);
+	putchar('\n');
+}
+
+/*
+	Prints a trace file oldest record first. The image named in the trace (or the one
+	given on the command line) supplies the function names and the operands. If it
+	can't be opened the records are printed with ids only.
+*/
+int trace_dump(Executable* exe, char* filename)
+{
+	static char image[TRACE_IMAGE_NAME_SIZE];
+	Trace_Header header;
+	unsigned int record[3];
+	FILE* file = fopen(filename, "rb");
+	
+	if(file == NULL)
+		return 1;
+	
+	if(fread(&header, sizeof(Trace_Header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) || header.version != TRACE_VERSION ||
+		header.record_size != (header.flags & TRACE_FLAG_TOP ? 3 : 2) * sizeof(unsigned int) ||
+		header.capacity == 0 || header.capacity & (header.capacity - 1))
+	{
+		fclose(file);
+		return 1;
+	}
+	
+	if(exe->info->filename == NULL)
+	{
+		memcpy(image, header.image, TRACE_IMAGE_NAME_SIZE - 1);
+		exe->info->filename = image;
+	}
+	
+	FILE* test = fopen(exe->info->filename, "rb");
+	if(test != NULL)
+	{
+		fclose(test);
+		dexe_read(exe);
+	}
+	else
+		printf("Note: could not open the image '%s', decoding without it\n", exe->info->filename);
+	
+	unsigned long long count = header.head < header.capacity ? header.head : header.capacity;
+	unsigned long long first = header.head - count;
+	int depth = 0;
+	int called = 0;
+	
+	printf("# dexe trace of %s, %llu records (%llu overwritten)\n", exe->info->filename, count, first);
+	
+	for(unsigned long long sequence = first; sequence < header.head; sequence++)
+	{
+		//seek at the start and wherever the ring wraps, otherwise the records are contiguous
+		unsigned long long slot = sequence & (header.capacity - 1);
+		if(sequence == first || slot == 0)
+			if(fseek(file, (long)(sizeof(Trace_Header) + slot * header.record_size), SEEK_SET))
+				break;
+		
+		if(fread(record, header.record_size, 1, file) != 1)
+			break;
+		
+		if(called && record[1] >> 8 == 0)
+			depth++;
+		called = (record[1] & 0xFF) == Call;
+		
+		print_record(exe, sequence, depth, record, header.flags & TRACE_FLAG_TOP);
+		
+		if((record[1] & 0xFF) == Ret && depth > 0)
+			depth--;
+	}
+	
+	fclose(file);
+	return 0;
+}
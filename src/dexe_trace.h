@@ -0,0 +1,95 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+#define TRACE_MAGIC            "DTRC"
+#define TRACE_VERSION          1
+#define TRACE_DEFAULT_CAPACITY (1 << 22) //records. Always rounded up to a power of two
+#define TRACE_IMAGE_NAME_SIZE  224
+
+#define TRACE_FLAG_TOP         0x01 //every record also has the top of the operand stack
+
+
+/*
+	A trace file is a header followed by a ring of records. Each record is two
+	(or with TRACE_FLAG_TOP, three) native endian unsigned ints:
+	
+		function id
+		pc << 8 | opcode     (so pc is kept modulo 2^24)
+		top of stack         (0 when the stack is empty)
+	
+	The record is written before the instruction runs. Call and Ret records
+	delimit the calls, a Call followed by pc 0 entered a new frame. head counts
+	every record ever written, so the oldest record still in the ring is
+	head - capacity once the ring has wrapped.
+*/
+struct Trace_Header_struct
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int flags;
+	unsigned int record_size; //in bytes
+	unsigned long long capacity;
+	unsigned long long head;
+	char image[TRACE_IMAGE_NAME_SIZE];
+};
+typedef struct Trace_Header_struct Trace_Header;
+
+//one per Executable, so every thread that runs its own Executable has its own ring
+struct Trace_struct
+{
+	//the file is mapped, so the records survive even if the process is killed
+	Trace_Header* header;
+	unsigned int* records;
+	
+	unsigned long long mask;
+	int record_words;
+	size_t size;
+	
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+};
+typedef struct Trace_struct Trace;
+
+
+extern int trace_init(Executable*, char*, unsigned long, int);
+extern void trace_free(Executable*);
+
+extern int trace_dump(Executable*, char*);
+
+//called for every instruction by the trace variants, so it has to stay this small
+static inline void trace_record(Trace* trace, int function_id, int pc, unsigned char opcode, stack* st)
+{
+	unsigned int* record = trace->records + (trace->header->head++ & trace->mask) * trace->record_words;
+	
+	record[0] = (unsigned int)function_id;
+	record[1] = (unsigned int)pc << 8 | opcode;
+	if(trace->record_words > 2)
+		record[2] = st->stack_pointer > 0 ? (unsigned int)st->stack_elements[st->stack_pointer - 1] : 0;
+}
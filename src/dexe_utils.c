@@ -21,90 +21,228 @@
 */
 
 #include "dexe_utils.h"
+#include "dexe_memo.h"
+#include "dexe_profile.h"
+#include "dexe_counters.h"
+#include "dexe_debugger.h"
+#include "dexe_trace.h"
+#include "dexe_metrics.h"
+#include "dexe_linker.h"
+#include "dexe_heap.h"
+#include "dexe_tasks.h"
+#include "dexe_coroutines.h"
+#include "dexe_snapshot.h"
+#include "dexe_cache.h"
 
 int bytes_to_int(char* ptr)
 {
-	return 	((int)ptr[0] << 24) |
-			((int)ptr[1] << 16) |
-			((int)ptr[2] << 8) |
-			((int)ptr[3] << 0);
+	unsigned char* bytes = (unsigned char*)ptr;
+
+	return 	(int)(((unsigned int)bytes[0] << 24) |
+			((unsigned int)bytes[1] << 16) |
+			((unsigned int)bytes[2] << 8) |
+			((unsigned int)bytes[3] << 0));
 }
 
-Opcode get_opcode_from_instruction(char instruction)
+void int_to_bytes(int value, char* ptr)
+{
+	ptr[0] = (char)((unsigned int)value >> 24);
+	ptr[1] = (char)((unsigned int)value >> 16);
+	ptr[2] = (char)((unsigned int)value >> 8);
+	ptr[3] = (char)((unsigned int)value >> 0);
+}
+
+//a below b, the same results the interpreter gives. Returns 0 for what would be an error
+int fold_binary(unsigned char opcode, int a, int b, int* result)
 {
-	switch(instruction)
+	switch(opcode)
 	{
-		case Nop:
-			return NOP;
-		case Break:
-			return BREAK;
-		case Load:
-			return LOAD;
-		case Push:
-			return PUSH;
-		case Store:
-			return STORE;
-		case Dup: 
-			return DUP;
-		case Pop:
-			return POP;
-		case Inc:
-			return INC;
-		case Dec:
-			return DEC;
-		case Add:
-			return ADD;
-		case Sub:
-			return SUB;
-		case Mul:
-			return MUL;
+		case Add: *result = (int)((unsigned int)a + (unsigned int)b); return 1;
+		case Sub: *result = (int)((unsigned int)a - (unsigned int)b); return 1;
+		case Mul: *result = (int)((unsigned int)a * (unsigned int)b); return 1;
+		case And: *result = a & b; return 1;
+		case Or:  *result = a | b; return 1;
+		case Xor: *result = a ^ b; return 1;
+		case Shl: *result = (int)((unsigned int)a << (b & 31)); return 1;
+		case Shr: *result = a >> (b & 31); return 1;
 		case Div:
-			return DIV;
+			if(b == 0)
+				return 0;
+			*result = b == -1 ? (int)(0u - (unsigned int)a) : a / b;
+			return 1;
 		case Rem:
-			return REM;
-		case And:
-			return AND;
-		case Or:
-			return OR;
-		case Xor:
-			return XOR;
-		case Not:
-			return NOT;
-		case Neg:
-			return NEG;
-		case Shl:
-			return SHL;
-		case Shr:
-			return SHR;
-		case Cmp:
-			return CMP;
-		case Jmp:
-			return JMP;
-		case Je:
-			return JE;
-		case Jne:
-			return JNE;
-		case Jg:
-			return JG;
-		case Jge:
-			return JGE;
-		case Jl:
-			return JL;
-		case Jle:
-			return JLE;
-		case In:
-			return IN;
-		case Out:
-			return OUT;
-		case Call:
-			return CALL;
-		case Ret:
-			return RET;
+			if(b == 0)
+				return 0;
+			*result = b == -1 ? 0 : a % b;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int fold_unary(unsigned char opcode, int a, int* result)
+{
+	switch(opcode)
+	{
+		case Inc: *result = (int)((unsigned int)a + 1); return 1;
+		case Dec: *result = (int)((unsigned int)a - 1); return 1;
+		case Not: *result = ~a; return 1;
+		case Neg: *result = (int)(0u - (unsigned int)a); return 1;
 		default:
-			return NOP;
+			return 0;
 	}
 }
 
+unsigned long long hash_bytes(unsigned long long hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	
+	return hash;
+}
+
+//of the whole file
+int hash_file(char* filename, unsigned long long* hash)
+{
+	unsigned char buffer[1 << 16];
+	FILE* file = fopen(filename, "rb");
+	size_t count;
+	
+	if(file == NULL)
+		return 1;
+	
+	*hash = HASH_START;
+	while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		*hash = hash_bytes(*hash, buffer, count);
+	
+	fclose(file);
+	return 0;
+}
+
+//indexed by opcode, so looking one up is a load instead of a switch
+Opcode* const opcode_table[LAST_OPCODE + 1] =
+{
+	[Nop]       = &NOP,
+	[Break]     = &BREAK,
+	[Load]      = &LOAD,
+	[Push]      = &PUSH,
+	[Store]     = &STORE,
+	[Dup]       = &DUP,
+	[Pop]       = &POP,
+	[Inc]       = &INC,
+	[Dec]       = &DEC,
+	[Add]       = &ADD,
+	[Sub]       = &SUB,
+	[Mul]       = &MUL,
+	[Div]       = &DIV,
+	[Rem]       = &REM,
+	[And]       = &AND,
+	[Or]        = &OR,
+	[Xor]       = &XOR,
+	[Not]       = &NOT,
+	[Neg]       = &NEG,
+	[Shl]       = &SHL,
+	[Shr]       = &SHR,
+	[Cmp]       = &CMP,
+	[Jmp]       = &JMP,
+	[Je]        = &JE,
+	[Jne]       = &JNE,
+	[Jg]        = &JG,
+	[Jge]       = &JGE,
+	[Jl]        = &JL,
+	[Jle]       = &JLE,
+	[In]        = &IN,
+	[Out]       = &OUT,
+	[Call]      = &CALL,
+	[Ret]       = &RET,
+	[Alloc]     = &ALLOC,
+	[Ldi]       = &LDI,
+	[Sti]       = &STI,
+	[Reset]     = &RESET,
+	[Fill]      = &FILL,
+	[Copy]      = &COPY,
+	[Sum]       = &SUM,
+	[Min]       = &MIN,
+	[Max]       = &MAX,
+	[Vadd]      = &VADD,
+	[Vmul]      = &VMUL,
+	[Find]      = &FIND,
+	[Outs]      = &OUTS,
+	[Outi]      = &OUTI,
+	[Ini]       = &INI,
+	[Pushk]     = &PUSHK,
+	[Spawn]     = &SPAWN,
+	[Join]      = &JOIN,
+	[Coroutine] = &COROUTINE,
+	[Resume]    = &RESUME,
+	[Yield]     = &YIELD
+};
+
+//the OPCODE_CLASS_* of every byte, so Trap and anything else that isn't an opcode are other
+const unsigned char opcode_classes[256] =
+{
+	[Nop]       = OPCODE_CLASS_STACK,
+	[Load]      = OPCODE_CLASS_STACK,
+	[Push]      = OPCODE_CLASS_STACK,
+	[Store]     = OPCODE_CLASS_STACK,
+	[Dup]       = OPCODE_CLASS_STACK,
+	[Pop]       = OPCODE_CLASS_STACK,
+	[Pushk]     = OPCODE_CLASS_STACK,
+	[Inc]       = OPCODE_CLASS_ARITHMETIC,
+	[Dec]       = OPCODE_CLASS_ARITHMETIC,
+	[Add]       = OPCODE_CLASS_ARITHMETIC,
+	[Sub]       = OPCODE_CLASS_ARITHMETIC,
+	[Mul]       = OPCODE_CLASS_ARITHMETIC,
+	[Div]       = OPCODE_CLASS_ARITHMETIC,
+	[Rem]       = OPCODE_CLASS_ARITHMETIC,
+	[And]       = OPCODE_CLASS_ARITHMETIC,
+	[Or]        = OPCODE_CLASS_ARITHMETIC,
+	[Xor]       = OPCODE_CLASS_ARITHMETIC,
+	[Not]       = OPCODE_CLASS_ARITHMETIC,
+	[Neg]       = OPCODE_CLASS_ARITHMETIC,
+	[Shl]       = OPCODE_CLASS_ARITHMETIC,
+	[Shr]       = OPCODE_CLASS_ARITHMETIC,
+	[Cmp]       = OPCODE_CLASS_ARITHMETIC,
+	[Jmp]       = OPCODE_CLASS_BRANCH,
+	[Je]        = OPCODE_CLASS_BRANCH,
+	[Jne]       = OPCODE_CLASS_BRANCH,
+	[Jg]        = OPCODE_CLASS_BRANCH,
+	[Jge]       = OPCODE_CLASS_BRANCH,
+	[Jl]        = OPCODE_CLASS_BRANCH,
+	[Jle]       = OPCODE_CLASS_BRANCH,
+	[Call]      = OPCODE_CLASS_CALL,
+	[Ret]       = OPCODE_CLASS_CALL,
+	[Spawn]     = OPCODE_CLASS_CALL,
+	[Join]      = OPCODE_CLASS_CALL,
+	[Coroutine] = OPCODE_CLASS_CALL,
+	[Resume]    = OPCODE_CLASS_CALL,
+	[Yield]     = OPCODE_CLASS_CALL,
+	[Alloc]     = OPCODE_CLASS_HEAP,
+	[Ldi]       = OPCODE_CLASS_HEAP,
+	[Sti]       = OPCODE_CLASS_HEAP,
+	[Reset]     = OPCODE_CLASS_HEAP,
+	[Fill]      = OPCODE_CLASS_VECTOR,
+	[Copy]      = OPCODE_CLASS_VECTOR,
+	[Sum]       = OPCODE_CLASS_VECTOR,
+	[Min]       = OPCODE_CLASS_VECTOR,
+	[Max]       = OPCODE_CLASS_VECTOR,
+	[Vadd]      = OPCODE_CLASS_VECTOR,
+	[Vmul]      = OPCODE_CLASS_VECTOR,
+	[Find]      = OPCODE_CLASS_VECTOR,
+	[In]        = OPCODE_CLASS_IO,
+	[Out]       = OPCODE_CLASS_IO,
+	[Outs]      = OPCODE_CLASS_IO,
+	[Outi]      = OPCODE_CLASS_IO,
+	[Ini]       = OPCODE_CLASS_IO
+};
+
+Opcode get_opcode_from_instruction(char instruction)
+{
+	return (unsigned char)instruction <= LAST_OPCODE ? *opcode_table[(unsigned char)instruction] : NOP;
+}
+
 /*
 	free_memory -> otherwise known as SEGFAULT village
 	You don't really know how much you love Window's C lib until it's gone
@@ -117,53 +255,102 @@ void free_memory(Executable* exe)
 {
 	if(exe == NULL) 
 		return;
+	
+	//the last report goes out before anything it reads is freed
+	metrics_free(exe);
 
-	//free the functions struct
-	for(int i = 0; i < exe->number_of_functions; i++)
+	//free the functions struct. It may only be partly read if this came from error()
+	//functions linked in from a library share its code unless a breakpoint copied it,
+	//and the layout may have moved the rest into one arena
+	for(int i = 0; i < exe->number_of_functions && exe->functions != NULL; i++)
 	{
-		free(exe->functions[i].instructions);
-		if(exe->info->commandline & COMMANDLINE_DEBUG)
-		{
-			free(exe->functions[i].function_name);
-			
-			for(int k = 0; k < exe->functions[i].arg_count; k++)
-				free(exe->functions[i].arg_names[k]);
-			free(exe->functions[i].arg_names);
-			
-			for(int k = 0; k < exe->functions[i].local_count; k++)
-				free(exe->functions[i].local_names[k]);
-			free(exe->functions[i].local_names);
-		}
+		if(!(exe->functions[i].attributes & (FUNCTION_ATTRIBUTE_SHARED | FUNCTION_ATTRIBUTE_ARENA)))
+			free(exe->functions[i].instructions);
+		free(exe->functions[i].registers);
 	}
-	
+	free(exe->code_arena);
 	
 	if(exe->functions)
 		free(exe->functions);
-	//free the callstack
+	free(exe->debug);
+	free(exe->debug_pool);
+	
+	for(int i = 0; i < exe->number_of_exports && exe->exports != NULL; i++)
+		free(exe->exports[i].name);
+	free(exe->exports);
+	for(int i = 0; i < exe->number_of_imports && exe->imports != NULL; i++)
+	{
+		free(exe->imports[i].library);
+		free(exe->imports[i].name);
+	}
+	free(exe->imports);
+	free(exe->constants);
+	free(exe->constant_pool);
+	
+	//libraries go once the last executable linked against them is gone
+	linker_release(exe);
+	
+	//free the callstack. Frame stacks are windows into the operand stack, so only their locals are theirs
 	if(exe->call_stack.stack_elements != NULL)
 	{
 		for(int i = exe->call_stack.stack_pointer - 1; i >= 0; i--)
 		{
 			Stack_Frame* sf = (Stack_Frame*)exe->call_stack.stack_elements[i];
-			stack_free(&sf->stack);
 			free(sf->local_memory);
 		}
-		//stack_free(&exe->call_stack); //SEGFAULT 1
+		stack_free(&exe->call_stack);
 	}
+	stack_free(&exe->operand_stack);
+	
+	memo_free(exe);
+	profile_free(exe);
+	counters_free(exe);
+	debugger_free(exe);
+	trace_free(exe);
+	heap_free(exe);
+	tasks_free(exe);
+	coroutines_free(exe);
+	snapshot_free(exe);
+	cache_free(exe);
 	
 	//free the info struct
 	if(exe->info != NULL)
 	{
+		free(exe->info->breakpoint_specs);
+		free(exe->info->watchpoint_specs);
 		//if(exe->info->file != NULL)
 		//	fclose(exe->info->file); //SEGFAULT 2
 		free(exe->info);
 	}
 }
 
+//for an option that can't do what was asked, where the run goes on without it
+void warning(char* format, ...)
+{
+	va_list args;
+	
+	va_start(args, format);
+	fputs("Warning: ", stdout);
+	vprintf(format, args);
+	putchar('\n');
+	va_end(args);
+}
+
 void error(Executable* exe, enum DEXE_ERROR error, char* format, ...)
 {
+	//a call forked beside the one that failed comes first, and so does its error
+	tasks_settle(exe);
+	
+	//other threads may still be running tasks on everything free_memory would free
+	if(tasks_running(exe) && exe->info->commandline & COMMANDLINE_SILENT)
+	{
+		metrics_free(exe);
+		cache_finish(exe, error);
+		exit(error);
+	}
 	if(exe->info->commandline & COMMANDLINE_SILENT)
 	{
+		cache_finish(exe, error);
 		free_memory(exe);
 		exit(error);
 	}
@@ -223,6 +410,30 @@ void error(Executable* exe, enum DEXE_ERROR error, char* format, ...)
 		case NOT_ENOUGH_ARGUMENTS:
 			puts("A function call was made without sufficient arguments on the stack.");
 			break;
+		case STACK_OVERFLOW:
+			puts("The stack has overflowed. The program recursed too deeply or pushed too many items.");
+			break;
+		case UNRESOLVED_IMPORT:
+			puts("A function this file imports could not be found. The library may be missing, or may not export it.");
+			break;
+		case HEAP_EXHAUSTED:
+			puts("The heap has run out of space, or an allocation had a negative size.");
+			break;
+		case HEAP_INDEX_OUT_OF_RANGE:
+			puts("A heap address outside of anything allocated was used.");
+			break;
+		case CONSTANT_DOES_NOT_EXIST:
+			puts("An instruction used a constant that the constant pool does not have, or one of the wrong size.");
+			break;
+		case TASK_DOES_NOT_EXIST:
+			puts("A join was given a handle that is not a task spawned by the same function call, or a task that was already joined.");
+			break;
+		case COROUTINE_DOES_NOT_EXIST:
+			puts("A resume was given a handle that is not a suspended coroutine, or a yield happened outside of a coroutine's own function.");
+			break;
+		case NATIVE_DOMAIN_ERROR:
+			puts("A native function was given an argument it has no result for, such as the square root of a negative number.");
+			break;
 		default:
 			puts("An unknown error has occured and caused the termination of this program.");
 			break;
@@ -241,13 +452,22 @@ void error(Executable* exe, enum DEXE_ERROR error, char* format, ...)
 		puts("Unwinding the call stack:");
 		for(int i = exe->call_stack.stack_pointer -1; i >= 0; i--)
 		{
-			if(exe->info->commandline & COMMANDLINE_DEBUG)
-				printf("  %s @ %d\n", exe->functions[((Stack_Frame*)exe->call_stack.stack_elements[i])->function_id].function_name, ((Stack_Frame*)exe->call_stack.stack_elements[i])->pc);
+			if(exe->flags & DEXE_FLAGS_DEBUG)
+				printf("  %s @ %d\n", exe->debug[((Stack_Frame*)exe->call_stack.stack_elements[i])->function_id].function_name, ((Stack_Frame*)exe->call_stack.stack_elements[i])->pc);
 			else
 				printf("  %d @ %d\n", ((Stack_Frame*)exe->call_stack.stack_elements[i])->function_id, ((Stack_Frame*)exe->call_stack.stack_elements[i])->pc);
 		}
 	}
 
+	cache_finish(exe, error);
+	
+	if(tasks_running(exe))
+	{
+		metrics_free(exe);
+		fflush(stdout);
+		exit(error);
+	}
+	
 	free_memory(exe);
 	exit(error);
 }
\ No newline at end of file
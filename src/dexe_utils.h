@@ -38,9 +38,12 @@
 
 //defines
 #define DEXE_MAJOR_VERSION    0x00
-#define DEXE_MINOR_VERSION    0x01
+#define DEXE_MINOR_VERSION    0x03
 #define DEXE_REVISION_VERSION 0x00
 
+//files older than this jump, read operands and do arithmetic differently, and are refused
+#define DEXE_OLDEST_VERSION   0x000102
+
 #define COMMANDLINE_HELP      0x01
 #define COMMANDLINE_VERSION   0x02
 #define COMMANDLINE_DEBUG     0x04
@@ -48,6 +51,21 @@
 #define COMMANDLINE_DECOMPILE 0x10
 #define COMMANDLINE_SILENT    0x20
 #define COMMANDLINE_VERBOSE   0x40
+#define COMMANDLINE_MEMOIZE   0x80
+#define COMMANDLINE_PROFILE   0x100
+#define COMMANDLINE_TRACE     0x200
+#define COMMANDLINE_TRACE_TOP 0x400
+#define COMMANDLINE_TRACE_DUMP 0x800
+#define COMMANDLINE_METRICS   0x1000
+#define COMMANDLINE_CONVERT   0x2000
+#define COMMANDLINE_BATCH     0x4000
+#define COMMANDLINE_NO_REGISTERS 0x8000
+#define COMMANDLINE_AUTO_PARALLEL 0x10000
+#define COMMANDLINE_SNAPSHOT  0x20000
+#define COMMANDLINE_RESTORE   0x40000
+
+#define COMMANDLINE_CACHE     0x80000
+#define COMMANDLINE_COUNTERS  0x100000
 
 #define DEXE_FLAGS_DEBUG      0x01
 #define DEXE_FLAGS_EXECUTABLE 0x02
@@ -59,6 +77,42 @@ struct Dexe_Info_struct
 	int commandline;
 	char* filename;
 	FILE* file;
+	
+	char* profile_filename;
+	char* layout_filename; //a profile to lay the code out by
+	char* trace_filename;
+	char* trace_dump_filename;
+	unsigned long trace_size;
+	
+	char* counters_filename; //hardware performance counters per function
+	
+	char* metrics_filename;
+	int metrics_format;
+	
+	int decompile_format; //DISASSEMBLY_*
+	
+	char* convert_filename;
+	int convert_compact;
+	
+	int threads; //0 picks a count from the size of the work
+	
+	char* parallel_filename; //a profile to estimate the cost of calls from
+	unsigned long parallel_threshold;
+	
+	char* library_path;
+	
+	char* snapshot_filename; //written at the first input
+	char* restore_filename;
+	
+	char* cache_directory;
+	unsigned long long cache_size; //bytes the directory may hold
+	
+	char* batch_function;
+	
+	int number_of_breakpoint_specs;
+	char** breakpoint_specs;
+	int number_of_watchpoint_specs;
+	char** watchpoint_specs;
 };
 typedef struct Dexe_Info_struct Dexe_Info;
 
@@ -90,6 +144,24 @@ enum DEXE_ERROR
 	MANIPULATED_EMPTY_STACK,
 	DIVISION_BY_ZERO,
 	NOT_ENOUGH_ARGUMENTS,
+	STACK_OVERFLOW,
+	
+	//Linking errors
+	UNRESOLVED_IMPORT,
+	
+	//Heap errors
+	HEAP_EXHAUSTED,
+	HEAP_INDEX_OUT_OF_RANGE,
+	
+	//Constant pool errors
+	CONSTANT_DOES_NOT_EXIST,
+	
+	//Task and coroutine errors
+	TASK_DOES_NOT_EXIST,
+	COROUTINE_DOES_NOT_EXIST,
+	
+	//Native function errors
+	NATIVE_DOMAIN_ERROR,
 	
 	//unknown
 	UNKNOWN_ERROR
@@ -98,11 +170,23 @@ enum DEXE_ERROR
 
 //prototypes
 extern int bytes_to_int(char*);
+extern void int_to_bytes(int, char*);
 
+extern Opcode* const opcode_table[LAST_OPCODE + 1];
+extern const unsigned char opcode_classes[256];
 extern Opcode get_opcode_from_instruction(char);
+extern int fold_binary(unsigned char, int, int, int*);
+extern int fold_unary(unsigned char, int, int*);
+
+//FNV-1a, the hash of no bytes is HASH_START
+#define HASH_START 14695981039346656037ULL
+extern unsigned long long hash_bytes(unsigned long long, const void*, size_t);
+extern int hash_file(char*, unsigned long long*);
 
 extern void free_memory(Executable*);
 
+extern void warning(char*, ...);
+
 //this declares that the function won't return, so the compiler won't give out warnings
 #ifdef _MSC_VER
 	__declspec(noreturn) extern void error(Executable*, enum DEXE_ERROR, char*, ...);
@@ -0,0 +1,236 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include <limits.h>
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_heap.h"
+#include "dexe_batch.h"
+#include "dexe_vector.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define VECTOR_X86 1
+	#include <immintrin.h>
+#else
+	#define VECTOR_X86 0
+#endif
+
+struct Vector_Kernels_struct
+{
+	void (*fill)(int*, int, int);
+	int (*sum)(int*, int);
+	int (*extreme)(int*, int, int);
+	void (*add)(int*, int*, int*, int);
+	void (*mul)(int*, int*, int*, int);
+	int (*find)(int*, int, int);
+};
+typedef struct Vector_Kernels_struct Vector_Kernels;
+
+
+#define VECTOR_NAME(kernel) kernel##_generic
+#define VECTOR_TARGET
+#define VEC int
+#define VEC_WIDTH 1
+#define VEC_LOAD(p) (*(p))
+#define VEC_STORE(p, v) (*(p) = (v))
+#define VEC_SET1(x) (x)
+#define VEC_ADD(a, b) ((int)((unsigned int)(a) + (unsigned int)(b)))
+#define VEC_MUL(a, b) ((int)((unsigned int)(a) * (unsigned int)(b)))
+#define VEC_CMPEQ(a, b) ((a) == (b) ? -1 : 0)
+#define VEC_CMPGT(a, b) ((a) > (b) ? -1 : 0)
+#define VEC_BLEND(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+#define VEC_MASK(v) ((v) & 1)
+#include "dexe_vector_kernels.h"
+#undef VECTOR_NAME
+#undef VECTOR_TARGET
+#undef VEC
+#undef VEC_WIDTH
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_SET1
+#undef VEC_ADD
+#undef VEC_MUL
+#undef VEC_CMPEQ
+#undef VEC_CMPGT
+#undef VEC_BLEND
+#undef VEC_MASK
+
+#if VECTOR_X86
+
+//SSE2 has no 32 bit multiply, so it's put together from the even and odd lanes
+__attribute__((target("sse2"))) static inline __m128i sse2_mullo(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#define VECTOR_NAME(kernel) kernel##_sse2
+#define VECTOR_TARGET __attribute__((target("sse2")))
+#define VEC __m128i
+#define VEC_WIDTH 4
+#define VEC_LOAD(p) _mm_loadu_si128((__m128i*)(p))
+#define VEC_STORE(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define VEC_SET1(x) _mm_set1_epi32(x)
+#define VEC_ADD(a, b) _mm_add_epi32((a), (b))
+#define VEC_MUL(a, b) sse2_mullo((a), (b))
+#define VEC_CMPEQ(a, b) _mm_cmpeq_epi32((a), (b))
+#define VEC_CMPGT(a, b) _mm_cmpgt_epi32((a), (b))
+#define VEC_BLEND(mask, a, b) _mm_or_si128(_mm_and_si128((mask), (a)), _mm_andnot_si128((mask), (b)))
+#define VEC_MASK(v) _mm_movemask_ps(_mm_castsi128_ps(v))
+#include "dexe_vector_kernels.h"
+#undef VECTOR_NAME
+#undef VECTOR_TARGET
+#undef VEC
+#undef VEC_WIDTH
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_SET1
+#undef VEC_ADD
+#undef VEC_MUL
+#undef VEC_CMPEQ
+#undef VEC_CMPGT
+#undef VEC_BLEND
+#undef VEC_MASK
+
+#define VECTOR_NAME(kernel) kernel##_avx2
+#define VECTOR_TARGET __attribute__((target("avx2")))
+#define VEC __m256i
+#define VEC_WIDTH 8
+#define VEC_LOAD(p) _mm256_loadu_si256((__m256i*)(p))
+#define VEC_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define VEC_SET1(x) _mm256_set1_epi32(x)
+#define VEC_ADD(a, b) _mm256_add_epi32((a), (b))
+#define VEC_MUL(a, b) _mm256_mullo_epi32((a), (b))
+#define VEC_CMPEQ(a, b) _mm256_cmpeq_epi32((a), (b))
+#define VEC_CMPGT(a, b) _mm256_cmpgt_epi32((a), (b))
+#define VEC_BLEND(mask, a, b) _mm256_blendv_epi8((b), (a), (mask))
+#define VEC_MASK(v) _mm256_movemask_ps(_mm256_castsi256_ps(v))
+#include "dexe_vector_kernels.h"
+#undef VECTOR_NAME
+#undef VECTOR_TARGET
+#undef VEC
+#undef VEC_WIDTH
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_SET1
+#undef VEC_ADD
+#undef VEC_MUL
+#undef VEC_CMPEQ
+#undef VEC_CMPGT
+#undef VEC_BLEND
+#undef VEC_MASK
+
+#endif
+
+static Vector_Kernels generic_kernels = { fill_generic, sum_generic, extreme_generic, add_generic, mul_generic, find_generic };
+static Vector_Kernels* kernels = &generic_kernels;
+
+//the same instruction sets as the batch interpreter, DEXE_BATCH_ISA limits both
+void vector_init()
+{
+#if VECTOR_X86
+	static Vector_Kernels sse2_kernels = { fill_sse2, sum_sse2, extreme_sse2, add_sse2, mul_sse2, find_sse2 };
+	static Vector_Kernels avx2_kernels = { fill_avx2, sum_avx2, extreme_avx2, add_avx2, mul_avx2, find_avx2 };
+	
+	if(batch_isa() == BATCH_ISA_AVX2)
+		kernels = &avx2_kernels;
+	else if(batch_isa() == BATCH_ISA_SSE2)
+		kernels = &sse2_kernels;
+#endif
+}
+
+//the heap memory of [address, address + count), after making sure it's all allocated
+static int* range(Executable* exe, int address, int count)
+{
+	if(count < 0)
+		error(exe, HEAP_INDEX_OUT_OF_RANGE, "A range of %d ints was given", count);
+	if(address < 0 || (size_t)address + (size_t)count > exe->heap->top)
+		error(exe, HEAP_INDEX_OUT_OF_RANGE, "The range %d - %lu is outside of the heap's %u ints", address, (unsigned long)((size_t)address + (size_t)count), exe->heap->top);
+	
+	return exe->heap->memory + address;
+}
+
+//true when the ranges share an int without being the same range
+static int overlap(int* a, int* b, int count)
+{
+	return a != b && a < b + count && b < a + count;
+}
+
+void vector_fill(Executable* exe, int address, int count, int value)
+{
+	kernels->fill(range(exe, address, count), count, value);
+}
+
+//like memmove, overlapping ranges copy as if through a temporary
+void vector_copy(Executable* exe, int destination, int source, int count)
+{
+	int* to = range(exe, destination, count);
+	int* from = range(exe, source, count);
+	
+	memmove(to, from, (size_t)count * sizeof(int));
+}
+
+int vector_sum(Executable* exe, int address, int count)
+{
+	return kernels->sum(range(exe, address, count), count);
+}
+
+int vector_min(Executable* exe, int address, int count)
+{
+	return kernels->extreme(range(exe, address, count), count, 0);
+}
+
+int vector_max(Executable* exe, int address, int count)
+{
+	return kernels->extreme(range(exe, address, count), count, 1);
+}
+
+/*
+	An element-wise result is the same as a loop from the first int to the last.
+	When the destination partly overlaps a source that is what the generic kernel
+	does, and the vector ones would not.
+*/
+void vector_add(Executable* exe, int destination, int a, int b, int count)
+{
+	int* to = range(exe, destination, count);
+	int* left = range(exe, a, count);
+	int* right = range(exe, b, count);
+	
+	(overlap(to, left, count) || overlap(to, right, count) ? add_generic : kernels->add)(to, left, right, count);
+}
+
+void vector_mul(Executable* exe, int destination, int a, int b, int count)
+{
+	int* to = range(exe, destination, count);
+	int* left = range(exe, a, count);
+	int* right = range(exe, b, count);
+	
+	(overlap(to, left, count) || overlap(to, right, count) ? mul_generic : kernels->mul)(to, left, right, count);
+}
+
+int vector_find(Executable* exe, int address, int count, int value)
+{
+	return kernels->find(range(exe, address, count), count, value);
+}
@@ -0,0 +1,42 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#pragma once
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+
+/*
+	The bulk opcodes, one dispatch for a whole range of the heap. Ranges are an
+	address and a count, and are checked once per instruction in every interpreter.
+	The kernels are picked in vector_init by the instruction sets the processor has.
+*/
+
+extern void vector_init();
+
+extern void vector_fill(Executable*, int, int, int);
+extern void vector_copy(Executable*, int, int, int);
+extern int vector_sum(Executable*, int, int);
+extern int vector_min(Executable*, int, int);
+extern int vector_max(Executable*, int, int);
+extern void vector_add(Executable*, int, int, int, int);
+extern void vector_mul(Executable*, int, int, int, int);
+extern int vector_find(Executable*, int, int, int);
@@ -0,0 +1,140 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+/*
+	The bulk opcode kernels. Like dexe_batch_interpreter.h this is a template:
+	dexe_vector.c includes it once per instruction set, with no include guard.
+	Before each inclusion it defines
+	
+		VECTOR_NAME(kernel) the name to give each kernel for this instruction set
+		VECTOR_TARGET       an attribute that lets the compiler use the instruction set, or nothing
+		VEC, VEC_WIDTH      a vector of VEC_WIDTH ints, and
+		VEC_LOAD(p) VEC_STORE(p, v) VEC_SET1(x) VEC_ADD(a, b) VEC_MUL(a, b)
+		VEC_CMPEQ(a, b) VEC_CMPGT(a, b) VEC_BLEND(mask, a, b) VEC_MASK(v)
+	
+	VEC_MASK gives one bit per lane, set where the lane is all ones. Each kernel
+	runs whole vectors and finishes the last few ints one at a time. Arithmetic
+	wraps, the same as the interpreter's.
+*/
+
+VECTOR_TARGET static void VECTOR_NAME(fill)(int* destination, int count, int value)
+{
+	VEC values = VEC_SET1(value);
+	int i = 0;
+	
+	for(; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+		VEC_STORE(destination + i, values);
+	for(; i < count; i++)
+		destination[i] = value;
+}
+
+VECTOR_TARGET static int VECTOR_NAME(sum)(int* source, int count)
+{
+	VEC sums = VEC_SET1(0);
+	int lanes[VEC_WIDTH];
+	unsigned int sum = 0;
+	int i = 0;
+	
+	for(; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+		sums = VEC_ADD(sums, VEC_LOAD(source + i));
+	
+	VEC_STORE(lanes, sums);
+	for(int l = 0; l < VEC_WIDTH; l++)
+		sum += (unsigned int)lanes[l];
+	for(; i < count; i++)
+		sum += (unsigned int)source[i];
+	
+	return (int)sum;
+}
+
+//maximum when greater is set, minimum otherwise. An empty range gives the identity
+VECTOR_TARGET static int VECTOR_NAME(extreme)(int* source, int count, int greater)
+{
+	int best = greater ? INT_MIN : INT_MAX;
+	VEC bests = VEC_SET1(best);
+	int lanes[VEC_WIDTH];
+	int i = 0;
+	
+	for(; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+	{
+		VEC values = VEC_LOAD(source + i);
+		VEC better = greater ? VEC_CMPGT(values, bests) : VEC_CMPGT(bests, values);
+		
+		bests = VEC_BLEND(better, values, bests);
+	}
+	
+	VEC_STORE(lanes, bests);
+	for(int l = 0; l < VEC_WIDTH; l++)
+		if(greater ? lanes[l] > best : lanes[l] < best)
+			best = lanes[l];
+	for(; i < count; i++)
+		if(greater ? source[i] > best : source[i] < best)
+			best = source[i];
+	
+	return best;
+}
+
+//element-wise. destination may be either source, but must not otherwise overlap them
+VECTOR_TARGET static void VECTOR_NAME(add)(int* destination, int* a, int* b, int count)
+{
+	int i = 0;
+	
+	for(; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+		VEC_STORE(destination + i, VEC_ADD(VEC_LOAD(a + i), VEC_LOAD(b + i)));
+	for(; i < count; i++)
+		destination[i] = (int)((unsigned int)a[i] + (unsigned int)b[i]);
+}
+
+VECTOR_TARGET static void VECTOR_NAME(mul)(int* destination, int* a, int* b, int count)
+{
+	int i = 0;
+	
+	for(; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+		VEC_STORE(destination + i, VEC_MUL(VEC_LOAD(a + i), VEC_LOAD(b + i)));
+	for(; i < count; i++)
+		destination[i] = (int)((unsigned int)a[i] * (unsigned int)b[i]);
+}
+
+//the index of the first int equal to value, or -1
+VECTOR_TARGET static int VECTOR_NAME(find)(int* source, int count, int value)
+{
+	VEC values = VEC_SET1(value);
+	int i = 0;
+	
+	for(; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+	{
+		unsigned int found = (unsigned int)VEC_MASK(VEC_CMPEQ(VEC_LOAD(source + i), values));
+		
+		if(found)
+		{
+			int l = 0;
+			while(!(found >> l & 1))
+				l++;
+			return i + l;
+		}
+	}
+	for(; i < count; i++)
+		if(source[i] == value)
+			return i;
+	
+	return -1;
+}
@@ -0,0 +1,213 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_verifier.h"
+
+/*
+	The verifier proves, once per function at load time, everything the interpreter
+	would otherwise check on every instruction:
+	
+	  - every opcode is valid and its operand lies inside the function
+	  - every Load/Store index is a local that exists
+	  - every jump lands on the start of an instruction inside the function
+	  - every Call, Spawn and Coroutine names a function that exists
+	  - the stack depth at each instruction is the same along every path, and no
+	    instruction (or call) ever needs more items than are on the stack
+	  - execution can never run off the end of the function
+	
+	Functions that pass are marked FUNCTION_ATTRIBUTE_VERIFIED and can be run by
+	the unchecked interpreter variants. Functions that don't are still runnable by
+	the checked variants, they just pay for the checks.
+*/
+
+#define UNVISITED -1
+
+static int fail(char* message, char* format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	vsnprintf(message, VERIFY_MESSAGE_SIZE, format, ap);
+	va_end(ap);
+	
+	return 1;
+}
+
+//returns 0 if the function verified, otherwise 1 with the reason in message (VERIFY_MESSAGE_SIZE bytes)
+int verify_function(Executable* exe, int id, char* message)
+{
+	Executable_Function* function = &exe->functions[id];
+	unsigned char* code = (unsigned char*)function->instructions;
+	int size = function->size_of_instructions;
+	int result = 0;
+	
+	if(size == 0)
+		return fail(message, "Function %d has no code.", id);
+	
+	int* depth = (int*)malloc(size * sizeof(int));
+	int* worklist = (int*)malloc(size * sizeof(int));
+	if(depth == NULL || worklist == NULL)
+	{
+		free(depth);
+		free(worklist);
+		return fail(message, "Out of memory while verifying function %d.", id);
+	}
+	
+	//first pass: decode linearly, which marks where instructions start
+	for(int pc = 0; pc < size; pc++)
+	{
+		depth[pc] = UNVISITED;
+		
+		if(code[pc] > LAST_OPCODE)
+		{
+			result = fail(message, "Invalid opcode 0x%X at %d in function %d.", code[pc], pc, id);
+			goto done;
+		}
+		
+		int parameter_size = get_opcode_from_instruction(code[pc]).parameter_size;
+		if(pc + parameter_size >= size)
+		{
+			result = fail(message, "The operand of the instruction at %d runs past the end of function %d.", pc, id);
+			goto done;
+		}
+		
+		for(int k = 1; k <= parameter_size; k++)
+			depth[pc + k] = UNVISITED - 1; //inside an instruction
+		pc += parameter_size;
+	}
+	
+	//second pass: follow every path from the entry, tracking the stack depth
+	int pending = 0;
+	depth[0] = function->arg_count;
+	worklist[pending++] = 0;
+	
+	while(pending)
+	{
+		int pc = worklist[--pending];
+		int current = depth[pc];
+		unsigned char opcode = code[pc];
+		Opcode op = get_opcode_from_instruction(opcode);
+		int successors[2];
+		int successor_count = 0;
+		
+		switch(opcode)
+		{
+			case Load:
+			case Store:
+				if(code[pc + 1] >= function->local_count)
+				{
+					result = fail(message, "Local %d does not exist in function %d (at %d).", code[pc + 1], id, pc);
+					goto done;
+				}
+				break;
+				
+			case Call:
+			case Spawn:
+			case Coroutine:
+			{
+				int callee = bytes_to_int((char*)code + pc + 1);
+				if(callee < 0 || callee >= exe->number_of_functions)
+				{
+					result = fail(message, "%s to function %d which does not exist (at %d in function %d).", opcode == Call ? "Call" : opcode == Spawn ? "Spawn" : "Coroutine", callee, pc, id);
+					goto done;
+				}
+				if(current < exe->functions[callee].arg_count)
+				{
+					result = fail(message, "%s to function %d needs %d arguments, only %d are on the stack (at %d in function %d).", opcode == Call ? "Call" : opcode == Spawn ? "Spawn" : "Coroutine", callee, exe->functions[callee].arg_count, current, pc, id);
+					goto done;
+				}
+				current -= exe->functions[callee].arg_count;
+				break;
+			}
+			
+			case Outs:
+			case Pushk:
+			{
+				int constant = bytes_to_int((char*)code + pc + 1);
+				if(constant < 0 || constant >= exe->number_of_constants)
+				{
+					result = fail(message, "Constant %d does not exist (at %d in function %d). There are %d.", constant, pc, id, exe->number_of_constants);
+					goto done;
+				}
+				if(opcode == Pushk && exe->constants[constant].size != 4)
+				{
+					result = fail(message, "Constant %d is %d bytes, pushk needs 4 (at %d in function %d).", constant, exe->constants[constant].size, pc, id);
+					goto done;
+				}
+				break;
+			}
+			
+			default:
+				break;
+		}
+		
+		//a return with an empty stack returns 0
+		if(opcode != Ret && current < op.required_stack_size)
+		{
+			result = fail(message, "A(n) '%s' instruction at %d in function %d needs %d items, only %d are on the stack.", op.mnemonic, pc, id, op.required_stack_size, current);
+			goto done;
+		}
+		current += op.pushed_stack_size - op.required_stack_size;
+		
+		if(opcode >= Jmp && opcode <= Jle)
+		{
+			int target = pc + bytes_to_int((char*)code + pc + 1);
+			if(target < 0 || target >= size || depth[target] < UNVISITED)
+			{
+				result = fail(message, "The jump at %d in function %d lands on %d, which is not the start of an instruction.", pc, id, target);
+				goto done;
+			}
+			successors[successor_count++] = target;
+		}
+		
+		if(opcode != Ret && opcode != Jmp)
+		{
+			if(pc + 1 + op.parameter_size >= size)
+			{
+				result = fail(message, "Execution can run off the end of function %d (after %d).", id, pc);
+				goto done;
+			}
+			successors[successor_count++] = pc + 1 + op.parameter_size;
+		}
+		
+		for(int i = 0; i < successor_count; i++)
+		{
+			if(depth[successors[i]] == UNVISITED)
+			{
+				depth[successors[i]] = current;
+				worklist[pending++] = successors[i];
+			}
+			else if(depth[successors[i]] != current)
+			{
+				result = fail(message, "The stack holds %d items at %d in function %d along one path and %d along another.", depth[successors[i]], successors[i], id, current);
+				goto done;
+			}
+		}
+	}
+	
+done:
+	free(depth);
+	free(worklist);
+	
+	return result;
+}
@@ -0,0 +1,214 @@
+/*
+	Copyright (C) 2014 Patrick Demian
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of
+	this software and associated documentation files (the "Software"), to deal in
+	the Software without restriction, including without limitation the rights to
+	use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+	of the Software, and to permit persons to whom the Software is furnished to do
+	so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+	THE SOFTWARE.
+*/
+
+#include "dexe_utils.h"
+#include "dexe_executable.h"
+#include "dexe_encoding.h"
+#include "dexe_linker.h"
+#include "dexe_writer.h"
+
+static void write_int(FILE* file, int value)
+{
+	fputc(((unsigned int)value >> 24) & 0xFF, file);
+	fputc(((unsigned int)value >> 16) & 0xFF, file);
+	fputc(((unsigned int)value >> 8) & 0xFF, file);
+	fputc(value & 0xFF, file);
+}
+
+//names are written the way the parser reads them, a length byte and then the name with its terminator
+static void write_name(FILE* file, char* name)
+{
+	size_t length = strlen(name) + 1;
+	
+	if(length > 255)
+		length = 255;
+	
+	fputc((int)length, file);
+	fwrite(name, 1, length - 1, file);
+	fputc('\0', file);
+}
+
+//section names have no terminator, the length byte is all there is
+static void write_section_name(FILE* file, char* name)
+{
+	size_t length = strlen(name);
+	
+	if(length > 255)
+		length = 255;
+	
+	fputc((int)length, file);
+	fwrite(name, 1, length, file);
+}
+
+static int section_name_size(char* name)
+{
+	size_t length = strlen(name);
+	return 1 + (int)(length > 255 ? 255 : length);
+}
+
+static void write_sections(Executable* exe, FILE* file)
+{
+	int size;
+	
+	if(exe->number_of_exports > 0)
+	{
+		size = 4;
+		for(int i = 0; i < exe->number_of_exports; i++)
+			size += section_name_size(exe->exports[i].name) + 4;
+		
+		fputc(SECTION_EXPORTS, file);
+		write_int(file, size);
+		write_int(file, exe->number_of_exports);
+		for(int i = 0; i < exe->number_of_exports; i++)
+		{
+			write_section_name(file, exe->exports[i].name);
+			write_int(file, exe->exports[i].function_id);
+		}
+	}
+	
+	if(exe->number_of_imports > 0)
+	{
+		size = 4;
+		for(int i = 0; i < exe->number_of_imports; i++)
+			size += section_name_size(exe->imports[i].library) + section_name_size(exe->imports[i].name);
+		
+		fputc(SECTION_IMPORTS, file);
+		write_int(file, size);
+		write_int(file, exe->number_of_imports);
+		for(int i = 0; i < exe->number_of_imports; i++)
+		{
+			write_section_name(file, exe->imports[i].library);
+			write_section_name(file, exe->imports[i].name);
+		}
+	}
+	
+	if(exe->number_of_constants > 0)
+	{
+		size = 4;
+		for(int i = 0; i < exe->number_of_constants; i++)
+			size += 4 + exe->constants[i].size;
+		
+		fputc(SECTION_CONSTANTS, file);
+		write_int(file, size);
+		write_int(file, exe->number_of_constants);
+		for(int i = 0; i < exe->number_of_constants; i++)
+		{
+			write_int(file, exe->constants[i].size);
+			fwrite(exe->constants[i].data, 1, exe->constants[i].size, file);
+		}
+	}
+}
+
+/*
+	Writes a loaded (not linked) executable back out. With compact set the file is
+	version 0.2 and its code is re-encoded, or 0.3 if it has exports, imports or
+	constants to write. Otherwise it's the fixed encoding of DEXE_OLDEST_VERSION, which has
+	no sections. Returns 0 on success, or 1 with the reason in message (WRITE_MESSAGE_SIZE bytes).
+*/
+int dexe_write(Executable* exe, char* filename, int compact, char* message)
+{
+	int sections = exe->number_of_exports > 0 || exe->number_of_imports > 0 || exe->number_of_constants > 0;
+	int version = !compact ? DEXE_OLDEST_VERSION : DEXE_MAJOR_VERSION << 16 | (sections ? DEXE_SECTIONS_MINOR_VERSION : DEXE_COMPACT_MINOR_VERSION) << 8;
+	FILE* file;
+	
+	if(sections && !compact)
+	{
+		snprintf(message, WRITE_MESSAGE_SIZE, "The fixed encoding can't hold the exports, imports and constants of '%s'", exe->info->filename);
+		return 1;
+	}
+	
+	file = fopen(filename, "wb");
+	if(file == NULL)
+	{
+		snprintf(message, WRITE_MESSAGE_SIZE, "'%s' could not be opened for writing", filename);
+		return 1;
+	}
+	
+	fwrite("DASM\xF0", 1, 5, file);
+	write_int(file, version);
+	write_int(file, exe->flags);
+	write_int(file, exe->entry);
+	write_int(file, exe->number_of_functions);
+	fputc(0xE0, file);
+	
+	for(int i = 0; i < exe->number_of_functions; i++)
+	{
+		Executable_Function* function = &exe->functions[i];
+		
+		if(exe->flags & DEXE_FLAGS_DEBUG)
+		{
+			write_name(file, exe->debug[i].function_name);
+			
+			fputc(function->arg_count, file);
+			for(int k = 0; k < function->arg_count; k++)
+				write_name(file, exe->debug[i].arg_names[k]);
+			
+			fputc(function->local_count, file);
+			for(int k = 0; k < function->local_count; k++)
+				write_name(file, exe->debug[i].local_names[k]);
+		}
+		else
+		{
+			fputc(function->arg_count, file);
+			fputc(function->local_count, file);
+		}
+		
+		if(compact)
+		{
+			char* code;
+			int size;
+			int result = encode_compact_code(function->instructions, function->size_of_instructions, &code, &size);
+			
+			if(result != ENCODING_OK)
+			{
+				if(result == ENCODING_NO_MEMORY)
+					snprintf(message, WRITE_MESSAGE_SIZE, "Out of memory while encoding function %d", i);
+				else
+					snprintf(message, WRITE_MESSAGE_SIZE, "Function %d has an invalid instruction or a jump into the middle of an instruction", i);
+				fclose(file);
+				remove(filename);
+				return 1;
+			}
+			
+			write_int(file, size);
+			fwrite(code, 1, size, file);
+			free(code);
+		}
+		else
+		{
+			write_int(file, function->size_of_instructions);
+			fwrite(function->instructions, 1, function->size_of_instructions, file);
+		}
+	}
+	
+	fputc(0xEF, file);
+	if(sections)
+		write_sections(exe, file);
+	fputc(0xFF, file);
+	
+	if(fclose(file))
+	{
+		snprintf(message, WRITE_MESSAGE_SIZE, "Could not finish writing '%s'", filename);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Runs the tests in this directory and compares what they print with what they
+# should. A test is <name>.test, shell commands run one at a time from a scratch
+# directory holding a copy of every image in here. DEXE and OPT are the
+# interpreter and the optimizer, and are printed as dexe and dexe-opt. Whatever
+# a command prints, then its exit code, has to match <name>.out.
+#
+#	sh run.sh              run every test
+#	sh run.sh heap tasks   run heap.test and tasks.test
+#	UPDATE=1 sh run.sh     write the .out files from what the tests print now
+#
+
+TEST=$(cd "$(dirname "$0")" && pwd)
+SRC=$(cd "$TEST/../src" && pwd)
+DEXE=${DEXE:-$SRC/dexe}
+OPT=${OPT:-$SRC/dexe-opt}
+export DEXE OPT
+
+passed=0
+failed=0
+
+if [ $# -eq 0 ]; then
+	set -- $(cd "$TEST" && ls *.test | sed 's/\.test$//')
+fi
+
+for name in "$@"; do
+	scratch=$(mktemp -d)
+	printed=$(mktemp)
+	output=$(mktemp)
+	cp "$TEST"/*.dexe "$scratch"
+	
+	(
+		cd "$scratch"
+		while IFS= read -r command; do
+			case "$command" in
+				''|'#'*) continue ;;
+			esac
+			sh -c "$command" < /dev/null > "$printed" 2>&1
+			status=$?
+			sed "s|$DEXE|dexe|g; s|$OPT|dexe-opt|g" "$printed"
+			echo "[exit $status]"
+		done < "$TEST/$name.test"
+	) > "$output"
+	
+	if [ -n "$UPDATE" ]; then
+		cp "$output" "$TEST/$name.out"
+	elif cmp -s "$output" "$TEST/$name.out"; then
+		passed=$((passed + 1))
+	else
+		echo "FAIL $name"
+		diff "$TEST/$name.out" "$output"
+		failed=$((failed + 1))
+	fi
+	
+	rm -rf "$scratch" "$printed" "$output"
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]